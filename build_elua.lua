@@ -215,6 +215,7 @@ builder:add_option( 'toolchain', 'specifies toolchain to use (auto=search for us
 builder:add_option( 'optram', 'enables Lua Tiny RAM enhancements', true )
 builder:add_option( 'boot', 'boot mode, standard will boot to shell, luarpc boots to an rpc server', 'standard', { 'standard' , 'luarpc' } )
 builder:add_option( 'romfs', 'ROMFS compilation mode', 'verbatim', { 'verbatim' , 'compress', 'compile' } )
+builder:add_option( 'romfsblocks', 'compress ROMFS files in blocks, decompressed when read (Lua bytecode is not compressed)', false )
 builder:add_option( 'cpumode', 'ARM CPU compilation mode (only affects certain ARM targets)', nil, { 'arm', 'thumb' } )
 builder:add_option( 'bootloader', 'Build for bootloader usage (AVR32 only)', 'none', { 'none', 'emblod' } )
 builder:init( args )
@@ -443,7 +444,7 @@ local function make_romfs()
     flist[ k ] = v:gsub( "romfs" .. utils.dir_sep, "" )
   end
 
-  if not mkfs.mkfs( "romfs", "romfiles", flist, comp.romfs, fscompcmd ) then return -1 end
+  if not mkfs.mkfs( "romfs", "romfiles", flist, comp.romfs, fscompcmd, comp.romfsblocks and 1024 or 0 ) then return -1 end
   if utils.is_file( "inc/romfiles.h" ) then
     -- Read both the old and the new file
     local oldfile = io.open( "inc/romfiles.h", "rb" )
@@ -29,6 +29,17 @@ data_en =
       ret = "The sector number of the sector that contains $addr$.",
     },
 
+    { sig = "u32 #platform_flash_get_sector_bounds#( u32 addr, u32 *pstart, u32 *pend );",
+      desc = "Returns the flash sector that contains the given address, as well as the first and last address of this sector. This function is implemented in %src/common.c%.",
+      args =
+      {
+        "$addr$ - the flash address.",
+        "$pstart$ - the first address of the sector will be written in $*pstart$ if $pstart$ is not NULL.",
+        "$pend$ - the last address of the sector will be written in $*pend$ if $pend$ is not NULL.",
+      },
+      ret = "The sector number of the sector that contains $addr$.",
+    },
+
     { sig = "u32 #platform_flash_write#( const void *from, u32 toaddr, u32 size );",
       desc = [[Writes data in the internal flash. This function can automatically take care of flash alignment or size restrictions if $INTERNAL_FLASH_WRITE_UNIT_SIZE$ is properly defined. Check @arch_wofs.html@here@ for more details. This function is implemented in %src/common.c%. In order to actually write data to the internal flash, this function will call its platform specific (@#platform_s_flash_write@platform_s_flash_write@).]],
       args = 
@@ -263,8 +263,9 @@ $period_us$ microseconds]]
 }~</li>
   </ol>
   <p>Note that because of step 2 above you are limited by practical constraints on the value of $VTMR_FREQ_HZ$. If set too high, the timer interrupt will fire too often, thus taking too much
-  CPU time. The maximum value depends largely on the hardware and the desired behaviour of the virtual timers, but in practice values larger than 10 might visibly change the behaviour of your 
-  system.</p>
+  CPU time. The work done by $cmn_virtual_timer_cb$ doesn't depend on $VTMR_NUM_TIMERS$: all the virtual timers count the ticks of a single counter, and the armed match interrupts are
+  kept ordered by their deadline, so a tick only increments the counter and looks at the earliest deadline. The maximum value depends largely on the hardware and the desired behaviour of
+  the virtual timers, but in practice values larger than 10 might visibly change the behaviour of your system.</p>
   <p>To $use$ a virtual timer, identify it with the constant $VTMR_FIRST_ID$ (defined in %inc/common.h%) plus an offset. For example, $VTMR_FIRST_ID+0$ (or simply
   $VTMR_FIRST_ID$) is the ID of the first virtual timer in the system, and $VTMR_FIRST_ID+2$ is the ID of the third virtual timer in the system.</p>
   <p>Virtual timers are capable of generating timer match interrupts just like regular timers, check @#platform_timer_set_match_int@here@ for details.
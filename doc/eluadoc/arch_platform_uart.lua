@@ -127,6 +127,21 @@ enum
       }
     },
 
+    { sig = "unsigned #platform_uart_recv_n#( unsigned id, unsigned timer_id, timer_data_type timeout, u8 *data, unsigned maxlen );",
+      desc = [[Receive a block of data from the UART interface. The function waits for the first byte exactly like @#platform_uart_recv@platform_uart_recv@, then
+  returns all the bytes that are already available (up to $maxlen$) without waiting for more. If the UART is buffered, the data is copied from the buffer in a single operation,
+  so this is much faster than calling @#platform_uart_recv@platform_uart_recv@ for each byte. This function is implemented in %src/common_uart.c%.]],
+      args = 
+      {
+        "$id$ - UART interface ID.",
+        "$timer_id$ - the ID of the timer used in this operation (see @#platform_uart_recv@platform_uart_recv@).",
+        "$timeout$ - timeout for the first byte (see @#platform_uart_recv@platform_uart_recv@).",
+        "$data$ - buffer for the received data.",
+        "$maxlen$ - the maximum number of bytes to receive.",
+      },
+      ret = "The number of bytes received (0 if no data was received before the timeout)."
+    },
+
     { sig = "int #platform_s_uart_recv#( unsigned id, timer_data_type timeout );",
       link = "platform_s_uart_recv",
       desc = [[This is the platform-dependent part of the UART receive function @#platform_uart_recv@platform_uart_recv@ and is in fact a "subset" of the full function 
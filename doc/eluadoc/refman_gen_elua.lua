@@ -19,10 +19,19 @@ data_en =
       desc = "Change the emergency garbage collector operation mode and memory limit (see @elua_egc.html@here@ for details).",
       args = 
       {
-        "$mode$ - the EGC operation mode. Can be either $elua.EGC_NOT_ACTIVE$, $elua.EGC_ON_ALLOC_FAILURE$, $elua.EGC_ON_MEM_LIMIT$, $elua.EGC_ALWAYS$ or a combination between the last 3 modes in this list (they can be combined both with bitwise OR operations, using the @refman_gen_bit.html@bit@ module, or simply by adding them).",
-        "$memlimit$ - required only when $elua.EGC_ON_MEM_LIMIT$ is specified in $mode$, specifies the EGC upper memory limit."
+        "$mode$ - the EGC operation mode. Can be either $elua.EGC_NOT_ACTIVE$, $elua.EGC_ON_ALLOC_FAILURE$, $elua.EGC_ON_MEM_LIMIT$, $elua.EGC_ALWAYS$, $elua.EGC_ADAPTIVE$ or a combination between the last 4 modes in this list (they can be combined both with bitwise OR operations, using the @refman_gen_bit.html@bit@ module, or simply by adding them).",
+        "$memlimit$ - required only when $elua.EGC_ON_MEM_LIMIT$ or $elua.EGC_ADAPTIVE$ is specified in $mode$, specifies the EGC upper memory limit. In $elua.EGC_ADAPTIVE$ mode the collector runs incremental steps when the memory in use gets close to this limit, keeping a reserve that depends on the allocation rate measured between calls to $elua.egc_idle$."
       },
     },
+
+    { sig = "#elua.egc_idle#()",
+      desc = "Tell the emergency garbage collector that the program is idle. This updates the allocation rate estimate and, in $elua.EGC_ADAPTIVE$ mode, collects garbage until the memory reserve is available again. The interactive interpreter calls this automatically while waiting for input; long running programs should call it from their main loop.",
+    },
+
+    { sig = "stats = #elua.egc_stats#()",
+      desc = "Returns the emergency garbage collector statistics.",
+      ret = "a table with the fields $rate$ (smoothed number of bytes allocated between calls to $elua.egc_idle$), $fullgcs$ (number of emergency collections), $steps$ (number of incremental steps run in $elua.EGC_ADAPTIVE$ mode), $maxpause$ and $totalpause$ (longest and total collection pause in microseconds, 0 if the platform has no system timer)."
+    },
     
     { sig = "#elua.save_history#( filename )",
       desc = "Save the interpreter line history. Only available if linenoise is enabled, check @linenoise.html@here@ for details.",
@@ -67,6 +67,10 @@ data_en =
       <td>$val1$, $val2$, $valn$ = $handle$.$remote_func$()</td>
       <td>call $remote_func$ on the server side, and return values to local state</td>
     </tr>
+    <tr>
+      <td>$future$ = $handle$.$remote_func$:async()</td>
+      <td>send a call to $remote_func$ without waiting for the server and return a $future$. Calling the $future$ ($val1$, $val2$, $valn$ = $future$()) waits for the reply if needed and returns the values returned by $remote_func$. Replies are read in the order the calls were made, so several asynchronous calls can be in flight at the same time. At most RPC_MAX_INFLIGHT calls (16 by default) are left without a reply: when the limit is reached, the oldest replies are read before the new call is sent.</td>
+    </tr>
     <tr>
       <td>$helper$ = $handle$.$remote_var$</td>
       <td>create a $helper$ which points to $remote_var$, and can be used as shorthand later (e.g.: $helper$:get() would get the contents of the remote variable. If $remote_var$ were a table with functions on it: $helper$.$funcname$() would call $funcname$, on table $remote_var$ on the server, and return any results.)</td>
@@ -81,6 +85,16 @@ data_en =
       args = "$handle$ - handle associated with the connection.",
     },
 
+    { sig = "#rpc.batch#( handle )",
+      desc = [[Enter batch mode: asynchronous calls made on $handle$ are queued locally instead of being sent one by one. Queued calls are sent to the server in a single frame by @#rpc.flush@rpc.flush@, by calling one of their futures or by any synchronous operation on $handle$. A frame that grows past RPC_MAX_FRAME_SIZE bytes (512 by default) is sent right away and a new frame is started.]],
+      args = "$handle$ - handle associated with the connection.",
+    },
+
+    { sig = "#rpc.flush#( handle )",
+      desc = [[Leave batch mode, send any queued calls and read the replies of all asynchronous calls still in flight on $handle$. After this function returns, calling their futures does not block.]],
+      args = "$handle$ - handle associated with the connection.",
+    },
+
     { sig = "#rpc.server#( transport_identifiers )",
       desc = "Start a blocking/captive RPC server, which will wait for incoming connections.",
       args = "$transport_identifiers$ - platform-specific serial port identification (see @#overview@overview@)",
@@ -23,7 +23,7 @@ typedef struct
 {
   u8 logsize;
   u8 logdsize;
-  volatile u16 wptr, rptr, count;
+  volatile u16 wptr, rptr;        // free running element indexes (written by the producer/consumer)
   t_buf_data *buf;
 } buf_desc;
 
@@ -64,6 +64,8 @@ unsigned buf_get_size( unsigned resid, unsigned resnum );
 unsigned buf_get_count( unsigned resid, unsigned resnum );
 int buf_write( unsigned resid, unsigned resnum, t_buf_data *data );
 int buf_read( unsigned resid, unsigned resnum, t_buf_data *data );
+unsigned buf_write_n( unsigned resid, unsigned resnum, const t_buf_data *data, unsigned n );
+unsigned buf_read_n( unsigned resid, unsigned resnum, t_buf_data *data, unsigned n );
 void buf_flush( unsigned resid, unsigned resnum );
 
 #endif
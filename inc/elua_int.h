@@ -35,6 +35,9 @@ typedef struct
 // C interrupt handlers
 typedef void( *elua_int_c_handler )( elua_int_resnum resnum );
 
+// Language specific part of elua_int_dispatch: runs the handler of an interrupt
+typedef void ( *elua_int_p_dispatch )( elua_int_id id, elua_int_resnum resnum, void *arg );
+
 // Handler key in the registry
 #define LUA_INT_HANDLER_KEY             ( int )&elua_int_add
 
@@ -42,8 +45,20 @@ typedef void( *elua_int_c_handler )( elua_int_resnum resnum );
 // Must be a multiple of 32
 #define LUA_INT_MAX_SOURCES             128
 
+// Interpreters call elua_int_dispatch when this is true, at a point where
+// it's safe to run interpreted code
+extern volatile u16 elua_int_pending;
+extern u8 elua_int_dispatching;
+#define elua_int_should_dispatch()      ( elua_int_pending != 0 && !elua_int_dispatching )
+
 // Function prototypes
 int elua_int_add( elua_int_id inttype, elua_int_resnum resnum );
+int elua_int_get( elua_int_element *pelem );
+unsigned elua_int_dispatch( elua_int_p_dispatch handler, void *arg );
+void elua_int_dispatch_reset();
+int elua_int_set_priority( elua_int_id inttype, unsigned prio );
+unsigned elua_int_get_priority( elua_int_id inttype );
+unsigned elua_int_get_num_priorities();
 void elua_int_enable( elua_int_id inttype );
 void elua_int_disable( elua_int_id inttype );
 int elua_int_is_enabled( elua_int_id inttype );
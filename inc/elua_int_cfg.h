@@ -0,0 +1,19 @@
+// eLua interrupt handlers: build options derived from platform_conf.h
+
+#ifndef __ELUA_INT_CFG_H__
+#define __ELUA_INT_CFG_H__
+
+#include "platform_conf.h"
+
+// Interrupt handlers in any of the languages (they share the interrupt queue)
+#if defined( BUILD_LUA_INT_HANDLERS ) || defined( BUILD_PICOLISP_INT_HANDLERS ) ||\
+    defined( BUILD_PICOC_INT_HANDLERS ) || defined( BUILD_TINYSCHEME_INT_HANDLERS )
+#define BUILD_LANG_INT_HANDLERS
+#endif
+
+// Generic interrupt support (platform interrupt code, virtual timer matches)
+#if defined( BUILD_LANG_INT_HANDLERS ) || defined( BUILD_C_INT_HANDLERS )
+#define BUILD_INT_HANDLERS
+#endif
+
+#endif // #ifndef __ELUA_INT_CFG_H__
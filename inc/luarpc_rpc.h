@@ -9,6 +9,17 @@
 
 #define MAX_LINK_ERRS ( 2 ) // Maximum number of framing errors before connection reset
 
+#define RPC_BATCH_INIT_SIZE 64 // Initial size of the buffer used to assemble batched calls
+
+// Flow control for asynchronous calls: the server answers while the client
+// is still sending, so the replies not read yet must fit in the link buffers
+#ifndef RPC_MAX_INFLIGHT
+#define RPC_MAX_INFLIGHT 16 // Maximum number of asynchronous calls without a reply read
+#endif
+#ifndef RPC_MAX_FRAME_SIZE
+#define RPC_MAX_FRAME_SIZE 512 // A batch frame is sent when it grows past this size
+#endif
+
 #define LUARPC_MODE "elua"
 
 // a kind of silly way to get the maximum int, but oh well ...
@@ -87,8 +98,11 @@ struct _Transport
          loc_armflt: 1,               // local float representation is arm float?
          loc_intnum: 1,               // Local is integer only?
          net_little: 1,               // Network is little endian?
-         net_intnum: 1;               // Network is integer only?
+         net_intnum: 1,               // Network is integer only?
+         staging: 1;                  // Writes go to wbuf instead of the link?
   u8     lnum_bytes;
+  u8    *wbuf;                        // buffer used to assemble a frame of calls
+  u32    wlen, wsize;                 // bytes used / allocated in wbuf
 };
 
 typedef struct _Handle Handle;
@@ -96,8 +110,12 @@ struct _Handle
 {
   Transport tpt;                      // the handle socket
   int error_handler;                  // function reference
-  int async;                          // nonzero if async mode being used
-  int read_reply_count;               // number of async call return values to read
+  int pending;                        // registry ref to table of futures awaiting a reply
+  u32 seq_sent;                       // sequence number of the last async call sent
+  u32 seq_read;                       // sequence number of the last async reply read
+  u32 batch_calls;                    // number of calls in the frame being assembled
+  u32 wmark;                          // end of the last complete call in tpt.wbuf
+  u8 batching;                        // nonzero between rpc.batch and rpc.flush
 };
 
 typedef struct _Helper Helper;
@@ -109,6 +127,18 @@ struct _Helper {
   char funcname[NUM_FUNCNAME_CHARS];  // name of the function
 };
 
+// Future states
+enum { RPC_FUTURE_PENDING, RPC_FUTURE_DONE, RPC_FUTURE_ERROR };
+
+typedef struct _Future Future;
+struct _Future {
+  Handle *handle;                     // pointer to handle object
+  int href;                           // calling helper reference idx in registry
+  int results;                        // results table or error message idx in registry
+  u32 seq;                            // sequence number of the call
+  u8 state;                           // RPC_FUTURE_xxx
+};
+
 typedef struct _ServerHandle ServerHandle;
 struct _ServerHandle {
   Transport ltpt;   // listening transport, always valid if no error
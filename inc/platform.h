@@ -227,6 +227,7 @@ int platform_uart_set_buffer( unsigned id, unsigned size );
 void platform_uart_send( unsigned id, u8 data );
 void platform_s_uart_send( unsigned id, u8 data );
 int platform_uart_recv( unsigned id, unsigned timer_id, timer_data_type timeout );
+unsigned platform_uart_recv_n( unsigned id, unsigned timer_id, timer_data_type timeout, u8 *data, unsigned maxlen );
 int platform_s_uart_recv( unsigned id, timer_data_type timeout );
 int platform_uart_set_flow_control( unsigned id, int type );
 int platform_s_uart_set_flow_control( unsigned id, int type );
@@ -332,6 +333,7 @@ int platform_usb_cdc_recv( s32 timeout );
 
 u32 platform_flash_get_first_free_block_address( u32 *psect );
 u32 platform_flash_get_sector_of_address( u32 addr );
+u32 platform_flash_get_sector_bounds( u32 addr, u32 *pstart, u32 *pend );
 u32 platform_flash_write( const void *from, u32 toaddr, u32 size );
 u32 platform_s_flash_write( const void *from, u32 toaddr, u32 size );
 u32 platform_flash_get_num_sectors();
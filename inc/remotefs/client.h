@@ -17,9 +17,12 @@ typedef u32 ( *p_rfsc_recv )( u8 *p, u32 size, timer_data_type timeout );
 // Public interface
 void rfsc_setup( u8 *pbuf, p_rfsc_send rfsc_send_func, p_rfsc_recv rfsc_recv_func, timer_data_type timeout );
 void rfsc_set_timeout( timer_data_type timeout );
+void rfsc_set_window( unsigned window );
 int rfsc_open( const char* pathname, int flags, int mode );
 s32 rfsc_write( int fd, const void *buf, u32 count );
 s32 rfsc_read( int fd, void *buf, u32 count );
+s32 rfsc_read_pipelined( int fd, void *buf, u32 count, u32 chunk );
+s32 rfsc_write_pipelined( int fd, const void *buf, u32 count, u32 chunk );
 s32 rfsc_lseek( int fd, s32 offset, int whence );
 int rfsc_close( int fd );
 u32 rfsc_opendir( const char* name );
@@ -25,5 +25,10 @@ u32 os_opendir( const char* name );
 void os_readdir( u32 d, const char **pname );
 int os_closedir( u32 d );
 
+// Read only mapping of a whole file (returns NULL if not supported)
+s32 os_fsize( int fd );
+const void* os_map( int fd, u32 size );
+void os_unmap( const void *p, u32 size );
+
 #endif
 
@@ -4,6 +4,7 @@
 #define __REMOTEFS_H__
 
 #include "type.h"
+#include "eluarpc.h"
 
 // Operation IDs
 #define   RFS_OP_OPEN     0x01
@@ -15,7 +16,10 @@
 #define   RFS_OP_OPENDIR  0x06
 #define   RFS_OP_READDIR  0x07
 #define   RFS_OP_CLOSEDIR 0x08
-#define   RFS_OP_LAST     RFS_OP_CLOSEDIR
+#define   RFS_OP_WINDOW   0x09
+#define   RFS_OP_READSEQ  0x0A
+#define   RFS_OP_WRITESEQ 0x0B
+#define   RFS_OP_LAST     RFS_OP_WRITESEQ
 #define   RFS_OP_RES_MOD  0x80
 
 // Platform independent constants for "flags" in "open"
@@ -40,6 +44,14 @@
 // Max filename size on a RFS instance
 #define   RFS_MAX_FNAME_SIZE        31
 
+// Maximum number of outstanding READSEQ/WRITESEQ requests accepted by a server
+#define   RFS_MAX_WINDOW            8
+
+// Offset of the data in a READSEQ response and extra space needed by a
+// WRITESEQ request (both carry a sequence number in addition to READ/WRITE)
+#define   RFS_READSEQ_BUF_OFFSET    ( ELUARPC_READ_BUF_OFFSET + ELUARPC_U32_SIZE )
+#define   RFS_WRITESEQ_REQUEST_EXTRA  ( ELUARPC_WRITE_REQUEST_EXTRA + ELUARPC_U32_SIZE )
+
 // Function: int open(const char *pathname,int flags, mode_t mode)
 void remotefs_open_write_response( u8 *p, int result );
 int remotefs_open_read_response( const u8 *p, int *presult );
@@ -89,5 +101,26 @@ int remotefs_closedir_read_response( const u8 *p, int *pd );
 void remotefs_closedir_write_request( u8 *p, u32 d );
 int remotefs_closedir_read_request( const u8 *p, u32 *pd );
 
+// Function: u32 window( u32 window )
+// Negotiates the number of pipelined READSEQ/WRITESEQ requests
+void remotefs_window_write_response( u8 *p, u32 window );
+int remotefs_window_read_response( const u8 *p, u32 *pwindow );
+void remotefs_window_write_request( u8 *p, u32 window );
+int remotefs_window_read_request( const u8 *p, u32 *pwindow );
+
+// Function: ssize_t readseq( int fd, void *buf, size_t count, u32 seq )
+// Same as read, the response is tagged with the sequence number of the request
+void remotefs_readseq_write_response( u8 *p, u32 seq, u32 readbytes );
+int remotefs_readseq_read_response( const u8 *p, u32 *pseq, const u8 **ppdata, u32 *preadbytes );
+void remotefs_readseq_write_request( u8 *p, int fd, u32 count, u32 seq );
+int remotefs_readseq_read_request( const u8 *p, int *pfd, u32 *pcount, u32 *pseq );
+
+// Function: ssize_t writeseq( int fd, const void *buf, size_t count, u32 seq )
+// Same as write, the response is tagged with the sequence number of the request
+void remotefs_writeseq_write_response( u8 *p, u32 seq, u32 result );
+int remotefs_writeseq_read_response( const u8 *p, u32 *pseq, u32 *presult );
+void remotefs_writeseq_write_request( u8 *p, int fd, const void *buf, u32 count, u32 seq );
+int remotefs_writeseq_read_request( const u8 *p, int *pfd, const void **pbuf, u32 *pcount, u32 *pseq );
+
 #endif
 
@@ -21,9 +21,34 @@ structure that is quite similar with ROMFS' structure (repeated for each file):
 Filename: ASCIIZ, max length is DM_MAX_FNAME_LENGTH, first byte is 0xFF if last file.
           WOFS filenames always begin at an address which is a multiple of ROMFS_ALIGN.
 File deleted flag: (WOFS_DEL_FIELD_SIZE bytes), aligned to ROMFS_ALIGN bytes
-File size: (4 bytes), aligned to ROMFS_ALIGN bytes
+File id: (4 bytes), unique for each file
+Total size: (4 bytes), the size of the whole file (written when the file is closed)
+File size: (4 bytes), aligned to ROMFS_ALIGN bytes (the size of this record)
 File data: (file size bytes)
 
+Since more than one file can be written at the same time, a WOFS file can be
+split in more records. The first one is the record described above, the others
+("extents") have the same structure, but their name is "\1" and they have the
+id of their file. The records of a file are always in order in the file system.
+If a file is deleted, only its first record is marked as deleted (the extents
+are marked by the next compaction of the file system). The compaction can also
+leave "skip" records in WOFS: their first byte is 0x02 and the other 3 bytes
+are the length of the record (little endian).
+
+ROMFS files can also be block compressed by mkfs. Their file size field has the
+ROMFS_SIZE_COMPRESSED bit set (the rest of the field is the size of the data on
+the image) and their data has this structure:
+
+Uncompressed size: (4 bytes)
+Block size: (4 bytes), the uncompressed size of a block (except the last one)
+Block offsets: ((number of blocks + 1) * 4 bytes), offsets of the compressed
+               blocks (relative to the end of this table)
+Compressed blocks: each block is compressed independently (LZ4 block format)
+
+mkfs also generates an index of the ROMFS files (romfiles_index), containing the
+offsets of the file names sorted by name (case insensitive), which is used to
+find files with a binary search. WOFS builds a similar index in RAM.
+
 *******************************************************************************/
 
 enum
@@ -40,6 +65,7 @@ typedef u32 ( *p_fs_write )( const void *from, u32 toaddr, u32 size, const void
 #define ROMFS_FILE_FLAG_READ      0x01
 #define ROMFS_FILE_FLAG_WRITE     0x02
 #define ROMFS_FILE_FLAG_APPEND    0x04
+#define ROMFS_FILE_FLAG_COMPRESSED 0x08
 
 // A small "FILE" structure
 typedef struct 
@@ -48,22 +74,27 @@ typedef struct
   u32 offset;
   u32 size;
   u8 flags;
+  // WOFS only (a file can be split in more records, see above)
+  u32 extaddr;                    // data address of the record that contains 'offset'
+  u32 extstart;                   // file offset of the first byte in that record
+  u32 extsize;                    // size of that record
+  u32 lastaddr;                   // data address of the last record (write mode)
+  u32 laststart;                  // file offset of the first byte in the last record (write mode)
 } FD;
 
 // WOFS constants
 // The miminum size we need in order to create another file
 // This size will be added to the size of the filename when creating a new file
 // to ensure that there's enough space left on the device
-// This comes from the size of the file length field (4) + the maximum number of
-// bytes needed to align this field (3) + a single 0xFF byte which marks the end
-// of the filesystem (1) + the maximum number of bytes needed to align the contents 
-// of a file (3)
-#define WOFS_MIN_NEEDED_SIZE      11   
+// This comes from the size of the file length, id and total size fields (12) +
+// the maximum number of bytes needed to align these fields (3) + a single 0xFF
+// byte which marks the end of the filesystem (1) + the maximum number of bytes
+// needed to align the contents of a file (3)
+#define WOFS_MIN_NEEDED_SIZE      19   
 
 // Filesystem flags
 #define ROMFS_FS_FLAG_DIRECT      0x01    // direct mode (the file is mapped in a memory area directly accesible by the CPU)
 #define ROMFS_FS_FLAG_WO          0x02    // this FS is actually a WO (Write-Once) FS
-#define ROMFS_FS_FLAG_WRITING     0x04    // for WO only: there is already a file opened in write mode
 
 // File system descriptor
 typedef struct
@@ -73,6 +104,8 @@ typedef struct
   p_fs_read readf;                // pointer to read function (for non-direct mode FS)
   p_fs_write writef;              // pointer to write function (only for ROMFS_FS_FLAG_WO)
   u32 max_size;                   // maximum size of the FS (in bytes)
+  const u32 *pindex;              // sorted file index generated by mkfs (ROMFS only, can be NULL)
+  u32 nindex;                     // number of entries in the index
 } FSDATA;
 
 #define romfs_fs_set_flag( p, f )     p->flags |= ( f )
@@ -82,6 +115,7 @@ typedef struct
 // FS functions
 int romfs_init();
 int wofs_format();
+int wofs_compact();
 
 #endif
 
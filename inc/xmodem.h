@@ -8,7 +8,8 @@
 
 // XMODEM constants
 #define XMODEM_INITIAL_BUFFER_SIZE    1024
-#define XMODEM_INCREMENT_AMMOUNT      512
+#define XMODEM_INCREMENT_AMMOUNT      1024
+#define XMODEM_SIZE_UNKNOWN           0xFFFFFFFFUL
 
 // xmodem timeout/retry parameters
 #define XMODEM_TIMEOUT                1000000
@@ -19,10 +20,20 @@
 #define XMODEM_ERROR_OUTOFSYNC        (-2)
 #define XMODEM_ERROR_RETRYEXCEED      (-3)
 #define XMODEM_ERROR_OUTOFMEM         (-4)
+#define XMODEM_ERROR_LOCALCANCEL      (-5)
 
 typedef void ( *p_xm_send_func )( u8 );
 typedef int ( *p_xm_recv_func )( timer_data_type );
+// Data sink: called with the file data in order, returns 0 for OK or
+// a negative value to cancel the transfer
+typedef int ( *p_xm_data_func )( const u8 *data, u32 size );
+// YMODEM batch: called with the name and size (XMODEM_SIZE_UNKNOWN if the
+// sender didn't give one) before each file and with name == NULL after its
+// last data block. Returns 0 for OK or a negative value to cancel
+typedef int ( *p_xm_file_func )( const char *name, u32 size );
+
 long xmodem_receive( char** dest );
+long xmodem_receive_stream( p_xm_data_func data_func, p_xm_file_func file_func );
 void xmodem_init( p_xm_send_func send_func, p_xm_recv_func recv_func );
 
 #endif // #ifndef __XMODEM_H__
@@ -25,6 +25,58 @@ def _add_data( data, outfile, moredata = True ):
     _crtline = '  '
     _numdata = 0
 
+# Write an extended LZ4 length
+def _lz_length( out, n ):
+  while n >= 255:
+    out.append( chr( 255 ) )
+    n -= 255
+  out.append( chr( n ) )
+
+# Write a LZ4 sequence (literals followed by a match, mlen is 0 for the last sequence)
+def _lz_sequence( out, lits, offset, mlen ):
+  token = min( len( lits ), 15 ) << 4
+  if mlen:
+    token = token | min( mlen - 4, 15 )
+  out.append( chr( token ) )
+  if len( lits ) >= 15:
+    _lz_length( out, len( lits ) - 15 )
+  out.append( lits )
+  if mlen:
+    out.append( chr( offset & 0xFF ) + chr( offset >> 8 ) )
+    if mlen - 4 >= 15:
+      _lz_length( out, mlen - 4 - 15 )
+
+# Compress a block in the LZ4 block format (greedy matching)
+def _lz_compress( data ):
+  out = []
+  table = {}
+  anchor = i = 0
+  while i + 4 <= len( data ):
+    key = data[ i : i + 4 ]
+    cand = table.get( key )
+    table[ key ] = i
+    if cand is None:
+      i = i + 1
+      continue
+    mlen = 4
+    while i + mlen < len( data ) and data[ cand + mlen ] == data[ i + mlen ]:
+      mlen = mlen + 1
+    _lz_sequence( out, data[ anchor : i ], i - cand, mlen )
+    for j in range( i + 1, min( i + mlen, len( data ) - 3 ) ):
+      table[ data[ j : j + 4 ] ] = j
+    i = anchor = i + mlen
+  _lz_sequence( out, data[ anchor : ], 0, 0 )
+  return ''.join( out )
+
+# Block compress a file (see inc/romfs.h for the format)
+def _block_compress( data, blocksize ):
+  blocks = [ _lz_compress( data[ i : i + blocksize ] ) for i in range( 0, len( data ), blocksize ) ]
+  offsets = [ 0 ]
+  for b in blocks:
+    offsets.append( offsets[ -1 ] + len( b ) )
+  header = struct.pack( "<II", len( data ), blocksize ) + ''.join( [ struct.pack( "<I", o ) for o in offsets ] )
+  return header + ''.join( blocks )
+
 # dirname - the directory where the files are located.
 # outname - the name of the C output
 # flist - list of files
@@ -33,8 +85,10 @@ def _add_data( data, outfile, moredata = True ):
 #   "compile" - precompile all files to Lua bytecode and then copy them
 #   "compress" - keep the source code, but compress it with LuaSrcDiet
 # compcmd - the command to use for compiling if "mode" is "compile"
+# blocksize - if not 0, compress the files in blocks of this size. Lua bytecode
+#   files are never compressed, so they can still be executed from ROM.
 # Returns True for OK, False for error
-def mkfs( dirname, outname, flist, mode, compcmd ):
+def mkfs( dirname, outname, flist, mode, compcmd, blocksize = 0 ):
   # Try to create the output files
   outfname = outname + ".h"
   try:
@@ -47,6 +101,8 @@ def mkfs( dirname, outname, flist, mode, compcmd ):
   _crtline = '  '
   _numdata = 0
   _bytecnt = 0
+  findex = []
+  compressed = False
   # Generate headers
   outfile.write( "// Generated by mkfs.py\n// DO NOT MODIFY\n\n" )
   outfile.write( "#ifndef __%s_H__\n#define __%s_H__\n\n" % ( outname.upper(), outname.upper() ) )
@@ -108,7 +164,18 @@ def mkfs( dirname, outname, flist, mode, compcmd ):
     if fextpart == ".lua" and mode != "verbatim":
       os.remove( newname )
 
+    # Block compress the file if requested and if it makes it smaller
+    realsize = len( filedata )
+    sizeflag = 0
+    if blocksize and not filedata.startswith( "\033Lua" ):
+      compdata = _block_compress( filedata, blocksize )
+      if len( compdata ) < len( filedata ):
+        filedata = compdata
+        sizeflag = 0x80000000
+        compressed = True
+
     # Write name, size, id, numpars
+    findex.append( ( fname.lower(), _bytecnt ) )
     _fcnt = 0
     for c in fname:
       _add_data( ord( c ), outfile )
@@ -116,7 +183,7 @@ def mkfs( dirname, outname, flist, mode, compcmd ):
     size_ll = len( filedata ) & 0xFF
     size_lh = ( len( filedata ) >> 8 ) & 0xFF
     size_hl = ( len( filedata ) >> 16 ) & 0xFF
-    size_hh = ( len( filedata ) >> 24 ) & 0xFF
+    size_hh = ( ( len( filedata ) | sizeflag ) >> 24 ) & 0xFF
      # Round to a multiple of 4
     while _bytecnt & ( alignment - 1 ) != 0:
       _add_data( 0, outfile )
@@ -130,11 +197,26 @@ def mkfs( dirname, outname, flist, mode, compcmd ):
       _add_data( ord( c ), outfile )
     
     # Report
-    print "Encoded file %s (%d bytes real size, %d bytes encoded size)" % ( fname, len( filedata ), _fcnt )
+    if sizeflag:
+      print "Encoded file %s (%d bytes real size, %d bytes encoded size, compressed)" % ( fname, realsize, _fcnt )
+    else:
+      print "Encoded file %s (%d bytes real size, %d bytes encoded size)" % ( fname, realsize, _fcnt )
     
   # All done, write the final "0xFF" (terminator)
   _add_data( 0xFF, outfile, False )
-  outfile.write( "};\n\n#endif\n" );
+  outfile.write( "};\n\n" )
+
+  # Size of the buffer needed to decompress a block
+  if compressed:
+    outfile.write( "#define %s_BLOCK_SIZE %d\n\n" % ( outname.upper(), blocksize ) )
+
+  # Write the index (offsets of the file names sorted by name, case insensitive)
+  findex.sort()
+  outfile.write( "#define %s_INDEX_SIZE %d\n\n" % ( outname.upper(), len( findex ) ) )
+  outfile.write( "const unsigned long %s_index[] = \n{\n" % ( outname.lower() ) )
+  for i in range( 0, len( findex ), 8 ):
+    outfile.write( "  " + "".join( [ "0x%08X, " % e[ 1 ] for e in findex[ i : i + 8 ] ] ) + "\n" )
+  outfile.write( "  0xFFFFFFFF\n};\n\n#endif\n" )
   outfile.close()
   print "Done, total size is %d bytes" % _bytecnt
   return True
@@ -9,5 +9,11 @@
 #define NET_TIMEOUT_MS              100
 #define MEM_BUF_SIZE                ( 6 * 1024 )
 
+// Service scheduling and flow control
+#define MUX_QUEUE_SIZE              1024    // host to target queue of a virtual UART
+#define MUX_RFS_QUEUE_SIZE          ( 2 * MEM_BUF_SIZE ) // RFS requests waiting for the server
+#define MUX_QUANTUM                 64      // bytes a service can send in a scheduling round
+#define MUX_READ_CHUNK              256     // maximum size of a single port read
+
 #endif
 
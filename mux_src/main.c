@@ -24,17 +24,24 @@
 #define HND_TRANSPORT_OFFSET  0
 #define HND_FIRST_VOFFSET     1
 
-#define RFS_PSEUDO_SELIDX     0xFF
-
 // Send/receive/init function pointers
 typedef u32 ( *p_recv_func )( u8 *p, u32 size );
 typedef u32 ( *p_send_func )( const u8 *p, u32 size );
 typedef int ( *p_init_func )( void );
 
-// Serial thread buffer structure
+// Byte queue (circular buffer)
+typedef struct {
+  u8 *data;
+  unsigned size, head, count;
+} MUX_QUEUE;
+
+// Service data structure. Data read from the service port waits in 'q' until
+// the scheduler sends it to the target. The free space in 'q' is the credit of
+// the service: its port is not read anymore when it runs out of credits.
 typedef struct {
   const char *pname;
   ser_handler fd;
+  MUX_QUEUE q;
 } SERVICE_DATA;
 
 // Serial transport data structure
@@ -53,12 +60,26 @@ static p_send_func transport_send;
 static p_init_func transport_init;
 
 static int service_id_in = -1, service_id_out = -1;
+static int prev_sent = -1, got_esc;
  
 static ser_handler transport_hnd = SER_HANDLER_INVALID;
 static int mux_mode;
 static int verbose_mode;
 static int rfs_service_id = -1, service_offset;
 
+// RFS requests waiting for the server and pending RFS response
+static MUX_QUEUE rfs_queue;
+static u16 rfs_size;
+static u8 *rfs_ptr;
+
+// Data from the target waiting to be written to a service port
+static u8 deliver_buf[ MUX_READ_CHUNK ];
+static unsigned deliver_len;
+static int deliver_sid = -1;
+
+// Next service in the scheduling round
+static unsigned sched_next;
+
 // ***************************************************************************
 // Serial transport implementation
 
@@ -137,6 +158,261 @@ static int parse_transport( const char* s )
   return 1;
 }
 
+// ****************************************************************************
+// Queues
+
+static int queue_init( MUX_QUEUE *q, unsigned size )
+{
+  if( ( q->data = ( u8* )malloc( size ) ) == NULL )
+    return 0;
+  q->size = size;
+  q->head = q->count = 0;
+  return 1;
+}
+
+// Get a pointer to the oldest data in the queue and its contiguous length
+static unsigned queue_peek( MUX_QUEUE *q, u8 **pdata )
+{
+  unsigned n = q->size - q->head;
+
+  *pdata = q->data + q->head;
+  return n < q->count ? n : q->count;
+}
+
+static void queue_consume( MUX_QUEUE *q, unsigned n )
+{
+  q->head = ( q->head + n ) % q->size;
+  q->count -= n;
+}
+
+static unsigned queue_put( MUX_QUEUE *q, const u8 *p, unsigned n )
+{
+  unsigned i, pos = ( q->head + q->count ) % q->size;
+
+  if( n > q->size - q->count )
+    n = q->size - q->count;
+  for( i = 0; i < n; i ++, pos = ( pos + 1 ) % q->size )
+    q->data[ pos ] = p[ i ];
+  q->count += n;
+  return n;
+}
+
+// ****************************************************************************
+// Target to host direction
+
+// Write the data collected for a service port
+static void mux_deliver_flush()
+{
+  if( deliver_len > 0 )
+  {
+    ser_write( services[ deliver_sid - SERMUX_SERVICE_ID_FIRST - service_offset ].fd, deliver_buf, deliver_len );
+    deliver_len = 0;
+  }
+}
+
+// Collect a byte for a service, so that consecutive bytes for the same service
+// are written to its port at once
+static void mux_deliver( int sid, u8 c )
+{
+  if( sid == rfs_service_id ) // this request is for the RFS server
+  {
+    if( queue_put( &rfs_queue, &c, 1 ) == 0 )
+      log_err( "RFS request queue full, dropping data\n" );
+    return;
+  }
+  if( sid != deliver_sid || deliver_len == sizeof( deliver_buf ) )
+    mux_deliver_flush();
+  deliver_sid = sid;
+  deliver_buf[ deliver_len ++ ] = c;
+}
+
+// Interpret data received on the transport interface
+static int mux_parse_transport( const u8 *p, u32 size )
+{
+  u32 i;
+  int c;
+
+  for( i = 0; i < size; i ++ )
+  {
+    c = p[ i ];
+    if( c == SERMUX_ESCAPE_CHAR )
+    {
+      got_esc = 1;
+      continue;
+    }
+    if( c >= SERMUX_SERVICE_ID_FIRST && c <= SERMUX_SERVICE_ID_LAST )
+    {
+      log_msg( "Changed service_id_in from %d(%X) to %d(%X).\n", service_id_in, service_id_in, c, c );
+      service_id_in = c;
+    }
+    else if( c == SERMUX_FORCE_SID_CHAR )
+    {
+      // Re-transmit the last data AND the service ID. Since data is sent in
+      // bursts, the target can ask again for the following bytes of the same
+      // burst; in this case only the service ID is sent again.
+      if( prev_sent == -1 )
+      {
+        if( service_id_out == -1 )
+        {
+          log_err( "Protocol error: got request to resend service ID when the last char sent was not set.\n" );
+          return 0;
+        }
+        log_msg( "Got request to resend service_id_out %d(%X).\n", service_id_out, service_id_out );
+        transport_send_byte( service_id_out );
+        continue;
+      }
+      log_msg( "Got request to resend service_id_out %d(%X).\n", service_id_out, service_id_out );
+      transport_send_byte( service_id_out );
+      if( prev_sent & SERMUX_ESC_MASK )
+        transport_send_byte( SERMUX_ESCAPE_CHAR );
+      transport_send_byte( prev_sent & 0xFF );
+      prev_sent = -1;
+    }
+    else
+    {
+      if( got_esc )
+      {
+        // Got an escape last time, check the char now (with the 5th bit flipped)
+        c ^= SERMUX_ESCAPE_XOR_MASK;
+        if( c != SERMUX_ESCAPE_CHAR && c != SERMUX_FORCE_SID_CHAR && ( c < SERMUX_SERVICE_ID_FIRST || c > SERMUX_SERVICE_ID_LAST ) )
+        {
+           log_err( "Protocol error: invalid escape sequence\n" );
+           return 0;
+        }
+        got_esc = 0;
+      }
+      if( service_id_in == -1 )
+      {
+        transport_send_byte( SERMUX_FORCE_SID_CHAR );
+        log_msg( "Requested resend of service ID for byte %3d ('%c').\n", c, isprint( c ) ? c : ' ' );
+      }
+      else
+        mux_deliver( service_id_in, ( u8 )c );
+    }
+  }
+  mux_deliver_flush();
+  return 1;
+}
+
+// Feed queued requests to the RFS server. The server builds its response in
+// the same buffer as the request, so this waits until the previous response
+// was completely sent to the target.
+static void mux_rfs_process()
+{
+  u8 *p;
+  unsigned n, i;
+
+  while( rfs_size == 0 && ( n = queue_peek( &rfs_queue, &p ) ) > 0 )
+  {
+    for( i = 0; i < n && rfs_size == 0; i ++ )
+    {
+      rfs_mem_read_request_packet( p[ i ] );
+      if( rfs_mem_has_response() ) // we have a response from the RFS server
+      {
+        rfs_mem_write_response( &rfs_size, &rfs_ptr );
+        rfs_mem_start_request(); // initialize the RFS server for a new request
+      }
+    }
+    queue_consume( &rfs_queue, i );
+  }
+}
+
+// ****************************************************************************
+// Host to target direction
+
+// Return the contiguous data that the service with the given index (0 is RFS
+// in RFSMUX mode) has to send
+static unsigned mux_peek( unsigned idx, u8 **pdata )
+{
+  if( ( int )idx < service_offset )
+  {
+    *pdata = rfs_ptr;
+    return rfs_size;
+  }
+  return queue_peek( &services[ idx - service_offset ].q, pdata );
+}
+
+static void mux_consume( unsigned idx, unsigned n )
+{
+  if( ( int )idx < service_offset )
+  {
+    rfs_ptr += n;
+    rfs_size -= n;
+  }
+  else
+    queue_consume( &services[ idx - service_offset ].q, n );
+}
+
+static int mux_has_pending()
+{
+  u8 *p;
+  unsigned i;
+
+  for( i = 0; i < vport_num + service_offset; i ++ )
+    if( mux_peek( i, &p ) > 0 )
+      return 1;
+  return 0;
+}
+
+// Send up to MUX_QUANTUM bytes of a service as a single burst, preceded by
+// the service ID if the previous burst came from another service
+static void mux_send_burst( unsigned idx )
+{
+  u8 burst[ 1 + 2 * MUX_QUANTUM ];
+  unsigned len = 0, credit = MUX_QUANTUM, n, i;
+  int sid = SERMUX_SERVICE_ID_FIRST + idx;
+  u8 *p, c;
+
+  if( sid != service_id_out )
+  {
+    log_msg( "Changed service_id_out from %d(%X) to %d(%X).\n", service_id_out, service_id_out, sid, sid );
+    burst[ len ++ ] = sid;
+  }
+  while( credit > 0 && ( n = mux_peek( idx, &p ) ) > 0 )
+  {
+    if( n > credit )
+      n = credit;
+    for( i = 0; i < n; i ++ )
+    {
+      c = p[ i ];
+      // Escape the data byte if needed
+      if( c == SERMUX_ESCAPE_CHAR || c == SERMUX_FORCE_SID_CHAR || ( c >= SERMUX_SERVICE_ID_FIRST && c <= SERMUX_SERVICE_ID_LAST ) )
+      {
+        burst[ len ++ ] = SERMUX_ESCAPE_CHAR;
+        burst[ len ++ ] = c ^ SERMUX_ESCAPE_XOR_MASK;
+        prev_sent = SERMUX_ESC_MASK | ( c ^ SERMUX_ESCAPE_XOR_MASK );
+      }
+      else
+      {
+        burst[ len ++ ] = c;
+        prev_sent = c;
+      }
+    }
+    mux_consume( idx, n );
+    credit -= n;
+  }
+  service_id_out = sid;
+  if( transport_send( burst, len ) != len )
+    log_err( "Error sending data on transport\n" );
+}
+
+// Give every service with pending data a turn on the transport. Bursts are
+// limited to MUX_QUANTUM bytes, so a bulk transfer can't hold the link while
+// another (interactive) service is waiting.
+static void mux_schedule()
+{
+  unsigned i, idx, nsvc = vport_num + service_offset;
+  u8 *p;
+
+  for( i = 0; i < nsvc; i ++ )
+  {
+    idx = ( sched_next + i ) % nsvc;
+    if( mux_peek( idx, &p ) > 0 )
+      mux_send_burst( idx );
+  }
+  sched_next = ( sched_next + 1 ) % nsvc;
+}
+
 // ****************************************************************************
 // Program entry point
 
@@ -152,16 +428,14 @@ int main( int argc, char *argv[] )
 int main( int argc, char **argv )
 #endif
 {
-  unsigned i;
+  unsigned i, nhandlers, selidx;
   SERVICE_DATA *tservice;
-  int c, prev_sent = -1;
-  int temp;
-  int got_esc = 0;
   char* rfs_dir_name;
   ser_handler *phandlers;
-  int selidx;
-  u16 rfs_size = 0;
-  u8 *rfs_ptr;
+  unsigned *pmap;
+  u8 rdbuf[ MUX_READ_CHUNK ];
+  u32 n;
+  int timeout;
 
   // Interpret arguments
   setvbuf( stdout, NULL, _IONBF, 0 );  
@@ -223,12 +497,12 @@ int main( int argc, char **argv )
     log_err( "Not enough memory\n" );
     return 1;
   }
-  if( ( phandlers = ( ser_handler* )malloc( sizeof( ser_handler ) * ( vport_num + 1 ) ) ) == NULL )
+  if( ( phandlers = ( ser_handler* )malloc( sizeof( ser_handler ) * ( vport_num + 1 ) ) ) == NULL ||
+      ( pmap = ( unsigned* )malloc( sizeof( unsigned ) * ( vport_num + 1 ) ) ) == NULL )
   {
     log_err( "Not enough memory\n" );
     return 1;  
   }
-  phandlers[ HND_TRANSPORT_OFFSET ] = transport_hnd;
 
   memset( services, 0, sizeof( SERVICE_DATA ) * vport_num );
   for( i = 0; i < vport_num; i ++ ) 
@@ -245,7 +519,11 @@ int main( int argc, char **argv )
       return 1;
     }
     tservice->pname = argv[ i + FIRST_SERVICE_IDX ];
-    phandlers[ i + HND_FIRST_VOFFSET ] = tservice->fd;
+    if( queue_init( &tservice->q, MUX_QUEUE_SIZE ) == 0 )
+    {
+      log_err( "Not enough memory\n" );
+      return 1;
+    }
   }
   
   // Setup RFS server in RFSMUX mode
@@ -256,120 +534,49 @@ int main( int argc, char **argv )
       args[ 3 ] = "-v";
     if( rfs_init( verbose_mode ? 4 : 3, ( const char ** )args ) != 0 )      
       return 1;
+    if( queue_init( &rfs_queue, MUX_RFS_QUEUE_SIZE ) == 0 )
+    {
+      log_err( "Not enough memory\n" );
+      return 1;
+    }
   }
 
   log_msg( "Starting service multiplexer on %u port(s)\n", vport_num );
   
-  // Main service thread
+  // Main service loop
   while( 1 )
   {
-    if( rfs_size > 0 ) // Response packet from RFS
-    {
-      c = *rfs_ptr ++;
-      rfs_size --;
-      selidx = RFS_PSEUDO_SELIDX;
-    }
-    else
+    // Wait for data on the transport and on the services that have enough
+    // credits for a full read. Don't block if there is data waiting to be sent.
+    phandlers[ HND_TRANSPORT_OFFSET ] = transport_hnd;
+    nhandlers = HND_FIRST_VOFFSET;
+    for( i = 0; i < vport_num; i ++ )
+      if( services[ i ].q.size - services[ i ].q.count >= sizeof( rdbuf ) )
+      {
+        pmap[ nhandlers ] = i;
+        phandlers[ nhandlers ++ ] = services[ i ].fd;
+      }
+    timeout = mux_has_pending() ? SER_NO_TIMEOUT : SER_INF_TIMEOUT;
+    if( ( n = ser_select_read( phandlers, nhandlers, timeout, rdbuf, sizeof( rdbuf ), &selidx ) ) == 0 )
     {
-      if( ( c = ser_select_byte( phandlers, vport_num + 1, SER_INF_TIMEOUT ) ) == -1 )
+      if( timeout == SER_INF_TIMEOUT )
       {
         log_err( "Error on select, aborting program\n" );
         return 1;
       }
-      selidx = c >> 8;
-      c = c & 0xFF;
     }
-    //log_msg( "Got byte %d from idx %d\n", c, selidx );
-    if( selidx == HND_TRANSPORT_OFFSET ) // Got byte on transport interface
+    else if( selidx == HND_TRANSPORT_OFFSET ) // Got data on transport interface
     {
-      // Interpret byte
-      if( c != SERMUX_ESCAPE_CHAR )
-      {
-        if( c >= SERMUX_SERVICE_ID_FIRST && c <= SERMUX_SERVICE_ID_LAST )
-        {
-          log_msg( "Changed service_id_in from %d(%X) to %d(%X).\n", service_id_in, service_id_in, c, c );
-          service_id_in = c;
-        } 
-        else if( c == SERMUX_FORCE_SID_CHAR )
-        {
-          if( prev_sent == -1 )
-          {
-            log_err( "Protocol error: got request to resend service ID when the last char sent was not set.\n" );
-            return 1;
-          }
-          log_msg( "Got request to resend service_id_out %d(%X).\n", service_id_out, service_id_out );
-          // Re-transmit the last data AND the service ID
-          transport_send_byte( service_id_out );
-          if( prev_sent & SERMUX_ESC_MASK )
-            transport_send_byte( SERMUX_ESCAPE_CHAR );
-          transport_send_byte( prev_sent & 0xFF );
-          prev_sent = -1;
-        }          
-        else
-        {
-          if( got_esc )
-          {
-            // Got an escape last time, check the char now (with the 5th bit flipped)
-            c ^= SERMUX_ESCAPE_XOR_MASK;
-            if( c != SERMUX_ESCAPE_CHAR && c != SERMUX_FORCE_SID_CHAR && ( c < SERMUX_SERVICE_ID_FIRST || c > SERMUX_SERVICE_ID_LAST ) )
-            {
-               log_err( "Protocol error: invalid escape sequence\n" );
-               return 1;
-            }
-            got_esc = 0;
-          }  
-          if( service_id_in == -1 )
-          {
-            transport_send_byte( SERMUX_FORCE_SID_CHAR );
-            log_msg( "Requested resend of service ID for byte %3d ('%c').\n", c, isprint( c ) ? c : ' ' );
-          }
-          else
-          {
-            if( service_id_in == rfs_service_id ) // this request is for the RFS server
-            {
-              rfs_mem_read_request_packet( c );
-              if( rfs_mem_has_response() ) // we have a response from the RFS server
-              {
-                rfs_mem_write_response( &rfs_size, &rfs_ptr );                  
-                rfs_mem_start_request(); // initialize the RFS server for a new request  
-              }
-            }
-            else
-            {
-              //log_msg( "Sending byte %d to %s\n", c, services[ service_id_in - SERMUX_SERVICE_ID_FIRST - service_offset ].pname );
-              ser_write_byte( services[ service_id_in - SERMUX_SERVICE_ID_FIRST - service_offset ].fd, c );
-            }
-          }
-        }
-      }
-      else
-        got_esc = 1;                          
+      if( mux_parse_transport( rdbuf, n ) == 0 )
+        return 1;
     }
-    else
+    else // Got data from a service, queue it
     {
-      // No byte to read, there must be something to send
-      if( selidx == RFS_PSEUDO_SELIDX )
-        temp = SERMUX_SERVICE_ID_FIRST;
-      else        
-        temp = SERMUX_SERVICE_ID_FIRST + selidx - HND_FIRST_VOFFSET + service_offset;
-      prev_sent = c;
-      // Send the service ID first if needed
-      if( temp != service_id_out )
-      {
-        log_msg( "Changed service_id_out from %d(%X) to %d(%X).\n", service_id_out, service_id_out, temp, temp );
-        transport_send_byte( temp );
-      }
-      // Then send the actual data byte, escaping it if needed
-      if( c == SERMUX_ESCAPE_CHAR || c == SERMUX_FORCE_SID_CHAR || ( c >= SERMUX_SERVICE_ID_FIRST && c <= SERMUX_SERVICE_ID_LAST ) )
-      {
-        transport_send_byte( SERMUX_ESCAPE_CHAR );
-        transport_send_byte( ( u8 )c ^ SERMUX_ESCAPE_XOR_MASK );
-        prev_sent = SERMUX_ESC_MASK | ( ( u8 )c ^ SERMUX_ESCAPE_XOR_MASK );
-      }
-      else
-        transport_send_byte( c );
-      service_id_out = temp;
+      tservice = services + pmap[ selidx ];
+      queue_put( &tservice->q, rdbuf, n );
     }
+    mux_rfs_process();
+    mux_schedule();
   }
 
   return 0;
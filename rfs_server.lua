@@ -25,7 +25,9 @@ if utils.is_windows() then
   exeprefix = ".exe"
   socklib = 'ws2_32'
 else
-  flist = mainname .. " server.c os_io_posix.c log.c net_posix.c serial_posix.c deskutils.c rfs_transports.c"
+  flist = mainname .. " server.c os_io_posix.c log.c net_posix.c serial_posix.c deskutils.c rfs_transports.c mclient.c"
+  cdefs = cdefs .. " ELUARPC_THREAD_SAFE"
+  socklib = 'pthread'
 end
 
 local output = sim == 0 and 'rfs_server' or 'rfs_sim_server'
@@ -18,7 +18,9 @@ if platform.system() == "Windows":
   exeprefix = ".exe"
   socklib = '-lws2_32'
 else:
-  flist = "%s server.c os_io_posix.c log.c net_posix.c serial_posix.c deskutils.c rfs_transports.c" % mainname
+  flist = "%s server.c os_io_posix.c log.c net_posix.c serial_posix.c deskutils.c rfs_transports.c mclient.c" % mainname
+  cdefs = cdefs + " -DELUARPC_THREAD_SAFE"
+  socklib = '-lpthread'
   exeprefix = ""
 
 if sim == '0':
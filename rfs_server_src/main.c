@@ -16,6 +16,9 @@
 #include "rfs.h"
 #include "deskutils.h"
 #include "rfs_transports.h"
+#ifdef RFS_MULTI_CLIENT
+#include "mclient.h"
+#endif
 
 #ifdef RFS_STANDALONE_MODE
 int main( int argc, const char **argv )
@@ -32,12 +35,16 @@ int main( int argc, const char **argv )
   }
   
   // Enter the server endless loop
+#ifdef RFS_MULTI_CLIENT
+  mcl_run();
+#else
   while( 1 )
   {
     p_transport_data->f_read_request();
     server_execute_request( rfs_buffer );
     p_transport_data->f_send_response();
   }
+#endif
 
   p_transport_data->f_cleanup();
   return 0;
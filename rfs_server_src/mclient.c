@@ -0,0 +1,520 @@
+// Multi-client RFS server (POSIX only)
+// A single poll() loop reads requests from any number of serial ports and
+// UDP sockets, each UDP peer being a separate client. Requests are executed
+// by a pool of worker threads. A client is handled by at most one worker at
+// a time, so its requests are still executed (and answered) in order.
+
+#include "mclient.h"
+#include "server.h"
+#include "remotefs.h"
+#include "eluarpc.h"
+#include "rfs_transports.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+
+// ****************************************************************************
+// Local definitions and data
+
+#define MCL_PACKET_SIZE       ( MAX_PACKET_SIZE + RFS_WRITESEQ_REQUEST_EXTRA )
+#define MCL_QUEUE_LEN         RFS_MAX_WINDOW
+
+enum
+{
+  MCL_EP_SERIAL,
+  MCL_EP_UDP
+};
+
+struct mcl_client;
+
+typedef struct
+{
+  int type;
+  int fd;                               // serial port or socket, -1 if closed
+  int closing;                          // serial: failed, close it when idle
+  struct mcl_client *pclient;           // serial: the only client
+} MCL_ENDPOINT;
+
+typedef struct mcl_client
+{
+  MCL_ENDPOINT *pep;
+  struct sockaddr_in addr;              // UDP peer address
+  u32 lastused;
+  SERVER_CLIENT state;
+  // Request queue, protected by mcl_lock
+  u8 queue[ MCL_QUEUE_LEN ][ MCL_PACKET_SIZE ];
+  unsigned head, count;
+  int scheduled;                        // in the ready list or owned by a worker
+  struct mcl_client *next;              // ready list link
+  // Request assembly (poll thread only)
+  u32 rxlen;
+  u16 rxsize;
+} MCL_CLIENT;
+
+static MCL_ENDPOINT mcl_endpoints[ MCL_MAX_ENDPOINTS ];
+static unsigned mcl_num_endpoints;
+static MCL_CLIENT *mcl_clients[ MCL_MAX_CLIENTS ];
+static u32 mcl_clock;
+
+static pthread_mutex_t mcl_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mcl_cond = PTHREAD_COND_INITIALIZER;
+static MCL_CLIENT *mcl_ready_head, *mcl_ready_tail;
+static int mcl_wake_pipe[ 2 ];
+
+// ****************************************************************************
+// Clients
+
+static MCL_CLIENT* mcl_new_client( MCL_ENDPOINT *pep )
+{
+  MCL_CLIENT *pclient;
+
+  if( ( pclient = ( MCL_CLIENT* )calloc( 1, sizeof( MCL_CLIENT ) ) ) == NULL )
+    return NULL;
+  pclient->pep = pep;
+  server_client_init( &pclient->state );
+  pclient->state.zerocopy = 1;
+  return pclient;
+}
+
+// Find the client for an UDP peer. If there's no room for a new client, the
+// least recently used idle client is dropped, preferring clients without
+// open files (dropping those loses nothing).
+static MCL_CLIENT* mcl_udp_client( MCL_ENDPOINT *pep, const struct sockaddr_in *paddr )
+{
+  MCL_CLIENT *pclient, *pold = NULL;
+  unsigned i, freeidx = MCL_MAX_CLIENTS, oldidx = 0;
+  int handles, oldhandles = 0;
+
+  for( i = 0; i < MCL_MAX_CLIENTS; i ++ )
+  {
+    if( ( pclient = mcl_clients[ i ] ) == NULL )
+    {
+      if( freeidx == MCL_MAX_CLIENTS )
+        freeidx = i;
+      continue;
+    }
+    if( pclient->pep == pep && pclient->addr.sin_port == paddr->sin_port &&
+        pclient->addr.sin_addr.s_addr == paddr->sin_addr.s_addr )
+      return pclient;
+    pthread_mutex_lock( &mcl_lock );
+    if( !pclient->scheduled && pclient->rxlen == 0 )
+    {
+      handles = server_client_has_handles( &pclient->state );
+      if( pold == NULL || handles < oldhandles || ( handles == oldhandles && pclient->lastused < pold->lastused ) )
+      {
+        pold = pclient;
+        oldidx = i;
+        oldhandles = handles;
+      }
+    }
+    pthread_mutex_unlock( &mcl_lock );
+  }
+  if( freeidx == MCL_MAX_CLIENTS )
+  {
+    if( pold == NULL )
+      return NULL;
+    log_msg( "mclient: dropping client %s:%u\n", inet_ntoa( pold->addr.sin_addr ), ( unsigned )ntohs( pold->addr.sin_port ) );
+    server_client_release( &pold->state );
+    free( pold );
+    mcl_clients[ oldidx ] = NULL;
+    freeidx = oldidx;
+  }
+  if( ( pclient = mcl_new_client( pep ) ) == NULL )
+    return NULL;
+  pclient->addr = *paddr;
+  mcl_clients[ freeidx ] = pclient;
+  log_msg( "mclient: new client %s:%u\n", inet_ntoa( paddr->sin_addr ), ( unsigned )ntohs( paddr->sin_port ) );
+  return pclient;
+}
+
+// The request being received goes to the first free slot of the queue
+static u8* mcl_rx_slot( MCL_CLIENT *pclient )
+{
+  u8 *p;
+
+  pthread_mutex_lock( &mcl_lock );
+  p = pclient->queue[ ( pclient->head + pclient->count ) % MCL_QUEUE_LEN ];
+  pthread_mutex_unlock( &mcl_lock );
+  return p;
+}
+
+// Where the next received bytes of a request go, and how many are needed
+static u8* mcl_rx_ptr( MCL_CLIENT *pclient, u32 *pneeded )
+{
+  u8 *p = mcl_rx_slot( pclient );
+
+  if( pclient->rxlen < ELUARPC_START_OFFSET )
+    *pneeded = ELUARPC_START_OFFSET - pclient->rxlen;
+  else
+    *pneeded = pclient->rxsize - pclient->rxlen;
+  return p + pclient->rxlen;
+}
+
+// Account for 'size' received bytes. Returns 0 if the request is invalid.
+static int mcl_rx_done( MCL_CLIENT *pclient, u32 size )
+{
+  u8 *p = mcl_rx_slot( pclient );
+
+  pclient->rxlen += size;
+  if( pclient->rxlen == ELUARPC_START_OFFSET && pclient->rxsize == 0 )
+  {
+    if( eluarpc_get_packet_size( p, &pclient->rxsize ) == ELUARPC_ERR ||
+        pclient->rxsize <= ELUARPC_START_OFFSET || pclient->rxsize > MCL_PACKET_SIZE )
+    {
+      log_msg( "mclient: ERROR getting packet size.\n" );
+      pclient->rxlen = pclient->rxsize = 0;
+      return 0;
+    }
+  }
+  else if( pclient->rxsize && pclient->rxlen == pclient->rxsize )
+  {
+    // Complete request, queue it
+    pclient->rxlen = pclient->rxsize = 0;
+    pclient->lastused = ++ mcl_clock;
+    pthread_mutex_lock( &mcl_lock );
+    pclient->count ++;
+    if( !pclient->scheduled )
+    {
+      pclient->scheduled = 1;
+      pclient->next = NULL;
+      if( mcl_ready_tail )
+        mcl_ready_tail->next = pclient;
+      else
+        mcl_ready_head = pclient;
+      mcl_ready_tail = pclient;
+      pthread_cond_signal( &mcl_cond );
+    }
+    pthread_mutex_unlock( &mcl_lock );
+  }
+  return 1;
+}
+
+static int mcl_queue_full( MCL_CLIENT *pclient )
+{
+  int res;
+
+  pthread_mutex_lock( &mcl_lock );
+  res = pclient->count == MCL_QUEUE_LEN;
+  pthread_mutex_unlock( &mcl_lock );
+  return res;
+}
+
+// ****************************************************************************
+// Endpoint input (poll thread)
+
+// Called with mcl_lock held, when no worker owns the client of the endpoint
+static void mcl_close_endpoint( MCL_ENDPOINT *pep )
+{
+  close( pep->fd );
+  pep->fd = -1;
+  pep->closing = 0;
+}
+
+static void mcl_serial_input( MCL_ENDPOINT *pep )
+{
+  MCL_CLIENT *pclient = pep->pclient;
+  u8 *p;
+  u32 needed;
+  ssize_t res;
+
+  while( !mcl_queue_full( pclient ) )
+  {
+    p = mcl_rx_ptr( pclient, &needed );
+    if( ( res = read( pep->fd, p, needed ) ) > 0 )
+    {
+      if( !mcl_rx_done( pclient, ( u32 )res ) )
+        tcflush( pep->fd, TCIFLUSH );
+      continue;
+    }
+    if( res == 0 || ( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR ) )
+    {
+      log_err( "mclient: serial port error, closing it\n" );
+      // A worker might still be writing a response, it closes the port then
+      pthread_mutex_lock( &mcl_lock );
+      pep->closing = 1;
+      if( !pclient->scheduled )
+        mcl_close_endpoint( pep );
+      pthread_mutex_unlock( &mcl_lock );
+    }
+    break;
+  }
+}
+
+static void mcl_udp_input( MCL_ENDPOINT *pep )
+{
+  static u8 buf[ MCL_PACKET_SIZE ];
+  struct sockaddr_in from;
+  socklen_t fromlen = sizeof( from );
+  MCL_CLIENT *pclient;
+  ssize_t res;
+  u32 needed, size;
+  u8 *p, *pdata;
+
+  if( ( res = recvfrom( pep->fd, buf, sizeof( buf ), 0, ( struct sockaddr* )&from, &fromlen ) ) <= 0 )
+    return;
+  if( ( pclient = mcl_udp_client( pep, &from ) ) == NULL )
+  {
+    log_msg( "mclient: too many clients, dropping request\n" );
+    return;
+  }
+  // A request can be split over several datagrams
+  for( pdata = buf; res > 0; res -= size, pdata += size )
+  {
+    if( mcl_queue_full( pclient ) )
+    {
+      log_msg( "mclient: client queue full, dropping request\n" );
+      break;
+    }
+    p = mcl_rx_ptr( pclient, &needed );
+    size = ( u32 )res < needed ? ( u32 )res : needed;
+    memcpy( p, pdata, size );
+    if( !mcl_rx_done( pclient, size ) )
+      break;
+  }
+}
+
+// ****************************************************************************
+// Workers
+
+// Copy the response out of the request slot, so that the slot can be reused
+// before the response is sent. A zero-copy response has no file data in the
+// slot, only the packet header and the end of the packet are copied.
+static void mcl_take_response( MCL_CLIENT *pclient, u8 *pdest, const u8 *p )
+{
+  SERVER_CLIENT *pstate = &pclient->state;
+  u16 size;
+
+  if( eluarpc_get_packet_size( p, &size ) == ELUARPC_ERR || size > MCL_PACKET_SIZE )
+    size = ELUARPC_START_OFFSET;
+  if( pstate->zdata && pstate->zlen > 0 )
+  {
+    memcpy( pdest, p, pstate->zoffset );
+    memcpy( pdest + pstate->zoffset + pstate->zlen, p + pstate->zoffset + pstate->zlen, size - pstate->zoffset - pstate->zlen );
+  }
+  else
+    memcpy( pdest, p, size );
+}
+
+// Send the response with a single writev()/sendmsg() call. Zero-copy read
+// responses are sent in three pieces: the packet header, the file data (from
+// the file mapping) and the end of the packet.
+static void mcl_send( MCL_CLIENT *pclient, const u8 *p )
+{
+  MCL_ENDPOINT *pep = pclient->pep;
+  SERVER_CLIENT *pstate = &pclient->state;
+  struct iovec iov[ 3 ], *piov = iov;
+  struct msghdr msg;
+  struct pollfd pfd;
+  int niov = 1;
+  u16 size;
+  ssize_t res;
+
+  if( eluarpc_get_packet_size( p, &size ) == ELUARPC_ERR )
+  {
+    log_msg( "mclient: ERROR in send_response_packet!\n" );
+    return;
+  }
+  log_msg( "mclient: sending response packet of %u bytes\n", ( unsigned )size );
+  iov[ 0 ].iov_base = ( void* )p;
+  iov[ 0 ].iov_len = size;
+  if( pstate->zdata && pstate->zlen > 0 )
+  {
+    iov[ 0 ].iov_len = pstate->zoffset;
+    iov[ 1 ].iov_base = ( void* )pstate->zdata;
+    iov[ 1 ].iov_len = pstate->zlen;
+    iov[ 2 ].iov_base = ( void* )( p + pstate->zoffset + pstate->zlen );
+    iov[ 2 ].iov_len = size - pstate->zoffset - pstate->zlen;
+    niov = 3;
+  }
+  if( pep->type == MCL_EP_UDP )
+  {
+    memset( &msg, 0, sizeof( msg ) );
+    msg.msg_name = &pclient->addr;
+    msg.msg_namelen = sizeof( pclient->addr );
+    msg.msg_iov = iov;
+    msg.msg_iovlen = niov;
+    if( sendmsg( pep->fd, &msg, 0 ) == -1 && errno == EFAULT )
+      log_msg( "mclient: file truncated while sending data\n" );
+    return;
+  }
+  // Serial ports are non-blocking, wait until all the data is out
+  while( niov > 0 && pep->fd != -1 )
+  {
+    if( ( res = writev( pep->fd, piov, niov ) ) > 0 )
+    {
+      while( niov > 0 && ( size_t )res >= piov->iov_len )
+      {
+        res -= piov->iov_len;
+        piov ++;
+        niov --;
+      }
+      if( niov > 0 )
+      {
+        piov->iov_base = ( u8* )piov->iov_base + res;
+        piov->iov_len -= res;
+      }
+    }
+    else if( res == -1 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+    {
+      pfd.fd = pep->fd;
+      pfd.events = POLLOUT;
+      poll( &pfd, 1, -1 );
+    }
+    else if( res == -1 && errno != EINTR )
+    {
+      if( errno == EFAULT )
+        log_msg( "mclient: file truncated while sending data\n" );
+      break;
+    }
+  }
+}
+
+static void* mcl_worker( void *arg )
+{
+  u8 resp[ MCL_PACKET_SIZE ];
+  MCL_CLIENT *pclient;
+  u8 *p;
+  int wasfull;
+  char c = 0;
+
+  ( void )arg;
+  while( 1 )
+  {
+    pthread_mutex_lock( &mcl_lock );
+    while( mcl_ready_head == NULL )
+      pthread_cond_wait( &mcl_cond, &mcl_lock );
+    pclient = mcl_ready_head;
+    if( ( mcl_ready_head = pclient->next ) == NULL )
+      mcl_ready_tail = NULL;
+    // Execute all the queued requests of this client
+    while( pclient->count > 0 )
+    {
+      p = pclient->queue[ pclient->head ];
+      pthread_mutex_unlock( &mcl_lock );
+      server_execute_client_request( &pclient->state, p );
+      mcl_take_response( pclient, resp, p );
+      // Free the slot before sending: a client that sends its next request
+      // as soon as it gets a response must find room for it in the queue
+      pthread_mutex_lock( &mcl_lock );
+      wasfull = pclient->count == MCL_QUEUE_LEN;
+      pclient->head = ( pclient->head + 1 ) % MCL_QUEUE_LEN;
+      pclient->count --;
+      pthread_mutex_unlock( &mcl_lock );
+      // The poll loop stops reading from a client whose queue is full
+      if( wasfull && write( mcl_wake_pipe[ 1 ], &c, 1 ) < 0 )
+        log_msg( "mclient: unable to wake up the poll loop\n" );
+      mcl_send( pclient, resp );
+      pthread_mutex_lock( &mcl_lock );
+    }
+    pclient->scheduled = 0;
+    if( pclient->pep->closing )
+      mcl_close_endpoint( pclient->pep );
+    pthread_mutex_unlock( &mcl_lock );
+  }
+  return NULL;
+}
+
+// ****************************************************************************
+// Public interface
+
+static MCL_ENDPOINT* mcl_add_endpoint( int type, int fd )
+{
+  MCL_ENDPOINT *pep;
+
+  if( mcl_num_endpoints == MCL_MAX_ENDPOINTS )
+  {
+    log_err( "Too many transports (maximum is %d)\n", MCL_MAX_ENDPOINTS );
+    return NULL;
+  }
+  pep = mcl_endpoints + mcl_num_endpoints ++;
+  pep->type = type;
+  pep->fd = fd;
+  fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK );
+  return pep;
+}
+
+int mcl_add_serial( ser_handler ser )
+{
+  MCL_ENDPOINT *pep;
+  unsigned i;
+
+  if( ( pep = mcl_add_endpoint( MCL_EP_SERIAL, ( int )ser ) ) == NULL )
+    return 0;
+  // Each serial port has a single client
+  for( i = 0; i < MCL_MAX_CLIENTS; i ++ )
+    if( mcl_clients[ i ] == NULL )
+      break;
+  if( i == MCL_MAX_CLIENTS || ( pep->pclient = mcl_new_client( pep ) ) == NULL )
+  {
+    log_err( "Too many clients\n" );
+    return 0;
+  }
+  mcl_clients[ i ] = pep->pclient;
+  return 1;
+}
+
+int mcl_add_udp( NET_SOCKET s )
+{
+  return mcl_add_endpoint( MCL_EP_UDP, net_socket( s ) ) != NULL;
+}
+
+void mcl_run()
+{
+  struct pollfd pfds[ MCL_MAX_ENDPOINTS + 1 ];
+  MCL_ENDPOINT *eps[ MCL_MAX_ENDPOINTS ];
+  pthread_t thread;
+  unsigned i, n;
+  char buf[ 16 ];
+
+  if( pipe( mcl_wake_pipe ) == -1 )
+  {
+    log_err( "Unable to create pipe\n" );
+    return;
+  }
+  fcntl( mcl_wake_pipe[ 0 ], F_SETFL, O_NONBLOCK );
+  for( i = 0; i < MCL_WORKERS; i ++ )
+    if( pthread_create( &thread, NULL, mcl_worker, NULL ) != 0 )
+    {
+      log_err( "Unable to create worker thread\n" );
+      return;
+    }
+  log_msg( "mclient: serving %u transport(s) with %d worker(s)\n", mcl_num_endpoints, MCL_WORKERS );
+  while( 1 )
+  {
+    pfds[ 0 ].fd = mcl_wake_pipe[ 0 ];
+    pfds[ 0 ].events = POLLIN;
+    for( i = 0, n = 1; i < mcl_num_endpoints; i ++ )
+    {
+      if( mcl_endpoints[ i ].fd == -1 || mcl_endpoints[ i ].closing )
+        continue;
+      // Leave the data in the serial port buffer while the client is busy
+      if( mcl_endpoints[ i ].type == MCL_EP_SERIAL && mcl_queue_full( mcl_endpoints[ i ].pclient ) )
+        continue;
+      eps[ n - 1 ] = mcl_endpoints + i;
+      pfds[ n ].fd = mcl_endpoints[ i ].fd;
+      pfds[ n ++ ].events = POLLIN;
+    }
+    if( poll( pfds, n, -1 ) <= 0 )
+      continue;
+    if( pfds[ 0 ].revents & POLLIN )
+      while( read( mcl_wake_pipe[ 0 ], buf, sizeof( buf ) ) > 0 );
+    for( i = 1; i < n; i ++ )
+    {
+      if( pfds[ i ].revents == 0 )
+        continue;
+      if( eps[ i - 1 ]->type == MCL_EP_SERIAL )
+        mcl_serial_input( eps[ i - 1 ] );
+      else
+        mcl_udp_input( eps[ i - 1 ] );
+    }
+  }
+}
@@ -0,0 +1,20 @@
+// Multi-client RFS server (POSIX only)
+
+#ifndef __MCLIENT_H__
+#define __MCLIENT_H__
+
+#include "type.h"
+#include "net.h"
+
+#define MCL_MAX_ENDPOINTS     16
+#define MCL_MAX_CLIENTS       64
+
+#ifndef MCL_WORKERS
+#define MCL_WORKERS           4
+#endif
+
+int mcl_add_serial( ser_handler ser );
+int mcl_add_udp( NET_SOCKET s );
+void mcl_run();
+
+#endif
@@ -2,6 +2,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -119,7 +120,11 @@ u32 os_opendir( const char* name )
 void os_readdir( u32 d, const char **pname )
 {
   struct dirent *ent;
+#ifdef ELUARPC_THREAD_SAFE
+  static __thread char realname[ RFS_MAX_FNAME_SIZE + 1 ];
+#else
   static char realname[ RFS_MAX_FNAME_SIZE + 1 ]; 
+#endif
 
   while( 1 )
   {
@@ -144,3 +149,26 @@ int os_closedir( u32 d )
   return closedir( ( DIR* )d );
 }
 
+
+s32 os_fsize( int fd )
+{
+  struct stat st;
+
+  if( fstat( fd, &st ) == -1 || !S_ISREG( st.st_mode ) )
+    return -1;
+  return ( s32 )st.st_size;
+}
+
+const void* os_map( int fd, u32 size )
+{
+  void *p;
+
+  if( size == 0 || ( p = mmap( NULL, ( size_t )size, PROT_READ, MAP_SHARED, fd, 0 ) ) == MAP_FAILED )
+    return NULL;
+  return p;
+}
+
+void os_unmap( const void *p, u32 size )
+{
+  munmap( ( void* )p, ( size_t )size );
+}
@@ -153,3 +153,18 @@ int os_closedir( u32 d )
 {
   return FindClose( win32_dir_hnd ) == 0 ? -1 : 0;
 }
+
+s32 os_fsize( int fd )
+{
+  return ( s32 )_filelength( fd );
+}
+
+// File mappings are not used in Win32, file data is always copied
+const void* os_map( int fd, u32 size )
+{
+  return NULL;
+}
+
+void os_unmap( const void *p, u32 size )
+{
+}
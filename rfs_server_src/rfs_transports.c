@@ -16,6 +16,9 @@
 #include "rfs.h"
 #include "deskutils.h"
 #include "rfs_transports.h"
+#ifdef RFS_MULTI_CLIENT
+#include "mclient.h"
+#endif
 
 // ****************************************************************************
 // Local variables
@@ -175,7 +178,7 @@ static int udp_server_init( unsigned server_port )
   if( ( trans_socket = net_create_socket( AF_INET, SOCK_DGRAM, 0 ) ) == INVALID_SOCKET_VALUE )
   {
     log_err( "Unable to create socket\n" );
-    return 1;
+    return 0;
   }
   length = sizeof( server );
   memset( &server, 0, sizeof( server ) );
@@ -343,6 +346,10 @@ static int parse_transport_and_init( const char* s )
     }
     tempi = ser_server_init( temps, tempi, flow );
     free( temps );    
+#ifdef RFS_MULTI_CLIENT
+    if( tempi )
+      tempi = mcl_add_serial( ser );
+#endif
     return tempi;
   }
   else if( strstr( s, "udp:" ) == s )
@@ -359,7 +366,12 @@ static int parse_transport_and_init( const char* s )
       log_err( "Unable to initialize network\n" );
       return 0;
     }
-    return udp_server_init( tempi );   
+    tempi = udp_server_init( tempi );
+#ifdef RFS_MULTI_CLIENT
+    if( tempi )
+      tempi = mcl_add_udp( trans_socket );
+#endif
+    return tempi;
   }
   else if( !strcmp( s, "mem" ) )
   {
@@ -371,6 +383,32 @@ static int parse_transport_and_init( const char* s )
   return 0;
 }
 
+#ifdef RFS_MULTI_CLIENT
+// Multiple transports separated by ';'
+static int parse_transports_and_init( const char *s )
+{
+  const char *c;
+  char *temps;
+  int res;
+
+  while( ( c = strchr( s, ';' ) ) != NULL )
+  {
+    temps = l_strndup( s, c - s );
+    res = parse_transport_and_init( temps );
+    free( temps );
+    if( res == 0 )
+      return 0;
+    if( p_transport_data == &mem_transport_data )
+    {
+      log_err( "The 'mem' transport can't be combined with other transports.\n" );
+      return 0;
+    }
+    s = c + 1;
+  }
+  return parse_transport_and_init( s );
+}
+#endif
+
 // *****************************************************************************
 // Entry point
 
@@ -388,6 +426,9 @@ int rfs_init( int argc, const char **argv )
     log_err( "Usage: %s <transport> <dirname> [-v]\n", argv[ 0 ] );
     log_err( "  Serial transport: 'ser:<sername>,<serspeed>,<flow> ('flow' defines the flow control and can be either 'none' or 'rtscts')\n" );
     log_err( "  UDP transport: 'udp:<port>'\n" );
+#ifdef RFS_MULTI_CLIENT
+    log_err( "  Multiple transports can be served at the same time, separate them with ';' (for example 'udp:8079;ser:/dev/ttyUSB0,115200,none')\n" );
+#endif
     log_err( "Use -v for verbose output.\n" );
     return 1;
   }
@@ -402,7 +443,11 @@ int rfs_init( int argc, const char **argv )
     log_err( "Invalid directory %s\n", argv[ DIRNAME_ARG_IDX ] );
     return 1;
   }  
+#ifdef RFS_MULTI_CLIENT
+  if( parse_transports_and_init( argv[ TRANSPORT_ARG_IDX ] ) == 0 )
+#else
   if( parse_transport_and_init( argv[ TRANSPORT_ARG_IDX ] ) == 0 )
+#endif
     return 1;
     
     // Setup RFS server
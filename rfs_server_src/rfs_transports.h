@@ -13,6 +13,12 @@ typedef struct
 
 #define   MAX_PACKET_SIZE     4096
 
+// The standalone POSIX server can serve several transports (and clients)
+// at the same time, see mclient.c
+#if defined( RFS_STANDALONE_MODE ) && !defined( WIN32_BUILD )
+#define RFS_MULTI_CLIENT
+#endif
+
 extern const RFS_TRANSPORT_DATA *p_transport_data; 
 extern const RFS_TRANSPORT_DATA mem_transport_data;
 extern const RFS_TRANSPORT_DATA udp_transport_data;
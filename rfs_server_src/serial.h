@@ -40,6 +40,7 @@ int ser_read_byte( ser_handler id, u32 timeout );
 u32 ser_write( ser_handler id, const u8 *src, u32 size );
 u32 ser_write_byte( ser_handler id, u8 data );
 int ser_select_byte( ser_handler *pobjects, unsigned nobjects, int timeout );
+u32 ser_select_read( ser_handler *pobjects, unsigned nobjects, int timeout, u8 *dest, u32 maxsize, unsigned *pidx );
 
 #endif
 
@@ -8,6 +8,7 @@
 #include <errno.h>
 #include <termios.h>
 #include <sys/select.h>
+#include <poll.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
@@ -176,13 +177,31 @@ int ser_read_byte( ser_handler id, u32 timeout )
 }
 
 // Write up to the specified number of bytes, return bytes actually written
+// The port is in non-blocking mode, so wait (up to SER_WRITE_TIMEOUT_MS) for
+// room in the output buffer instead of dropping the data that doesn't fit
+#define SER_WRITE_TIMEOUT_MS    1000
 u32 ser_write( ser_handler id, const u8 *src, u32 size )
 {
-  u32 res;
-  
-  res = ( u32 )write( ( int )id, src, size );
+  struct pollfd pfd;
+  u32 written = 0;
+  int res;
+
+  while( written < size )
+  {
+    if( ( res = write( ( int )id, src + written, size - written ) ) > 0 )
+      written += ( u32 )res;
+    else if( res == -1 && ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) )
+    {
+      pfd.fd = ( int )id;
+      pfd.events = POLLOUT;
+      if( poll( &pfd, 1, SER_WRITE_TIMEOUT_MS ) <= 0 )
+        break;
+    }
+    else
+      break;
+  }
   tcdrain( ( int )id );
-  return res;
+  return written;
 }
 
 // Write a byte to the serial port
@@ -228,3 +247,39 @@ int ser_select_byte( ser_handler *pobjects, unsigned nobjects, int timeout )
   return res;
 }
 
+// Wait until one of the specified handler(s) has data, then read up to
+// 'maxsize' bytes from it without blocking. Returns the number of bytes read
+// (with the index of the object in *pidx) or 0 on timeout or error. Ready
+// objects are served in round robin order, so a busy port can't starve the
+// others.
+#define SER_MAX_SELECT_OBJECTS  64
+u32 ser_select_read( ser_handler *pobjects, unsigned nobjects, int timeout, u8 *dest, u32 maxsize, unsigned *pidx )
+{
+  static unsigned next;
+  struct pollfd fds[ SER_MAX_SELECT_OBJECTS ];
+  unsigned i, idx;
+  int res;
+
+  if( nobjects == 0 || nobjects > SER_MAX_SELECT_OBJECTS )
+    return 0;
+  for( i = 0; i < nobjects; i ++ )
+  {
+    fds[ i ].fd = ( int )pobjects[ i ];
+    fds[ i ].events = POLLIN;
+    fds[ i ].revents = 0;
+  }
+  if( poll( fds, nobjects, timeout == SER_INF_TIMEOUT ? -1 : timeout ) <= 0 )
+    return 0;
+  for( i = 0; i < nobjects; i ++ )
+  {
+    idx = ( next + i ) % nobjects;
+    if( fds[ idx ].revents == 0 )
+      continue;
+    if( ( res = read( fds[ idx ].fd, dest, maxsize ) ) <= 0 )
+      return 0;
+    next = idx + 1;
+    *pidx = idx;
+    return ( u32 )res;
+  }
+  return 0;
+}
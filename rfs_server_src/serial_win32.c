@@ -285,3 +285,17 @@ int ser_select_byte( ser_handler *pobjects, unsigned nobjects, int timeout )
   return res;
 }
 
+// Wait until one of the specified handler(s) has data and read it. Returns
+// the number of bytes read (with the index of the object in *pidx) or 0 on
+// timeout or error. This is built on ser_select_byte, so it reads a single
+// byte at a time.
+u32 ser_select_read( ser_handler *pobjects, unsigned nobjects, int timeout, u8 *dest, u32 maxsize, unsigned *pidx )
+{
+  int c;
+
+  if( maxsize == 0 || ( c = ser_select_byte( pobjects, nobjects, timeout ) ) == -1 )
+    return 0;
+  *dest = ( u8 )c;
+  *pidx = c >> 8;
+  return 1;
+}
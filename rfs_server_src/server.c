@@ -8,20 +8,137 @@
 #include "type.h"
 #include "os_io.h"
 #include "log.h"
+#include "rfs_transports.h"
+
+// Largest read that fits in a response packet with the data at 'offset'
+#define SERVER_MAX_READ( offset )   ( MAX_PACKET_SIZE - ( offset ) - ELUARPC_END_SIZE )
 
 static char* server_basedir;
-static char server_fullname[ PLATFORM_MAX_FNAME_LEN + 1 ];
+static SERVER_CLIENT server_default_client;
+
+typedef int ( *p_server_handler )( SERVER_CLIENT *pclient, u8 *p );
+
+// *****************************************************************************
+// Internal helpers: per client handle tables
+// A client can only use the files and directories that it opened itself, and
+// everything it left open is released with the client.
+
+static int server_add_fd( SERVER_CLIENT *pclient, int fd )
+{
+  unsigned i;
+
+  for( i = 0; i < SERVER_MAX_FILES; i ++ )
+    if( pclient->fds[ i ] == -1 )
+    {
+      pclient->fds[ i ] = fd;
+      return 1;
+    }
+  return 0;
+}
+
+static int server_find_fd( SERVER_CLIENT *pclient, int fd )
+{
+  unsigned i;
+
+  if( fd != -1 )
+    for( i = 0; i < SERVER_MAX_FILES; i ++ )
+      if( pclient->fds[ i ] == fd )
+        return i;
+  return -1;
+}
+
+static int server_add_dir( SERVER_CLIENT *pclient, u32 d )
+{
+  unsigned i;
+
+  for( i = 0; i < SERVER_MAX_DIRS; i ++ )
+    if( pclient->dirs[ i ] == 0 )
+    {
+      pclient->dirs[ i ] = d;
+      return 1;
+    }
+  return 0;
+}
+
+static int server_find_dir( SERVER_CLIENT *pclient, u32 d )
+{
+  unsigned i;
+
+  if( d != 0 )
+    for( i = 0; i < SERVER_MAX_DIRS; i ++ )
+      if( pclient->dirs[ i ] == d )
+        return i;
+  return -1;
+}
+
+static void server_unmap( SERVER_CLIENT *pclient, int idx )
+{
+  if( pclient->maps[ idx ] )
+  {
+    os_unmap( pclient->maps[ idx ], pclient->mapsizes[ idx ] );
+    pclient->maps[ idx ] = NULL;
+    pclient->mapsizes[ idx ] = 0;
+  }
+}
+
+// Zero-copy read: skip 'count' bytes of the file and point the response data
+// to them in a read only mapping of the file, so they are sent by the
+// transport straight from the page cache. Returns 0 if the data must be read
+// into the packet instead.
+static int server_read_mapped( SERVER_CLIENT *pclient, int idx, u32 offset, u32 *pcount )
+{
+  int fd = pclient->fds[ idx ];
+  s32 size, pos;
+  u32 count = *pcount;
+
+  if( !pclient->zerocopy || ( size = os_fsize( fd ) ) <= 0 )
+    return 0;
+  if( ( u32 )size != pclient->mapsizes[ idx ] )
+  {
+    // The file changed size since it was mapped
+    server_unmap( pclient, idx );
+    if( ( pclient->maps[ idx ] = ( const u8* )os_map( fd, ( u32 )size ) ) == NULL )
+      return 0;
+    pclient->mapsizes[ idx ] = ( u32 )size;
+  }
+  if( ( pos = os_lseek( fd, 0, RFS_LSEEK_CUR ) ) < 0 )
+    return 0;
+  if( pos >= size )
+    count = 0;
+  else if( count > ( u32 )( size - pos ) )
+    count = ( u32 )( size - pos );
+  if( count > 0 && os_lseek( fd, pos + ( s32 )count, RFS_LSEEK_SET ) < 0 )
+    return 0;
+  pclient->zdata = pclient->maps[ idx ] + pos;
+  pclient->zoffset = offset;
+  pclient->zlen = count;
+  *pcount = count;
+  return 1;
+}
 
-typedef int ( *p_server_handler )( u8 *p );
+// Build the full name of a file in the shared directory
+static void server_get_fullname( char *fullname, const char *name )
+{
+  char separator[ 2 ] = { PLATFORM_PATH_SEPARATOR, 0 };
+
+  fullname[ 0 ] = fullname[ PLATFORM_MAX_FNAME_LEN ] = 0;
+  strncpy( fullname, server_basedir, PLATFORM_MAX_FNAME_LEN );
+  if( name && strlen( name ) > 0 )
+  {
+    if( fullname[ strlen( fullname ) - 1 ] != PLATFORM_PATH_SEPARATOR )
+      strncat( fullname, separator, PLATFORM_MAX_FNAME_LEN - strlen( fullname ) );
+    strncat( fullname, name, PLATFORM_MAX_FNAME_LEN - strlen( fullname ) );
+  }
+}
 
 // *****************************************************************************
 // Internal helpers: execute the given request, build the response
 
-static int server_open( u8 *p )
+static int server_open( SERVER_CLIENT *pclient, u8 *p )
 {
   const char *filename;
   int mode, flags, fd;
-  char separator[ 2 ] = { PLATFORM_PATH_SEPARATOR, 0 };
+  char fullname[ PLATFORM_MAX_FNAME_LEN + 1 ];
   
   // Validate request
   log_msg( "server_open: request handler starting\n" );
@@ -31,22 +148,21 @@ static int server_open( u8 *p )
     return SERVER_ERR;
   }
   // Get real filename
-  server_fullname[ 0 ] = server_fullname[ PLATFORM_MAX_FNAME_LEN ] = 0;
-  strncpy( server_fullname, server_basedir, PLATFORM_MAX_FNAME_LEN );
-  if( filename && strlen( filename ) > 0 )
+  server_get_fullname( fullname, filename );
+  log_msg( "server_open: full file path is %s\n", fullname ); 
+  fd = os_open( fullname, flags, mode );
+  log_msg( "server_open: OS file handler is %d\n", fd );
+  if( fd != -1 && !server_add_fd( pclient, fd ) )
   {
-    if( server_fullname[ strlen( server_fullname ) - 1 ] != PLATFORM_PATH_SEPARATOR )
-      strncat( server_fullname, separator, PLATFORM_MAX_FNAME_LEN );
-    strncat( server_fullname, filename, PLATFORM_MAX_FNAME_LEN );
+    log_msg( "server_open: too many open files\n" );
+    os_close( fd );
+    fd = -1;
   }
-  log_msg( "server_open: full file path is %s\n", server_fullname ); 
-  fd = os_open( server_fullname, flags, mode );
-  log_msg( "server_open: OS file handler is %d\n", fd );
   remotefs_open_write_response( p, fd );
   return SERVER_OK;
 }
 
-static int server_write( u8 *p )
+static int server_write( SERVER_CLIENT *pclient, u8 *p )
 {
   int fd;
   const void *buf;
@@ -59,15 +175,15 @@ static int server_write( u8 *p )
     return SERVER_ERR;
   }
   log_msg( "server_write: fd = %d, buf = %p, count = %u\n", fd, buf, ( unsigned )count );
-  count = ( u32 )os_write( fd, buf, count );
+  count = server_find_fd( pclient, fd ) == -1 ? ( u32 )-1 : ( u32 )os_write( fd, buf, count );
   log_msg( "server_write: OS response is %u\n", ( unsigned )count );
   remotefs_write_write_response( p, count );
   return SERVER_OK;
 }
 
-static int server_read( u8 *p )
+static int server_read( SERVER_CLIENT *pclient, u8 *p )
 {
-  int fd;
+  int fd, idx;
   u32 count;
   
   log_msg( "server_read: request handler starting\n" );
@@ -77,15 +193,20 @@ static int server_read( u8 *p )
     return SERVER_ERR;
   }
   log_msg( "server_read: fd = %d, count = %u\n", fd, ( unsigned )count );
-  count = ( u32 )os_read( fd, p + ELUARPC_READ_BUF_OFFSET, count );
+  if( count > SERVER_MAX_READ( ELUARPC_READ_BUF_OFFSET ) )
+    count = SERVER_MAX_READ( ELUARPC_READ_BUF_OFFSET );
+  if( ( idx = server_find_fd( pclient, fd ) ) == -1 )
+    count = 0;
+  else if( !server_read_mapped( pclient, idx, ELUARPC_READ_BUF_OFFSET, &count ) )
+    count = ( u32 )os_read( fd, p + ELUARPC_READ_BUF_OFFSET, count );
   log_msg( "server_read: OS response is %u\n", ( unsigned )count );
   remotefs_read_write_response( p, count );
   return SERVER_OK;
 }
 
-static int server_close( u8 *p )
+static int server_close( SERVER_CLIENT *pclient, u8 *p )
 {
-  int fd;
+  int fd, idx;
   
   log_msg( "server_close: request handler starting\n" );
   if( remotefs_close_read_request( p, &fd ) == ELUARPC_ERR )
@@ -94,13 +215,20 @@ static int server_close( u8 *p )
     return SERVER_ERR;
   }
   log_msg( "server_close: fd = %d\n", fd );
-  fd = os_close( fd );
+  if( ( idx = server_find_fd( pclient, fd ) ) == -1 )
+    fd = -1;
+  else
+  {
+    server_unmap( pclient, idx );
+    pclient->fds[ idx ] = -1;
+    fd = os_close( fd );
+  }
   log_msg( "server_close: OS response is %d\n", fd );
   remotefs_close_write_response( p, fd );
   return SERVER_OK;
 }
 
-static int server_lseek( u8 *p )
+static int server_lseek( SERVER_CLIENT *pclient, u8 *p )
 {
   int fd, whence;
   s32 offset;
@@ -112,17 +240,17 @@ static int server_lseek( u8 *p )
     return SERVER_ERR;
   }
   log_msg( "server_lseek: fd = %d, offset = %d, whence = %d\n", fd, ( int )offset, whence );
-  offset = os_lseek( fd, offset, whence );
+  offset = server_find_fd( pclient, fd ) == -1 ? -1 : os_lseek( fd, offset, whence );
   log_msg( "server_lseek: OS response is %d\n", ( int )offset );
   remotefs_lseek_write_response( p, offset );
   return SERVER_OK;
 }
 
-static int server_opendir( u8 *p )
+static int server_opendir( SERVER_CLIENT *pclient, u8 *p )
 {
   const char* name;
   u32 d;
-  char separator[ 2 ] = { PLATFORM_PATH_SEPARATOR, 0 };
+  char fullname[ PLATFORM_MAX_FNAME_LEN + 1 ];
 
   log_msg( "server_opendir: request handler starting\n" );
   if( remotefs_opendir_read_request( p, &name ) == ELUARPC_ERR )
@@ -131,27 +259,26 @@ static int server_opendir( u8 *p )
     return SERVER_ERR;
   }
   // Get real filename
-  server_fullname[ 0 ] = server_fullname[ PLATFORM_MAX_FNAME_LEN ] = 0;
-  strncpy( server_fullname, server_basedir, PLATFORM_MAX_FNAME_LEN );
-  if( name && strlen( name ) > 0 )
+  server_get_fullname( fullname, name );
+  log_msg( "server_opendir: full dirname is %s\n", fullname );
+  d = os_opendir( fullname );
+  log_msg( "server_opendir: OS response is %08X\n", d );
+  if( d != 0 && !server_add_dir( pclient, d ) )
   {
-    if( server_fullname[ strlen( server_fullname ) - 1 ] != PLATFORM_PATH_SEPARATOR )
-      strncat( server_fullname, separator, PLATFORM_MAX_FNAME_LEN );
-    strncat( server_fullname, name, PLATFORM_MAX_FNAME_LEN );
+    log_msg( "server_opendir: too many open directories\n" );
+    os_closedir( d );
+    d = 0;
   }
-  log_msg( "server_opendir: full dirname is %s\n", server_fullname );
-  d = os_opendir( server_fullname );
-  log_msg( "server_opendir: OS response is %08X\n", d );
   remotefs_opendir_write_response( p, d );
   return SERVER_OK;
 }
 
-static int server_readdir( u8 *p )
+static int server_readdir( SERVER_CLIENT *pclient, u8 *p )
 {
-  const char* name;
+  const char* name = NULL;
   u32 fsize = 0, d;
   int fd;
-  char separator[ 2 ] = { PLATFORM_PATH_SEPARATOR, 0 };
+  char fullname[ PLATFORM_MAX_FNAME_LEN + 1 ];
 
   log_msg( "server_readdir: request handler starting\n" );
   if( remotefs_readdir_read_request( p, &d ) == ELUARPC_ERR )
@@ -160,20 +287,14 @@ static int server_readdir( u8 *p )
     return SERVER_ERR;
   }
   log_msg( "server_readdir: DIR = %08X\n", d );
-  os_readdir( d, &name );
+  if( server_find_dir( pclient, d ) != -1 )
+    os_readdir( d, &name );
   if( name )
   {
     // Need to compute size now
     // Get real filename
-    server_fullname[ 0 ] = server_fullname[ PLATFORM_MAX_FNAME_LEN ] = 0;
-    strncpy( server_fullname, server_basedir, PLATFORM_MAX_FNAME_LEN );
-    if( name && strlen( name ) > 0 )
-    {
-      if( server_fullname[ strlen( server_fullname ) - 1 ] != PLATFORM_PATH_SEPARATOR )
-        strncat( server_fullname, separator, PLATFORM_MAX_FNAME_LEN );
-      strncat( server_fullname, name, PLATFORM_MAX_FNAME_LEN );
-    }
-    fd = os_open( server_fullname, RFS_OPEN_FLAG_RDONLY, 0 );
+    server_get_fullname( fullname, name );
+    fd = os_open( fullname, RFS_OPEN_FLAG_RDONLY, 0 );
     if( fd )
     {
       fsize = os_lseek( fd, 0, RFS_LSEEK_END );
@@ -181,7 +302,7 @@ static int server_readdir( u8 *p )
     }
     else
     {
-      log_msg( "server_readdir: unable to open file %s\n", server_fullname );
+      log_msg( "server_readdir: unable to open file %s\n", fullname );
       name = NULL;
     }
   }
@@ -190,10 +311,10 @@ static int server_readdir( u8 *p )
   return SERVER_OK;
 }
 
-static int server_closedir( u8 *p )
+static int server_closedir( SERVER_CLIENT *pclient, u8 *p )
 {
   u32 d;
-  int res;
+  int res, idx;
 
   log_msg( "server_closedir: request handler starting\n" );
   if( remotefs_closedir_read_request( p, &d ) == ELUARPC_ERR )
@@ -202,42 +323,169 @@ static int server_closedir( u8 *p )
     return SERVER_ERR;
   }
   log_msg( "server_closedir: DIR = %08X\n", d );
-  res = os_closedir( d );
+  if( ( idx = server_find_dir( pclient, d ) ) == -1 )
+    res = -1;
+  else
+  {
+    pclient->dirs[ idx ] = 0;
+    res = os_closedir( d );
+  }
   log_msg( "server_closedir: OS response is %d\n", res );
   remotefs_closedir_write_response( p, d );
   return SERVER_OK;
 }
 
+static int server_window( SERVER_CLIENT *pclient, u8 *p )
+{
+  u32 window;
+
+  log_msg( "server_window: request handler starting\n" );
+  if( remotefs_window_read_request( p, &window ) == ELUARPC_ERR )
+  {
+    log_msg( "server_window: unable to read request\n" );
+    return SERVER_ERR;
+  }
+  // Requests are executed in the order they are received, so the server only
+  // needs to limit the window to what the transport can safely queue
+  if( window > RFS_MAX_WINDOW )
+    window = RFS_MAX_WINDOW;
+  else if( window == 0 )
+    window = 1;
+  log_msg( "server_window: window is %u\n", ( unsigned )window );
+  remotefs_window_write_response( p, window );
+  return SERVER_OK;
+}
+
+static int server_readseq( SERVER_CLIENT *pclient, u8 *p )
+{
+  int fd, idx;
+  u32 count, seq;
+
+  log_msg( "server_readseq: request handler starting\n" );
+  if( remotefs_readseq_read_request( p, &fd, &count, &seq ) == ELUARPC_ERR )
+  {
+    log_msg( "server_readseq: unable to read request\n" );
+    return SERVER_ERR;
+  }
+  log_msg( "server_readseq: fd = %d, count = %u, seq = %u\n", fd, ( unsigned )count, ( unsigned )seq );
+  if( count > SERVER_MAX_READ( RFS_READSEQ_BUF_OFFSET ) )
+    count = SERVER_MAX_READ( RFS_READSEQ_BUF_OFFSET );
+  if( ( idx = server_find_fd( pclient, fd ) ) == -1 )
+    count = 0;
+  else if( !server_read_mapped( pclient, idx, RFS_READSEQ_BUF_OFFSET, &count ) )
+    count = ( u32 )os_read( fd, p + RFS_READSEQ_BUF_OFFSET, count );
+  log_msg( "server_readseq: OS response is %u\n", ( unsigned )count );
+  remotefs_readseq_write_response( p, seq, count );
+  return SERVER_OK;
+}
+
+static int server_writeseq( SERVER_CLIENT *pclient, u8 *p )
+{
+  int fd;
+  const void *buf;
+  u32 count, seq;
+
+  log_msg( "server_writeseq: request handler starting\n" );
+  if( remotefs_writeseq_read_request( p, &fd, &buf, &count, &seq ) == ELUARPC_ERR )
+  {
+    log_msg( "server_writeseq: unable to read request\n" );
+    return SERVER_ERR;
+  }
+  log_msg( "server_writeseq: fd = %d, buf = %p, count = %u, seq = %u\n", fd, buf, ( unsigned )count, ( unsigned )seq );
+  count = server_find_fd( pclient, fd ) == -1 ? ( u32 )-1 : ( u32 )os_write( fd, buf, count );
+  log_msg( "server_writeseq: OS response is %u\n", ( unsigned )count );
+  remotefs_writeseq_write_response( p, seq, count );
+  return SERVER_OK;
+}
+
 // *****************************************************************************
 // Server public interface
 
 static const p_server_handler server_handlers[] = 
 { 
-  server_open, server_write, server_read, server_close, server_lseek, server_opendir, server_readdir, server_closedir
+  server_open, server_write, server_read, server_close, server_lseek, server_opendir, server_readdir, server_closedir,
+  server_window, server_readseq, server_writeseq
 };
 
 void server_setup( const char* basedir )
 {
   server_basedir = strdup( basedir );
+  server_client_init( &server_default_client );
 }
 
 void server_cleanup()
 {
+  server_client_release( &server_default_client );
   free( server_basedir );
   server_basedir = NULL;
 }
-int server_execute_request( u8 *pdata )
+
+void server_client_init( SERVER_CLIENT *pclient )
+{
+  unsigned i;
+
+  for( i = 0; i < SERVER_MAX_FILES; i ++ )
+  {
+    pclient->fds[ i ] = -1;
+    pclient->maps[ i ] = NULL;
+    pclient->mapsizes[ i ] = 0;
+  }
+  for( i = 0; i < SERVER_MAX_DIRS; i ++ )
+    pclient->dirs[ i ] = 0;
+  pclient->zerocopy = 0;
+  pclient->zdata = NULL;
+}
+
+// Close everything that the client left open
+void server_client_release( SERVER_CLIENT *pclient )
+{
+  unsigned i;
+
+  for( i = 0; i < SERVER_MAX_FILES; i ++ )
+    if( pclient->fds[ i ] != -1 )
+    {
+      server_unmap( pclient, i );
+      os_close( pclient->fds[ i ] );
+      pclient->fds[ i ] = -1;
+    }
+  for( i = 0; i < SERVER_MAX_DIRS; i ++ )
+    if( pclient->dirs[ i ] != 0 )
+    {
+      os_closedir( pclient->dirs[ i ] );
+      pclient->dirs[ i ] = 0;
+    }
+}
+
+// Returns 1 if the client still has open files or directories
+int server_client_has_handles( SERVER_CLIENT *pclient )
+{
+  unsigned i;
+
+  for( i = 0; i < SERVER_MAX_FILES; i ++ )
+    if( pclient->fds[ i ] != -1 )
+      return 1;
+  for( i = 0; i < SERVER_MAX_DIRS; i ++ )
+    if( pclient->dirs[ i ] != 0 )
+      return 1;
+  return 0;
+}
+
+int server_execute_client_request( SERVER_CLIENT *pclient, u8 *pdata )
 {
   u8 req;
   
   // Decode request
+  pclient->zdata = NULL;
   if( eluarpc_get_request_id( pdata, &req ) == ELUARPC_ERR )
     return SERVER_ERR;
   log_msg( "server_execute_request: got request with ID %d\n", req );
   if( req >= RFS_OP_FIRST && req <= RFS_OP_LAST ) 
-    return server_handlers[ req - RFS_OP_FIRST ]( pdata );
+    return server_handlers[ req - RFS_OP_FIRST ]( pclient, pdata );
   else
     return SERVER_ERR;
-
 }
 
+int server_execute_request( u8 *pdata )
+{
+  return server_execute_client_request( &server_default_client, pdata );
+}
@@ -9,9 +9,35 @@
 #define SERVER_OK     0
 #define SERVER_ERR    1
 
+// Maximum number of files and directories open by a single client
+#define SERVER_MAX_FILES    32
+#define SERVER_MAX_DIRS     8
+
+// Per client state
+typedef struct
+{
+  int fds[ SERVER_MAX_FILES ];
+  u32 dirs[ SERVER_MAX_DIRS ];
+  // Read only file mappings, used for zero-copy read responses
+  const u8 *maps[ SERVER_MAX_FILES ];
+  u32 mapsizes[ SERVER_MAX_FILES ];
+  // Set by the transport if it can send the response data from 'zdata'.
+  // In this case the response packet has a 'zlen' bytes gap at 'zoffset'
+  // that must be replaced with 'zdata' when sending it.
+  int zerocopy;
+  const u8 *zdata;
+  u32 zoffset, zlen;
+} SERVER_CLIENT;
+
 // Server function                     
 void server_setup( const char *basedir );
 void server_cleanup();
 int server_execute_request( u8 *pdata );
 
+// Multiple clients
+void server_client_init( SERVER_CLIENT *pclient );
+void server_client_release( SERVER_CLIENT *pclient );
+int server_client_has_handles( SERVER_CLIENT *pclient );
+int server_execute_client_request( SERVER_CLIENT *pclient, u8 *pdata );
+
 #endif
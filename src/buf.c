@@ -45,17 +45,29 @@ static const buf_desc* buf_desc_array[ BUF_ID_TOTAL ] =
 };
 
 // Helper macros
-#define BUF_MOD_INCR( p, m ) p->m = ( p->m + ( ( u16 )1 << p->logdsize ) ) & ( ( ( u16 )1 << p->logsize ) - 1 )
 #define BUF_REALSIZE( p ) ( ( u16 )1 << ( p->logsize - p->logdsize ) )
 #define BUF_BYTESIZE( p ) ( ( u16 )1 << p->logsize )
-#define BUF_REALDSIZE( p ) ( ( u16 )1 << p->logdsize )
 #define BUF_GETPTR( resid, resnum ) buf_desc *pbuf = ( buf_desc* )buf_desc_array[ resid ] + resnum
+// Byte offset in the buffer of the element with the given (free running) index
+#define BUF_OFFSET( p, idx ) ( ( ( idx ) & ( BUF_REALSIZE( p ) - 1 ) ) << p->logdsize )
 
 // READ16 and WRITE16 macros are here to ensure _atomic_ reads and writes of 
 // 16-bits data. Might have to be changed for an 8-bit architecture.
 #define READ16( p )     p
 #define WRITE16( p, x ) p = x
 
+// The buffers are single producer/single consumer rings: only the producer
+// (usually an interrupt handler) changes 'wptr' and only the consumer changes
+// 'rptr', so they don't need to disable interrupts. The data must be in the
+// buffer before the other side can see the new index (and must be read before
+// its space is given back), so the compiler can't move memory accesses across
+// the index updates.
+#ifdef __GNUC__
+#define BUF_BARRIER()   __asm__ __volatile__( "" ::: "memory" )
+#else
+#define BUF_BARRIER()
+#endif
+
 // Helper: check 'resnum' (for virtual UARTs)
 // UART resource ID translation to buffer ID translation (for serial multiplexer support)
 #ifdef BUILD_SERMUX
@@ -89,7 +101,7 @@ int buf_set( unsigned resid, unsigned resnum, u8 logsize, u8 logdsize )
   if( ( pbuf->buf = ( t_buf_data* )realloc( pbuf->buf, BUF_BYTESIZE( pbuf ) ) ) == NULL )
   {
     pbuf->logsize = BUF_SIZE_NONE;
-    pbuf->rptr = pbuf->wptr = pbuf->count = 0;
+    pbuf->rptr = pbuf->wptr = 0;
     if( logsize != BUF_SIZE_NONE )
       return PLATFORM_ERR;
   }
@@ -103,7 +115,85 @@ void buf_flush( unsigned resid, unsigned resnum )
   BUF_CHECK_RESNUM( resid, resnum );
   BUF_GETPTR( resid, resnum );
   
-  pbuf->rptr = pbuf->wptr = pbuf->count = 0;
+  // Only the consumer can do this, so just skip over the data in the buffer
+  BUF_BARRIER();
+  WRITE16( pbuf->rptr, READ16( pbuf->wptr ) );
+}
+
+// Copy 'n' elements between 'data' and the ring starting at element 'idx'
+// (taking care of the wrap around)
+static void bufh_copy( buf_desc *pbuf, u16 idx, t_buf_data *data, unsigned n, int towrite )
+{
+  unsigned offset = BUF_OFFSET( pbuf, idx );
+  unsigned first = BUF_BYTESIZE( pbuf ) - offset;
+  unsigned total = n << pbuf->logdsize;
+
+  if( first > total )
+    first = total;
+  if( towrite )
+  {
+    memcpy( pbuf->buf + offset, data, first );
+    memcpy( pbuf->buf, data + first, total - first );
+  }
+  else
+  {
+    memcpy( data, pbuf->buf + offset, first );
+    memcpy( data + first, pbuf->buf, total - first );
+  }
+}
+
+// Write up to 'n' elements to buffer
+// resid - resource ID (BUF_ID_UART ...)
+// resnum - resource number (0, 1, 2...)
+// data - pointer for where data will come from
+// n - number of elements to write
+// Returns the number of elements actually written (less than 'n' if the
+//   buffer is full or disabled)
+unsigned buf_write_n( unsigned resid, unsigned resnum, const t_buf_data *data, unsigned n )
+{
+  BUF_CHECK_RESNUM( resid, resnum );
+  BUF_GETPTR( resid, resnum );
+  u16 wptr = READ16( pbuf->wptr );
+  unsigned space;
+
+  if( pbuf->logsize == BUF_SIZE_NONE )
+    return 0;
+  space = BUF_REALSIZE( pbuf ) - ( u16 )( wptr - READ16( pbuf->rptr ) );
+  if( n > space )
+    n = space;
+  if( n == 0 )
+    return 0;
+  bufh_copy( pbuf, wptr, ( t_buf_data* )data, n, 1 );
+  BUF_BARRIER();
+  WRITE16( pbuf->wptr, wptr + n );
+  return n;
+}
+
+// Read up to 'n' elements from buffer
+// resid - resource ID (BUF_ID_UART ...)
+// resnum - resource number (0, 1, 2...)
+// data - pointer for where data should go
+// n - maximum number of elements to read
+// Returns the number of elements actually read (0 if the buffer is empty)
+unsigned buf_read_n( unsigned resid, unsigned resnum, t_buf_data *data, unsigned n )
+{
+  BUF_CHECK_RESNUM( resid, resnum );
+  BUF_GETPTR( resid, resnum );
+  u16 rptr = READ16( pbuf->rptr );
+  unsigned count;
+
+  if( pbuf->logsize == BUF_SIZE_NONE )
+    return 0;
+  count = ( u16 )( READ16( pbuf->wptr ) - rptr );
+  if( n > count )
+    n = count;
+  if( n == 0 )
+    return 0;
+  BUF_BARRIER();
+  bufh_copy( pbuf, rptr, data, n, 0 );
+  BUF_BARRIER();
+  WRITE16( pbuf->rptr, rptr + n );
+  return n;
 }
 
 // Write to buffer
@@ -114,23 +204,13 @@ void buf_flush( unsigned resid, unsigned resnum )
 // [TODO] maybe add a buffer overflow flag
 int buf_write( unsigned resid, unsigned resnum, t_buf_data *data )
 {
-  BUF_CHECK_RESNUM( resid, resnum );
-  BUF_GETPTR( resid, resnum );
-  const char* s = ( const char* )data;
-  char* d = ( char* )( pbuf->buf + pbuf->wptr );
-  
-  if( pbuf->logsize == BUF_SIZE_NONE )
-    return PLATFORM_ERR;    
-  if( pbuf->count > BUF_REALSIZE( pbuf ) )
+  if( !buf_is_enabled( resid, resnum ) )
+    return PLATFORM_ERR;
+  if( buf_write_n( resid, resnum, data, 1 ) == 0 )
   {
     fprintf( stderr, "[ERROR] Buffer overflow on resid=%d, resnum=%d!\n", resid, resnum );
     return PLATFORM_ERR; 
   }
-  DUFF_DEVICE_8( BUF_REALDSIZE( pbuf ),  *d++ = *s++ );
-  
-  BUF_MOD_INCR( pbuf, wptr );
-    pbuf->count ++;
-    
   return PLATFORM_OK;
 }
 
@@ -160,7 +240,7 @@ unsigned buf_get_count( unsigned resid, unsigned resnum )
   BUF_CHECK_RESNUM( resid, resnum );
   BUF_GETPTR( resid, resnum );
   
-  return READ16( pbuf->count );  
+  return ( u16 )( READ16( pbuf->wptr ) - READ16( pbuf->rptr ) );
 }
 
 // Get data from buffer of size dsize
@@ -172,24 +252,7 @@ unsigned buf_get_count( unsigned resid, unsigned resnum )
 //   PLATFORM_UNDERFLOW on buffer empty
 int buf_read( unsigned resid, unsigned resnum, t_buf_data *data )
 {
-  BUF_CHECK_RESNUM( resid, resnum );
-  BUF_GETPTR( resid, resnum );
-
-  int old_status;
-  const char* s = ( const char* )( pbuf->buf + pbuf->rptr );
-  char* d = ( char* )data;
-  
-  if( pbuf->logsize == BUF_SIZE_NONE || READ16( pbuf->count ) == 0 )
-    return PLATFORM_UNDERFLOW;
- 
-  DUFF_DEVICE_8( BUF_REALDSIZE( pbuf ),  *d++ = *s++ );
-
-  old_status = platform_cpu_set_global_interrupts( PLATFORM_CPU_DISABLE );
-  pbuf->count --;
-  platform_cpu_set_global_interrupts( old_status );
-  BUF_MOD_INCR( pbuf, rptr );
-  
-  return PLATFORM_OK;
+  return buf_read_n( resid, resnum, data, 1 ) ? PLATFORM_OK : PLATFORM_UNDERFLOW;
 }
 
 #endif // #ifdef BUF_ENABLE
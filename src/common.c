@@ -15,6 +15,7 @@
 #include "term.h"
 #include "xmodem.h"
 #include "elua_int.h"
+#include "elua_int_cfg.h"
 #include "sermux.h"
 
 #if defined ALCOR_LANG_TINYSCHEME
@@ -35,9 +36,7 @@
 # include "lauxlib.h"
 #endif
 
-// [TODO] the new builder should automatically do this
-#if defined( BUILD_LUA_INT_HANDLERS ) || defined( BUILD_C_INT_HANDLERS )
-#define BUILD_INT_HANDLERS
+#ifdef BUILD_INT_HANDLERS
 
 #ifndef INT_TMR_MATCH
 #define INT_TMR_MATCH         ELUA_INT_INVALID_INTERRUPT
@@ -45,7 +44,7 @@
 
 extern const elua_int_descriptor elua_int_table[ INT_ELUA_LAST ];
 
-#endif // #if defined( BUILD_LUA_INT_HANDLERS ) || defined( BUILD_C_INT_HANDLERS )
+#endif // #ifdef BUILD_INT_HANDLERS
 
 // [TODO] the new builder should automatically do this
 #ifndef VTMR_NUM_TIMERS
@@ -514,6 +513,11 @@ u32 platform_flash_get_sector_of_address( u32 addr )
   return flashh_find_sector( addr, NULL, NULL );
 }
 
+u32 platform_flash_get_sector_bounds( u32 addr, u32 *pstart, u32 *pend )
+{
+  return flashh_find_sector( addr, pstart, pend );
+}
+
 u32 platform_flash_get_num_sectors()
 {
 #ifdef INTERNAL_FLASH_SECTOR_SIZE
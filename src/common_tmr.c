@@ -6,17 +6,15 @@
 #include "type.h"
 #include "common.h"
 #include "elua_int.h"
+#include "elua_int_cfg.h"
 #include "utils.h"
 #include <stdio.h>
 
-// [TODO] when the new build system is ready, automatically add the
-// code below in platform_conf.h
-#if defined( BUILD_LUA_INT_HANDLERS ) || defined( BUILD_C_INT_HANDLERS )
-#define BUILD_INT_HANDLERS
+#ifdef BUILD_INT_HANDLERS
 
 extern const elua_int_descriptor elua_int_table[ INT_ELUA_LAST ];
 
-#endif // #if defined( BUILD_LUA_INT_HANDLERS ) || defined( BUILD_C_INT_HANDLERS )
+#endif // #ifdef BUILD_INT_HANDLERS
 
 #ifndef VTMR_NUM_TIMERS
 #define VTMR_NUM_TIMERS       0
@@ -39,130 +37,220 @@ extern const elua_int_descriptor elua_int_table[ INT_ELUA_LAST ];
 // ============================================================================
 // VTMR functions
 
-static volatile u32 vtmr_counters[ VTMR_NUM_TIMERS ];
-static volatile s8 vtmr_reset_idx = -1;
+// All virtual timers count the ticks of a single free running counter.
+// A virtual timer only remembers the tick of its last reset, so the tick
+// handler does not have to touch it and a reset is a single store.
+static volatile u32 vtmr_ticks;
+static volatile u32 vtmr_start[ VTMR_NUM_TIMERS ];
 
 #if defined( BUILD_INT_HANDLERS ) && defined( INT_TMR_MATCH )
 #define CMN_TIMER_INT_SUPPORT
 #endif // #if defined( BUILD_INT_HANDLERS ) && defined( INT_TMR_MATCH )
 
 #ifdef CMN_TIMER_INT_SUPPORT
-static volatile u32 vtmr_period_limit[ VTMR_NUM_TIMERS ];  
-static volatile u8 vtmr_int_periodic_flag[ ( VTMR_NUM_TIMERS + 7 ) >> 3 ];
-static volatile u8 vtmr_int_enabled[ ( VTMR_NUM_TIMERS + 7 ) >> 3 ];
-static volatile u8 vtmr_int_flag[ ( VTMR_NUM_TIMERS + 7 ) >> 3 ];
+// Armed match interrupts are kept in a binary min-heap ordered by the tick
+// they are due at, so the tick handler only has to look at the heap root.
+// A reset of the timer makes the match due later than its heap key says;
+// the tick handler notices that when the key comes up and requeues it.
+static u32 vtmr_period_limit[ VTMR_NUM_TIMERS ];
+static u32 vtmr_deadline[ VTMR_NUM_TIMERS ];
+static u16 vtmr_heap[ VTMR_NUM_TIMERS ];
+static u16 vtmr_heap_pos[ VTMR_NUM_TIMERS ]; // 1 + position in vtmr_heap, 0 if not queued
+static unsigned vtmr_heap_size;
+// One byte per timer so that the tick handler and the code never share
+// a read-modify-write
+static volatile u8 vtmr_int_periodic_flag[ VTMR_NUM_TIMERS ];
+static volatile u8 vtmr_int_enabled[ VTMR_NUM_TIMERS ];
+static volatile u8 vtmr_int_flag[ VTMR_NUM_TIMERS ];
+
+// Deadlines are compared by their distance from the current tick, which
+// works across the wraparound of vtmr_ticks
+#define VTMR_DUE_BEFORE( a, b, now )  ( ( u32 )( ( a ) - ( now ) ) < ( u32 )( ( b ) - ( now ) ) )
+
+static void vtmr_heap_set( unsigned pos, unsigned id )
+{
+  vtmr_heap[ pos ] = id;
+  vtmr_heap_pos[ id ] = pos + 1;
+}
+
+static void vtmr_heap_up( unsigned pos, u32 now )
+{
+  unsigned id = vtmr_heap[ pos ], parent;
+
+  while( pos > 0 )
+  {
+    parent = ( pos - 1 ) >> 1;
+    if( !VTMR_DUE_BEFORE( vtmr_deadline[ id ], vtmr_deadline[ vtmr_heap[ parent ] ], now ) )
+      break;
+    vtmr_heap_set( pos, vtmr_heap[ parent ] );
+    pos = parent;
+  }
+  vtmr_heap_set( pos, id );
+}
+
+static void vtmr_heap_down( unsigned pos, u32 now )
+{
+  unsigned id = vtmr_heap[ pos ], child;
+
+  while( ( child = 2 * pos + 1 ) < vtmr_heap_size )
+  {
+    if( child + 1 < vtmr_heap_size &&
+        VTMR_DUE_BEFORE( vtmr_deadline[ vtmr_heap[ child + 1 ] ], vtmr_deadline[ vtmr_heap[ child ] ], now ) )
+      child ++;
+    if( !VTMR_DUE_BEFORE( vtmr_deadline[ vtmr_heap[ child ] ], vtmr_deadline[ id ], now ) )
+      break;
+    vtmr_heap_set( pos, vtmr_heap[ child ] );
+    pos = child;
+  }
+  vtmr_heap_set( pos, id );
+}
+
+static void vtmr_heap_insert( unsigned id, u32 now )
+{
+  vtmr_heap_set( vtmr_heap_size, id );
+  vtmr_heap_up( vtmr_heap_size ++, now );
+}
+
+static void vtmr_heap_remove( unsigned id, u32 now )
+{
+  unsigned pos = vtmr_heap_pos[ id ] - 1;
+
+  vtmr_heap_pos[ id ] = 0;
+  if( pos == -- vtmr_heap_size )
+    return;
+  // Move the last entry in the hole and restore the order around it
+  id = vtmr_heap[ vtmr_heap_size ];
+  vtmr_heap_set( pos, id );
+  vtmr_heap_up( pos, now );
+  vtmr_heap_down( vtmr_heap_pos[ id ] - 1, now );
+}
+
+// Fire all the matches due at tick 'now'
+static void vtmr_expire( u32 now )
+{
+  unsigned id;
+  u32 left;
+
+  while( vtmr_heap_size > 0 && vtmr_deadline[ id = vtmr_heap[ 0 ] ] == now )
+  {
+    // If the timer was reset after the match was queued, the match is due
+    // later. A reset that raced with a periodic restart can also leave it
+    // slightly in the past, in which case it fires now.
+    left = vtmr_start[ id ] + vtmr_period_limit[ id ] - now;
+    if( left != 0 && left <= vtmr_period_limit[ id ] )
+    {
+      vtmr_deadline[ id ] = now + left;
+      vtmr_heap_down( 0, now );
+      continue;
+    }
+    vtmr_int_flag[ id ] = 1;
+    if( vtmr_int_enabled[ id ] )
+      elua_int_add( INT_TMR_MATCH, id + VTMR_FIRST_ID );
+    if( vtmr_int_periodic_flag[ id ] )
+    {
+      vtmr_start[ id ] = now;
+      vtmr_deadline[ id ] = now + vtmr_period_limit[ id ];
+      vtmr_heap_down( 0, now );
+    }
+    else
+    {
+      vtmr_int_enabled[ id ] = 0;
+      vtmr_heap_remove( id, now );
+    }
+  }
+}
 #endif // #ifdef CMN_TIMER_INT_SUPPORT
 
 // This should be called from the platform's timer interrupt at VTMR_FREQ_HZ
+// Its cost doesn't depend on VTMR_NUM_TIMERS, only on the number of matches
+// that are due at this tick
 void cmn_virtual_timer_cb()
 {
-  unsigned i;
-#ifdef CMN_TIMER_INT_SUPPORT
-  u8 msk;
-#endif
+  u32 now = vtmr_ticks + 1;
 
-  for( i = 0; i < VTMR_NUM_TIMERS; i ++ )
-  {
-    vtmr_counters[ i ] ++;  
+  vtmr_ticks = now;
 #ifdef CMN_TIMER_INT_SUPPORT
-    msk = 1 << ( i & 0x07 );
-    if( vtmr_counters[ i ] >= vtmr_period_limit[ i ] )
-    {
-      vtmr_int_flag[ i >> 3 ] |= msk;
-      if( vtmr_int_enabled[ i >> 3 ] & msk )      
-        elua_int_add( INT_TMR_MATCH, i + VTMR_FIRST_ID );
-      if( vtmr_int_periodic_flag[ i >> 3 ] & msk )
-        vtmr_counters[ i ] = 0;
-      else
-        vtmr_int_enabled[ i >> 3 ] &= ( u8 )~msk;    
-    }
+  vtmr_expire( now );
 #endif // #ifdef CMN_TIMER_INT_SUPPORT
-  }    
-  if( vtmr_reset_idx != -1 )
-  {
-    vtmr_counters[ vtmr_reset_idx ] = 0;
-    vtmr_reset_idx = -1;
-  }
 }
 
-static void vtmr_reset_timer( unsigned vid )
+static u32 vtmr_read( unsigned vid )
 {
-  unsigned id = VTMR_GET_ID( vid );
+  return vtmr_ticks - vtmr_start[ VTMR_GET_ID( vid ) ];
+}
 
-  vtmr_reset_idx = ( s8 )id;
-  while( vtmr_reset_idx != -1 );  
+static void vtmr_reset_timer( unsigned vid )
+{
+  vtmr_start[ VTMR_GET_ID( vid ) ] = vtmr_ticks;
 }
 
 static void vtmr_delay( unsigned vid, timer_data_type delay_us )
 {
   timer_data_type final;
-  unsigned id = VTMR_GET_ID( vid );
   
   if( delay_us > VTMR_MAX_PERIOD )
     return;
   final = ( ( u64 )delay_us * VTMR_FREQ_HZ ) / 1000000;
   vtmr_reset_timer( vid );
-  while( vtmr_counters[ id ] < final );  
+  while( vtmr_read( vid ) < final );  
 }
 
 #ifdef CMN_TIMER_INT_SUPPORT
 
 static int vtmr_set_match_int( unsigned vid, timer_data_type period_us, int type )
 {
-  timer_data_type final;
+  timer_data_type final = 0;
   unsigned id = VTMR_GET_ID( vid );
-  u8 msk = 1 << ( id & 0x07 );
+  int old_status;
+  u32 now;
 
   if( period_us > VTMR_MAX_PERIOD )
     return PLATFORM_TIMER_INT_TOO_LONG;
+  if( period_us != 0 && ( final = ( ( u64 )period_us * VTMR_FREQ_HZ ) / 1000000 ) == 0 )
+    return PLATFORM_TIMER_INT_TOO_SHORT;
+  // The heap is shared with the tick handler
+  old_status = platform_cpu_set_global_interrupts( PLATFORM_CPU_DISABLE );
+  now = vtmr_ticks;
+  if( vtmr_heap_pos[ id ] != 0 )
+    vtmr_heap_remove( id, now );
+  vtmr_int_flag[ id ] = 0;
   if( period_us == 0 )
+    vtmr_int_enabled[ id ] = 0;
+  else
   {
-    vtmr_int_enabled[ id >> 3 ] &= ( u8 )~msk;
-    vtmr_int_flag[ id >> 3 ] &= ( u8 )~msk;
-    return PLATFORM_TIMER_INT_OK;
+    vtmr_period_limit[ id ] = final;
+    vtmr_int_periodic_flag[ id ] = type != PLATFORM_TIMER_INT_ONESHOT;
+    vtmr_start[ id ] = now;
+    vtmr_deadline[ id ] = now + final;
+    vtmr_heap_insert( id, now );
+    vtmr_int_enabled[ id ] = 1;
   }
-  if( ( final = ( ( u64 )period_us * VTMR_FREQ_HZ ) / 1000000 ) == 0 )
-    return PLATFORM_TIMER_INT_TOO_SHORT;
-  vtmr_period_limit[ id ] = final;
-  if( type == PLATFORM_TIMER_INT_ONESHOT )
-    vtmr_int_periodic_flag[ id >> 3 ] &= ( u8 )~msk;
-  else
-    vtmr_int_periodic_flag[ id >> 3 ] |= msk;
-  vtmr_int_flag[ id >> 3 ] &= ( u8 )~msk;
-  vtmr_reset_timer( vid ); 
-  vtmr_int_enabled[ id >> 3 ] |= msk;
+  platform_cpu_set_global_interrupts( old_status );
   return PLATFORM_TIMER_INT_OK;
 }
 
 static int vtmr_int_get_flag( elua_int_resnum resnum, int clear )
 {
   unsigned id = VTMR_GET_ID( resnum );
-  u8 msk = 1 << ( id & 0x07 );
-  int status = ( vtmr_int_flag[ id >> 3 ] & msk ) != 0;
+  int status = vtmr_int_flag[ id ] != 0;
 
   if( clear )
-    vtmr_int_flag[ id >> 3 ] &= ( u8 )~msk;
+    vtmr_int_flag[ id ] = 0;
   return status;
 }
 
 static int vtmr_int_set_status( elua_int_resnum resnum, int status )
 {
   unsigned id = VTMR_GET_ID( resnum );
-  u8 msk = 1 << ( id & 0x07 );
-  int prev = ( vtmr_int_enabled[ id >> 3 ] & msk ) != 0;
+  int prev = vtmr_int_enabled[ id ] != 0;
 
-  if( status == PLATFORM_CPU_ENABLE )
-    vtmr_int_enabled[ id >> 3 ] |= msk;
-  else
-    vtmr_int_enabled[ id >> 3 ] &= ( u8 )~msk;
+  vtmr_int_enabled[ id ] = status == PLATFORM_CPU_ENABLE;
   return prev;
 }
 
 static int vtmr_int_get_status( elua_int_resnum resnum )
 {
-  unsigned id = VTMR_GET_ID( resnum );
-  u8 msk = 1 << ( id & 0x07 );
-  return ( vtmr_int_enabled[ id >> 3 ] & msk ) != 0;
+  return vtmr_int_enabled[ VTMR_GET_ID( resnum ) ] != 0;
 }
 #endif // #ifdef CMN_TIMER_INT_SUPPORT 
 
@@ -284,7 +372,7 @@ timer_data_type platform_timer_op( unsigned id, int op, timer_data_type data )
       break;
       
     case PLATFORM_TIMER_OP_READ:
-      res = vtmr_counters[ VTMR_GET_ID( id ) ];
+      res = vtmr_read( id );
       break;
       
     case PLATFORM_TIMER_OP_GET_MAX_DELAY:
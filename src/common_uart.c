@@ -73,6 +73,18 @@ static int cmn_recv_helper( unsigned id, timer_data_type timeout )
   return -1;
 }
 
+#ifdef BUF_ENABLE_UART
+// Returns 1 if the data received on UART 'id' goes through a buffer
+static int cmn_uart_is_buffered( unsigned id )
+{
+#ifdef BUILD_USB_CDC
+  if( id == CDC_UART_ID )
+    return 0;
+#endif
+  return buf_is_enabled( BUF_ID_UART, id );
+}
+#endif // #ifdef BUF_ENABLE_UART
+
 int platform_uart_recv( unsigned id, unsigned timer_id, timer_data_type timeout )
 {
   timer_data_type tmr_start;
@@ -97,6 +109,34 @@ int platform_uart_recv( unsigned id, unsigned timer_id, timer_data_type timeout
   }
 }
 
+// Receive up to 'maxlen' bytes from a UART. Waits for the first byte like
+// platform_uart_recv, then returns all the bytes that are already available
+// (without waiting for more). Returns the number of bytes received (0 on
+// timeout).
+unsigned platform_uart_recv_n( unsigned id, unsigned timer_id, timer_data_type timeout, u8 *data, unsigned maxlen )
+{
+  unsigned n = 0;
+  int res;
+
+  if( maxlen == 0 )
+    return 0;
+#ifdef BUF_ENABLE_UART
+  // Buffered UART: take everything that's in the buffer at once
+  if( cmn_uart_is_buffered( id ) && ( n = buf_read_n( BUF_ID_UART, id, data, maxlen ) ) > 0 )
+    return n;
+#endif
+  if( ( res = platform_uart_recv( id, timer_id, timeout ) ) == -1 )
+    return 0;
+  data[ n ++ ] = ( u8 )res;
+#ifdef BUF_ENABLE_UART
+  if( cmn_uart_is_buffered( id ) )
+    return n + buf_read_n( BUF_ID_UART, id, data + n, maxlen - n );
+#endif
+  while( n < maxlen && ( res = cmn_recv_helper( id, 0 ) ) != -1 )
+    data[ n ++ ] = ( u8 )res;
+  return n;
+}
+
 static void cmn_rx_handler( int usart_id, u8 data )
 {
 #ifdef BUILD_SERMUX
@@ -168,15 +208,29 @@ void platform_uart_send( unsigned id, u8 data )
 #ifdef BUF_ENABLE_UART
 static elua_int_c_handler prev_uart_rx_handler;
 
+#define CMN_UART_RX_CHUNK     16
+
 static void cmn_uart_rx_inthandler( elua_int_resnum resnum )
 {
   int data;
+  u8 temp[ CMN_UART_RX_CHUNK ];
+  unsigned n;
 
-  if( buf_is_enabled( BUF_ID_UART, resnum ) || resnum == SERMUX_PHYS_ID )
+  if( resnum == SERMUX_PHYS_ID )
   {
     while( -1 != ( data = platform_s_uart_recv( resnum, 0 ) ) )
       cmn_rx_handler( resnum, ( u8 )data );
   }
+  else if( buf_is_enabled( BUF_ID_UART, resnum ) )
+  {
+    // Move the data to the buffer in chunks (what doesn't fit in the buffer is lost)
+    do
+    {
+      for( n = 0; n < CMN_UART_RX_CHUNK && -1 != ( data = platform_s_uart_recv( resnum, 0 ) ); n ++ )
+        temp[ n ] = ( u8 )data;
+      buf_write_n( BUF_ID_UART, resnum, temp, n );
+    } while( n == CMN_UART_RX_CHUNK );
+  }
 
   // Chain to previous handler
   if( prev_uart_rx_handler != NULL )
@@ -23,103 +23,226 @@
 
 #include "platform.h"
 #include "platform_conf.h"
+#include "elua_int_cfg.h"
 #include "type.h"
 #include <stdio.h>
 #include <string.h>
 
-// A reference required in common_tmr.c.
+#if defined( ALCOR_LANG_LUA ) && defined( BUILD_LUA_INT_HANDLERS )
+#define BUILD_LUA_INT_HOOK
+#endif
 
-#ifndef ALCOR_LANG_LUA
+// ****************************************************************************
+// Interrupt queue (shared by all the languages)
 
-int elua_int_add(elua_int_id inttype, elua_int_resnum resnum)
-{
-  return PLATFORM_ERR;
-}
+#ifdef BUILD_LANG_INT_HANDLERS
 
+// Number of priority levels. Every interrupt starts at level 0; the queue of
+// a higher level is always emptied before the ones below it
+#ifndef ELUA_INT_NUM_PRIORITIES
+#define ELUA_INT_NUM_PRIORITIES         3
 #endif
 
-#if defined ALCOR_LANG_LUA
-
-// ****************************************************************************
-// Interrupt handlers for Lua.
-
-#if defined (BUILD_LUA_INT_HANDLERS)
+// Maximum number of handlers run by a single elua_int_dispatch call, so that
+// an interrupt storm can't starve the interpreter completely
+#ifndef ELUA_INT_MAX_BATCH
+#define ELUA_INT_MAX_BATCH              8
+#endif
 
-// Interrupt queue read and write indexes
-static volatile u8 elua_int_read_idx, elua_int_write_idx;
-// The interrupt queue
-static elua_int_element elua_int_queue[ 1 << PLATFORM_INT_QUEUE_LOG_SIZE ];
+// Masking for read/write indexes
+#define INT_IDX_SHIFT                   ( PLATFORM_INT_QUEUE_LOG_SIZE )
+#define INT_QUEUE_SIZE                  ( 1 << INT_IDX_SHIFT )
+#define INT_IDX_MASK                    ( INT_QUEUE_SIZE - 1 )
+
+// One ring per priority level: read index and number of queued elements
+static elua_int_element elua_int_queue[ ELUA_INT_NUM_PRIORITIES ][ INT_QUEUE_SIZE ];
+static volatile u8 elua_int_read_idx[ ELUA_INT_NUM_PRIORITIES ];
+static volatile u8 elua_int_count[ ELUA_INT_NUM_PRIORITIES ];
+// Priority level of each interrupt
+static u8 elua_int_priority[ LUA_INT_MAX_SOURCES ];
 // Interrupt enabled/disabled flags
 static u32 elua_int_flags[ LUA_INT_MAX_SOURCES / 32 ];
+// Interrupts lost because their queue was full (reported by elua_int_dispatch)
+static volatile u16 elua_int_dropped;
 
-// Masking for read/write indexes
-#define INT_IDX_SHIFT                   ( PLATFORM_INT_QUEUE_LOG_SIZE )
-#define INT_IDX_MASK                    ( ( 1 << INT_IDX_SHIFT ) - 1 )
+// Total number of queued interrupts and the "handler running" flag, checked
+// by the interpreters through elua_int_should_dispatch()
+volatile u16 elua_int_pending;
+u8 elua_int_dispatching;
+
+#ifdef BUILD_LUA_INT_HOOK
+
+// Run the Lua handler of an interrupt
+static void elua_int_lua_call( elua_int_id id, elua_int_resnum resnum, void *arg )
+{
+  lua_State *L = ( lua_State* )arg;
+
+  // Get interrupt handler table
+  lua_rawgeti( L, LUA_REGISTRYINDEX, LUA_INT_HANDLER_KEY ); // inttable
+  lua_rawgeti( L, -1, id ); // inttable f
+  if( !lua_isnil( L, -1 ) )
+  {
+    lua_pushinteger( L, resnum ); // inttable f resnum
+    lua_call( L, 1, 0 ); // inttable
+  }
+  else
+    lua_remove( L, -1 ); // inttable
+  lua_remove( L, -1 );
+}
 
 // Our hook function (called by the Lua VM)
+// The VM never calls a hook from inside another hook, so this doesn't need
+// the elua_int_dispatching guard
 static void elua_int_hook( lua_State *L, lua_Debug *ar )
 {
-  elua_int_element crt;
   int old_status;
 
-  // Get interrupt (and remove from queue)
-  crt = elua_int_queue[ elua_int_read_idx ];
-  elua_int_queue[ elua_int_read_idx ].id = ELUA_INT_EMPTY_SLOT;
-  elua_int_read_idx = ( elua_int_read_idx + 1 ) & INT_IDX_MASK;
-
-  if( elua_int_is_enabled( crt.id ) )
-  {
-    // Call Lua handler
-    // Get interrupt handler table
-    lua_rawgeti( L, LUA_REGISTRYINDEX, LUA_INT_HANDLER_KEY ); // inttable
-    lua_rawgeti( L, -1, crt.id ); // inttable f
-    if( !lua_isnil( L, -1 ) )
-    {
-      lua_pushinteger( L, crt.resnum ); // inttable f resnum
-      lua_call( L, 1, 0 ); // inttable    
-    }
-    else
-      lua_remove( L, -1 ); // inttable
-    lua_remove( L, -1 );
-  }
+  elua_int_dispatch( elua_int_lua_call, L );
 
   old_status = platform_cpu_set_global_interrupts( PLATFORM_CPU_DISABLE );
-  if( elua_int_queue[ elua_int_read_idx ].id == ELUA_INT_EMPTY_SLOT ) // no more interrupts in the queue, so clear the hook
+  if( elua_int_pending == 0 ) // no more interrupts in the queue, so clear the hook
     lua_sethook( L, NULL, 0, 0 );
   platform_cpu_set_global_interrupts( old_status );
 }
 
-// Queue an interrupt and set the Lua hook
+#endif // #ifdef BUILD_LUA_INT_HOOK
+
+// Queue an interrupt (called from interrupt context)
+// An interrupt that is already waiting in the queue with the same resource
+// number is not queued again.
 // Returns PLATFORM_OK or PLATFORM_ERR
 int elua_int_add( elua_int_id inttype, elua_int_resnum resnum )
 {
+  elua_int_element *q;
+  unsigned prio, r, n, i;
+
   if( inttype < ELUA_INT_FIRST_ID || inttype > INT_ELUA_LAST )
     return PLATFORM_ERR;
 
-  // If Lua is not running (no Lua state), or no Lua interrupt handler is set, 
-  // or the interrupt is not enabled, don't do anything
-  if( lua_getstate() == NULL || !elua_int_is_enabled( inttype ) )
+  // If no interrupt handler is set (the interrupt is not enabled) don't do anything
+  if( !elua_int_is_enabled( inttype ) )
+    return PLATFORM_ERR;
+#ifdef BUILD_LUA_INT_HOOK
+  // Same thing if Lua is not running
+  if( lua_getstate() == NULL )
     return PLATFORM_ERR;
+#endif
+
+  prio = elua_int_priority[ inttype ];
+  q = elua_int_queue[ prio ];
+  r = elua_int_read_idx[ prio ];
+  n = elua_int_count[ prio ];
+
+  // Coalesce with an event that wasn't handled yet
+  for( i = 0; i < n; i ++ )
+    if( q[ ( r + i ) & INT_IDX_MASK ].id == inttype && q[ ( r + i ) & INT_IDX_MASK ].resnum == resnum )
+      return PLATFORM_OK;
 
-  // If there's no more room in the queue, set the overflow flag and return
-  if( elua_int_queue[ elua_int_write_idx ].id != ELUA_INT_EMPTY_SLOT )
+  // If there's no more room in the queue, count the lost interrupt and return
+  if( n == INT_QUEUE_SIZE )
   {
-    printf( "ERROR in elua_int_add: buffer overflow, interrupt not queued\n" );
+    if( elua_int_dropped != 0xFFFF )
+      elua_int_dropped ++;
     return PLATFORM_ERR;
   }
 
   // Queue the interrupt
-  elua_int_queue[ elua_int_write_idx ].id = inttype;
-  elua_int_queue[ elua_int_write_idx ].resnum = resnum;
-  elua_int_write_idx = ( elua_int_write_idx + 1 ) & INT_IDX_MASK;
+  q[ ( r + n ) & INT_IDX_MASK ].id = inttype;
+  q[ ( r + n ) & INT_IDX_MASK ].resnum = resnum;
+  elua_int_count[ prio ] = n + 1;
+  elua_int_pending ++;
 
+#ifdef BUILD_LUA_INT_HOOK
   // Set the Lua hook (it's OK to set it even if it's already set)
   lua_sethook( lua_getstate(), elua_int_hook, LUA_MASKCOUNT, 2 ); 
+#endif
 
   // All OK
   return PLATFORM_OK;
 }
 
+// Remove the most urgent interrupt from the queue
+// Returns 1 if an interrupt was written in *pelem, 0 if the queue is empty
+int elua_int_get( elua_int_element *pelem )
+{
+  int old_status, prio, res = 0;
+
+  old_status = platform_cpu_set_global_interrupts( PLATFORM_CPU_DISABLE );
+  for( prio = ELUA_INT_NUM_PRIORITIES - 1; prio >= 0; prio -- )
+    if( elua_int_count[ prio ] > 0 )
+    {
+      *pelem = elua_int_queue[ prio ][ elua_int_read_idx[ prio ] ];
+      elua_int_read_idx[ prio ] = ( elua_int_read_idx[ prio ] + 1 ) & INT_IDX_MASK;
+      elua_int_count[ prio ] --;
+      elua_int_pending --;
+      res = 1;
+      break;
+    }
+  platform_cpu_set_global_interrupts( old_status );
+  return res;
+}
+
+// Run the handlers of (at most ELUA_INT_MAX_BATCH) queued interrupts, most
+// urgent first. 'handler' is the language specific part that finds and
+// calls the handler of an interrupt.
+// Returns the number of interrupts taken from the queue
+unsigned elua_int_dispatch( elua_int_p_dispatch handler, void *arg )
+{
+  elua_int_element crt;
+  unsigned n = 0;
+  u16 dropped;
+  int old_status;
+
+  elua_int_dispatching = 1;
+  old_status = platform_cpu_set_global_interrupts( PLATFORM_CPU_DISABLE );
+  dropped = elua_int_dropped;
+  elua_int_dropped = 0;
+  platform_cpu_set_global_interrupts( old_status );
+  if( dropped )
+    printf( "ERROR in elua_int_dispatch: buffer overflow, %u interrupt(s) not queued\n", ( unsigned )dropped );
+
+  while( n < ELUA_INT_MAX_BATCH && elua_int_get( &crt ) )
+  {
+    n ++;
+    // The handler might have been removed after the interrupt was queued
+    if( elua_int_is_enabled( crt.id ) )
+      handler( crt.id, crt.resnum, arg );
+  }
+  elua_int_dispatching = 0;
+  return n;
+}
+
+// Clear the "handler running" flag after an error unwound a handler
+void elua_int_dispatch_reset()
+{
+  elua_int_dispatching = 0;
+}
+
+// Set the priority level of the given interrupt
+// Returns PLATFORM_OK or PLATFORM_ERR
+int elua_int_set_priority( elua_int_id inttype, unsigned prio )
+{
+  if( inttype < ELUA_INT_FIRST_ID || inttype > INT_ELUA_LAST || prio >= ELUA_INT_NUM_PRIORITIES )
+    return PLATFORM_ERR;
+  // Events that are already queued keep their old level
+  elua_int_priority[ inttype ] = prio;
+  return PLATFORM_OK;
+}
+
+// Returns the priority level of the given interrupt (0 if the ID is invalid)
+unsigned elua_int_get_priority( elua_int_id inttype )
+{
+  if( inttype < ELUA_INT_FIRST_ID || inttype > INT_ELUA_LAST )
+    return 0;
+  return elua_int_priority[ inttype ];
+}
+
+// Returns the number of priority levels
+unsigned elua_int_get_num_priorities()
+{
+  return ELUA_INT_NUM_PRIORITIES;
+}
+
 // Enable the given interrupt
 void elua_int_enable( elua_int_id inttype )
 {
@@ -151,15 +274,22 @@ void elua_int_disable_all()
     elua_int_flags[ i ] = 0;    
 }
 
-// Called from lstate.c/lua_close
+// Called when the interpreter exits (lstate.c/lua_close for Lua)
 void elua_int_cleanup()
 {
+  int old_status;
+
   elua_int_disable_all();
-  elua_int_read_idx = elua_int_write_idx = 0;
-  memset( elua_int_queue, ELUA_INT_EMPTY_SLOT, sizeof( elua_int_queue ) );
+  old_status = platform_cpu_set_global_interrupts( PLATFORM_CPU_DISABLE );
+  memset( ( void* )elua_int_read_idx, 0, sizeof( elua_int_read_idx ) );
+  memset( ( void* )elua_int_count, 0, sizeof( elua_int_count ) );
+  elua_int_pending = elua_int_dropped = 0;
+  platform_cpu_set_global_interrupts( old_status );
+  memset( elua_int_priority, 0, sizeof( elua_int_priority ) );
+  elua_int_dispatching = 0;
 }
 
-#else // #if defined (BUILD_LUA_INT_HANDLERS)
+#else // #ifdef BUILD_LANG_INT_HANDLERS
 
 // This is needed by lua_close (lstate.c)
 void elua_int_disable_all()
@@ -179,14 +309,13 @@ void elua_int_disable( elua_int_id inttype )
 {
 }
 
+// A reference required in common_tmr.c.
 int elua_int_add( elua_int_id inttype, elua_int_resnum resnum )
 {
   return PLATFORM_ERR;
 }
 
-#endif // #if defined(BUILD_LUA_INT_HANDLERS)
-
-#endif // #ifdef ALCOR_LANG_LUA
+#endif // #ifdef BUILD_LANG_INT_HANDLERS
 
 // ****************************************************************************
 // C handlers
@@ -7,7 +7,14 @@
 #include "eluarpc.h"
 #include "rtype.h"
 
-static u8 eluarpc_err_flag;
+// The RFS server calls these functions from more than one thread
+#ifdef ELUARPC_THREAD_SAFE
+#define ELUARPC_LOCAL         static __thread
+#else
+#define ELUARPC_LOCAL         static
+#endif
+
+ELUARPC_LOCAL u8 eluarpc_err_flag;
 
 // *****************************************************************************
 // Internal functions: fdata serialization
@@ -137,7 +144,7 @@ static const u8 *eluarpc_read_small_ptr( const u8 *p, void* src, u16 *psrclen )
 // *****************************************************************************
 // Internal functions: packet handling (read and write)
 
-static u8* eluarpc_packet_ptr;
+ELUARPC_LOCAL u8* eluarpc_packet_ptr;
 
 static u8* eluarpc_start_packet( u8 *p )
 {
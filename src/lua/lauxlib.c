@@ -735,18 +735,31 @@ static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
     free(ptr);
     return NULL;
   }
-  if (L != NULL && (mode & EGC_ALWAYS)) /* always collect memory if requested */
+  if (L != NULL && (mode & EGC_ALWAYS)) { /* always collect memory if requested */
+    legc_pause_begin(L);
     luaC_fullgc(L);
+    legc_pause_end(L, 1);
+  }
   if(nsize > osize && L != NULL) {
 #if defined(LUA_STRESS_EMERGENCY_GC)
     luaC_fullgc(L);
 #endif
-    if(G(L)->memlimit > 0 && (mode & EGC_ON_MEM_LIMIT) && l_check_memlimit(L, nsize - osize))
-      return NULL;
+    legc_before_alloc(L, nsize - osize);
+    if(G(L)->memlimit > 0 && (mode & EGC_ON_MEM_LIMIT) &&
+       G(L)->totalbytes + (nsize - osize) >= G(L)->memlimit) {
+      int fail;
+      legc_pause_begin(L);
+      fail = l_check_memlimit(L, nsize - osize);
+      legc_pause_end(L, 1);
+      if (fail)
+        return NULL;
+    }
   }
   nptr = realloc(ptr, nsize);
   if (nptr == NULL && L != NULL && (mode & EGC_ON_ALLOC_FAILURE)) {
+    legc_pause_begin(L);
     luaC_fullgc(L); /* emergency full collection. */
+    legc_pause_end(L, 1);
     nptr = realloc(ptr, nsize); /* try allocation again */
   }
   return nptr;
@@ -2,6 +2,8 @@
 
 #include "legc.h"
 #include "lstate.h"
+#include "lgc.h"
+#include "platform.h"
 
 void legc_set_mode(lua_State *L, int mode, unsigned limit) {
    global_State *g = G(L); 
@@ -10,3 +12,72 @@ void legc_set_mode(lua_State *L, int mode, unsigned limit) {
    g->memlimit = limit;
 }
 
+// Bytes that should stay free below the memory limit
+static lu_mem legc_reserve(global_State *g) {
+   lu_mem reserve = g->memlimit / EGC_RESERVE_DIV;
+
+   return g->egcstats.rate > reserve ? g->egcstats.rate : reserve;
+}
+
+// Called by the allocator before growing a block by 'needbytes'. In adaptive
+// mode, run a single incremental step if the allocation would eat into the
+// reserve. Returns 1 if a step was taken.
+int legc_before_alloc(lua_State *L, size_t needbytes) {
+   global_State *g = G(L);
+
+   g->egcstats.allocated += needbytes;
+   if (!(g->egcmode & EGC_ADAPTIVE) || g->memlimit == 0 || is_block_gc(L))
+      return 0;
+   if (g->totalbytes + needbytes + legc_reserve(g) < g->memlimit)
+      return 0;
+   legc_pause_begin(L);
+   luaC_step(L);
+   legc_pause_end(L, 0);
+   return 1;
+}
+
+void legc_pause_begin(lua_State *L) {
+   G(L)->egcstats.start = ( unsigned long )platform_timer_read_sys();
+}
+
+void legc_pause_end(lua_State *L, int full) {
+   EGCStats *s = &G(L)->egcstats;
+   unsigned pause = ( unsigned )( ( unsigned long )platform_timer_read_sys() - s->start );
+
+   if (full)
+      s->fullgcs ++;
+   else
+      s->steps ++;
+   s->totalpause += pause;
+   if (pause > s->maxpause)
+      s->maxpause = pause;
+}
+
+// Called when the application is idle (for example while the interpreter
+// waits for input). Updates the allocation rate estimate and uses the idle
+// time to collect until the reserve is available again, so that allocation
+// bursts that follow don't have to.
+void legc_idle(lua_State *L) {
+   global_State *g = G(L);
+   EGCStats *s = &g->egcstats;
+   int cycles = 0;
+
+   // exponentially weighted moving average, weight 1/4 for the new sample
+   s->rate = s->rate - (s->rate >> 2) + (s->allocated >> 2);
+   s->allocated = 0;
+   if (!(g->egcmode & EGC_ADAPTIVE) || g->memlimit == 0 || is_block_gc(L))
+      return;
+   while (g->totalbytes + 2 * legc_reserve(g) >= g->memlimit) {
+      // never run more than one complete cycle
+      if (g->gcstate == GCSpause && ++cycles > 1)
+         break;
+      legc_pause_begin(L);
+      luaC_step(L);
+      legc_pause_end(L, 0);
+   }
+}
+
+const EGCStats *legc_get_stats(lua_State *L) {
+   return &G(L)->egcstats;
+}
+
@@ -10,8 +10,30 @@
 #define EGC_ON_ALLOC_FAILURE  1   // run EGC on allocation failure
 #define EGC_ON_MEM_LIMIT      2   // run EGC when an upper memory limit is hit
 #define EGC_ALWAYS            4   // always run EGC before an allocation
+#define EGC_ADAPTIVE          8   // step the GC ahead of the memory limit
 
+// The adaptive mode keeps a reserve below the memory limit sized from the
+// observed allocation rate (but never less than 1/EGC_RESERVE_DIV of the
+// limit). Allocations that eat into the reserve run single incremental GC
+// steps instead of waiting for the limit to be hit and a full collection.
+#ifndef EGC_RESERVE_DIV
+#define EGC_RESERVE_DIV       16
+#endif
+
+#ifdef LUA_CROSS_COMPILER
+// The cross compiler and the host luarpc build don't link legc.c
+#define legc_before_alloc(L, n)
+#define legc_pause_begin(L)
+#define legc_pause_end(L, full)
+#define legc_idle(L)
+#else
 void legc_set_mode(lua_State *L, int mode, unsigned limit);
+int legc_before_alloc(lua_State *L, size_t needbytes);
+void legc_pause_begin(lua_State *L);
+void legc_pause_end(lua_State *L, int full);
+void legc_idle(lua_State *L);
+const EGCStats *legc_get_stats(lua_State *L);
+#endif
 
 #endif
 
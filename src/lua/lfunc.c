@@ -17,6 +17,8 @@
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
+#include "lvm.h"
+#include "lrotable.h"
 
 
 
@@ -148,6 +150,9 @@ void luaF_freeproto (lua_State *L, Proto *f) {
     luaM_freearray(L, f->lineinfo, f->sizelineinfo, int);
   }
   luaM_free(L, f);
+#if LUA_ROTABLE_ICACHE > 0
+  luaV_flushrocache();
+#endif
 }
 
 
@@ -15,14 +15,49 @@
 /* Externally defined read-only table array */
 extern const luaR_table lua_rotable[];
 
+#if LUA_ROTABLE_CACHE > 0
+/* Lookup cache for string keys. A line remembers where a key was last found
+   in a table, so repeated lookups cost a hash and a single strcmp. The cached
+   key is the one stored in the rotable itself, so a line can't go stale */
+typedef struct
+{
+  const void *ptable;
+  const char *strkey;
+  const void *res;
+} luaR_cacheline;
+
+static luaR_cacheline luaR_cache[LUA_ROTABLE_CACHE];
+
+static luaR_cacheline* luaR_cacheline_for(const void *ptable, const char *strkey, unsigned len) {
+  unsigned h = len ^ (unsigned)((size_t)ptable >> 2);
+  
+  while (len --)
+    h ^= (h << 5) + (h >> 2) + (unsigned char)*strkey ++;
+  return &luaR_cache[h & (LUA_ROTABLE_CACHE - 1)];
+}
+#endif
+
 /* Find a global "read only table" in the constant lua_rotable array */
 void* luaR_findglobal(const char *name, unsigned len) {
   unsigned i;    
+#if LUA_ROTABLE_CACHE > 0
+  luaR_cacheline *pline;
+#endif
   
-  if (strlen(name) > LUA_MAX_ROTABLE_NAME)
+  if (len == 0 || len > LUA_MAX_ROTABLE_NAME)
     return NULL;
+#if LUA_ROTABLE_CACHE > 0
+  pline = luaR_cacheline_for(lua_rotable, name, len);
+  if (pline->ptable == lua_rotable && !strncmp(pline->strkey, name, len) && pline->strkey[len] == '\0')
+    return (void*)pline->res;
+#endif
   for (i=0; lua_rotable[i].name; i ++)
-    if (*lua_rotable[i].name != '\0' && strlen(lua_rotable[i].name) == len && !strncmp(lua_rotable[i].name, name, len)) {
+    if (*lua_rotable[i].name == *name && strlen(lua_rotable[i].name) == len && !strncmp(lua_rotable[i].name, name, len)) {
+#if LUA_ROTABLE_CACHE > 0
+      pline->ptable = lua_rotable;
+      pline->strkey = lua_rotable[i].name;
+      pline->res = lua_rotable[i].pentries;
+#endif
       return (void*)(lua_rotable[i].pentries);
     }
   return NULL;
@@ -32,17 +67,34 @@ void* luaR_findglobal(const char *name, unsigned len) {
 static const TValue* luaR_auxfind(const luaR_entry *pentry, const char *strkey, luaR_numkey numkey, unsigned *ppos) {
   const TValue *res = NULL;
   unsigned i = 0;
+#if LUA_ROTABLE_CACHE > 0
+  luaR_cacheline *pline = NULL;
+#endif
   
   if (pentry == NULL)
     return NULL;  
+#if LUA_ROTABLE_CACHE > 0
+  if (strkey && !ppos) {
+    pline = luaR_cacheline_for(pentry, strkey, strlen(strkey));
+    if (pline->ptable == pentry && !strcmp(pline->strkey, strkey))
+      return (const TValue*)pline->res;
+  }
+#endif
   while(pentry->key.type != LUA_TNIL) {
-    if ((strkey && (pentry->key.type == LUA_TSTRING) && (!strcmp(pentry->key.id.strkey, strkey))) || 
+    if ((strkey && (pentry->key.type == LUA_TSTRING) && *pentry->key.id.strkey == *strkey && (!strcmp(pentry->key.id.strkey, strkey))) || 
         (!strkey && (pentry->key.type == LUA_TNUMBER) && ((luaR_numkey)pentry->key.id.numkey == numkey))) {
       res = &pentry->value;
       break;
     }
     i ++; pentry ++;
   }
+#if LUA_ROTABLE_CACHE > 0
+  if (res && pline) {
+    pline->ptable = pentry - i;
+    pline->strkey = pentry->key.id.strkey;
+    pline->res = res;
+  }
+#endif
   if (res && ppos)
     *ppos = i;   
   return res;
@@ -34,6 +34,16 @@
 /* Maximum length of a rotable name and of a string key*/
 #define LUA_MAX_ROTABLE_NAME      32
 
+/* Lines in the string key lookup cache (a power of 2, 0 to disable it) */
+#ifndef LUA_ROTABLE_CACHE
+#define LUA_ROTABLE_CACHE         32
+#endif
+
+/* Lines in the VM's per-instruction rotable cache (a power of 2, 0 to disable it) */
+#ifndef LUA_ROTABLE_ICACHE
+#define LUA_ROTABLE_ICACHE        32
+#endif
+
 /* Type of a numeric key in a rotable */
 typedef int luaR_numkey;
 
@@ -6,6 +6,7 @@
 
 
 #include <stddef.h>
+#include <string.h>
 
 #define lstate_c
 #define LUA_CORE
@@ -201,6 +202,7 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
 #else
   g->memlimit = 0;
 #endif
+  memset(&g->egcstats, 0, sizeof(g->egcstats));
   for (i=0; i<NUM_TAGS; i++) g->mt[i] = NULL;
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != 0) {
     /* memory allocation error: free partial state */
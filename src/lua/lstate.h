@@ -62,6 +62,20 @@ typedef struct CallInfo {
 #define isLua(ci)	(ttisfunction((ci)->func) && f_isLua(ci))
 
 
+/*
+** emergency garbage collector accounting (see legc.h)
+*/
+typedef struct EGCStats {
+  lu_mem rate;  /* smoothed bytes allocated between idle calls */
+  lu_mem allocated;  /* bytes allocated since the last idle call */
+  unsigned long start;  /* system timer value when the current pause began */
+  unsigned fullgcs;  /* emergency (full or until-under-limit) collections */
+  unsigned steps;  /* incremental steps taken ahead of the memory limit */
+  unsigned maxpause;  /* longest pause, in system timer microseconds */
+  unsigned totalpause;  /* sum of all pauses */
+} EGCStats;
+
+
 /*
 ** `global state', shared by all threads of this state
 */
@@ -88,6 +102,7 @@ typedef struct global_State {
   int gcpause;  /* size of pause between successive GCs */
   int gcstepmul;  /* GC `granularity' */
   int egcmode;    /* emergency garbage collection operation mode */
+  EGCStats egcstats;  /* emergency garbage collection statistics */
   lua_CFunction panic;  /* to be called in unprotected errors */
   TValue l_registry;
   struct lua_State *mainthread;
@@ -16,6 +16,7 @@
 
 #include "lauxlib.h"
 #include "lualib.h"
+#include "legc.h"
 
 
 
@@ -180,6 +181,8 @@ static int pushline (lua_State *L, int firstline) {
   char *b = buffer;
   size_t l;
   const char *prmt = get_prompt(L, firstline);
+  if (firstline)
+    legc_idle(L);  /* waiting for input: let the EGC catch up */
   if (lua_readline(L, b, prmt) == 0)
     return 0;  /* no input */
   l = strlen(b);
@@ -31,6 +31,44 @@
 /* limit for table tag-method chains (to avoid loops) */
 #define MAXTAGLOOP	100
 
+#if LUA_ROTABLE_ICACHE > 0
+/*
+** Inline cache for rotable lookups with a constant key. A line remembers
+** what the instruction at `pc' found in rotable `rt'. Rotables never change,
+** and the cache is flushed when a prototype is freed, so a given `pc' always
+** stands for the same key.
+*/
+typedef struct RoCacheLine {
+  const Instruction *pc;
+  void *rt;
+  const TValue *res;
+} RoCacheLine;
+
+static RoCacheLine rocache[LUA_ROTABLE_ICACHE];
+
+
+void luaV_flushrocache (void) {
+  memset(rocache, 0, sizeof(rocache));
+}
+
+
+static const TValue *rocache_get (const Instruction *pc, void *rt,
+                                  const TValue *key) {
+  RoCacheLine *line = &rocache[((size_t)pc / sizeof(Instruction)) &
+                               (LUA_ROTABLE_ICACHE - 1)];
+  const TValue *res;
+  if (line->pc == pc && line->rt == rt)
+    return line->res;
+  res = luaH_get_ro(rt, key);
+  if (!ttisnil(res)) {
+    line->pc = pc;
+    line->rt = rt;
+    line->res = res;
+  }
+  return res;
+}
+#endif
+
 #if defined LUA_NUMBER_INTEGRAL
 LUA_NUMBER luai_ipow(LUA_NUMBER a, LUA_NUMBER b) {
   if (b < 0)
@@ -488,6 +526,15 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         continue;
       }
       case OP_GETTABLE: {
+#if LUA_ROTABLE_ICACHE > 0
+        if (ttisrotable(RB(i)) && ISK(GETARG_C(i))) {
+          const TValue *res = rocache_get(pc, rvalue(RB(i)), RKC(i));
+          if (!ttisnil(res)) {
+            setobj2s(L, ra, res);
+            continue;
+          }
+        }
+#endif
         Protect(luaV_gettable(L, RB(i), RKC(i), ra));
         continue;
       }
@@ -520,6 +567,15 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       case OP_SELF: {
         StkId rb = RB(i);
         setobjs2s(L, ra+1, rb);
+#if LUA_ROTABLE_ICACHE > 0
+        if (ttisrotable(rb) && ISK(GETARG_C(i))) {
+          const TValue *res = rocache_get(pc, rvalue(rb), RKC(i));
+          if (!ttisnil(res)) {
+            setobj2s(L, ra, res);
+            continue;
+          }
+        }
+#endif
         Protect(luaV_gettable(L, rb, RKC(i), ra));
         continue;
       }
@@ -147,6 +147,184 @@ any plisp_cpu_clock(any ex) {
   return box(platform_cpu_get_frequency());
 }
 
+#ifdef BUILD_PICOLISP_INT_HANDLERS
+
+// Checks an interrupt ID.
+static elua_int_id plisp_cpu_int_id(any ex, any y) {
+  NeedNum(ex, y);
+  if (unBox(y) < ELUA_INT_FIRST_ID || unBox(y) > INT_ELUA_LAST)
+    err(ex, y, "invalid interrupt ID");
+  return (elua_int_id)unBox(y);
+}
+
+// Returns the (id . fun) pair of an interrupt
+// from IntHandlers or NIL.
+static any plisp_cpu_int_pair(elua_int_id id) {
+  any x;
+
+  for (x = IntHandlers; isCell(x); x = cdr(x))
+    if (unBox(caar(x)) == id)
+      return car(x);
+  return Nil;
+}
+
+// Runs the handler of an interrupt.
+static void plisp_cpu_int_call(elua_int_id id, elua_int_resnum resnum, void *arg) {
+  any x;
+  cell foo, c1;
+
+  if (isNil(x = plisp_cpu_int_pair(id)) || isNil(cdr(x)))
+    return;
+  Push(foo, cdr(x));
+  Push(c1, box(resnum));
+  apply(NULL, data(foo), NO, 1, &c1);
+  drop(foo);
+}
+
+// Runs queued interrupt handlers; called from
+// evList when elua_int_should_dispatch() is true.
+void plisp_cpu_int_dispatch(void) {
+  elua_int_dispatch(plisp_cpu_int_call, NULL);
+}
+
+#endif // BUILD_PICOLISP_INT_HANDLERS
+
+// Either disables or enables the given interrupt(s).
+static any plisp_cpuh_int_helper(any ex, int mode) {
+#ifdef BUILD_PICOLISP_INT_HANDLERS
+  elua_int_id id;
+  elua_int_resnum resnum;
+  int res;
+  any x, y;
+
+  x = cdr(ex);
+  if (isCell(x)) {
+    id = plisp_cpu_int_id(ex, EVAL(car(x)));
+    while (isCell(x = cdr(x))) {
+      NeedNum(ex, y = EVAL(car(x)));
+      resnum = (elua_int_resnum)unBox(y);
+      res = platform_cpu_set_interrupt(id, resnum, mode);
+      if (res == PLATFORM_INT_INVALID)
+        err(ex, y, "not a valid interrupt ID");
+      else if (res == PLATFORM_INT_NOT_HANDLED)
+        err(ex, y, "operation not implemented for this interrupt and resource");
+      else if (res == PLATFORM_INT_BAD_RESNUM)
+        err(ex, y, "resource not valid for this interrupt");
+    }
+    return Nil;
+  }
+#else
+  if (isCell(cdr(ex)))
+    err(ex, NULL, "picoLisp interrupt support not available.");
+#endif // BUILD_PICOLISP_INT_HANDLERS
+  platform_cpu_set_global_interrupts(mode);
+  return Nil;
+}
+
+// (cpu-cli ['id 'resnum1 ['resnum2] ...]) -> Nil
+any plisp_cpu_cli(any ex) {
+  return plisp_cpuh_int_helper(ex, PLATFORM_CPU_DISABLE);
+}
+
+// (cpu-sei ['id 'resnum1 ['resnum2] ...]) -> Nil
+any plisp_cpu_sei(any ex) {
+  return plisp_cpuh_int_helper(ex, PLATFORM_CPU_ENABLE);
+}
+
+#ifdef BUILD_PICOLISP_INT_HANDLERS
+
+// (cpu-set-int-handler 'id 'fun) -> prevfun
+any plisp_cpu_set_int_handler(any ex) {
+  elua_int_id id;
+  any x, y, prev;
+  cell c1;
+
+  x = cdr(ex);
+  id = plisp_cpu_int_id(ex, EVAL(car(x)));
+  x = cdr(x);
+  Push(c1, EVAL(car(x)));
+  if (isNil(data(c1)))
+    elua_int_disable(id);
+  else
+    elua_int_enable(id);
+  if (isNil(y = plisp_cpu_int_pair(id))) {
+    prev = Nil;
+    IntHandlers = cons(cons(box(id), data(c1)), IntHandlers);
+  } else {
+    prev = cdr(y);
+    cdr(y) = data(c1);
+  }
+  drop(c1);
+  return prev;
+}
+
+// (cpu-get-int-handler 'id) -> fun
+any plisp_cpu_get_int_handler(any ex) {
+  any x;
+
+  x = plisp_cpu_int_pair(plisp_cpu_int_id(ex, EVAL(cadr(ex))));
+  return isNil(x)? Nil : cdr(x);
+}
+
+// (cpu-get-int-flag 'id 'resnum ['flg]) -> num
+// 'flg' (clear the flag) defaults to T.
+any plisp_cpu_get_int_flag(any ex) {
+  elua_int_id id;
+  elua_int_resnum resnum;
+  int clear = 1, res;
+  any x, y;
+
+  x = cdr(ex);
+  id = plisp_cpu_int_id(ex, EVAL(car(x)));
+  x = cdr(x);
+  NeedNum(ex, y = EVAL(car(x)));
+  resnum = (elua_int_resnum)unBox(y);
+  x = cdr(x);
+  if (isCell(x))
+    clear = !isNil(EVAL(car(x)));
+  res = platform_cpu_get_interrupt_flag(id, resnum, clear);
+  if (res == PLATFORM_INT_INVALID)
+    err(ex, NULL, "not a valid interrupt ID");
+  else if (res == PLATFORM_INT_NOT_HANDLED)
+    err(ex, y, "get flag operation not implemented for this interrupt and resource");
+  else if (res == PLATFORM_INT_BAD_RESNUM)
+    err(ex, y, "resource not valid for this interrupt");
+  return box(res);
+}
+
+// (cpu-set-int-priority 'id 'num) -> Nil
+any plisp_cpu_set_int_priority(any ex) {
+  elua_int_id id;
+  any x, y;
+
+  x = cdr(ex);
+  id = plisp_cpu_int_id(ex, EVAL(car(x)));
+  x = cdr(x);
+  NeedNum(ex, y = EVAL(car(x)));
+  if (elua_int_set_priority(id, unBox(y)) != PLATFORM_OK)
+    err(ex, y, "invalid priority");
+  return Nil;
+}
+
+// (cpu-get-int-priority 'id) -> num
+any plisp_cpu_get_int_priority(any ex) {
+  return box(elua_int_get_priority(plisp_cpu_int_id(ex, EVAL(cadr(ex)))));
+}
+
+#else
+
+static any plisp_cpu_no_int(any ex) {
+  err(ex, NULL, "picoLisp interrupt support not available.");
+}
+
+any plisp_cpu_set_int_handler(any ex) {return plisp_cpu_no_int(ex);}
+any plisp_cpu_get_int_handler(any ex) {return plisp_cpu_no_int(ex);}
+any plisp_cpu_get_int_flag(any ex) {return plisp_cpu_no_int(ex);}
+any plisp_cpu_set_int_priority(any ex) {return plisp_cpu_no_int(ex);}
+any plisp_cpu_get_int_priority(any ex) {return plisp_cpu_no_int(ex);}
+
+#endif // BUILD_PICOLISP_INT_HANDLERS
+
 #endif // ALCOR_LANG_PICOLISP
 
 #if defined ALCOR_LANG_PICOC
@@ -216,6 +394,159 @@ static void cpu_clock(pstate *p, val *r, val **param, int n)
     platform_cpu_get_frequency();
 }
 
+#ifdef BUILD_PICOC_INT_HANDLERS
+
+// Longest handler name accepted by cpu_set_int_handler.
+#define CPU_INT_MAX_NAME_LEN 32
+
+#define CPU_CHECK_INT_ID(id)\
+  if ((id) < ELUA_INT_FIRST_ID || (id) > INT_ELUA_LAST)\
+    return pmod_error("invalid interrupt ID")
+
+// Names of the interrupt handlers (registered
+// in the PicoC string table).
+static const char *cpu_int_handlers[INT_ELUA_LAST];
+
+// Runs the handler of an interrupt: parses
+// and runs "handler(resnum);".
+static void cpu_int_call(elua_int_id id, elua_int_resnum resnum, void *arg)
+{
+  char call[CPU_INT_MAX_NAME_LEN + 10];
+  const char *fname = cpu_int_handlers[id - ELUA_INT_FIRST_ID];
+
+  if (fname == NULL)
+    return;
+  snprintf(call, sizeof(call), "%s(%u);", fname, (unsigned)resnum);
+  PicocParse("interrupt", call, strlen(call), TRUE, TRUE, FALSE);
+}
+
+// Runs queued interrupt handlers; called from
+// ParseStatement when elua_int_should_dispatch()
+// is true.
+void cpu_int_dispatch(void)
+{
+  elua_int_dispatch(cpu_int_call, NULL);
+}
+
+#endif // #ifdef BUILD_PICOC_INT_HANDLERS
+
+// Either disables or enables the given interrupt(s).
+static void cpuh_int_helper(val **param, int n, int mode)
+{
+#ifdef BUILD_PICOC_INT_HANDLERS
+  elua_int_id id;
+  elua_int_resnum resnum;
+  int i, res;
+
+  if (n > 0) {
+    id = (elua_int_id)param[0]->Val->Integer;
+    CPU_CHECK_INT_ID(id);
+    for (i = 1; i < n; i++) {
+      resnum = (elua_int_resnum)param[i]->Val->Integer;
+      res = platform_cpu_set_interrupt(id, resnum, mode);
+      if (res == PLATFORM_INT_INVALID)
+        return ProgramFail(NULL, "%d is not a valid interrupt ID", (int)id);
+      else if (res == PLATFORM_INT_NOT_HANDLED)
+        return ProgramFail(NULL, "'%s' not implemented for interrupt %d with resource %d",
+                           mode == PLATFORM_CPU_ENABLE ? "sei" : "cli", (int)id, (int)resnum);
+      else if (res == PLATFORM_INT_BAD_RESNUM)
+        return ProgramFail(NULL, "resource %d not valid for interrupt %d", (int)resnum, (int)id);
+    }
+    return;
+  }
+#else
+  if (n > 0)
+    return pmod_error("PicoC interrupt support not available.");
+#endif // #ifdef BUILD_PICOC_INT_HANDLERS
+  platform_cpu_set_global_interrupts(mode);
+}
+
+// PicoC: cpu_cli([id, resnum1, [resnum2], ...]);
+static void cpu_cli(pstate *p, val *r, val **param, int n)
+{
+  cpuh_int_helper(param, n, PLATFORM_CPU_DISABLE);
+}
+
+// PicoC: cpu_sei([id, resnum1, [resnum2], ...]);
+static void cpu_sei(pstate *p, val *r, val **param, int n)
+{
+  cpuh_int_helper(param, n, PLATFORM_CPU_ENABLE);
+}
+
+#ifdef BUILD_PICOC_INT_HANDLERS
+
+// PicoC: cpu_set_int_handler(id, "fname");
+// The handler is a function taking the resource
+// number: void fname(int resnum). NULL or ""
+// removes the handler.
+static void cpu_set_int_handler(pstate *p, val *r, val **param, int n)
+{
+  int id = param[0]->Val->Integer;
+  const char *fname = param[1]->Val->Identifier;
+
+  CPU_CHECK_INT_ID(id);
+  if (fname == NULL || *fname == '\0') {
+    elua_int_disable(id);
+    cpu_int_handlers[id - ELUA_INT_FIRST_ID] = NULL;
+    return;
+  }
+  if (strlen(fname) > CPU_INT_MAX_NAME_LEN)
+    return pmod_error("handler name too long");
+  fname = TableStrRegister(fname);
+  if (!VariableDefined(fname))
+    return ProgramFail(NULL, "'%s' is not defined", fname);
+  cpu_int_handlers[id - ELUA_INT_FIRST_ID] = fname;
+  elua_int_enable(id);
+}
+
+// PicoC: fname = cpu_get_int_handler(id);
+static void cpu_get_int_handler(pstate *p, val *r, val **param, int n)
+{
+  int id = param[0]->Val->Integer;
+
+  CPU_CHECK_INT_ID(id);
+  r->Val->Identifier = (char *)cpu_int_handlers[id - ELUA_INT_FIRST_ID];
+}
+
+// PicoC: flag = cpu_get_int_flag(id, resnum, clear);
+static void cpu_get_int_flag(pstate *p, val *r, val **param, int n)
+{
+  int id = param[0]->Val->Integer;
+  int resnum = param[1]->Val->Integer;
+  int res;
+
+  CPU_CHECK_INT_ID(id);
+  res = platform_cpu_get_interrupt_flag(id, resnum, param[2]->Val->Integer);
+  if (res == PLATFORM_INT_INVALID)
+    return ProgramFail(NULL, "%d is not a valid interrupt ID", id);
+  else if (res == PLATFORM_INT_NOT_HANDLED)
+    return ProgramFail(NULL, "get flag operation not implemented for interrupt %d with resource %d", id, resnum);
+  else if (res == PLATFORM_INT_BAD_RESNUM)
+    return ProgramFail(NULL, "resource %d not valid for interrupt %d", resnum, id);
+  r->Val->Integer = res;
+}
+
+// PicoC: cpu_set_int_priority(id, prio);
+static void cpu_set_int_priority(pstate *p, val *r, val **param, int n)
+{
+  int id = param[0]->Val->Integer;
+
+  CPU_CHECK_INT_ID(id);
+  if (elua_int_set_priority(id, param[1]->Val->Integer) != PLATFORM_OK)
+    return pmod_error("invalid priority");
+}
+
+// PicoC: prio = cpu_get_int_priority(id);
+static void cpu_get_int_priority(pstate *p, val *r, val **param, int n)
+{
+  int id = param[0]->Val->Integer;
+
+  CPU_CHECK_INT_ID(id);
+  r->Val->Integer = elua_int_get_priority(id);
+}
+
+#endif // #ifdef BUILD_PICOC_INT_HANDLERS
+
 #ifdef PLATFORM_CPU_CONSTANTS
 
 // Returns the interrupt assignment values.
@@ -253,6 +584,15 @@ const PICOC_REG_TYPE cpu_library[] = {
   {FUNC(cpu_w8), PROTO("void cpu_w8(unsigned long, char);")},
   {FUNC(cpu_r8), PROTO("char cpu_r8(unsigned long);")},
   {FUNC(cpu_clock), PROTO("unsigned long cpu_clock(void);")},
+  {FUNC(cpu_cli), PROTO("void cpu_cli(...);")},
+  {FUNC(cpu_sei), PROTO("void cpu_sei(...);")},
+#ifdef BUILD_PICOC_INT_HANDLERS
+  {FUNC(cpu_set_int_handler), PROTO("void cpu_set_int_handler(int, char *);")},
+  {FUNC(cpu_get_int_handler), PROTO("char *cpu_get_int_handler(int);")},
+  {FUNC(cpu_get_int_flag), PROTO("int cpu_get_int_flag(int, int, int);")},
+  {FUNC(cpu_set_int_priority), PROTO("void cpu_set_int_priority(int, int);")},
+  {FUNC(cpu_get_int_priority), PROTO("int cpu_get_int_priority(int);")},
+#endif
 #ifdef PLATFORM_CPU_CONSTANTS
   {FUNC(cpu_const_getval), PROTO("int cpu_const_getval(char *);")},
 #endif
@@ -485,6 +825,30 @@ static int cpu_get_int_flag( lua_State *L )
   lua_pushinteger( L, res );
   return 1;
 }
+
+// Lua: cpu.set_int_priority( id, prio )
+static int cpu_set_int_priority( lua_State *L )
+{
+  elua_int_id id = ( elua_int_id )luaL_checkinteger( L, 1 );
+  unsigned prio = ( unsigned )luaL_checkinteger( L, 2 );
+
+  if( id < ELUA_INT_FIRST_ID || id > INT_ELUA_LAST )
+    return luaL_error( L, "invalid interrupt ID" );
+  if( elua_int_set_priority( id, prio ) != PLATFORM_OK )
+    return luaL_error( L, "invalid priority (must be between 0 and %d)", ( int )elua_int_get_num_priorities() - 1 );
+  return 0;
+}
+
+// Lua: prio = cpu.get_int_priority( id )
+static int cpu_get_int_priority( lua_State *L )
+{
+  elua_int_id id = ( elua_int_id )luaL_checkinteger( L, 1 );
+
+  if( id < ELUA_INT_FIRST_ID || id > INT_ELUA_LAST )
+    return luaL_error( L, "invalid interrupt ID" );
+  lua_pushinteger( L, elua_int_get_priority( id ) );
+  return 1;
+}
 #endif // #ifdef BUILD_LUA_INT_HANDLERS
 
 // Module function map
@@ -505,6 +869,8 @@ const LUA_REG_TYPE cpu_map[] =
   { LSTRKEY( "set_int_handler" ), LFUNCVAL( cpu_set_int_handler ) },
   { LSTRKEY( "get_int_handler" ), LFUNCVAL( cpu_get_int_handler ) },
   { LSTRKEY( "get_int_flag" ), LFUNCVAL( cpu_get_int_flag) },
+  { LSTRKEY( "set_int_priority" ), LFUNCVAL( cpu_set_int_priority ) },
+  { LSTRKEY( "get_int_priority" ), LFUNCVAL( cpu_get_int_priority ) },
 #endif
 #if defined( PLATFORM_CPU_CONSTANTS ) && LUA_OPTIMIZE_MEMORY > 0
   { LSTRKEY( "__metatable" ), LROVAL( cpu_map ) },
@@ -146,6 +146,22 @@ static void elua_shell(pstate *p, val *r, val **param , int n)
   free(cmdcpy);
 }
 
+// PicoC: elua_heapstats();
+static void elua_heapstats(pstate *p, val *r, val **param, int n)
+{
+  struct HeapStats st;
+
+  HeapGetStats(&st);
+  printf("stack: %d bytes used, %d bytes before the heap\n", st.StackUsed, st.Unused);
+  printf("heap: %d allocations", st.Allocations);
+#ifdef PICOC_FIXED_HEAP
+  printf(" using %d bytes, %d bytes free in %d chunks\n", st.HeapUsed, st.HeapFree, st.FreeChunks);
+  printf("largest free: %d bytes, fragmentation %d%%\n", st.LargestFree, st.Fragmentation);
+#else
+  printf("\n");
+#endif
+}
+
 #define MIN_OPT_LEVEL 2
 #include "rodefs.h"
 
@@ -154,6 +170,7 @@ const PICOC_REG_TYPE elua_library[] = {
   {FUNC(elua_version), PROTO("char *elua_version(void);")},
   {FUNC(elua_save_history), PROTO("void elua_save_history(char *);")},
   {FUNC(elua_shell), PROTO("void elua_shell(char *);")},
+  {FUNC(elua_heapstats), PROTO("void elua_heapstats(void);")},
   {NILFUNC, NILPROTO}
 };
 
@@ -182,6 +199,32 @@ static int elua_egc_setup( lua_State *L )
   return 0;
 }
 
+// Lua: elua.egc_idle()
+static int elua_egc_idle( lua_State *L )
+{
+  legc_idle( L );
+  return 0;
+}
+
+// Lua: stats = elua.egc_stats()
+static int elua_egc_stats( lua_State *L )
+{
+  const EGCStats *s = legc_get_stats( L );
+
+  lua_createtable( L, 0, 5 );
+  lua_pushinteger( L, ( lua_Integer )s->rate );
+  lua_setfield( L, -2, "rate" );
+  lua_pushinteger( L, s->fullgcs );
+  lua_setfield( L, -2, "fullgcs" );
+  lua_pushinteger( L, s->steps );
+  lua_setfield( L, -2, "steps" );
+  lua_pushinteger( L, s->maxpause );
+  lua_setfield( L, -2, "maxpause" );
+  lua_pushinteger( L, s->totalpause );
+  lua_setfield( L, -2, "totalpause" );
+  return 1;
+}
+
 // Lua: elua.version()
 static int elua_version( lua_State *L )
 {
@@ -234,6 +277,8 @@ static int elua_shell( lua_State *L )
 const LUA_REG_TYPE elua_map[] =
 {
   { LSTRKEY( "egc_setup" ), LFUNCVAL( elua_egc_setup ) },
+  { LSTRKEY( "egc_idle" ), LFUNCVAL( elua_egc_idle ) },
+  { LSTRKEY( "egc_stats" ), LFUNCVAL( elua_egc_stats ) },
   { LSTRKEY( "version" ), LFUNCVAL( elua_version ) },
   { LSTRKEY( "save_history" ), LFUNCVAL( elua_save_history ) },
   { LSTRKEY( "shell" ), LFUNCVAL( elua_shell ) },
@@ -242,6 +287,7 @@ const LUA_REG_TYPE elua_map[] =
   { LSTRKEY( "EGC_ON_ALLOC_FAILURE" ), LNUMVAL( EGC_ON_ALLOC_FAILURE ) },
   { LSTRKEY( "EGC_ON_MEM_LIMIT" ), LNUMVAL( EGC_ON_MEM_LIMIT ) },
   { LSTRKEY( "EGC_ALWAYS" ), LNUMVAL( EGC_ALWAYS ) },
+  { LSTRKEY( "EGC_ADAPTIVE" ), LNUMVAL( EGC_ADAPTIVE ) },
 #endif
   { LNILKEY, LNILVAL }
 };
@@ -256,6 +302,7 @@ LUALIB_API int luaopen_elua( lua_State *L )
   MOD_REG_NUMBER( L, "EGC_ON_ALLOC_FAILURE", EGC_ON_ALLOC_FAILURE );
   MOD_REG_NUMBER( L, "EGC_ON_MEM_LIMIT", EGC_ON_MEM_LIMIT );
   MOD_REG_NUMBER( L, "EGC_ALWAYS", EGC_ALWAYS );
+  MOD_REG_NUMBER( L, "EGC_ADAPTIVE", EGC_ADAPTIVE );
   return 1;
 #endif
 }
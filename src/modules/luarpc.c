@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
+#include <errno.h>
 #ifdef __MINGW32__
 void *alloca(size_t);
 #else
@@ -58,6 +59,7 @@ LUALIB_API int luaopen_rpc( lua_State *L );
 Handle *handle_create( lua_State *L );
 static void rpc_dispatch_helper( lua_State *L, ServerHandle *handle );
 static int rpc_adispatch_helper( lua_State *L, ServerHandle * handle );
+static void handle_sync( lua_State *L, Handle *h );
 
 struct exception_context the_exception_context[ 1 ];
 
@@ -102,16 +104,35 @@ enum {
   RPC_TABLE_END,
   RPC_FUNCTION,
   RPC_FUNCTION_END,
-  RPC_REMOTE
+  RPC_REMOTE,
+  RPC_ARRAY,
+  RPC_KEYREF
 };
 
+// Element types of packed arrays (RPC_ARRAY): signed integers of the given
+// size in bytes, or lua_Numbers in the negotiated format
+enum
+{
+  RPC_ARRAY_NUMBER = 0,
+  RPC_ARRAY_INT8 = 1,
+  RPC_ARRAY_INT16 = 2,
+  RPC_ARRAY_INT32 = 4
+};
+
+// Packed arrays are converted through a buffer of this size
+#define RPC_ARRAY_CHUNK 64
+
+// Maximum number of distinct table keys interned while sending one value
+#define RPC_MAX_KEYREFS 255
+
 // RPC Commands
 enum
 {
   RPC_CMD_CALL = 1,
   RPC_CMD_GET,
   RPC_CMD_CON,
-  RPC_CMD_NEWINDEX
+  RPC_CMD_NEWINDEX,
+  RPC_CMD_BATCH
 };
 
 // RPC Status Codes
@@ -122,7 +143,10 @@ enum
   RPC_DONE
 };
 
-enum { RPC_PROTOCOL_VERSION = 3 };
+enum { RPC_PROTOCOL_VERSION = 5 };
+
+// A batch frame starts with RPC_CMD_BATCH and the u32 number of calls
+enum { RPC_BATCH_HEADER_SIZE = 5 };
 
 
 // return a string representation of an error number
@@ -145,6 +169,37 @@ static const char * errorString( int n )
 // **************************************************************************
 // transport layer generics
 
+// write to the transport, or append to its frame buffer if a frame of calls
+// is being assembled
+static void transport_put( Transport *tpt, const u8 *buffer, int length )
+{
+  struct exception e;
+  u32 size;
+  u8 *p;
+
+  if( !tpt->staging )
+  {
+    transport_write_buffer( tpt, buffer, length );
+    return;
+  }
+  if( tpt->wlen + length > tpt->wsize )
+  {
+    size = tpt->wsize ? tpt->wsize : RPC_BATCH_INIT_SIZE;
+    while( size < tpt->wlen + length )
+      size <<= 1;
+    if( ( p = ( u8 * )realloc( tpt->wbuf, size ) ) == NULL )
+    {
+      e.errnum = ENOMEM;
+      e.type = nonfatal;
+      Throw( e );
+    }
+    tpt->wbuf = p;
+    tpt->wsize = size;
+  }
+  memcpy( tpt->wbuf + tpt->wlen, buffer, length );
+  tpt->wlen += length;
+}
+
 // read arbitrary length from the transport into a string buffer.
 static void transport_read_string( Transport *tpt, const char *buffer, int length )
 {
@@ -155,7 +210,7 @@ static void transport_read_string( Transport *tpt, const char *buffer, int lengt
 // write arbitrary length string buffer to the transport
 static void transport_write_string( Transport *tpt, const char *buffer, int length )
 {
-  transport_write_buffer( tpt, ( u8 * )buffer, length );
+  transport_put( tpt, ( u8 * )buffer, length );
 }
 
 
@@ -175,7 +230,7 @@ static void transport_write_u8( Transport *tpt, u8 x )
 {
   struct exception e;
   TRANSPORT_VERIFY_OPEN;
-  transport_write_buffer( tpt, &x, 1 );
+  transport_put( tpt, &x, 1 );
 }
 
 static void swap_bytes( uint8_t *number, size_t numbersize )
@@ -216,7 +271,7 @@ static void transport_write_u32( Transport *tpt, u32 x )
   ub.i = ( uint32_t )x;
   if( tpt->net_little != tpt->loc_little )
     swap_bytes( ( uint8_t * )ub.b, 4 );
-  transport_write_buffer( tpt, ub.b, 4 );
+  transport_put( tpt, ub.b, 4 );
 }
 
 // read a lua number from the transport
@@ -273,25 +328,25 @@ static void transport_write_number( Transport *tpt, lua_Number x )
     {
       case 1: {
         int8_t y = ( int8_t )x;
-        transport_write_buffer( tpt, ( u8 * )&y, 1 );
+        transport_put( tpt, ( u8 * )&y, 1 );
       } break;
       case 2: {
         int16_t y = ( int16_t )x;
         if( tpt->net_little != tpt->loc_little )
           swap_bytes( ( uint8_t * )&y, 2 );
-        transport_write_buffer( tpt, ( u8 * )&y, 2 );
+        transport_put( tpt, ( u8 * )&y, 2 );
       } break;
       case 4: {
         int32_t y = ( int32_t )x;
         if( tpt->net_little != tpt->loc_little )
           swap_bytes( ( uint8_t * )&y, 4 );
-        transport_write_buffer( tpt,( u8 * )&y, 4 );
+        transport_put( tpt,( u8 * )&y, 4 );
       } break;
       case 8: {
         int64_t y = ( int64_t )x;
         if( tpt->net_little != tpt->loc_little )
           swap_bytes( ( uint8_t * )&y, 8 );
-        transport_write_buffer( tpt, ( u8 * )&y, 8 );
+        transport_put( tpt, ( u8 * )&y, 8 );
       } break;
       default: lua_assert(0);
     }
@@ -300,7 +355,7 @@ static void transport_write_number( Transport *tpt, lua_Number x )
   {
     if( tpt->net_little != tpt->loc_little )
        swap_bytes( ( uint8_t * )&x, 8 );
-    transport_write_buffer( tpt, ( u8 * )&x, 8 );
+    transport_put( tpt, ( u8 * )&x, 8 );
   }
 }
 
@@ -350,21 +405,165 @@ static int ismetatable_type( lua_State *L, int ud, const char *tname )
 static void write_variable( Transport *tpt, lua_State *L, int var_index );
 static int read_variable( Transport *tpt, lua_State *L );
 
+// tables are sent as a key/value stream, except for arrays of numbers
+// (keys 1..n, numeric values) that are sent as a packed block:
+//   RPC_ARRAY, element type, u32 n, n elements
+// string keys are interned while sending a value: the first occurrence of a
+// key is sent as a RPC_STRING and both sides number it, later occurrences
+// are sent as RPC_KEYREF and the u8 number of the key.
+
+static void write_value( Transport *tpt, lua_State *L, int var_index, int keys );
+
+// check if the table at the given index is an array of numbers. returns the
+// narrowest element type able to hold all values or -1 if the table can't be
+// packed, and the number of elements in *pn.
+static int array_type( lua_State *L, int table_index, u32 *pn )
+{
+  u32 n = ( u32 )lua_objlen( L, table_index ), count = 0;
+  int type = RPC_ARRAY_INT8;
+  lua_Number k, v;
+
+  if( n == 0 )
+    return -1;
+  lua_pushnil( L );
+  while( lua_next( L, table_index ) )
+  {
+    if( lua_type( L, -2 ) != LUA_TNUMBER || lua_type( L, -1 ) != LUA_TNUMBER )
+    {
+      lua_pop( L, 2 );
+      return -1;
+    }
+    k = lua_tonumber( L, -2 );
+    v = lua_tonumber( L, -1 );
+    lua_pop( L, 1 );
+    if( k < 1 || k > n || k != ( lua_Number )( u32 )k )
+    {
+      lua_pop( L, 1 );
+      return -1;
+    }
+    if( type == RPC_ARRAY_NUMBER )
+      ;
+    else if( v < -2147483647.0 - 1 || v > 2147483647.0 || v != ( lua_Number )( int32_t )v )
+      type = RPC_ARRAY_NUMBER;
+    else if( v < -32768 || v > 32767 )
+      type = RPC_ARRAY_INT32;
+    else if( ( v < -128 || v > 127 ) && type < RPC_ARRAY_INT16 )
+      type = RPC_ARRAY_INT16;
+    count ++;
+  }
+  *pn = n;
+  return count == n ? type : -1;
+}
+
+// write the packed elements of an array of numbers
+static void write_array( Transport *tpt, lua_State *L, int table_index, u32 n, int type )
+{
+  u8 buf[ RPC_ARRAY_CHUNK ];
+  unsigned pos = 0;
+  u32 i;
+  int32_t y;
+
+  transport_write_u8( tpt, ( u8 )type );
+  transport_write_u32( tpt, n );
+  for( i = 1; i <= n; i ++ )
+  {
+    lua_rawgeti( L, table_index, ( int )i );
+    if( type == RPC_ARRAY_NUMBER )
+      transport_write_number( tpt, lua_tonumber( L, -1 ) );
+    else
+    {
+      y = ( int32_t )lua_tonumber( L, -1 );
+      if( pos + type > sizeof( buf ) )
+      {
+        transport_put( tpt, buf, pos );
+        pos = 0;
+      }
+      if( type == RPC_ARRAY_INT8 )
+        buf[ pos ] = ( u8 )y;
+      else if( type == RPC_ARRAY_INT16 )
+      {
+        int16_t z = ( int16_t )y;
+        memcpy( buf + pos, &z, 2 );
+      }
+      else
+        memcpy( buf + pos, &y, 4 );
+      if( type > 1 && tpt->net_little != tpt->loc_little )
+        swap_bytes( ( uint8_t * )buf + pos, type );
+      pos += type;
+    }
+    lua_pop( L, 1 );
+  }
+  if( pos > 0 )
+    transport_put( tpt, buf, pos );
+}
+
+// write a table key, using the number of the key if it was already sent
+static void write_key( Transport *tpt, lua_State *L, int key_index, int keys )
+{
+  int nkeys;
+
+  if( lua_type( L, key_index ) == LUA_TSTRING )
+  {
+    lua_pushvalue( L, key_index );
+    lua_rawget( L, keys );
+    if( lua_isnumber( L, -1 ) )
+    {
+      transport_write_u8( tpt, RPC_KEYREF );
+      transport_write_u8( tpt, ( u8 )lua_tonumber( L, -1 ) );
+      lua_pop( L, 1 );
+      return;
+    }
+    lua_pop( L, 1 );
+    if( ( nkeys = ( int )lua_objlen( L, keys ) ) < RPC_MAX_KEYREFS )
+    {
+      // keys[ key ] = number and keys[ number ] = key, so objlen counts keys
+      lua_pushvalue( L, key_index );
+      lua_pushnumber( L, nkeys + 1 );
+      lua_rawset( L, keys );
+      lua_pushvalue( L, key_index );
+      lua_rawseti( L, keys, nkeys + 1 );
+    }
+  }
+  write_value( tpt, L, key_index, keys );
+}
+
 // write a table at the given index in the stack. the index must be absolute
 // (i.e. positive).
 // @@@ circular table references will cause stack overflow!
-static void write_table( Transport *tpt, lua_State *L, int table_index )
+static void write_table( Transport *tpt, lua_State *L, int table_index, int keys )
 {
+  u32 n;
+  int type = array_type( L, table_index, &n );
+  int own_keys = 0;
+
+  if( type >= 0 )
+  {
+    transport_write_u8( tpt, RPC_ARRAY );
+    write_array( tpt, L, table_index, n, type );
+    return;
+  }
+
+  // key numbering is shared by all the tables of the value being sent
+  if( keys == 0 )
+  {
+    lua_newtable( L );
+    keys = lua_gettop( L );
+    own_keys = 1;
+  }
+  transport_write_u8( tpt, RPC_TABLE );
   lua_pushnil( L );  // push first key
   while ( lua_next( L, table_index ) )
   {
     // next key and value were pushed on the stack
-    write_variable( tpt, L, lua_gettop( L ) - 1 );
-    write_variable( tpt, L, lua_gettop( L ) );
+    write_key( tpt, L, lua_gettop( L ) - 1, keys );
+    write_value( tpt, L, lua_gettop( L ), keys );
 
     // remove value, keep key for next iteration
     lua_pop( L, 1 );
   }
+  transport_write_u8( tpt, RPC_TABLE_END );
+  if( own_keys )
+    lua_pop( L, 1 );
 }
 
 static int writer( lua_State *L, const void* b, size_t size, void* B ) {
@@ -434,9 +633,10 @@ static void write_function( Transport *tpt, lua_State *L, int var_index )
 static void helper_remote_index( Helper *helper );
 
 // write a variable at the given index in the stack. the index must be absolute
-// (i.e. positive).
+// (i.e. positive). keys is the stack index of the interned keys of the value
+// being sent, or 0 if this is the start of a new value.
 
-static void write_variable( Transport *tpt, lua_State *L, int var_index )
+static void write_value( Transport *tpt, lua_State *L, int var_index, int keys )
 {
   int stack_at_start = lua_gettop( L );
 
@@ -460,9 +660,7 @@ static void write_variable( Transport *tpt, lua_State *L, int var_index )
     }
 
     case LUA_TTABLE:
-      transport_write_u8( tpt, RPC_TABLE );
-      write_table( tpt, L, var_index );
-      transport_write_u8( tpt, RPC_TABLE_END );
+      write_table( tpt, L, var_index, keys );
       break;
 
     case LUA_TNIL:
@@ -500,20 +698,111 @@ static void write_variable( Transport *tpt, lua_State *L, int var_index )
   lua_assert( lua_gettop( L ) == stack_at_start );
 }
 
+static void write_variable( Transport *tpt, lua_State *L, int var_index )
+{
+  write_value( tpt, L, var_index, 0 );
+}
+
+
+static int read_value( Transport *tpt, lua_State *L, u8 type, int keys );
 
-// read a table and push in onto the stack
-static void read_table( Transport *tpt, lua_State *L )
+// read a table and push in onto the stack. keys is the stack index of the
+// keys interned so far in the value being read, or 0.
+static void read_table( Transport *tpt, lua_State *L, int keys )
 {
-  int table_index;
+  struct exception e;
+  int table_index, nkeys, own_keys = 0;
+  u8 type;
+
+  if( keys == 0 )
+  {
+    lua_newtable( L );
+    keys = lua_gettop( L );
+    own_keys = 1;
+  }
   lua_newtable( L );
   table_index = lua_gettop( L );
   for ( ;; )
   {
-    if( !read_variable( tpt, L ) )
-      return;
-    read_variable( tpt, L );
+    type = transport_read_u8( tpt );
+    if( type == RPC_TABLE_END )
+      break;
+    if( type == RPC_KEYREF )
+    {
+      lua_rawgeti( L, keys, transport_read_u8( tpt ) );
+      if( lua_isnil( L, -1 ) )
+      {
+        e.errnum = ERR_PROTOCOL;
+        e.type = fatal;
+        Throw( e );
+      }
+    }
+    else
+    {
+      read_value( tpt, L, type, keys );
+      // number string keys in the order they are received, like the sender
+      if( type == RPC_STRING && ( nkeys = ( int )lua_objlen( L, keys ) ) < RPC_MAX_KEYREFS )
+      {
+        lua_pushvalue( L, -1 );
+        lua_rawseti( L, keys, nkeys + 1 );
+      }
+    }
+    read_value( tpt, L, transport_read_u8( tpt ), keys );
     lua_rawset( L, table_index );
   }
+  if( own_keys )
+    lua_remove( L, keys );
+}
+
+// read a packed array of numbers and push it onto the stack
+static void read_array( Transport *tpt, lua_State *L )
+{
+  struct exception e;
+  u8 buf[ RPC_ARRAY_CHUNK ];
+  u8 type = transport_read_u8( tpt );
+  u32 i, n = transport_read_u32( tpt );
+  unsigned pos = 0, len = 0;
+  int32_t y;
+
+  if( type != RPC_ARRAY_NUMBER && type != RPC_ARRAY_INT8 &&
+      type != RPC_ARRAY_INT16 && type != RPC_ARRAY_INT32 )
+  {
+    e.errnum = ERR_PROTOCOL;
+    e.type = fatal;
+    Throw( e );
+  }
+  lua_createtable( L, ( int )n, 0 );
+  for( i = 1; i <= n; i ++ )
+  {
+    if( type == RPC_ARRAY_NUMBER )
+      lua_pushnumber( L, transport_read_number( tpt ) );
+    else
+    {
+      if( pos == len )
+      {
+        len = sizeof( buf );
+        if( ( n - i + 1 ) * type < len )
+          len = ( n - i + 1 ) * type;
+        transport_read_buffer( tpt, buf, len );
+        pos = 0;
+      }
+      if( type > 1 && tpt->net_little != tpt->loc_little )
+        swap_bytes( ( uint8_t * )buf + pos, type );
+      if( type == RPC_ARRAY_INT8 )
+        y = ( int8_t )buf[ pos ];
+      else if( type == RPC_ARRAY_INT16 )
+      {
+        int16_t z;
+        memcpy( &z, buf + pos, 2 );
+        y = z;
+      }
+      else
+        memcpy( &y, buf + pos, 4 );
+      pos += type;
+      lua_pushnumber( L, ( lua_Number )y );
+    }
+    lua_rawseti( L, -2, ( int )i );
+  }
 }
 
 // read function and load
@@ -557,13 +846,12 @@ static void read_index( Transport *tpt, lua_State *L )
 }
 
 
-// read a variable and push in onto the stack. this returns 1 if a "normal"
-// variable was read, or 0 if an end-table or end-function marker was read (in which case
-// nothing is pushed onto the stack).
-static int read_variable( Transport *tpt, lua_State *L )
+// read a variable of the given type and push in onto the stack. this returns 1
+// if a "normal" variable was read, or 0 if an end-table or end-function marker
+// was read (in which case nothing is pushed onto the stack).
+static int read_value( Transport *tpt, lua_State *L, u8 type, int keys )
 {
   struct exception e;
-  u8 type = transport_read_u8( tpt );
 
   switch( type )
   {
@@ -590,7 +878,11 @@ static int read_variable( Transport *tpt, lua_State *L )
     }
 
     case RPC_TABLE:
-      read_table( tpt, L );
+      read_table( tpt, L, keys );
+      break;
+
+    case RPC_ARRAY:
+      read_array( tpt, L );
       break;
 
     case RPC_TABLE_END:
@@ -615,6 +907,11 @@ static int read_variable( Transport *tpt, lua_State *L )
   return 1;
 }
 
+static int read_variable( Transport *tpt, lua_State *L )
+{
+  return read_value( tpt, L, transport_read_u8( tpt ), 0 );
+}
+
 
 // **************************************************************************
 // rpc utilities
@@ -757,11 +1054,34 @@ Handle *handle_create( lua_State *L )
   luaL_getmetatable( L, "rpc.handle" );
   lua_setmetatable( L, -2 );
   h->error_handler = LUA_NOREF;
-  h->async = 0;
-  h->read_reply_count = 0;
+  h->pending = LUA_NOREF;
+  h->seq_sent = h->seq_read = 0;
+  h->batch_calls = h->wmark = 0;
+  h->batching = 0;
+  h->tpt.staging = 0;
+  h->tpt.wbuf = NULL;
+  h->tpt.wlen = h->tpt.wsize = 0;
   return h;
 }
 
+// release the frame buffer of a handle
+static void handle_free_frame( Handle *h )
+{
+  free( h->tpt.wbuf );
+  h->tpt.wbuf = NULL;
+  h->tpt.wlen = h->tpt.wsize = 0;
+  h->tpt.staging = 0;
+  h->batch_calls = 0;
+}
+
+static int handle_gc( lua_State *L )
+{
+  Handle *h = ( Handle * )lua_touserdata( L, 1 );
+
+  handle_free_frame( h );
+  return 0;
+}
+
 static Helper *helper_create( lua_State *L, Handle *handle, const char *funcname )
 {
   Helper *h = ( Helper * )lua_newuserdata( L, sizeof( Helper ) );
@@ -882,6 +1202,7 @@ static int helper_get( lua_State *L, Helper *helper )
 
   Try
   {
+    handle_sync( L, helper->handle );
     helper_wait_ready( tpt, RPC_CMD_GET );
     helper_remote_index( helper );
 
@@ -897,38 +1218,243 @@ static int helper_get( lua_State *L, Helper *helper )
 }
 
 
-// static int helper_async( lua_State *L )
-// {
-//     /* first read out any pending return values for old async calls */
-//     for (; h->handle->read_reply_count > 0; h->handle->read_reply_count--) {
-//       ret_code = transport_read_u8 (tpt);   /* return code */
-//       if( ret_code == 0 )
-//       {
-//         /* read return arguments, ignore everything we read */
-//         nret = transport_read_u32( tpt );
+// **************************************************************************
+// asynchronous and batched calls (client side)
 //
-//         for (i=0; i < ( ( int ) nret ); i++)
-//           read_variable (tpt,L);
+//  an asynchronous call is written to the link without waiting for the
+//  server and returns a future (a pointer to a Future object). the server
+//  answers calls in the order it received them, so replies are read back in
+//  FIFO order when a future is called, when rpc.flush is called or before any
+//  synchronous operation on the same handle.
 //
-//         lua_pop (L,nret);
-//       }
-//       else
-//       {
-//         /* read error and handle it */
-//         u32 code = transport_read_u32( tpt );
-//         u32 len = transport_read_u32( tpt );
-//         char *err_string = ( char * )alloca( len + 1 );
-//         transport_read_string( tpt, err_string, len );
-//         err_string[ len ] = 0;
+//  calls are sent as a RPC_CMD_BATCH frame: the command, the number of calls
+//  and then for each call the function name and arguments as in RPC_CMD_CALL.
+//  the whole frame is assembled in tpt.wbuf and written to the link at once.
+//  outside of batch mode (rpc.batch) each frame holds a single call.
 //
-//         deal_with_error( L, h->handle, err_string );
-//         freturn = 0;
-//       }
-//     }
-// }
+//  nothing stops the server from answering while the client is still
+//  writing, and the client reads nothing while it writes. so a frame is sent
+//  as soon as it grows past RPC_MAX_FRAME_SIZE, and no more than
+//  RPC_MAX_INFLIGHT calls are left without a reply: the oldest replies are
+//  read (and stored in their futures) before a new call is queued.
+
+// send the frame being assembled (if any) to the server
+static void handle_flush_frame( Handle *h )
+{
+  Transport *tpt = &h->tpt;
+  u32 n = h->batch_calls;
+
+  if( !tpt->staging )
+    return;
+  if( n > 0 )
+  {
+    // fill in the frame header, leaving out any partially written call
+    tpt->wlen = 0;
+    transport_write_u8( tpt, RPC_CMD_BATCH );
+    transport_write_u32( tpt, n );
+  }
+  tpt->staging = 0;
+  h->batch_calls = 0;
+  if( n > 0 )
+    transport_write_buffer( tpt, tpt->wbuf, h->wmark );
+}
+
+// read the reply for the oldest outstanding asynchronous call and store it in
+// its future (if the future is still around)
+static void handle_read_reply( lua_State *L, Handle *h )
+{
+  struct exception e;
+  Transport *tpt = &h->tpt;
+  Future *f = NULL;
+  int top = lua_gettop( L );
+  u32 i, nret = 0;
+  u8 ret_code;
+
+  ret_code = transport_read_u8( tpt );
+  if( ret_code == 0 )
+  {
+    // read return arguments and pack them in a table
+    nret = transport_read_u32( tpt );
+    for ( i = 0; i < nret; i ++ )
+      read_variable( tpt, L );
+    lua_createtable( L, ( int )nret, 1 );
+    lua_insert( L, top + 1 );
+    for ( i = nret; i > 0; i -- )
+      lua_rawseti( L, top + 1, ( int )i );
+    lua_pushnumber( L, nret );
+    lua_setfield( L, top + 1, "n" );
+  }
+  else if( ret_code == 1 )
+  {
+    // read error message
+    transport_read_u32( tpt ); // read code (not being used here)
+    u32 len = transport_read_u32( tpt );
+    char *err_string = ( char * )alloca( len + 1 );
+    transport_read_string( tpt, err_string, len );
+    lua_pushlstring( L, err_string, len );
+  }
+  else
+  {
+    e.errnum = ERR_PROTOCOL;
+    e.type = fatal;
+    Throw( e );
+  }
+  h->seq_read ++;
+
+  // hand the reply over to its future
+  lua_rawgeti( L, LUA_REGISTRYINDEX, h->pending );
+  lua_rawgeti( L, -1, ( int )h->seq_read );
+  if( lua_isuserdata( L, -1 ) )
+  {
+    f = ( Future * )lua_touserdata( L, -1 );
+    lua_pushnil( L );
+    lua_rawseti( L, -3, ( int )h->seq_read );
+  }
+  lua_pop( L, 2 );
+  if( f )
+  {
+    f->state = ret_code == 0 ? RPC_FUTURE_DONE : RPC_FUTURE_ERROR;
+    f->results = luaL_ref( L, LUA_REGISTRYINDEX );
+  }
+  lua_settop( L, top );
+}
+
+// send pending calls and read all outstanding replies, so that a synchronous
+// command can be issued
+static void handle_sync( lua_State *L, Handle *h )
+{
+  handle_flush_frame( h );
+  while( h->seq_read != h->seq_sent )
+    handle_read_reply( L, h );
+}
+
+// queue a call to the remote function designated by helper, with the
+// arguments found on the stack starting at index argidx, and return a future
+static int helper_async( lua_State *L, Helper *helper, int argidx )
+{
+  struct exception e;
+  Handle *h = helper->handle;
+  Transport *tpt = &h->tpt;
+  Future *f;
+  int i, n = lua_gettop( L );
+
+  f = ( Future * )lua_newuserdata( L, sizeof( Future ) );
+  luaL_getmetatable( L, "rpc.future" );
+  lua_setmetatable( L, -2 );
+  f->handle = h;
+  f->href = LUA_REFNIL;
+  f->results = LUA_REFNIL;
+  f->seq = 0;
+  f->state = RPC_FUTURE_PENDING;
+
+  if( h->pending == LUA_NOREF )
+  {
+    lua_newtable( L );
+    h->pending = luaL_ref( L, LUA_REGISTRYINDEX );
+  }
+
+  Try
+  {
+    // make room for the call in the link: collect the oldest replies
+    if( h->seq_sent - h->seq_read >= RPC_MAX_INFLIGHT )
+    {
+      handle_flush_frame( h );
+      while( h->seq_sent - h->seq_read >= RPC_MAX_INFLIGHT )
+        handle_read_reply( L, h );
+    }
+
+    // append the call to the current frame, dropping leftovers of a call
+    // that failed halfway through
+    if( !tpt->staging )
+    {
+      tpt->staging = 1;
+      h->wmark = RPC_BATCH_HEADER_SIZE;
+      h->batch_calls = 0;
+    }
+    tpt->wlen = h->wmark;
+    helper_remote_index( helper );
+    transport_write_u32( tpt, n - argidx + 1 );
+    for( i = argidx; i <= n; i ++ )
+      write_variable( tpt, L, i );
+    h->wmark = tpt->wlen;
+    h->batch_calls ++;
+
+    // keep the future (and through it the handle) alive until its reply is read
+    f->seq = ++ h->seq_sent;
+    lua_rawgeti( L, LUA_REGISTRYINDEX, h->pending );
+    lua_pushvalue( L, n + 1 );
+    lua_rawseti( L, -2, ( int )f->seq );
+    lua_pop( L, 1 );
+    lua_pushvalue( L, 1 ); // calling helper, which references the handle
+    f->href = luaL_ref( L, LUA_REGISTRYINDEX );
 
+    if( !h->batching || h->wmark >= RPC_MAX_FRAME_SIZE )
+      handle_flush_frame( h );
+  }
+  Catch( e )
+  {
+    return generic_catch_handler( L, h, e );
+  }
+  lua_settop( L, n + 1 );
+  return 1;
+}
 
+// calling a future waits for the reply of its call and returns its results
+static int future_call( lua_State *L )
+{
+  struct exception e;
+  Future *f;
+  Handle *h;
+  int i, nret;
 
+  f = ( Future * )luaL_checkudata( L, 1, "rpc.future" );
+  luaL_argcheck( L, f, 1, "future expected" );
+  h = f->handle;
+
+  if( f->state == RPC_FUTURE_PENDING )
+  {
+    Try
+    {
+      handle_flush_frame( h );
+      while( f->state == RPC_FUTURE_PENDING && h->seq_read != h->seq_sent )
+        handle_read_reply( L, h );
+      if( f->state == RPC_FUTURE_PENDING )
+      {
+        e.errnum = ERR_PROTOCOL;
+        e.type = nonfatal;
+        Throw( e );
+      }
+    }
+    Catch( e )
+    {
+      return generic_catch_handler( L, h, e );
+    }
+  }
+
+  lua_rawgeti( L, LUA_REGISTRYINDEX, f->results );
+  if( f->state == RPC_FUTURE_ERROR )
+  {
+    deal_with_error( L, h, lua_tostring( L, -1 ) );
+    return 0;
+  }
+  lua_getfield( L, -1, "n" );
+  nret = ( int )lua_tonumber( L, -1 );
+  lua_pop( L, 1 );
+  luaL_checkstack( L, nret, "too many results" );
+  for( i = 1; i <= nret; i ++ )
+    lua_rawgeti( L, -i, i );
+  return nret;
+}
+
+static int future_gc( lua_State *L )
+{
+  Future *f = ( Future * )lua_touserdata( L, 1 );
+
+  luaL_unref( L, LUA_REGISTRYINDEX, f->results );
+  luaL_unref( L, LUA_REGISTRYINDEX, f->href );
+  f->results = f->href = LUA_REFNIL;
+  return 0;
+}
 
 static int helper_call (lua_State *L)
 {
@@ -948,6 +1474,8 @@ static int helper_call (lua_State *L)
     helper_get( L, h->parent );
     freturn = 1;
   }
+  else if( h->parent && strcmp( "async", h->funcname ) == 0 )
+    freturn = helper_async( L, h->parent, 3 );
   else
   {
     Try
@@ -955,7 +1483,8 @@ static int helper_call (lua_State *L)
       int i,n;
       u32 nret,ret_code;
 
-      // write function name
+      // collect replies of asynchronous calls, then write function name
+      handle_sync( L, h->handle );
       helper_wait_ready( tpt, RPC_CMD_CALL );
       helper_remote_index( h );
 
@@ -967,13 +1496,6 @@ static int helper_call (lua_State *L)
       for( i = 2; i <= n; i ++ )
         write_variable( tpt, L, i );
 
-      /* if we're in async mode, we're done */
-      /*if ( h->handle->async )
-      {
-        h->handle->read_reply_count++;
-        freturn = 0;
-      }*/
-
       // read return code
       ret_code = transport_read_u8( tpt );
 
@@ -1027,6 +1549,7 @@ static int helper_newindex( lua_State *L )
   Try
   {
     // index destination on remote side
+    handle_sync( L, h->handle );
     helper_wait_ready( tpt, RPC_CMD_NEWINDEX );
     helper_remote_index( h );
 
@@ -1114,6 +1637,8 @@ static ServerHandle *server_handle_create( lua_State *L )
 
   transport_init( &h->ltpt );
   transport_init( &h->atpt );
+  h->ltpt.staging = h->atpt.staging = 0;
+  h->ltpt.wbuf = h->atpt.wbuf = NULL;
   return h;
 }
 
@@ -1175,6 +1700,7 @@ static int rpc_close( lua_State *L )
     {
       Handle *handle = ( Handle * )lua_touserdata( L, 1 );
       transport_close( &handle->tpt );
+      handle_free_frame( handle );
       return 0;
     }
     if( ismetatable_type( L, 1, "rpc.server_handle" ) )
@@ -1189,28 +1715,47 @@ static int rpc_close( lua_State *L )
 }
 
 
-// rpc_async (handle,)
-//     this sets a handle's asynchronous calling mode (0/nil=off, other=on).
-//     (this is for the client only).
-//     @@@ Before re-enabling, this should be brought up to date with multi-command architecture
+// rpc_batch( handle )
+//     queue the following asynchronous calls on handle until rpc.flush is
+//     called, then send them to the server in a single frame.
+
+static int rpc_batch( lua_State *L )
+{
+  Handle *handle;
+
+  check_num_args( L, 1 );
+  handle = ( Handle * )luaL_checkudata( L, 1, "rpc.handle" );
+  luaL_argcheck( L, handle, 1, "handle expected" );
+
+  handle->batching = 1;
+  return 0;
+}
 
-// static int rpc_async (lua_State *L)
-// {
-//   Handle *handle;
-//   check_num_args( L, 2 );
-//
-//   if ( !lua_isuserdata( L, 1 ) || !ismetatable_type( L, 1, "rpc.handle" ) )
-//     my_lua_error( L, "first arg must be client handle" );
-//
-//   handle = ( Handle * )lua_touserdata( L, 1 );
-//
-//   if ( lua_isnil( L, 2 ) || ( lua_isnumber( L, 2 ) && lua_tonumber( L, 2 ) == 0) )
-//     handle->async = 0;
-//   else
-//     handle->async = 1;
-//
-//   return 0;
-// }
+
+// rpc_flush( handle )
+//     leave batch mode, send queued calls and read the replies of all
+//     outstanding asynchronous calls on handle.
+
+static int rpc_flush( lua_State *L )
+{
+  struct exception e;
+  Handle *handle;
+
+  check_num_args( L, 1 );
+  handle = ( Handle * )luaL_checkudata( L, 1, "rpc.handle" );
+  luaL_argcheck( L, handle, 1, "handle expected" );
+
+  handle->batching = 0;
+  Try
+  {
+    handle_sync( L, handle );
+  }
+  Catch( e )
+  {
+    return generic_catch_handler( L, handle, e );
+  }
+  return 0;
+}
 
 //****************************************************************************
 // lua remote function server
@@ -1313,6 +1858,17 @@ static void read_cmd_call( Transport *tpt, lua_State *L )
 }
 
 
+// read a frame of calls and answer each one in order
+static void read_cmd_batch( Transport *tpt, lua_State *L )
+{
+  u32 i, ncalls;
+
+  ncalls = transport_read_u32( tpt );
+  for( i = 0; i < ncalls; i ++ )
+    read_cmd_call( tpt, L );
+}
+
+
 static void read_cmd_get( Transport *tpt, lua_State *L )
 {
   u32 len;
@@ -1506,6 +2062,9 @@ static void rpc_dispatch_helper( lua_State *L, ServerHandle *handle )
             transport_write_u8( &handle->atpt, RPC_READY );
             read_cmd_newindex( &handle->atpt, L );
             break;
+          case RPC_CMD_BATCH: // call functions, replies are not preceded by RPC_READY
+            read_cmd_batch( &handle->atpt, L );
+            break;
           default: // complain and throw exception if unknown command
             transport_write_u8(&handle->atpt, RPC_UNSUPPORTED_CMD );
             e.type = nonfatal;
@@ -1677,6 +2236,7 @@ const LUA_REG_TYPE rpc_handle[] =
 {
   { LSTRKEY( "__index" ), LFUNCVAL( handle_index ) },
   { LSTRKEY( "__newindex"), LFUNCVAL( handle_newindex )},
+  { LSTRKEY( "__gc" ), LFUNCVAL( handle_gc ) },
   { LNILKEY, LNILVAL }
 };
 
@@ -1689,6 +2249,13 @@ const LUA_REG_TYPE rpc_helper[] =
   { LNILKEY, LNILVAL }
 };
 
+const LUA_REG_TYPE rpc_future[] =
+{
+  { LSTRKEY( "__call" ), LFUNCVAL( future_call ) },
+  { LSTRKEY( "__gc" ), LFUNCVAL( future_gc ) },
+  { LNILKEY, LNILVAL }
+};
+
 const LUA_REG_TYPE rpc_server_handle[] =
 {
   { LNILKEY, LNILVAL }
@@ -1704,7 +2271,8 @@ const LUA_REG_TYPE rpc_map[] =
   {  LSTRKEY( "peek" ), LFUNCVAL( rpc_peek ) },
   {  LSTRKEY( "dispatch" ), LFUNCVAL( rpc_dispatch ) },
   {  LSTRKEY( "adispatch" ), LFUNCVAL( rpc_adispatch ) },
-//  {  LSTRKEY( "rpc_async" ), LFUNCVAL( rpc_async ) },
+  {  LSTRKEY( "batch" ), LFUNCVAL( rpc_batch ) },
+  {  LSTRKEY( "flush" ), LFUNCVAL( rpc_flush ) },
 #if LUA_OPTIMIZE_MEMORY > 0
 // {  LSTRKEY("mode"), LSTRVAL( LUARPC_MODE ) },
 #endif // #if LUA_OPTIMIZE_MEMORY > 0
@@ -1717,6 +2285,7 @@ LUALIB_API int luaopen_rpc(lua_State *L)
 #if LUA_OPTIMIZE_MEMORY > 0
   luaL_rometatable(L, "rpc.helper", (void*)rpc_helper);
   luaL_rometatable(L, "rpc.handle", (void*)rpc_handle);
+  luaL_rometatable(L, "rpc.future", (void*)rpc_future);
   luaL_rometatable(L, "rpc.server_handle", (void*)rpc_server_handle);
 #else
   luaL_register( L, "rpc", rpc_map );
@@ -1729,6 +2298,9 @@ LUALIB_API int luaopen_rpc(lua_State *L)
   luaL_newmetatable( L, "rpc.handle" );
   luaL_register( L, NULL, rpc_handle );
 
+  luaL_newmetatable( L, "rpc.future" );
+  luaL_register( L, NULL, rpc_future );
+
   luaL_newmetatable( L, "rpc.server_handle" );
 #endif
   return 1;
@@ -1740,6 +2312,7 @@ static const luaL_reg rpc_handle[] =
 {
   { "__index", handle_index },
   { "__newindex", handle_newindex },
+  { "__gc", handle_gc },
   { NULL, NULL }
 };
 
@@ -1752,6 +2325,13 @@ static const luaL_reg rpc_helper[] =
   { NULL, NULL }
 };
 
+static const luaL_reg rpc_future[] =
+{
+  { "__call", future_call },
+  { "__gc", future_gc },
+  { NULL, NULL }
+};
+
 static const luaL_reg rpc_server_handle[] =
 {
   { NULL, NULL }
@@ -1767,7 +2347,8 @@ static const luaL_reg rpc_map[] =
   { "peek", rpc_peek },
   { "dispatch", rpc_dispatch },
   { "adispatch", rpc_adispatch },
-//  { "rpc_async", rpc_async },
+  { "batch", rpc_batch },
+  { "flush", rpc_flush },
   { NULL, NULL }
 };
 
@@ -1784,6 +2365,9 @@ LUALIB_API int luaopen_rpc(lua_State *L)
   luaL_newmetatable( L, "rpc.handle" );
   luaL_register( L, NULL, rpc_handle );
 
+  luaL_newmetatable( L, "rpc.future" );
+  luaL_register( L, NULL, rpc_future );
+
   luaL_newmetatable( L, "rpc.server_handle" );
 
   return 1;
@@ -52,7 +52,14 @@
   PICOLISP_LIB_DEFINE(plisp_cpu_r16, cpu-r16),\
   PICOLISP_LIB_DEFINE(plisp_cpu_w8, cpu-w8),\
   PICOLISP_LIB_DEFINE(plisp_cpu_r8, cpu-r8),\
-  PICOLISP_LIB_DEFINE(plisp_cpu_clock, cpu-clock),
+  PICOLISP_LIB_DEFINE(plisp_cpu_clock, cpu-clock),\
+  PICOLISP_LIB_DEFINE(plisp_cpu_cli, cpu-cli),\
+  PICOLISP_LIB_DEFINE(plisp_cpu_sei, cpu-sei),\
+  PICOLISP_LIB_DEFINE(plisp_cpu_set_int_handler, cpu-set-int-handler),\
+  PICOLISP_LIB_DEFINE(plisp_cpu_get_int_handler, cpu-get-int-handler),\
+  PICOLISP_LIB_DEFINE(plisp_cpu_get_int_flag, cpu-get-int-flag),\
+  PICOLISP_LIB_DEFINE(plisp_cpu_set_int_priority, cpu-set-int-priority),\
+  PICOLISP_LIB_DEFINE(plisp_cpu_get_int_priority, cpu-get-int-priority),
 
 // timer module.
 #define PICOLISP_MOD_TIMER\
@@ -65,6 +72,7 @@
   PICOLISP_LIB_DEFINE(tmr_getmaxdelay, tmr-getmaxdelay),\
   PICOLISP_LIB_DEFINE(tmr_setclock, tmr-setclock),\
   PICOLISP_LIB_DEFINE(tmr_getclock, tmr-getclock),\
+  PICOLISP_LIB_DEFINE(tmr_set_match_int, tmr-set-match-int),\
   PICOLISP_LIB_DEFINE(tmr_decode, tmr-decode),
 
 // i2c module.
@@ -45,6 +45,10 @@
 #define HAS_TMR_MATCH_INT_PICOC
 #endif
 
+#if defined( BUILD_PICOLISP_INT_HANDLERS ) && defined( INT_TMR_MATCH )
+#define HAS_TMR_MATCH_INT_PICOLISP
+#endif
+
 #if defined ALCOR_LANG_PICOLISP
 
 // ****************************************************************************
@@ -221,12 +225,40 @@ any tmr_getclock(any ex) {
   return box(res);
 }
 
+// (tmr-set-match-int 'num 'num 'num) -> Nil
+any tmr_set_match_int(any ex) {
 #ifdef HAS_TMR_MATCH_INT_PICOLISP
-// TODO: For now, picoLisp on Alcor6L doesn't
-// support interrupts.
-// any tmr_set_match_int(any ex)
-// {}
+  unsigned id;
+  timer_data_type period;
+  int type;
+  u32 res;
+  any x, y;
+
+  x = cdr(ex), y = EVAL(car(x));
+  NeedNum(ex, y);
+  id = unBox(y); // get id.
+  MOD_CHECK_TIMER(ex, id);
+
+  x = cdr(x), y = EVAL(car(x));
+  NeedNum(ex, y);
+  period = (timer_data_type)unBox(y); // get period.
+
+  x = cdr(x), y = EVAL(car(x));
+  NeedNum(ex, y);
+  type = unBox(y); // get type.
+
+  res = platform_timer_set_match_int(id, period, type);
+  if (res == PLATFORM_TIMER_INT_TOO_SHORT)
+    err(ex, NULL, "timer interval too small");
+  else if (res == PLATFORM_TIMER_INT_TOO_LONG)
+    err(ex, NULL, "timer interval too long");
+  else if (res == PLATFORM_TIMER_INT_INVALID_ID)
+    err(ex, NULL, "match interrupt cannot be set on this timer");
+#else
+  err(ex, NULL, "timer match interrupts not available.");
 #endif // HAS_TMR_MATCH_INT_PICOLISP
+  return Nil;
+}
 
 // Look for all VIRTx timer identifiers.
 #if VTMR_NUM_TIMERS > 0
@@ -420,10 +452,23 @@ static void tmr_getclock(pstate *p, val *r, val **param, int n)
 }
 
 #ifdef HAS_TMR_MATCH_INT_PICOC
-// TODO: For now, PicoC on Alcor6L doesn't support
-// interrupts.
-// static void tmr_set_match_int(pstate *p, val *r, val **param, int n)
-// {}
+// PicoC: tmr_set_match_int(id, timeout, type);
+static void tmr_set_match_int(pstate *p, val *r, val **param, int n)
+{
+  unsigned id;
+  u32 res;
+
+  id = param[0]->Val->UnsignedInteger;
+  MOD_CHECK_TIMER(id);
+  res = platform_timer_set_match_int(id, param[1]->Val->UnsignedLongInteger,
+				     param[2]->Val->Integer);
+  if (res == PLATFORM_TIMER_INT_TOO_SHORT)
+    return pmod_error("timer interval too small");
+  else if (res == PLATFORM_TIMER_INT_TOO_LONG)
+    return pmod_error("timer interval too long");
+  else if (res == PLATFORM_TIMER_INT_INVALID_ID)
+    return pmod_error("match interrupt cannot be set on this timer");
+}
 #endif // HAS_TMR_MATCH_INT_PICOC
 
 #if VTMR_NUM_TIMERS > 0
@@ -480,6 +525,9 @@ const PICOC_REG_TYPE tmr_library[] = {
   {FUNC(tmr_getmaxdelay), PROTO("unsigned long tmr_getmaxdelay(unsigned int);")},
   {FUNC(tmr_setclock), PROTO("unsigned long tmr_setclock(unsigned int, unsigned long);")},
   {FUNC(tmr_getclock), PROTO("unsigned long tmr_getclock(unsigned int);")},
+#ifdef HAS_TMR_MATCH_INT_PICOC
+  {FUNC(tmr_set_match_int), PROTO("void tmr_set_match_int(unsigned int, unsigned long, int);")},
+#endif
 #if VTMR_NUM_TIMERS > 0
   {FUNC(tmr_decode), PROTO("unsigned long tmr_decode(char *);")},
 #endif
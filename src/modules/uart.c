@@ -484,10 +484,10 @@ static void uart_read_num(pstate *p, val *r, val **param, int n)
 // PicoC: data = uart_readn(id, max_num, timeout, timer_id);
 static void uart_readn(pstate *p, val *r, val **param, int n)
 {
-  int id, res;
+  int id;
   unsigned timer_id;
-  s32 maxsize = 0;
-  char cres; char *buf;
+  s32 maxsize = 0, count = 0, chunk;
+  u8 data[ 64 ]; char *buf;
   timer_data_type timeout;
   FILE *buf_stream;
   size_t buf_size;
@@ -505,14 +505,15 @@ static void uart_readn(pstate *p, val *r, val **param, int n)
   // Get timer and timeout information.
   uart_get_timeout_data(&timeout, &timer_id, param, 2, 3);
 
-  // Read data.
-  while (1) {
-    if ((res = platform_uart_recv(id, timer_id, timeout)) == -1)
-      break;
-    cres = (char)res;
-    fprintf(buf_stream, "%c", cres);
-    if (buf_size == maxsize)
+  // Read data (in blocks).
+  while (maxsize == 0 || count < maxsize) {
+    chunk = sizeof(data);
+    if (maxsize && maxsize - count < chunk)
+      chunk = maxsize - count;
+    if ((chunk = platform_uart_recv_n(id, timer_id, timeout, data, chunk)) == 0)
       break;
+    fwrite(data, 1, chunk, buf_stream);
+    count += chunk;
   }
   fflush(buf_stream);
   fclose(buf_stream);
@@ -778,7 +779,7 @@ static int uart_read( lua_State* L )
 {
   int id, res, mode, issign;
   unsigned timer_id = PLATFORM_TIMER_SYS_ID;
-  s32 maxsize = 0, count = 0;
+  s32 maxsize = 0, count = 0, chunk;
   const char *fmt;
   luaL_Buffer b;
   char cres;
@@ -812,7 +813,22 @@ static int uart_read( lua_State* L )
 
   // Read data
   luaL_buffinit( L, &b );
-  while( 1 )
+  if( mode == UART_READ_MODE_MAXSIZE )
+  {
+    // The data doesn't need to be checked, so read it in blocks
+    while( maxsize == 0 || count < maxsize )
+    {
+      chunk = LUAL_BUFFERSIZE;
+      if( maxsize && maxsize - count < chunk )
+        chunk = maxsize - count;
+      if( ( chunk = platform_uart_recv_n( id, timer_id, timeout, ( u8* )luaL_prepbuffer( &b ), chunk ) ) == 0 )
+        break;
+      luaL_addsize( &b, chunk );
+      count += chunk;
+    }
+  }
+  // Otherwise look at each char
+  while( mode != UART_READ_MODE_MAXSIZE )
   {
     if( ( res = platform_uart_recv( id, timer_id, timeout ) ) == -1 )
       break; 
@@ -828,8 +844,6 @@ static int uart_read( lua_State* L )
     if( isspace( cres ) && ( mode == UART_READ_MODE_SPACE ) )
       break;
     luaL_putchar( &b, cres );
-    if( ( count == maxsize ) && ( mode == UART_READ_MODE_MAXSIZE ) )
-      break;
   }
   luaL_pushresult( &b );
 
@@ -984,6 +984,586 @@ void ExpressionGetStructElement(struct ParseState *Parser, struct ExpressionStac
     }
 }
 
+#ifndef NO_COMPILED_BODIES
+/* expressions in compiled function bodies which only use integer variables, constants and
+ * operators are compiled into a list of stack operations once they've run a few times, and
+ * run from that from then on. anything else is parsed as usual */
+#define COMPILED_OPS_MAX 32                 /* longest compiled expression */
+#define COMPILED_VARIABLES_MAX 8            /* most variable references in a compiled expression */
+#define COMPILED_STACK_MAX 8                /* deepest value stack a compiled expression can use */
+
+#define COMPILED_WRITTEN 1                  /* the expression assigns to this variable */
+#define COMPILED_INDEXED 2                  /* the expression uses an element of this array or pointer */
+
+#define COMPILED_VALUE(n) ((LValue[n] == NULL) ? Stack[n] : (LValue[n]->Typ->Base == TypeInt) ? (long)LValue[n]->Val->Integer : ExpressionCoerceInteger(LValue[n]))
+
+/* like the parser, variables are pushed as lvalues and only read when an operator uses them */
+enum CompiledCode
+{
+    CompiledConstant,                       /* push Constant */
+    CompiledLoad,                           /* push variable Arg, or the element of it indexed by the top value */
+    CompiledStore,                          /* assign the top value to the lvalue under it using assignment operator Token */
+    CompiledIncrement,                      /* ++ or -- the lvalue on top and replace it with the new value */
+    CompiledIncrementAfter,                 /* ++ or -- the lvalue on top and replace it with the old value */
+    CompiledPrefix,                         /* apply prefix operator Token to the top value */
+    CompiledInfix,                          /* combine the top two values with infix operator Token */
+    CompiledAndJump,                        /* if the top value is false make it 0 and jump to Arg */
+    CompiledOrJump                          /* if the top value is true make it 1 and jump to Arg */
+};
+
+struct CompiledOp
+{
+    unsigned char Code;                     /* what to do - an enum CompiledCode */
+    unsigned char Token;                    /* the operator to apply */
+    unsigned short Arg;                     /* the variable or jump destination */
+    long Constant;                          /* the value to push */
+};
+
+/* a variable used by a compiled expression. it's looked up again whenever the frame or the tables it was found in change */
+struct CompiledVariable
+{
+    const char *Ident;                      /* the registered identifier */
+    unsigned char Use;                      /* COMPILED_WRITTEN and/or COMPILED_INDEXED */
+    char IsConstant;                        /* it's a macro for an integer constant */
+    unsigned short LocalChanges;            /* the frame's local table when it was looked up */
+    unsigned short GlobalChanges;           /* the global table when it was looked up */
+    unsigned int FrameSerial;               /* the frame it was looked up in */
+    struct Value *Val;                      /* what it was found to be, NULL until it's been looked up */
+    long Constant;                          /* the macro's value */
+};
+
+struct CompiledExpression
+{
+    struct CompiledExpression *Next;        /* the next expression in this hash bucket */
+    const unsigned char *Pos;               /* where the expression starts */
+    const unsigned char *EndPos;            /* where it ends */
+    short int EndLine;
+    short int EndCharacterPos;
+    unsigned char NumOps;                   /* 0 if the expression can't be compiled */
+    unsigned char NumVariables;
+    char IsBare;                            /* it's just a variable or a constant, with no operator */
+    struct CompiledOp *Op;
+    struct CompiledVariable *Variable;
+};
+
+/* the state of the compiler while it's reading an expression */
+struct ExpressionCompiler
+{
+    struct ParseState Parser;               /* where we're reading from */
+    struct CompiledOp Op[COMPILED_OPS_MAX];
+    const char *Ident[COMPILED_VARIABLES_MAX];
+    unsigned char Use[COMPILED_VARIABLES_MAX];
+    int NumOps;
+    int NumVariables;
+    int Depth;                              /* values on the stack at this point */
+    int MaxDepth;
+};
+
+static struct CompiledExpression *CompiledExpressionTable[COMPILED_EXPRESSION_TABLE_SIZE];
+static unsigned char CompiledExpressionHits[COMPILED_EXPRESSION_TABLE_SIZE];
+
+static int ExpressionCompileExpression(struct ExpressionCompiler *Compiler, int MinPrecedence, int *IsLValue);
+
+/* add an operation to the expression being compiled */
+static int ExpressionCompileOp(struct ExpressionCompiler *Compiler, enum CompiledCode Code, enum LexToken Token, int Arg, long Constant, int StackChange)
+{
+    struct CompiledOp *Op;
+    
+    if (Compiler->NumOps == COMPILED_OPS_MAX)
+        return FALSE;
+    
+    Op = &Compiler->Op[Compiler->NumOps++];
+    Op->Code = (unsigned char)Code;
+    Op->Token = (unsigned char)Token;
+    Op->Arg = (unsigned short)Arg;
+    Op->Constant = Constant;
+    
+    Compiler->Depth += StackChange;
+    if (Compiler->Depth > Compiler->MaxDepth)
+        Compiler->MaxDepth = Compiler->Depth;
+        
+    return TRUE;
+}
+
+/* mark the variable we've just loaded as the target of an assignment */
+static int ExpressionCompileLValue(struct ExpressionCompiler *Compiler, int IsLValue)
+{
+    if (!IsLValue)
+        return FALSE;
+    
+    Compiler->Use[Compiler->Op[Compiler->NumOps-1].Arg] |= COMPILED_WRITTEN;
+    return TRUE;
+}
+
+/* does this token end an expression? */
+static int ExpressionCompileEnds(enum LexToken Token)
+{
+    if (Token == TokenComma || Token == TokenColon || Token == TokenCloseBracket || Token == TokenRightSquareBracket)
+        return TRUE;
+    
+    return !((Token > TokenComma && Token <= TokenCharacterConstant) || IS_TYPE_TOKEN(Token));
+}
+
+/* compile a variable, array element or pointer element and any postfix operator after it */
+static int ExpressionCompileVariable(struct ExpressionCompiler *Compiler, const char *Ident, int *IsLValue)
+{
+    struct ParseState PreState;
+    enum LexToken Token;
+    int Var;
+    int Dummy;
+    
+    if (Compiler->NumVariables == COMPILED_VARIABLES_MAX)
+        return FALSE;
+    
+    Var = Compiler->NumVariables++;
+    Compiler->Ident[Var] = Ident;
+    Compiler->Use[Var] = 0;
+    
+    ParserCopyPos(&PreState, &Compiler->Parser);
+    Token = LexGetToken(&Compiler->Parser, NULL, TRUE);
+    if (Token == TokenOpenBracket)
+        return FALSE;       /* a function call */
+        
+    if (Token == TokenLeftSquareBracket)
+    {
+        Compiler->Use[Var] = COMPILED_INDEXED;
+        if (!ExpressionCompileExpression(Compiler, 0, &Dummy) || LexGetToken(&Compiler->Parser, NULL, TRUE) != TokenRightSquareBracket ||
+                !ExpressionCompileOp(Compiler, CompiledLoad, TokenIdentifier, Var, 0, 0))
+            return FALSE;
+            
+        ParserCopyPos(&PreState, &Compiler->Parser);
+        Token = LexGetToken(&Compiler->Parser, NULL, TRUE);
+    }
+    else if (!ExpressionCompileOp(Compiler, CompiledLoad, TokenIdentifier, Var, 0, 1))
+        return FALSE;
+    
+    if (Token == TokenIncrement || Token == TokenDecrement)
+    {
+        ExpressionCompileLValue(Compiler, TRUE);
+        *IsLValue = FALSE;
+        return ExpressionCompileOp(Compiler, CompiledIncrementAfter, Token, 0, 0, 0);
+    }
+    
+    ParserCopyPos(&Compiler->Parser, &PreState);
+    *IsLValue = TRUE;
+    return TRUE;
+}
+
+/* compile a value with any prefix operators in front of it */
+static int ExpressionCompileOperand(struct ExpressionCompiler *Compiler, int *IsLValue)
+{
+    struct Value *LexValue;
+    enum LexToken Token;
+    
+    *IsLValue = FALSE;
+    Token = LexGetToken(&Compiler->Parser, &LexValue, TRUE);
+    switch (Token)
+    {
+        case TokenIntegerConstant:
+            return ExpressionCompileOp(Compiler, CompiledConstant, Token, 0, (long)LexValue->Val->Integer, 1);
+            
+        case TokenCharacterConstant:
+            return ExpressionCompileOp(Compiler, CompiledConstant, Token, 0, (long)LexValue->Val->Character, 1);
+            
+        case TokenIdentifier:
+            return ExpressionCompileVariable(Compiler, LexValue->Val->Identifier, IsLValue);
+            
+        case TokenOpenBracket:
+            if (IS_TYPE_TOKEN(LexGetToken(&Compiler->Parser, NULL, FALSE)))
+                return FALSE;       /* a cast */
+                
+            return ExpressionCompileExpression(Compiler, 0, IsLValue) && LexGetToken(&Compiler->Parser, NULL, TRUE) == TokenCloseBracket;
+            
+        case TokenIncrement:
+        case TokenDecrement:
+            if (!ExpressionCompileOperand(Compiler, IsLValue) || !ExpressionCompileLValue(Compiler, *IsLValue))
+                return FALSE;
+            
+            *IsLValue = FALSE;
+            return ExpressionCompileOp(Compiler, CompiledIncrement, Token, 0, 0, 0);
+            
+        case TokenPlus:
+        case TokenMinus:
+        case TokenUnaryNot:
+        case TokenUnaryExor:
+            if (!ExpressionCompileOperand(Compiler, IsLValue))
+                return FALSE;
+                
+            *IsLValue = FALSE;
+            return ExpressionCompileOp(Compiler, CompiledPrefix, Token, 0, 0, 0);
+            
+        default:
+            return FALSE;
+    }
+}
+
+/* compile an expression down to operators of a given precedence */
+static int ExpressionCompileExpression(struct ExpressionCompiler *Compiler, int MinPrecedence, int *IsLValue)
+{
+    struct ParseState PreState;
+    enum LexToken Token;
+    int Precedence;
+    int RHSIsLValue;
+    int Jump;
+    
+    if (!ExpressionCompileOperand(Compiler, IsLValue))
+        return FALSE;
+        
+    while (TRUE)
+    {
+        ParserCopyPos(&PreState, &Compiler->Parser);
+        Token = LexGetToken(&Compiler->Parser, NULL, TRUE);
+        if (ExpressionCompileEnds(Token))
+        {
+            ParserCopyPos(&Compiler->Parser, &PreState);
+            return TRUE;
+        }
+        
+#ifdef NO_MODULUS
+        if (Token == TokenModulus || Token == TokenModulusAssign)
+            return FALSE;
+#endif
+        if ( !(Token >= TokenAssign && Token <= TokenArithmeticExorAssign) && !(Token >= TokenLogicalOr && Token <= TokenModulus) )
+            return FALSE;       /* not an operator we compile */
+        
+        Precedence = OperatorPrecedence[(int)Token].InfixPrecedence;
+        if (Precedence < MinPrecedence)
+        {
+            ParserCopyPos(&Compiler->Parser, &PreState);
+            return TRUE;
+        }
+        
+        if (Token <= TokenArithmeticExorAssign)
+        {
+            /* assignments group right to left */
+            if (!ExpressionCompileLValue(Compiler, *IsLValue) || !ExpressionCompileExpression(Compiler, Precedence, &RHSIsLValue) ||
+                    !ExpressionCompileOp(Compiler, CompiledStore, Token, 0, 0, -1))
+                return FALSE;
+        }
+        else if (Token == TokenLogicalAnd || Token == TokenLogicalOr)
+        {
+            /* only evaluate the right hand side if we need to */
+            Jump = Compiler->NumOps;
+            if (!ExpressionCompileOp(Compiler, (Token == TokenLogicalAnd) ? CompiledAndJump : CompiledOrJump, Token, 0, 0, 0) ||
+                    !ExpressionCompileExpression(Compiler, Precedence+1, &RHSIsLValue) ||
+                    !ExpressionCompileOp(Compiler, CompiledInfix, Token, 0, 0, -1))
+                return FALSE;
+                
+            Compiler->Op[Jump].Arg = (unsigned short)Compiler->NumOps;
+        }
+        else
+        {
+            if (!ExpressionCompileExpression(Compiler, Precedence+1, &RHSIsLValue) || !ExpressionCompileOp(Compiler, CompiledInfix, Token, 0, 0, -1))
+                return FALSE;
+        }
+        
+        *IsLValue = FALSE;
+    }
+}
+
+/* compile the expression at the parser's position. NULL if we're out of memory */
+static struct CompiledExpression *ExpressionCompile(struct ParseState *Parser)
+{
+    struct ExpressionCompiler Compiler;
+    struct CompiledExpression *Expr;
+    int IsLValue;
+    int Count;
+    
+    ParserCopy(&Compiler.Parser, Parser);
+    Compiler.NumOps = 0;
+    Compiler.NumVariables = 0;
+    Compiler.Depth = 0;
+    Compiler.MaxDepth = 0;
+    if (!ExpressionCompileExpression(&Compiler, 0, &IsLValue) || Compiler.MaxDepth > COMPILED_STACK_MAX)
+    {
+        /* remember that it can't be compiled */
+        Compiler.NumOps = 0;
+        Compiler.NumVariables = 0;
+    }
+    
+    Expr = HeapAllocMem(sizeof(struct CompiledExpression) + sizeof(struct CompiledOp) * Compiler.NumOps + sizeof(struct CompiledVariable) * Compiler.NumVariables);
+    if (Expr == NULL)
+        return NULL;
+        
+    Expr->Pos = Parser->Pos;
+    Expr->EndPos = Compiler.Parser.Pos;
+    Expr->EndLine = Compiler.Parser.Line;
+    Expr->EndCharacterPos = Compiler.Parser.CharacterPos;
+    Expr->NumOps = (unsigned char)Compiler.NumOps;
+    Expr->NumVariables = (unsigned char)Compiler.NumVariables;
+    Expr->IsBare = Compiler.NumOps > 0 && (Compiler.Op[Compiler.NumOps-1].Code == CompiledLoad || Compiler.Op[Compiler.NumOps-1].Code == CompiledConstant);
+    Expr->Op = (struct CompiledOp *)((char *)Expr + sizeof(struct CompiledExpression));
+    Expr->Variable = (struct CompiledVariable *)((char *)Expr->Op + sizeof(struct CompiledOp) * Compiler.NumOps);
+    memcpy((void *)Expr->Op, (void *)&Compiler.Op[0], sizeof(struct CompiledOp) * Compiler.NumOps);
+    for (Count = 0; Count < Compiler.NumVariables; Count++)
+    {
+        Expr->Variable[Count].Ident = Compiler.Ident[Count];
+        Expr->Variable[Count].Use = Compiler.Use[Count];
+        Expr->Variable[Count].Val = NULL;
+    }
+    
+    return Expr;
+}
+
+/* look up the variables a compiled expression uses. FALSE if one of them isn't an integer it can use */
+static int ExpressionCompiledBind(struct CompiledExpression *Expr)
+{
+    unsigned int Serial = (TopStackFrame == NULL) ? 0 : TopStackFrame->Serial;
+    unsigned short LocalChanges = (TopStackFrame == NULL) ? 0 : TopStackFrame->LocalTable.Changes;
+    struct CompiledVariable *Var;
+    struct Value *Val;
+    int Count;
+    
+    for (Count = 0; Count < Expr->NumVariables; Count++)
+    {
+        Var = &Expr->Variable[Count];
+        if (Var->Val != NULL && Var->FrameSerial == Serial && Var->LocalChanges == LocalChanges && Var->GlobalChanges == GlobalTable.Changes)
+            continue;
+        
+        if ( (TopStackFrame == NULL || !TableGet(&TopStackFrame->LocalTable, Var->Ident, &Val, NULL, NULL, NULL)) &&
+             !TableGet(&GlobalTable, Var->Ident, &Val, NULL, NULL, NULL) )
+            return FALSE;
+        
+        Var->IsConstant = FALSE;
+        if (Var->Use & COMPILED_INDEXED)
+        {
+            if ((Val->Typ->Base != TypeArray && Val->Typ->Base != TypePointer) || !IS_INTEGER_NUMERIC_TYPE(Val->Typ->FromType))
+                return FALSE;
+        }
+        else if (Val->Typ->Base == TypeMacro)
+        {
+            /* a macro which is just an integer constant */
+            struct ParseState MacroParser;
+            struct Value *LexValue;
+            
+            ParserCopy(&MacroParser, &Val->Val->MacroDef.Body);
+            if ((Var->Use & COMPILED_WRITTEN) || Val->Val->MacroDef.NumParams != 0 || LexGetToken(&MacroParser, &LexValue, TRUE) != TokenIntegerConstant)
+                return FALSE;
+                
+            Var->Constant = (long)LexValue->Val->Integer;
+            if (LexGetToken(&MacroParser, NULL, FALSE) != TokenEndOfFunction)
+                return FALSE;
+                
+            Var->IsConstant = TRUE;
+        }
+        else if (!IS_INTEGER_NUMERIC(Val))
+            return FALSE;
+        
+        if ((Var->Use & COMPILED_WRITTEN) && !Val->IsLValue)
+            return FALSE;
+        
+        Var->Val = Val;
+        Var->FrameSerial = Serial;
+        Var->LocalChanges = LocalChanges;
+        Var->GlobalChanges = GlobalTable.Changes;
+    }
+    
+    return TRUE;
+}
+
+/* make an lvalue for an element of an array or pointer a compiled expression uses */
+static struct Value *ExpressionCompiledElement(struct CompiledVariable *Var, long Index, struct Value *Element)
+{
+    struct Value *Val = Var->Val;
+    char *Data;
+    
+    if (Val->Typ->Base == TypeArray)
+        Data = &Val->Val->ArrayMem[0];
+    else
+        Data = (char *)Val->Val->Pointer;
+    
+    Element->Typ = Val->Typ->FromType;
+    Element->Val = (union AnyValue *)(Data + Element->Typ->Sizeof * (int)Index);
+    Element->LValueFrom = Val->LValueFrom;
+    Element->ValOnHeap = FALSE;
+    Element->ValOnStack = FALSE;
+    Element->IsLValue = Val->IsLValue;
+    return Element;
+}
+
+/* apply an integer infix or assignment operator */
+static long ExpressionCompiledInfix(enum LexToken Op, long BottomInt, long TopInt)
+{
+    switch (Op)
+    {
+        case TokenAssign:                                   return TopInt;
+        case TokenAddAssign:            case TokenPlus:     return BottomInt + TopInt;
+        case TokenSubtractAssign:       case TokenMinus:    return BottomInt - TopInt;
+        case TokenMultiplyAssign:       case TokenAsterisk: return BottomInt * TopInt;
+        case TokenDivideAssign:         case TokenSlash:    return BottomInt / TopInt;
+#ifndef NO_MODULUS
+        case TokenModulusAssign:        case TokenModulus:  return BottomInt % TopInt;
+#endif
+        case TokenShiftLeftAssign:      case TokenShiftLeft:        return BottomInt << TopInt;
+        case TokenShiftRightAssign:     case TokenShiftRight:       return BottomInt >> TopInt;
+        case TokenArithmeticAndAssign:  case TokenAmpersand:        return BottomInt & TopInt;
+        case TokenArithmeticOrAssign:   case TokenArithmeticOr:     return BottomInt | TopInt;
+        case TokenArithmeticExorAssign: case TokenArithmeticExor:   return BottomInt ^ TopInt;
+        case TokenEqual:                return BottomInt == TopInt;
+        case TokenNotEqual:             return BottomInt != TopInt;
+        case TokenLessThan:             return BottomInt < TopInt;
+        case TokenGreaterThan:          return BottomInt > TopInt;
+        case TokenLessEqual:            return BottomInt <= TopInt;
+        case TokenGreaterEqual:         return BottomInt >= TopInt;
+        case TokenLogicalOr:            return BottomInt || TopInt;
+        case TokenLogicalAnd:           return BottomInt && TopInt;
+        default:                        return 0;
+    }
+}
+
+/* run the expression at the parser's position from its compiled form and leave the parser after it.
+ * FALSE if it hasn't been compiled (or can't be) and has to be parsed instead */
+static int ExpressionRunCompiled(struct ParseState *Parser, long *Result, int AllowBare)
+{
+    unsigned int Bucket = (unsigned long)Parser->Pos % COMPILED_EXPRESSION_TABLE_SIZE;
+    struct CompiledExpression *Expr;
+    struct CompiledOp *Op;
+    struct CompiledOp *EndOp;
+    struct CompiledVariable *Var;
+    long Stack[COMPILED_STACK_MAX];                 /* values */
+    struct Value *LValue[COMPILED_STACK_MAX];       /* or the variables to read them from */
+    struct Value Element[COMPILED_STACK_MAX];       /* array and pointer elements used as lvalues */
+    long Value;
+    int Top = -1;
+    
+    for (Expr = CompiledExpressionTable[Bucket]; Expr != NULL && Expr->Pos != Parser->Pos; Expr = Expr->Next)
+    {}
+    
+    if (Expr == NULL)
+    {
+        /* only compile expressions which get run more than once or twice */
+        if (++CompiledExpressionHits[Bucket] < COMPILE_THRESHOLD)
+            return FALSE;
+        
+        CompiledExpressionHits[Bucket] = 0;
+        Expr = ExpressionCompile(Parser);
+        if (Expr == NULL)
+            return FALSE;
+            
+        Expr->Next = CompiledExpressionTable[Bucket];
+        CompiledExpressionTable[Bucket] = Expr;
+    }
+    
+    if (Expr->NumOps == 0 || (Expr->IsBare && !AllowBare))
+        return FALSE;
+        
+    if (!ExpressionCompiledBind(Expr))
+    {
+        /* it uses something other than integers - always parse it */
+        Expr->NumOps = 0;
+        return FALSE;
+    }
+    
+    Op = Expr->Op;
+    EndOp = &Expr->Op[Expr->NumOps];
+    while (Op < EndOp)
+    {
+        switch ((enum CompiledCode)Op->Code)
+        {
+            case CompiledConstant:
+                Stack[++Top] = Op->Constant;
+                LValue[Top] = NULL;
+                break;
+                
+            case CompiledLoad:
+                Var = &Expr->Variable[Op->Arg];
+                if (Var->Use & COMPILED_INDEXED)
+                    LValue[Top] = ExpressionCompiledElement(Var, COMPILED_VALUE(Top), &Element[Top]);
+                else if (Var->IsConstant)
+                {
+                    Stack[++Top] = Var->Constant;
+                    LValue[Top] = NULL;
+                }
+                else
+                    LValue[++Top] = Var->Val;
+                break;
+                
+            case CompiledStore:
+                Value = COMPILED_VALUE(Top);
+                Top--;
+                Stack[Top] = (int)ExpressionAssignInt(Parser, LValue[Top], ExpressionCompiledInfix((enum LexToken)Op->Token, ExpressionCoerceInteger(LValue[Top]), Value), FALSE);
+                LValue[Top] = NULL;
+                break;
+                
+            case CompiledIncrement:
+            case CompiledIncrementAfter:
+                Stack[Top] = (int)ExpressionAssignInt(Parser, LValue[Top], ExpressionCoerceInteger(LValue[Top]) + ((Op->Token == TokenIncrement) ? 1 : -1), Op->Code == CompiledIncrementAfter);
+                LValue[Top] = NULL;
+                break;
+                
+            case CompiledPrefix:
+                Value = COMPILED_VALUE(Top);
+                switch ((enum LexToken)Op->Token)
+                {
+                    case TokenMinus:        Stack[Top] = (int)-Value; break;
+                    case TokenUnaryNot:     Stack[Top] = !Value; break;
+                    case TokenUnaryExor:    Stack[Top] = (int)~Value; break;
+                    default:                Stack[Top] = (int)Value; break;
+                }
+                LValue[Top] = NULL;
+                break;
+                
+            case CompiledInfix:
+                Value = COMPILED_VALUE(Top);
+                Top--;
+                Stack[Top] = (int)ExpressionCompiledInfix((enum LexToken)Op->Token, COMPILED_VALUE(Top), Value);
+                LValue[Top] = NULL;
+                break;
+                
+            case CompiledAndJump:
+            case CompiledOrJump:
+                if ((COMPILED_VALUE(Top) != 0) == (Op->Code == CompiledOrJump))
+                {
+                    /* the left hand side decides it - skip the right */
+                    Stack[Top] = (Op->Code == CompiledOrJump);
+                    LValue[Top] = NULL;
+                    Op = &Expr->Op[Op->Arg];
+                    continue;
+                }
+                break;
+        }
+        
+        Op++;
+    }
+    
+    Parser->Pos = Expr->EndPos;
+    Parser->Line = Expr->EndLine;
+    Parser->CharacterPos = Expr->EndCharacterPos;
+    if (Result != NULL)
+        *Result = COMPILED_VALUE(0);
+        
+    return TRUE;
+}
+
+/* run an expression statement from its compiled form, if it has one */
+int ExpressionParseCompiled(struct ParseState *Parser)
+{
+    return ExpressionRunCompiled(Parser, NULL, TRUE);
+}
+#endif
+
+/* forget all the compiled expressions */
+void ExpressionCleanup()
+{
+#ifndef NO_COMPILED_BODIES
+    struct CompiledExpression *Expr;
+    struct CompiledExpression *Next;
+    int Count;
+    
+    for (Count = 0; Count < COMPILED_EXPRESSION_TABLE_SIZE; Count++)
+    {
+        for (Expr = CompiledExpressionTable[Count]; Expr != NULL; Expr = Next)
+        {
+            Next = Expr->Next;
+            HeapFreeMem(Expr);
+        }
+        
+        CompiledExpressionTable[Count] = NULL;
+        CompiledExpressionHits[Count] = 0;
+    }
+#endif
+}
+
 /* parse an expression with operator precedence */
 int ExpressionParse(struct ParseState *Parser, struct Value **Result)
 {
@@ -997,6 +1577,20 @@ int ExpressionParse(struct ParseState *Parser, struct Value **Result)
     struct ExpressionStack *StackTop = NULL;
     int TernaryDepth = 0;
     
+#ifndef NO_COMPILED_BODIES
+    if (Parser->Compiled && Parser->Mode == RunModeRun)
+    {
+        long CompiledResult;
+        
+        if (ExpressionRunCompiled(Parser, &CompiledResult, FALSE))
+        {
+            *Result = VariableAllocValueFromType(Parser, &IntType, FALSE, NULL, FALSE);
+            (*Result)->Val->Integer = CompiledResult;
+            return TRUE;
+        }
+    }
+#endif
+
     debugf("ExpressionParse():\n");
     do
     {
@@ -1179,10 +1773,6 @@ int ExpressionParse(struct ParseState *Parser, struct Value **Result)
                     
             }
 
-             /* if we've successfully ignored the RHS turn ignoring off */
-            if (Precedence <= IgnorePrecedence)
-                IgnorePrecedence = DEEP_PRECEDENCE;
-
             PrefixState = FALSE;
         }
         else if ((int)Token > TokenCloseBracket && (int)Token <= TokenCharacterConstant)
@@ -1459,6 +2049,11 @@ long ExpressionParseInt(struct ParseState *Parser)
     struct Value *Val;
     long Result = 0;
     
+#ifndef NO_COMPILED_BODIES
+    if (Parser->Compiled && Parser->Mode == RunModeRun && ExpressionRunCompiled(Parser, &Result, TRUE))
+        return Result;
+#endif
+
     if (!ExpressionParse(Parser, &Val))
         ProgramFail(Parser, "expression expected");
     
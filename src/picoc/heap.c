@@ -2,49 +2,71 @@
 #include "interpreter.h"
 #include "platform_conf.h"
 
-#define FREELIST_BUCKETS 8                          /* freelists for 4, 8, 12 ... 32 byte allocs */
-#define SPLIT_MEM_THRESHOLD 16                      /* don't split memory which is close in size */
+/* the heap is made of chunks, each starting with an AllocNode Size word. free
+ * chunks are also linked into a freelist bin and end with a copy of their size
+ * so they can be coalesced with the chunk above them when that's freed */
+#define HEAP_SMALL_BINS 16                          /* exact-size bins for chunks under 16 alignment units */
+#define HEAP_BINS 32                                /* the rest are binned by power of two */
+#define CHUNK_FREE 1                                /* Size flag: this chunk is on a freelist */
+#define CHUNK_PREV_FREE 2                           /* Size flag: the chunk just below this one is free */
+#define CHUNK_FLAGS (CHUNK_FREE | CHUNK_PREV_FREE)
+#define CHUNK_SIZE(c) ((c)->Size & ~CHUNK_FLAGS)
+#define CHUNK_HEADER MEM_ALIGN(sizeof(((struct AllocNode *)0)->Size))
+#define CHUNK_MIN MEM_ALIGN(sizeof(struct AllocNode) + sizeof(unsigned int))
+#define CHUNK_FOOTER(c, s) (*(unsigned int *)((char *)(c) + (s) - sizeof(unsigned int)))
 
 #ifdef USE_MALLOC_STACK
 static unsigned char *HeapMemory = NULL;            /* stack memory since our heap is malloc()ed */
 static void *HeapBottom = NULL;                     /* the bottom of the (downward-growing) heap */
+static void *HeapTop = NULL;                        /* the top of the heap */
 static void *StackFrame = NULL;                     /* the current stack frame */
 void *HeapStackTop = NULL;                          /* the top of the stack */
 #else
 # ifdef SURVEYOR_HOST
 static unsigned char *HeapMemory = (unsigned char *)C_HEAPSTART;      /* all memory - stack and heap */
 static void *HeapBottom = (void *)C_HEAPSTART + HEAP_SIZE;  /* the bottom of the (downward-growing) heap */
+static void *HeapTop = (void *)C_HEAPSTART + HEAP_SIZE;     /* the top of the heap */
 static void *StackFrame = (void *)C_HEAPSTART;              /* the current stack frame */
 void *HeapStackTop = (void *)C_HEAPSTART;                   /* the top of the stack */
 void *HeapMemStart = (void *)C_HEAPSTART;
 # else
 static unsigned char HeapMemory[HEAP_SIZE];         /* all memory - stack and heap */
 static void *HeapBottom = &HeapMemory[HEAP_SIZE];   /* the bottom of the (downward-growing) heap */
+static void *HeapTop = &HeapMemory[HEAP_SIZE];      /* the top of the heap */
 static void *StackFrame = &HeapMemory[0];           /* the current stack frame */
 void *HeapStackTop = &HeapMemory[0];                /* the top of the stack */
 # endif
 #endif
 
-static struct AllocNode *FreeListBucket[FREELIST_BUCKETS];      /* we keep a pool of freelist buckets to reduce fragmentation */
-static struct AllocNode *FreeListBig;                           /* free memory which doesn't fit in a bucket */
+#ifdef USE_MALLOC_HEAP
+static int HeapAllocations = 0;                     /* number of live malloc()ed blocks */
+#else
+static struct AllocNode *FreeBin[HEAP_BINS];        /* freelists of chunks binned by size */
+static unsigned long FreeBinMap;                    /* bit n is set if FreeBin[n] isn't empty */
+#endif
 
 #ifdef DEBUG_HEAP
 void ShowBigList()
 {
+#ifndef USE_MALLOC_HEAP
     struct AllocNode *LPos;
+    int Bin;
     
-    printf("Heap: bottom=0x%lx 0x%lx-0x%lx, big freelist=", (long)HeapBottom, (long)&HeapMemory[0], (long)&HeapMemory[HEAP_SIZE]);
-    for (LPos = FreeListBig; LPos != NULL; LPos = LPos->NextFree)
-        printf("0x%lx:%d ", (long)LPos, LPos->Size);
+    printf("Heap: bottom=0x%lx 0x%lx-0x%lx, freelist=", (long)HeapBottom, (long)&HeapMemory[0], (long)HeapTop);
+    for (Bin = 0; Bin < HEAP_BINS; Bin++)
+    {
+        for (LPos = FreeBin[Bin]; LPos != NULL; LPos = LPos->NextFree)
+            printf("%d:0x%lx:%d ", Bin, (long)LPos, CHUNK_SIZE(LPos));
+    }
     
     printf("\n");
+#endif
 }
 #endif
 
 /* initialise the stack and heap storage */
 void HeapInit(int StackOrHeapSize)
 {
-    int Count;
     int AlignOffset = 0;
     
 #ifdef USE_MALLOC_STACK
@@ -58,9 +80,18 @@ void HeapInit(int StackOrHeapSize)
     HeapStackTop = &HeapMemory[AlignOffset];
     *(void **)StackFrame = NULL;
     HeapBottom = &HeapMemory[StackOrHeapSize-sizeof(ALIGN_TYPE)+AlignOffset];
-    FreeListBig = NULL;
-    for (Count = 0; Count < FREELIST_BUCKETS; Count++)
-        FreeListBucket[Count] = NULL;
+    HeapTop = HeapBottom;
+#ifdef USE_MALLOC_HEAP
+    HeapAllocations = 0;
+#else
+    {
+        int Count;
+        
+        FreeBinMap = 0;
+        for (Count = 0; Count < HEAP_BINS; Count++)
+            FreeBin[Count] = NULL;
+    }
+#endif
 }
 
 void HeapCleanup()
@@ -139,16 +170,108 @@ int HeapPopStackFrame()
         return FALSE;
 }
 
+#ifndef USE_MALLOC_HEAP
+/* which freelist bin a chunk of this size belongs in */
+static int HeapBin(unsigned int Size)
+{
+    unsigned int Units = Size / sizeof(ALIGN_TYPE);
+    int Bin = HEAP_SMALL_BINS;
+    
+    if (Units < HEAP_SMALL_BINS)
+        return Units;
+    
+    for (Units /= HEAP_SMALL_BINS; Units > 1 && Bin < HEAP_BINS-1; Units >>= 1)
+        Bin++;
+    
+    return Bin;
+}
+
+/* put a free chunk on its freelist */
+static void HeapBinInsert(struct AllocNode *Chunk)
+{
+    int Bin = HeapBin(CHUNK_SIZE(Chunk));
+    
+    Chunk->NextFree = FreeBin[Bin];
+    Chunk->PrevFree = NULL;
+    if (FreeBin[Bin] != NULL)
+        FreeBin[Bin]->PrevFree = Chunk;
+    
+    FreeBin[Bin] = Chunk;
+    FreeBinMap |= 1UL << Bin;
+}
+
+/* take a free chunk off its freelist */
+static void HeapBinRemove(struct AllocNode *Chunk)
+{
+    int Bin = HeapBin(CHUNK_SIZE(Chunk));
+    
+    if (Chunk->PrevFree != NULL)
+        Chunk->PrevFree->NextFree = Chunk->NextFree;
+    else
+        FreeBin[Bin] = Chunk->NextFree;
+    
+    if (Chunk->NextFree != NULL)
+        Chunk->NextFree->PrevFree = Chunk->PrevFree;
+    
+    if (FreeBin[Bin] == NULL)
+        FreeBinMap &= ~(1UL << Bin);
+}
+
+/* find a free chunk with room for AllocSize bytes and take it off its freelist */
+static struct AllocNode *HeapBinFind(unsigned int AllocSize)
+{
+    struct AllocNode *Chunk;
+    int Bin = HeapBin(AllocSize);
+    
+    if (Bin >= HEAP_SMALL_BINS)
+    {
+        /* large bins hold a range of sizes so take the first one that fits */
+        for (Chunk = FreeBin[Bin]; Chunk != NULL && CHUNK_SIZE(Chunk) < AllocSize; Chunk = Chunk->NextFree)
+        {}
+        
+        if (Chunk != NULL)
+        {
+            HeapBinRemove(Chunk);
+            return Chunk;
+        }
+    }
+    else if (FreeBin[Bin] != NULL)
+    {
+        /* an exact fit */
+        Chunk = FreeBin[Bin];
+        HeapBinRemove(Chunk);
+        return Chunk;
+    }
+    
+    /* anything in a bigger bin will do */
+    for (Bin++; Bin < HEAP_BINS; Bin++)
+    {
+        if (FreeBinMap & (1UL << Bin))
+        {
+            Chunk = FreeBin[Bin];
+            HeapBinRemove(Chunk);
+            return Chunk;
+        }
+    }
+    
+    return NULL;
+}
+#endif
+
 /* allocate some dynamically allocated memory. memory is cleared. can return NULL if out of memory */
 void *HeapAllocMem(int Size)
 {
 #ifdef USE_MALLOC_HEAP
-    return calloc(Size, 1);
+    void *NewMem = calloc(Size, 1);
+    
+    if (NewMem != NULL)
+        HeapAllocations++;
+    
+    return NewMem;
 #else
-    struct AllocNode *NewMem = NULL;
-    struct AllocNode **FreeNode;
-    int AllocSize = MEM_ALIGN(Size) + MEM_ALIGN(sizeof(NewMem->Size));
-    int Bucket;
+    struct AllocNode *NewMem;
+    unsigned int AllocSize = MEM_ALIGN(Size) + CHUNK_HEADER;
+    unsigned int ChunkSize;
     void *ReturnMem;
     
     if (Size == 0)
@@ -156,58 +279,41 @@ void *HeapAllocMem(int Size)
     
     assert(Size > 0);
     
-    /* make sure we have enough space for an AllocNode */
-    if (AllocSize < sizeof(struct AllocNode))
-        AllocSize = sizeof(struct AllocNode);
+    /* make sure we have enough space to free it again */
+    if (AllocSize < CHUNK_MIN)
+        AllocSize = CHUNK_MIN;
     
-    Bucket = AllocSize >> 2;
-    if (Bucket < FREELIST_BUCKETS && FreeListBucket[Bucket] != NULL)
-    { 
-        /* try to allocate from a freelist bucket first */
-#ifdef DEBUG_HEAP
-        printf("allocating %d(%d) from bucket", Size, AllocSize);
-#endif
-        NewMem = FreeListBucket[Bucket];
-        assert((unsigned long)NewMem >= (unsigned long)&HeapMemory[0] && (unsigned char *)NewMem - &HeapMemory[0] < HEAP_SIZE);
-        FreeListBucket[Bucket] = *(struct AllocNode **)NewMem;
-        assert(FreeListBucket[Bucket] == NULL || ((unsigned long)FreeListBucket[Bucket] >= (unsigned long)&HeapMemory[0] && (unsigned char *)FreeListBucket[Bucket] - &HeapMemory[0] < HEAP_SIZE));
-        NewMem->Size = AllocSize;
-    }
-    else if (FreeListBig != NULL)
-    { 
-        /* grab the first item from the "big" freelist we can fit in */
-        for (FreeNode = &FreeListBig; *FreeNode != NULL && (*FreeNode)->Size < AllocSize; FreeNode = &(*FreeNode)->NextFree)
-        {}
-        
-        if (*FreeNode != NULL)
+    NewMem = HeapBinFind(AllocSize);
+    if (NewMem != NULL)
+    {
+        assert((unsigned char *)NewMem >= (unsigned char *)HeapBottom && (unsigned char *)NewMem < (unsigned char *)HeapTop);
+        ChunkSize = CHUNK_SIZE(NewMem);
+        if (ChunkSize - AllocSize >= CHUNK_MIN)
         {
-            assert((unsigned long)*FreeNode >= (unsigned long)&HeapMemory[0] && (unsigned char *)*FreeNode - &HeapMemory[0] < HEAP_SIZE);
-            assert((*FreeNode)->Size < HEAP_SIZE && (*FreeNode)->Size > 0);
-            if ((*FreeNode)->Size < AllocSize + SPLIT_MEM_THRESHOLD)
-            { 
-                /* close in size - reduce fragmentation by not splitting */
+            /* split it, leaving the lower part free */
 #ifdef DEBUG_HEAP
-               printf("allocating %d(%d) from freelist, no split (%d)", Size, AllocSize, (*FreeNode)->Size);
+            printf("allocating %d(%d) from freelist, split chunk (%d)", Size, AllocSize, ChunkSize);
 #endif
-                NewMem = *FreeNode;
-                assert((unsigned long)NewMem >= (unsigned long)&HeapMemory[0] && (unsigned char *)NewMem - &HeapMemory[0] < HEAP_SIZE);
-                *FreeNode = NewMem->NextFree;
-            }
-            else
-            { 
-                /* split this big memory chunk */
+            NewMem->Size = (ChunkSize - AllocSize) | CHUNK_FREE;
+            CHUNK_FOOTER(NewMem, ChunkSize - AllocSize) = ChunkSize - AllocSize;
+            HeapBinInsert(NewMem);
+            NewMem = (struct AllocNode *)((char *)NewMem + ChunkSize - AllocSize);
+            NewMem->Size = AllocSize | CHUNK_PREV_FREE;
+        }
+        else
+        {
 #ifdef DEBUG_HEAP
-                printf("allocating %d(%d) from freelist, split chunk (%d)", Size, AllocSize, (*FreeNode)->Size);
+            printf("allocating %d(%d) from freelist, no split (%d)", Size, AllocSize, ChunkSize);
 #endif
-                NewMem = (void *)((char *)*FreeNode + (*FreeNode)->Size - AllocSize);
-                assert((unsigned long)NewMem >= (unsigned long)&HeapMemory[0] && (unsigned char *)NewMem - &HeapMemory[0] < HEAP_SIZE);
-                (*FreeNode)->Size -= AllocSize;
-                NewMem->Size = AllocSize;
-            }
+            AllocSize = ChunkSize;
+            NewMem->Size = AllocSize;
         }
+        
+        /* the chunk above no longer has a free neighbour */
+        if ((char *)NewMem + AllocSize < (char *)HeapTop)
+            ((struct AllocNode *)((char *)NewMem + AllocSize))->Size &= ~CHUNK_PREV_FREE;
     }
-    
-    if (NewMem == NULL)
+    else
     { 
         /* couldn't allocate from a freelist - try to increase the size of the heap area */
 #ifdef DEBUG_HEAP
@@ -221,8 +327,8 @@ void *HeapAllocMem(int Size)
         NewMem->Size = AllocSize;
     }
     
-    ReturnMem = (void *)((char *)NewMem + MEM_ALIGN(sizeof(NewMem->Size)));
-    memset(ReturnMem, '\0', AllocSize - MEM_ALIGN(sizeof(NewMem->Size)));
+    ReturnMem = (void *)((char *)NewMem + CHUNK_HEADER);
+    memset(ReturnMem, '\0', AllocSize - CHUNK_HEADER);
 #ifdef DEBUG_HEAP
     printf(" = %lx\n", (unsigned long)ReturnMem);
 #endif
@@ -234,53 +340,103 @@ void *HeapAllocMem(int Size)
 void HeapFreeMem(void *Mem)
 {
 #ifdef USE_MALLOC_HEAP
+    if (Mem != NULL)
+        HeapAllocations--;
+    
     free(Mem);
 #else
-    struct AllocNode *MemNode = (struct AllocNode *)((char *)Mem - MEM_ALIGN(sizeof(MemNode->Size)));
-    int Bucket = MemNode->Size >> 2;
+    struct AllocNode *MemNode = (struct AllocNode *)((char *)Mem - CHUNK_HEADER);
+    struct AllocNode *Neighbour;
+    unsigned int Size;
     
 #ifdef DEBUG_HEAP
     printf("HeapFreeMem(0x%lx)\n", (unsigned long)Mem);
 #endif
-    assert((unsigned long)Mem >= (unsigned long)&HeapMemory[0] && (unsigned char *)Mem - &HeapMemory[0] < HEAP_SIZE);
-    assert(MemNode->Size < HEAP_SIZE && MemNode->Size > 0);
     if (Mem == NULL)
         return;
     
+    assert((unsigned char *)MemNode >= (unsigned char *)HeapBottom && (unsigned char *)MemNode < (unsigned char *)HeapTop);
+    assert(!(MemNode->Size & CHUNK_FREE) && CHUNK_SIZE(MemNode) >= CHUNK_MIN);
+    Size = CHUNK_SIZE(MemNode);
+    
+    /* merge with a free chunk above */
+    Neighbour = (struct AllocNode *)((char *)MemNode + Size);
+    if ((void *)Neighbour < HeapTop && (Neighbour->Size & CHUNK_FREE))
+    {
+        HeapBinRemove(Neighbour);
+        Size += CHUNK_SIZE(Neighbour);
+    }
+    
+    /* merge with a free chunk below */
+    if (MemNode->Size & CHUNK_PREV_FREE)
+    {
+        Neighbour = (struct AllocNode *)((char *)MemNode - *((unsigned int *)MemNode - 1));
+        assert(Neighbour->Size & CHUNK_FREE);
+        HeapBinRemove(Neighbour);
+        Size += CHUNK_SIZE(Neighbour);
+        MemNode = Neighbour;
+    }
+    
+    Neighbour = (struct AllocNode *)((char *)MemNode + Size);
     if ((void *)MemNode == HeapBottom)
     { 
         /* pop it off the bottom of the heap, reducing the heap size */
 #ifdef DEBUG_HEAP
-        printf("freeing %d from bottom of heap\n", MemNode->Size);
-#endif
-        HeapBottom = (void *)((char *)HeapBottom + MemNode->Size);
-#ifdef DEBUG_HEAP
-        ShowBigList();
+        printf("freeing %d from bottom of heap\n", Size);
 #endif
+        HeapBottom = (void *)Neighbour;
+        if ((void *)Neighbour < HeapTop)
+            Neighbour->Size &= ~CHUNK_PREV_FREE;
     }
-    else if (Bucket < FREELIST_BUCKETS)
+    else
     { 
-        /* we can fit it in a bucket */
+        /* put it on a freelist */
 #ifdef DEBUG_HEAP
-        printf("freeing %d to bucket\n", MemNode->Size);
+        printf("freeing %lx:%d to freelist\n", (unsigned long)MemNode, Size);
 #endif
-        assert(FreeListBucket[Bucket] == NULL || ((unsigned long)FreeListBucket[Bucket] >= (unsigned long)&HeapMemory[0] && (unsigned char *)FreeListBucket[Bucket] - &HeapMemory[0] < HEAP_SIZE));
-        *(struct AllocNode **)MemNode = FreeListBucket[Bucket];
-        FreeListBucket[Bucket] = (struct AllocNode *)MemNode;
+        MemNode->Size = Size | CHUNK_FREE;
+        CHUNK_FOOTER(MemNode, Size) = Size;
+        HeapBinInsert(MemNode);
+        if ((void *)Neighbour < HeapTop)
+            Neighbour->Size |= CHUNK_PREV_FREE;
     }
-    else
-    { 
-        /* put it in the big memory freelist */
 #ifdef DEBUG_HEAP
-        printf("freeing %lx:%d to freelist\n", (unsigned long)Mem, MemNode->Size);
+    ShowBigList();
 #endif
-        assert(FreeListBig == NULL || ((unsigned long)FreeListBig >= (unsigned long)&HeapMemory[0] && (unsigned char *)FreeListBig - &HeapMemory[0] < HEAP_SIZE));
-        MemNode->NextFree = FreeListBig;
-        FreeListBig = MemNode;
-#ifdef DEBUG_HEAP
-        ShowBigList();
 #endif
+}
+
+/* report how the stack and heap are being used */
+void HeapGetStats(struct HeapStats *Stats)
+{
+    memset((void *)Stats, '\0', sizeof(*Stats));
+    Stats->StackUsed = (char *)HeapStackTop - (char *)&HeapMemory[0];
+    Stats->Unused = (char *)HeapBottom - (char *)HeapStackTop;
+    Stats->LargestFree = Stats->Unused;
+#ifdef USE_MALLOC_HEAP
+    Stats->Allocations = HeapAllocations;
+#else
+    {
+        struct AllocNode *Chunk;
+        
+        for (Chunk = HeapBottom; (void *)Chunk < HeapTop; Chunk = (struct AllocNode *)((char *)Chunk + CHUNK_SIZE(Chunk)))
+        {
+            if (Chunk->Size & CHUNK_FREE)
+            {
+                Stats->HeapFree += CHUNK_SIZE(Chunk);
+                Stats->FreeChunks++;
+                if (CHUNK_SIZE(Chunk) > Stats->LargestFree)
+                    Stats->LargestFree = CHUNK_SIZE(Chunk);
+            }
+            else
+            {
+                Stats->HeapUsed += CHUNK_SIZE(Chunk);
+                Stats->Allocations++;
+            }
+        }
+        
+        if (Stats->HeapFree + Stats->Unused > 0)
+            Stats->Fragmentation = 100 - (int)((long)Stats->LargestFree * 100 / (Stats->HeapFree + Stats->Unused));
     }
 #endif
 }
-
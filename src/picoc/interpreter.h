@@ -79,7 +79,8 @@ enum LexToken
     /* 0x52 */ TokenHashDefine, TokenHashInclude, TokenHashIf, TokenHashIfdef, TokenHashIfndef, TokenHashElse, TokenHashEndif,
     /* 0x59 */ TokenNew, TokenDelete,
     /* 0x5b */ TokenOpenMacroBracket,
-    /* 0x5c */ TokenEOF, TokenEndOfLine, TokenEndOfFunction
+    /* 0x5c */ TokenEOF, TokenEndOfLine, TokenEndOfFunction,
+    /* 0x5f */ TokenLeftBraceJump      /* a '{' in a compiled function body, followed by the jump to its '}' */
 };
 
 /* used in dynamic memory allocation */
@@ -87,6 +88,20 @@ struct AllocNode
 {
     unsigned int Size;
     struct AllocNode *NextFree;
+    struct AllocNode *PrevFree;
+};
+
+/* stack and heap usage, as reported by HeapGetStats() */
+struct HeapStats
+{
+    int StackUsed;                  /* bytes of stack in use */
+    int Unused;                     /* untouched space between the stack and the heap */
+    int HeapUsed;                   /* bytes in allocated chunks, including their headers */
+    int HeapFree;                   /* bytes in freed chunks */
+    int FreeChunks;                 /* number of freed chunks */
+    int LargestFree;                /* the largest contiguous free region */
+    int Allocations;                /* number of live allocations */
+    int Fragmentation;              /* percentage of free memory outside the largest free region */
 };
 
 /* whether we're running or skipping code */
@@ -114,6 +129,7 @@ typedef struct ParseState
     short int HashIfLevel;
     short int HashIfEvaluateToLevel;
     const char *SourceText;
+    char Compiled;              /* the tokens are a compiled function body with block jumps */
 } pstate;
 
 /* values */
@@ -233,6 +249,9 @@ struct Table
     short Size;
     short OnHeap;
     struct TableEntry **HashTable;
+    short Count;                    /* number of entries in the table */
+    short HashOnHeap;               /* the hash array has been grown onto the heap */
+    unsigned short Changes;         /* bumped whenever an entry is added or removed */
 };
 
 /* stack frame for function calls */
@@ -246,6 +265,7 @@ struct StackFrame
     struct Table LocalTable;                /* the local variables and parameters */
     struct TableEntry *LocalHashTable[LOCAL_TABLE_SIZE];
     struct StackFrame *PreviousStackFrame;  /* the next lower stack frame */
+    unsigned int Serial;                    /* unique for each call, used to validate cached lookups */
 };
 
 /* lexer state */
@@ -335,6 +355,7 @@ int TableGet(struct Table *Tbl, const char *Key, struct Value **Val, const char
 struct Value *TableDelete(struct Table *Tbl, const char *Key);
 char *TableSetIdentifier(struct Table *Tbl, const char *Ident, int IdentLen);
 void TableStrFree();
+void TableFreeHash(struct Table *Tbl);
 
 /* lex.c */
 void LexInit();
@@ -345,6 +366,8 @@ enum LexToken LexGetToken(struct ParseState *Parser, struct Value **Value, int I
 enum LexToken LexRawPeekToken(struct ParseState *Parser);
 void LexToEndOfLine(struct ParseState *Parser);
 void *LexCopyTokens(struct ParseState *StartParser, struct ParseState *EndParser);
+void LexCompileTokens(struct ParseState *Body);
+void LexSkipBlock(struct ParseState *Parser, struct ParseState *BlockStart);
 void LexInteractiveClear(struct ParseState *Parser);
 void LexInteractiveCompleted(struct ParseState *Parser);
 void LexInteractiveStatementPrompt();
@@ -362,6 +385,8 @@ void ParserCopy(struct ParseState *To, struct ParseState *From);
 /* expression.c */
 int ExpressionParse(struct ParseState *Parser, struct Value **Result);
 long ExpressionParseInt(struct ParseState *Parser);
+int ExpressionParseCompiled(struct ParseState *Parser);
+void ExpressionCleanup();
 void ExpressionAssign(struct ParseState *Parser, struct Value *DestValue, struct Value *SourceValue, int Force, const char *FuncName, int ParamNo, int AllowPointerCoercion);
 long ExpressionCoerceInteger(struct Value *Val);
 unsigned long ExpressionCoerceUnsignedInteger(struct Value *Val);
@@ -392,6 +417,7 @@ void HeapPushStackFrame();
 int HeapPopStackFrame();
 void *HeapAllocMem(int Size);
 void HeapFreeMem(void *Mem);
+void HeapGetStats(struct HeapStats *Stats);
 
 /* variable.c */
 void VariableInit();
@@ -443,6 +469,7 @@ void LibPrintf(struct ParseState *Parser, struct Value *ReturnValue, struct Valu
  * extern int PicocExitValue; */
 void ProgramFail(struct ParseState *Parser, const char *Message, ...);
 void pmod_error(char *msg);
+void cpu_int_dispatch(void);
 void AssignFail(struct ParseState *Parser, const char *Format, struct ValueType *Type1, struct ValueType *Type2, int Num1, int Num2, const char *FuncName, int ParamNo);
 void LexFail(struct LexState *Lexer, const char *Message, ...);
 void PlatformCleanup();
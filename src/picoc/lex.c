@@ -22,6 +22,7 @@
 #define LEXER_INC(l) ( (l)->Pos++, (l)->CharacterPos++ )
 #define LEXER_INCN(l, n) ( (l)->Pos+=(n), (l)->CharacterPos+=(n) )
 #define TOKEN_DATA_OFFSET 2
+#define BLOCK_JUMP_SIZE (2 * sizeof(unsigned short))    /* offset and line count from a compiled '{' to its '}' */
 
 #define MAX_CHAR_VALUE 255      /* maximum value which can be represented by a "char" data type */
 
@@ -494,6 +495,7 @@ int LexTokenSize(enum LexToken Token)
         case TokenIntegerConstant: return sizeof(int);
         case TokenCharacterConstant: return sizeof(unsigned char);
         case TokenFPConstant: return sizeof(double);
+        case TokenLeftBraceJump: return BLOCK_JUMP_SIZE;
         default: return 0;
     }
 }
@@ -594,6 +596,7 @@ void LexInitParser(struct ParseState *Parser, const char *SourceText, void *Toke
     Parser->HashIfEvaluateToLevel = 0;
     Parser->CharacterPos = 0;
     Parser->SourceText = SourceText;
+    Parser->Compiled = FALSE;
 }
 
 /* get the next token, without pre-processing */
@@ -681,6 +684,15 @@ enum LexToken LexGetRawToken(struct ParseState *Parser, struct Value **Value, in
     } while ((Parser->FileName == StrEmpty && Token == TokenEOF) || Token == TokenEndOfLine);
 
     Parser->CharacterPos = *((unsigned char *)Parser->Pos + 1);
+    if (Token == TokenLeftBraceJump)
+    {
+        /* a compiled block start looks like a plain '{' to everyone but ParseBlock() */
+        if (IncPos)
+            Parser->Pos += BLOCK_JUMP_SIZE + TOKEN_DATA_OFFSET;
+
+        return TokenLeftBrace;
+    }
+
     ValueSize = LexTokenSize(Token);
     if (ValueSize > 0)
     { 
@@ -926,6 +938,107 @@ void *LexCopyTokens(struct ParseState *StartParser, struct ParseState *EndParser
     return NewTokens;
 }
 
+#ifndef NO_COMPILED_BODIES
+/* compile a function body so each '{' records how far it is to its matching '}'.
+ * this lets the parser jump over blocks it isn't running instead of re-parsing
+ * them. bodies which can't be compiled are left as they are */
+void LexCompileTokens(struct ParseState *Body)
+{
+    unsigned char *Pos = (unsigned char *)Body->Pos;
+    unsigned char *NewTokens;
+    unsigned char *NewPos;
+    unsigned char *BlockStart[COMPILE_BLOCK_DEPTH];
+    int BlockLine[COMPILE_BLOCK_DEPTH];
+    int Depth = 0;
+    int NumBlocks = 0;
+    int Line = 0;
+    int TokenSize;
+    enum LexToken Token;
+    
+    /* size up the compiled body */
+    while ((Token = (enum LexToken)*Pos) != TokenEndOfFunction)
+    {
+        if (Token >= TokenHashDefine && Token <= TokenHashEndif)
+            return;     /* the pre-processor can change the shape of blocks */
+        
+        if (Token == TokenLeftBrace)
+            NumBlocks++;
+            
+        Pos += LexTokenSize(Token) + TOKEN_DATA_OFFSET;
+    }
+    
+    if (NumBlocks == 0)
+        return;
+    
+    NewTokens = HeapAllocMem(Pos - (unsigned char *)Body->Pos + NumBlocks * BLOCK_JUMP_SIZE + TOKEN_DATA_OFFSET);
+    if (NewTokens == NULL)
+        return;
+    
+    /* copy the tokens, filling in each block's jump when we reach its end */
+    Pos = (unsigned char *)Body->Pos;
+    NewPos = NewTokens;
+    while ((Token = (enum LexToken)*Pos) != TokenEndOfFunction)
+    {
+        if (Token == TokenLeftBrace)
+        {
+            if (Depth == COMPILE_BLOCK_DEPTH)
+                break;
+                
+            NewPos[0] = (unsigned char)TokenLeftBraceJump;
+            NewPos[1] = Pos[1];
+            NewPos += BLOCK_JUMP_SIZE + TOKEN_DATA_OFFSET;
+            Pos += TOKEN_DATA_OFFSET;
+            BlockStart[Depth] = NewPos;
+            BlockLine[Depth] = Line;
+            Depth++;
+            continue;
+        }
+        
+        if (Token == TokenRightBrace && Depth > 0)
+        {
+            unsigned short Jump[2];
+            
+            Depth--;
+            if (NewPos - BlockStart[Depth] > 0xffff || Line - BlockLine[Depth] > 0xffff)
+                break;
+                
+            Jump[0] = (unsigned short)(NewPos - BlockStart[Depth]);
+            Jump[1] = (unsigned short)(Line - BlockLine[Depth]);
+            memcpy(BlockStart[Depth] - BLOCK_JUMP_SIZE, &Jump[0], BLOCK_JUMP_SIZE);
+        }
+        else if (Token == TokenEndOfLine)
+            Line++;
+        
+        TokenSize = LexTokenSize(Token) + TOKEN_DATA_OFFSET;
+        memcpy(NewPos, Pos, TokenSize);
+        NewPos += TokenSize;
+        Pos += TokenSize;
+    }
+    
+    if (Token != TokenEndOfFunction || Depth != 0)
+    {
+        /* too deep, too long or unbalanced - run it from the plain tokens */
+        HeapFreeMem(NewTokens);
+        return;
+    }
+    
+    *NewPos = (unsigned char)TokenEndOfFunction;
+    HeapFreeMem((void *)Body->Pos);
+    Body->Pos = NewTokens;
+    Body->Compiled = TRUE;
+}
+#endif
+
+/* jump from just inside a compiled block to its closing '}' */
+void LexSkipBlock(struct ParseState *Parser, struct ParseState *BlockStart)
+{
+    unsigned short Jump[2];
+    
+    memcpy(&Jump[0], BlockStart->Pos - BLOCK_JUMP_SIZE, BLOCK_JUMP_SIZE);
+    Parser->Pos = BlockStart->Pos + Jump[0];
+    Parser->Line = BlockStart->Line + Jump[1];
+}
+
 /* indicate that we've completed up to this point in the interactive input and free expired tokens */
 void LexInteractiveClear(struct ParseState *Parser)
 {
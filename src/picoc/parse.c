@@ -1,5 +1,7 @@
 #include "picoc.h"
 #include "interpreter.h"
+#include "platform_conf.h"
+#include "elua_int.h"
 
 /* a chunk of heap-allocated tokens we'll cleanup when we're done */
 struct CleanupTokenNode
@@ -21,7 +23,7 @@ void ParseCleanup()
         
         HeapFreeMem(CleanupTokenList->Tokens);
         if (CleanupTokenList->SourceText != NULL)
-            HeapFreeMem((void *)CleanupTokenList->SourceText);
+            free((void *)CleanupTokenList->SourceText);     /* PlatformReadFile() malloc()s it */
             
         HeapFreeMem(CleanupTokenList);
         CleanupTokenList = Next;
@@ -156,6 +158,9 @@ struct Value *ParseFunctionDefinition(struct ParseState *Parser, struct ValueTyp
 
         FuncValue->Val->FuncDef.Body = FuncBody;
         FuncValue->Val->FuncDef.Body.Pos = LexCopyTokens(&FuncBody, Parser);
+#ifndef NO_COMPILED_BODIES
+        LexCompileTokens(&FuncValue->Val->FuncDef.Body);
+#endif
 
         /* is this function already in the global table? */
         if (TableGet(&GlobalTable, Identifier, &OldFuncValue, NULL, NULL, NULL))
@@ -430,23 +435,38 @@ void ParseFor(struct ParseState *Parser)
 /* parse a block of code and return what mode it returned in */
 enum RunMode ParseBlock(struct ParseState *Parser, int AbsorbOpenBrace, int Condition)
 {
+    struct ParseState BlockStart;
+    
     if (AbsorbOpenBrace && LexGetToken(Parser, NULL, TRUE) != TokenLeftBrace)
         ProgramFail(Parser, "'{' expected");
     
+    ParserCopyPos(&BlockStart, Parser);
     if (Parser->Mode == RunModeSkip || !Condition)
     { 
         /* condition failed - skip this block instead */
         enum RunMode OldMode = Parser->Mode;
-        Parser->Mode = RunModeSkip;
-        while (ParseStatement(Parser, TRUE) == ParseResultOk)
-        {}
-        Parser->Mode = OldMode;
+        if (Parser->Compiled)
+            LexSkipBlock(Parser, &BlockStart);
+        else
+        {
+            Parser->Mode = RunModeSkip;
+            while (ParseStatement(Parser, TRUE) == ParseResultOk)
+            {}
+            Parser->Mode = OldMode;
+        }
     }
     else
     { 
         /* just run it in its current mode */
         while (ParseStatement(Parser, TRUE) == ParseResultOk)
-        {}
+        {
+            if (Parser->Compiled && (Parser->Mode == RunModeReturn || Parser->Mode == RunModeBreak || Parser->Mode == RunModeContinue))
+            {
+                /* nothing else in this block will run */
+                LexSkipBlock(Parser, &BlockStart);
+                break;
+            }
+        }
     }
     
     if (LexGetToken(Parser, NULL, TRUE) != TokenRightBrace)
@@ -484,9 +504,32 @@ enum ParseResult ParseStatement(struct ParseState *Parser, int CheckTrailingSemi
     struct ParseState PreState;
     enum LexToken Token;
     
+#ifdef BUILD_PICOC_INT_HANDLERS
+    /* run queued interrupt handlers between two statements */
+    if (Parser->Mode == RunModeRun && elua_int_should_dispatch())
+        cpu_int_dispatch();
+#endif
+
     ParserCopy(&PreState, Parser);
     Token = LexGetToken(Parser, &LexerValue, TRUE);
     
+#ifndef NO_COMPILED_BODIES
+    if (Parser->Compiled && Parser->Mode == RunModeRun && (Token == TokenIdentifier || Token == TokenIncrement || Token == TokenDecrement || Token == TokenOpenBracket))
+    {
+        /* run an expression statement from its compiled form if it has one */
+        *Parser = PreState;
+        if (ExpressionParseCompiled(Parser))
+        {
+            if (CheckTrailingSemicolon && LexGetToken(Parser, NULL, TRUE) != TokenSemicolon)
+                ProgramFail(Parser, "';' expected");
+                
+            return ParseResultOk;
+        }
+        
+        Token = LexGetToken(Parser, &LexerValue, TRUE);
+    }
+#endif
+
     switch (Token)
     {
         case TokenEOF:
@@ -855,6 +898,10 @@ void PicocParseInteractive()
     PlatformPrintf(INTERACTIVE_PROMPT_START);
     LexInitParser(&Parser, NULL, NULL, StrEmpty, TRUE);
     PicocPlatformSetExitPoint();
+#ifdef BUILD_PICOC_INT_HANDLERS
+    /* an error might have left a handler unfinished */
+    elua_int_dispatch_reset();
+#endif
     LexInteractiveClear(&Parser);
 
     do
@@ -2,6 +2,7 @@
 #include "interpreter.h"
 #include "picoc_mod.h"
 #include "platform_conf.h"
+#include "elua_int.h"
 #include "rotable.h"
 
 /* the value passed to exit() */
@@ -58,12 +59,14 @@ void PicocInitialise(int StackSize)
 /* free memory */
 void PicocCleanup()
 {
+    elua_int_cleanup();
     PlatformCleanup();
 #ifndef NO_HASH_INCLUDE
     IncludeCleanup();
 #endif
     ParseCleanup();
     LexCleanup();
+    ExpressionCleanup();
     VariableCleanup();
     TypeCleanup();
     TableStrFree();
@@ -15,7 +15,9 @@
 # include <math.h>
 
 # define USE_MALLOC_STACK                   /* stack is allocated using malloc() */
+#ifndef PICOC_FIXED_HEAP                   /* otherwise the heap shares PICOC_STACK_SIZE with the stack */
 # define USE_MALLOC_HEAP                    /* heap is allocated using malloc() */
+#endif
 
 #define LARGE_INT_POWER_OF_TEN 1000000000   /* the largest power of ten which fits in an int on this architecture */
 #if defined(__hppa__) || defined(__sparc__)
@@ -31,6 +33,12 @@
 #define LINEBUFFER_MAX 256                  /* maximum number of characters on a line */
 #define LOCAL_TABLE_SIZE 11                 /* size of local variable table (can expand) */
 #define STRUCT_TABLE_SIZE 11                /* size of struct/union member table (can expand) */
+#define TABLE_LOAD_FACTOR 2                 /* grow heap tables once they average more entries per bucket than this */
+#define VARIABLE_CACHE_SIZE 31              /* resolved identifier cache entries (0 to disable) */
+#define COMPILE_BLOCK_DEPTH 16              /* deepest block nesting in a compiled function body */
+#define COMPILE_THRESHOLD 4                 /* times an expression in a function body is parsed before it's compiled */
+#define COMPILED_EXPRESSION_TABLE_SIZE 31   /* hash table size for compiled expressions */
+/* #define NO_COMPILED_BODIES */            /* always re-parse function bodies and their expressions from the plain tokens */
 
 #define INTERACTIVE_PROMPT_START "starting picoc " PICOC_VERSION "\n"
 #define INTERACTIVE_PROMPT_STATEMENT "picoc> "
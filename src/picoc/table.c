@@ -35,9 +35,63 @@ void TableInitTable(struct Table *Tbl, struct TableEntry **HashTable, int Size,
     Tbl->Size = Size;
     Tbl->OnHeap = OnHeap;
     Tbl->HashTable = HashTable;
+    Tbl->Count = 0;
+    Tbl->HashOnHeap = FALSE;
+    Tbl->Changes = 0;
     memset((void *)HashTable, '\0', sizeof(struct TableEntry *) * Size);
 }
 
+/* grow a table's hash array once its chains get too long. only tables which live
+ * on the heap can grow - local tables go away with their stack frame anyway */
+static void TableGrow(struct Table *Tbl, int HashByName)
+{
+    struct TableEntry **NewHashTable;
+    struct TableEntry *Entry;
+    struct TableEntry *NextEntry;
+    int NewSize = Tbl->Size * 2 + 1;
+    int HashValue;
+    int Count;
+    
+    if (!Tbl->OnHeap || Tbl->Count <= Tbl->Size * TABLE_LOAD_FACTOR || NewSize > 0x7fff)
+        return;
+    
+    NewHashTable = HeapAllocMem(sizeof(struct TableEntry *) * NewSize);
+    if (NewHashTable == NULL)
+        return;     /* not fatal - we just keep the long chains */
+    
+    for (Count = 0; Count < Tbl->Size; Count++)
+    {
+        for (Entry = Tbl->HashTable[Count]; Entry != NULL; Entry = NextEntry)
+        {
+            NextEntry = Entry->Next;
+            if (HashByName)
+                HashValue = TableHash(&Entry->p.Key[0], strlen(&Entry->p.Key[0])) % NewSize;
+            else
+                HashValue = ((unsigned long)Entry->p.v.Key) % NewSize;
+            
+            Entry->Next = NewHashTable[HashValue];
+            NewHashTable[HashValue] = Entry;
+        }
+    }
+    
+    if (Tbl->HashOnHeap)
+        HeapFreeMem(Tbl->HashTable);
+    
+    Tbl->HashTable = NewHashTable;
+    Tbl->Size = NewSize;
+    Tbl->HashOnHeap = TRUE;
+}
+
+/* free a hash array which has been grown onto the heap */
+void TableFreeHash(struct Table *Tbl)
+{
+    if (Tbl->HashOnHeap)
+    {
+        HeapFreeMem(Tbl->HashTable);
+        Tbl->HashOnHeap = FALSE;
+    }
+}
+
 /* check a hash table entry for a key */
 static struct TableEntry *TableSearch(struct Table *Tbl, const char *Key, int *AddAt)
 {
@@ -71,6 +125,9 @@ int TableSet(struct Table *Tbl, char *Key, struct Value *Val, const char *DeclFi
         NewEntry->p.v.Val = Val;
         NewEntry->Next = Tbl->HashTable[AddAt];
         Tbl->HashTable[AddAt] = NewEntry;
+        Tbl->Count++;
+        Tbl->Changes++;
+        TableGrow(Tbl, FALSE);
         return TRUE;
     }
 
@@ -112,6 +169,8 @@ struct Value *TableDelete(struct Table *Tbl, const char *Key)
             struct Value *Val = DeleteEntry->p.v.Val;
             *EntryPtr = DeleteEntry->Next;
             HeapFreeMem(DeleteEntry);
+            Tbl->Count--;
+            Tbl->Changes++;
 
             return Val;
         }
@@ -154,6 +213,8 @@ char *TableSetIdentifier(struct Table *Tbl, const char *Ident, int IdentLen)
         NewEntry->p.Key[IdentLen] = '\0';
         NewEntry->Next = Tbl->HashTable[AddAt];
         Tbl->HashTable[AddAt] = NewEntry;
+        Tbl->Count++;
+        TableGrow(Tbl, TRUE);
         return &NewEntry->p.Key[0];
     }
 }
@@ -184,4 +245,6 @@ void TableStrFree()
             HeapFreeMem(Entry);
         }
     }
+    
+    TableFreeHash(&StringTable);
 }
@@ -15,6 +15,23 @@ struct TableEntry *StringLiteralHashTable[STRING_LITERAL_TABLE_SIZE];
 
 /* the stack */
 struct StackFrame *TopStackFrame = NULL;
+static unsigned int FrameSerial = 0;
+
+#if VARIABLE_CACHE_SIZE > 0
+/* identifiers we've already resolved, keyed on the token position they were read from.
+ * an entry is only used while the frame and the tables it was looked up in are unchanged */
+struct VariableCacheEntry
+{
+    const unsigned char *Pos;       /* where the identifier was read */
+    const char *Ident;              /* the registered identifier */
+    unsigned int FrameSerial;       /* the stack frame it was resolved in (0 for global scope) */
+    unsigned short LocalChanges;    /* the frame's local table at the time */
+    unsigned short GlobalChanges;   /* the global table at the time */
+    struct Value *Val;              /* what it resolved to */
+};
+
+static struct VariableCacheEntry VariableCache[VARIABLE_CACHE_SIZE];
+#endif
 
 /* initialise the variable system */
 void VariableInit(void)
@@ -22,6 +39,9 @@ void VariableInit(void)
     TableInitTable(&GlobalTable, &GlobalHashTable[0], GLOBAL_TABLE_SIZE, TRUE);
     TableInitTable(&StringLiteralTable, &StringLiteralHashTable[0], STRING_LITERAL_TABLE_SIZE, TRUE);
     TopStackFrame = NULL;
+#if VARIABLE_CACHE_SIZE > 0
+    memset((void *)&VariableCache[0], '\0', sizeof(VariableCache));
+#endif
 }
 
 /* deallocate the contents of a variable */
@@ -31,7 +51,12 @@ void VariableFree(struct Value *Val)
     {
         /* free function bodies */
         if (Val->Typ == &FunctionType && Val->Val->FuncDef.Intrinsic == NULL && Val->Val->FuncDef.Body.Pos != NULL)
+        {
+            if (Val->Val->FuncDef.Body.Compiled)
+                ExpressionCleanup();    /* compiled expressions are keyed on where they are in the body */
+                
             HeapFreeMem((void *)Val->Val->FuncDef.Body.Pos);
+        }
 
         /* free macro bodies */
         if (Val->Typ == &MacroType)
@@ -60,6 +85,8 @@ void VariableTableCleanup(struct Table *HashTable)
             HeapFreeMem(Entry);
         }
     }
+    
+    TableFreeHash(HashTable);
 }
 
 void VariableCleanup(void)
@@ -245,24 +272,53 @@ extern const picoc_rt picoc_rotable[];
 /* get the value of a variable. must be defined. Ident must be registered */
 void VariableGet(struct ParseState *Parser, const char *Ident, struct Value **LVal)
 {
-#if ((PICOC_OPTIMIZE_MEMORY == 2) && !defined (BUILTIN_MINI_STDLIB))
-    int i;
-    unsigned pos;
-    for (i = 0; picoc_rotable[i].pentries; i++) {
-        *LVal = (struct Value *)picoc_auxfind(picoc_rotable[i].pentries, Ident, 0, &pos);
-	if (*LVal)
-	    break;
+#if VARIABLE_CACHE_SIZE > 0
+    struct VariableCacheEntry *Cache = NULL;
+    unsigned int Serial = (TopStackFrame == NULL) ? 0 : TopStackFrame->Serial;
+    unsigned short LocalChanges = (TopStackFrame == NULL) ? 0 : TopStackFrame->LocalTable.Changes;
+    
+    if (Parser != NULL)
+    {
+        Cache = &VariableCache[(unsigned long)Parser->Pos % VARIABLE_CACHE_SIZE];
+        if (Cache->Pos == Parser->Pos && Cache->Ident == Ident && Cache->FrameSerial == Serial && 
+                Cache->LocalChanges == LocalChanges && Cache->GlobalChanges == GlobalTable.Changes)
+        {
+            *LVal = Cache->Val;
+            return;
+        }
     }
 #endif
+
     if (TopStackFrame == NULL || !TableGet(&TopStackFrame->LocalTable, Ident, LVal, NULL, NULL, NULL))
     {
-#if ((PICOC_OPTIMIZE_MEMORY == 2) && !defined (BUILTIN_MINI_STDLIB))
-        if (!TableGet(&GlobalTable, Ident, LVal, NULL, NULL, NULL) && ! *LVal)
-#else
         if (!TableGet(&GlobalTable, Ident, LVal, NULL, NULL, NULL))
+        {
+#if ((PICOC_OPTIMIZE_MEMORY == 2) && !defined (BUILTIN_MINI_STDLIB))
+            /* last of all try the read-only platform variables */
+            int i;
+            unsigned pos;
+            
+            *LVal = NULL;
+            for (i = 0; picoc_rotable[i].pentries && *LVal == NULL; i++)
+                *LVal = (struct Value *)picoc_auxfind(picoc_rotable[i].pentries, Ident, 0, &pos);
+            
+            if (*LVal == NULL)
 #endif
-            ProgramFail(Parser, "'%s' is undefined", Ident);
+                ProgramFail(Parser, "'%s' is undefined", Ident);
+        }
+    }
+    
+#if VARIABLE_CACHE_SIZE > 0
+    if (Cache != NULL)
+    {
+        Cache->Pos = Parser->Pos;
+        Cache->Ident = Ident;
+        Cache->FrameSerial = Serial;
+        Cache->LocalChanges = LocalChanges;
+        Cache->GlobalChanges = GlobalTable.Changes;
+        Cache->Val = *LVal;
     }
+#endif
 }
 
 /* define a global variable shared with a platform global. Ident will be registered */
@@ -317,6 +373,7 @@ void VariableStackFrameAdd(struct ParseState *Parser, const char *FuncName, int
     NewFrame->Parameter = (NumParams > 0) ? ((void *)((char *)NewFrame + sizeof(struct StackFrame))) : NULL;
     TableInitTable(&NewFrame->LocalTable, &NewFrame->LocalHashTable[0], LOCAL_TABLE_SIZE, FALSE);
     NewFrame->PreviousStackFrame = TopStackFrame;
+    NewFrame->Serial = ++FrameSerial;
     TopStackFrame = NewFrame;
 }
 
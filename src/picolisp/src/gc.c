@@ -7,58 +7,125 @@
 
 #include "pico.h"
 
-#if (PICOLISP_OPTIMIZE_MEMORY == 2)
-static void mark(any);
+#ifndef PICOLISP_MARK_STACK
+#define PICOLISP_MARK_STACK 64
 #endif
 
-/* Mark data */
-#if (PICOLISP_OPTIMIZE_MEMORY == 2)
-static void markTail(any x) {
-#else
-static void mark(any x) {
-#endif
-#if (PICOLISP_OPTIMIZE_MEMORY == 0)
-   while (isCell(x)) {
-      if (!(num(cdr(x)) & 1))
+static any MarkStack[PICOLISP_MARK_STACK];
+static int MarkSP;
+static bool Overflow;
+
+/* Remember an object to mark in a later pass over the heap */
+static void markPending(any x) {
+   heap *h;
+   long i;
+
+   for (h = Heaps;  h;  h = h->next)
+      if ((any)x >= h->cells  &&  (any)x < h->cells + CELLS) {
+         i = (word*)x - (word*)h->cells;
+         h->pending[i / BITS] |= 1UL << i % BITS;
+         Overflow = YES;
          return;
-      *(long*)&cdr(x) &= ~1;
-      mark(car(x)),  x = cdr(x);
-   }
-   if (!isNum(x)  &&  num(val(x)) & 1) {
-      *(long*)&val(x) &= ~1;
-      mark(val(x)),  x = tail(x);
-#endif
+      }
+}
+
+/* Queue an object if it isn't marked yet */
+static void markPush(any x) {
+   if (isNum(x)  ||  !(num(isCell(x)? cdr(x) : val(x)) & 1))
+      return;
+   if (MarkSP < PICOLISP_MARK_STACK)
+      MarkStack[MarkSP++] = x;
+   else
+      markPending(x);
+}
+
+/* Mark data, or with 'tl' a symbol's tail */
+static void markLoop(any x, bool tl) {
+   for (;;) {
+      if (!tl) {
+         while (isCell(x)) {
+            if (!(num(cdr(x)) & 1))
+               goto next;
+            *(long*)&cdr(x) &= ~1;
+            markPush(car(x)),  x = cdr(x);
+         }
+         if (isNum(x)  ||  !(num(val(x)) & 1))
+            goto next;
+         *(long*)&val(x) &= ~1;
+         markPush(val(x)),  x = tail(x);
+      }
       while (isCell(x)) {
          if (!(num(cdr(x)) & 1))
-            return;
+            goto next;
          *(long*)&cdr(x) &= ~1;
-         mark(cdr(x)),  x = car(x);
+         markPush(cdr(x)),  x = car(x);
       }
       if (!isTxt(x))
          do {
             if (!(num(val(x)) & 1))
-               return;
+               goto next;
             *(long*)&val(x) &= ~1;
          } while (!isNum(x = val(x)));
-#if (PICOLISP_OPTIMIZE_MEMORY == 0)
-   }
-#endif
-}   
-
-#if (PICOLISP_OPTIMIZE_MEMORY == 2)
-static void mark(any x) {
-   while (isCell(x)) {
-      if (!(num(cdr(x)) & 1))
+   next:
+      if (!MarkSP)
          return;
-      *(long*)&cdr(x) &= ~1;
-      mark(car(x)),  x = cdr(x);
+      x = MarkStack[--MarkSP],  tl = NO;
    }
-   if (!isNum(x)  &&  num(val(x)) & 1) {
-      *(long*)&val(x) &= ~1;
-      mark(val(x));
-      markTail(tail(x));
+}
+
+#define mark(x)      markLoop(x, NO)
+#define markTail(x)  markLoop(x, YES)
+
+/* Mark whatever didn't fit on the mark stack */
+static void markRescan(void) {
+   heap *h;
+   word *p;
+   long i;
+
+   while (Overflow) {
+      Overflow = NO;
+      for (h = Heaps;  h;  h = h->next)
+         for (p = h->pending, i = 0;  i < CELLS*2;  ++i)
+            if (!p[i / BITS])
+               i += BITS-1 - i % BITS;
+            else if (p[i / BITS] & 1UL << i % BITS) {
+               p[i / BITS] &= ~(1UL << i % BITS);
+               mark((any)((word*)h->cells + i));
+            }
    }
 }
+
+#ifdef PICOLISP_INCREMENTAL_GC
+static heap *Sweep;  // Next heap block to sweep
+static long Want;    // Free cells still wanted by the last gc()
+
+/* Sweep one heap block */
+static void sweepStep(void) {
+   any p = Sweep->cells + CELLS-1;
+
+   do
+      if (num(p->cdr) & 1)
+         Free(p),  --Want;
+   while (--p >= Sweep->cells);
+   if (!(Sweep = Sweep->next))
+      while (Want >= 0)
+         heapAlloc(),  Want -= CELLS;
+}
+
+/* Sweep until a free cell turns up */
+static cell *avail(void) {
+   while (!Avail && Sweep)
+      sweepStep();
+   return Avail;
+}
+
+/* Finish the sweep started by the last gc() */
+void gcFinish(void) {
+   while (Sweep)
+      sweepStep();
+}
+#else
+#define avail() Avail
 #endif
 
 /* Garbage collector */
@@ -86,6 +153,7 @@ static void gc(long c) {
    mark(Intern[0]),  mark(Intern[1]);
    mark(Transient[0]), mark(Transient[1]);
    mark(ApplyArgs),  mark(ApplyBody);
+   mark(IntHandlers);
 #if (PICOLISP_OPTIMIZE_MEMORY == 0)
    mark(Reloc);
 #endif
@@ -101,10 +169,19 @@ static void gc(long c) {
          mark(((catchFrame*)p)->tag);
       mark(((catchFrame*)p)->fin);
    }
+   if (Overflow)
+      markRescan();
    /* Sweep */
    Avail = NULL;
    h = Heaps;
    if (c) {
+#ifdef PICOLISP_INCREMENTAL_GC
+      /* Sweep just enough for now, the rest as cells are needed */
+      Sweep = h,  Want = c;
+      do
+         sweepStep();
+      while (!Avail);
+#else
       do {
          p = h->cells + CELLS-1;
          do
@@ -114,11 +191,16 @@ static void gc(long c) {
       } while (h = h->next);
       while (c >= 0)
          heapAlloc(),  c -= CELLS;
+#endif
    }
    else {
       heap **hp = &Heaps;
       cell *av;
 
+#ifdef PICOLISP_INCREMENTAL_GC
+      Sweep = NULL;
+#endif
+
       do {
          c = CELLS;
          av = Avail;
@@ -147,7 +229,7 @@ any doGc(any x) {
 any cons(any x, any y) {
    cell *p;
 
-   if (!(p = Avail)) {
+   if (!(p = avail())) {
       cell c1, c2;
 
       Push(c1,x);
@@ -166,7 +248,7 @@ any cons(any x, any y) {
 any consSym(any val, word w) {
    cell *p;
 
-   if (!(p = Avail)) {
+   if (!(p = avail())) {
       cell c1;
 
       if (!val)
@@ -189,7 +271,7 @@ any consSym(any val, word w) {
 any consName(word w, any n) {
    cell *p;
 
-   if (!(p = Avail)) {
+   if (!(p = avail())) {
       gc(CELLS);
       p = Avail;
    }
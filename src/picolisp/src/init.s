@@ -331,6 +331,13 @@ cpu-r16 {plisp_cpu_r16}
 cpu-w8 {plisp_cpu_w8}
 cpu-r8 {plisp_cpu_r8}
 cpu-clock {plisp_cpu_clock}
+cpu-cli {plisp_cpu_cli}
+cpu-sei {plisp_cpu_sei}
+cpu-set-int-handler {plisp_cpu_set_int_handler}
+cpu-get-int-handler {plisp_cpu_get_int_handler}
+cpu-get-int-flag {plisp_cpu_get_int_flag}
+cpu-set-int-priority {plisp_cpu_set_int_priority}
+cpu-get-int-priority {plisp_cpu_get_int_priority}
 
 ### Timers ###
 tmr-delay {tmr_delay}
@@ -342,6 +349,7 @@ tmr-getmindelay {tmr_getmindelay}
 tmr-getmaxdelay {tmr_getmaxdelay}
 tmr-setclock {tmr_setclock}
 tmr-getclock {tmr_getclock}
+tmr-set-match-int {tmr_set_match_int}
 tmr-decode {tmr_decode}
 
 ### I2C ###
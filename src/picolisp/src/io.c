@@ -1153,7 +1153,11 @@ any doSave(any x) {
    any p;
    heap *h;
 
-   x = cdr(x),  save(x = EVAL(car(x))),  newline();
+   x = cdr(x),  x = EVAL(car(x));
+#ifdef PICOLISP_INCREMENTAL_GC
+   gcFinish();  // save() borrows the mark bits
+#endif
+   save(x),  newline();
    h = Heaps;
    do {
       p = h->cells + CELLS-1;
@@ -5,6 +5,8 @@
  * (c) SimpleMachines. Raman Gopalan
  */
 #include "pico.h"
+#include "platform_conf.h"
+#include "elua_int.h"
 
 /* Globals */
 int Chr, Trace;
@@ -19,7 +21,7 @@ any Intern[2], Transient[2];
 #if (PICOLISP_OPTIMIZE_MEMORY == 0)
 any Reloc;
 #endif
-any ApplyArgs, ApplyBody;
+any ApplyArgs, ApplyBody, IntHandlers;
 
 #if (PICOLISP_OPTIMIZE_MEMORY == 0)
 
@@ -56,6 +58,7 @@ void bye(int n) {
       unwind(NULL);
       prog(val(Bye));
    }
+   elua_int_cleanup();
    exit(n);
 }
 
@@ -78,6 +81,7 @@ void heapAlloc(void) {
 
    h = (heap*)((long)alloc(NULL, sizeof(heap) + sizeof(cell)) + (sizeof(cell)-1) & ~(sizeof(cell)-1));
    h->next = Heaps,  Heaps = h;
+   memset(h->pending, 0, sizeof(h->pending));
    p = h->cells + CELLS-1;
    do
       Free(p);
@@ -96,6 +100,9 @@ any doHeap(any x) {
       while (h = h->next);
       return box(n);
    }
+#ifdef PICOLISP_INCREMENTAL_GC
+   gcFinish();
+#endif
    for (x = Avail;  x;  x = car(x))
       ++n;
    return box(n / CELLS);
@@ -385,6 +392,9 @@ void err(any ex, any x, char *fmt, ...) {
    Env.make = Env.yoke = NULL;
    Env.parser = NULL;
    Trace = 0;
+#ifdef BUILD_PICOLISP_INT_HANDLERS
+   elua_int_dispatch_reset();
+#endif
 #if (PICOLISP_OPTIMIZE_MEMORY == 2)
    Env.put = putStdout;
    Env.get = getStdin;
@@ -557,6 +567,10 @@ static any evList2(any foo, any ex) {
 any evList(any ex) {
    any foo;
 
+#ifdef BUILD_PICOLISP_INT_HANDLERS
+   if (elua_int_should_dispatch())
+      plisp_cpu_int_dispatch();
+#endif
    if (isNum(foo = car(ex)))
       return ex;
    if (isCell(foo)) {
@@ -795,6 +809,7 @@ int picolisp_main(int ac, char *av[]) {
    OutFile = stdout,  Env.put = putStdout;
    ApplyArgs = cons(cons(consSym(Nil,0), Nil), Nil);
    ApplyBody = cons(Nil,Nil);
+   IntHandlers = Nil;
    if (!setjmp(ErrRst))
       loadAll(NULL);
    while (!feof(stdin))
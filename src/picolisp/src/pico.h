@@ -60,8 +60,11 @@ typedef any (*fun)(any);
 # include "sym.d"
 #endif
 
+#define PENDING ((CELLS*2 + BITS-1) / BITS)  // Pending words per heap block
+
 typedef struct heap {
    cell cells[CELLS];
+   word pending[PENDING];  // One bit per word, for objects the mark stack had no room for
    struct heap *next;
 } heap;
 
@@ -200,7 +203,7 @@ extern any Intern[2], Transient[2];
 extern any Reloc;
 #endif
 
-extern any ApplyArgs, ApplyBody;
+extern any ApplyArgs, ApplyBody, IntHandlers;
 #if (PICOLISP_OPTIMIZE_MEMORY == 2)
 extern any const Rom[];
 extern any Ram[];
@@ -215,6 +218,8 @@ extern any Dbg, Scl, Class, Up, Err, Msg, Bye;
 
 // system timer.
 any sys_timer;
+any plisp_tmr_int_oneshot;
+any plisp_tmr_int_cyclic;
 
 // i2c symbols.
 any plisp_i2c_fast;
@@ -297,6 +302,13 @@ any plisp_cpu_r16(any x);
 any plisp_cpu_w8(any x);
 any plisp_cpu_r8(any x);
 any plisp_cpu_clock(any x);
+any plisp_cpu_cli(any x);
+any plisp_cpu_sei(any x);
+any plisp_cpu_set_int_handler(any x);
+any plisp_cpu_get_int_handler(any x);
+any plisp_cpu_get_int_flag(any x);
+any plisp_cpu_set_int_priority(any x);
+any plisp_cpu_get_int_priority(any x);
 
 // can module.
 any plisp_can_setup(any x);
@@ -313,6 +325,7 @@ any tmr_getmindelay(any ex);
 any tmr_getmaxdelay(any ex);
 any tmr_setclock(any ex);
 any tmr_getclock(any ex);
+any tmr_set_match_int(any ex);
 any tmr_decode(any ex);
 
 // i2c module.
@@ -395,6 +408,7 @@ any plisp_ks0108b_prinl_big(any ex);
 
 /* Prototypes */
 int picolisp_main(int argc, char *argv[]);
+void plisp_cpu_int_dispatch(void);
 void *alloc(void*,size_t);
 any apply(any,any,bool,int,cell*);
 void argError(any,any) __attribute__ ((noreturn));
@@ -424,6 +438,9 @@ long evNum(any,any);
 any evSym(any);
 void execError(char*) __attribute__ ((noreturn));
 int firstByte(any);
+#ifdef PICOLISP_INCREMENTAL_GC
+void gcFinish(void);
+#endif
 any get(any,any);
 int getByte(int*,word*,any*);
 int getByte1(int*,word*,any*);
@@ -321,6 +321,8 @@ void initSymbols(void) {
 // system timer symbols.
 #ifdef PICOLISP_MOD_TIMER
    sys_timer = initSym(box(PLATFORM_TIMER_SYS_ID), "*tmr-sys-timer*");
+   plisp_tmr_int_oneshot = initSym(box(PLATFORM_TIMER_INT_ONESHOT), "*tmr-int-oneshot*");
+   plisp_tmr_int_cyclic = initSym(box(PLATFORM_TIMER_INT_CYCLIC), "*tmr-int-cyclic*");
 #endif
    
 // i2c symbols.
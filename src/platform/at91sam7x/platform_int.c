@@ -1,7 +1,8 @@
 // AVR32 interrupt support
 
 #include "platform_conf.h"
-#if defined( BUILD_C_INT_HANDLERS ) || defined( BUILD_LUA_INT_HANDLERS )
+#include "elua_int_cfg.h"
+#ifdef BUILD_INT_HANDLERS
 
 // Generic headers
 #include "platform.h"
@@ -114,4 +115,4 @@ const elua_int_descriptor elua_int_table[ INT_ELUA_LAST ] =
   { int_uart_rx_set_status, int_uart_rx_get_status, int_uart_rx_get_flag }
 };
 
-#endif // #if defined( BUILD_C_INT_HANDLERS ) || defined( BUILD_LUA_INT_HANDLERS )
+#endif // #ifdef BUILD_INT_HANDLERS
@@ -53,6 +53,10 @@
 # define BUILD_LUA_INT_HANDLERS
 #endif
 
+#if defined ALCOR_LANG_TINYSCHEME
+# define BUILD_TINYSCHEME_INT_HANDLERS
+#endif
+
 # define BUILD_USB_CDC
 # define BUILD_EDITOR_IV
 
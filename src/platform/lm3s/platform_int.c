@@ -1,7 +1,8 @@
 // AVR32 interrupt support
 
 #include "platform_conf.h"
-#if defined( BUILD_C_INT_HANDLERS ) || defined( BUILD_LUA_INT_HANDLERS )
+#include "elua_int_cfg.h"
+#ifdef BUILD_INT_HANDLERS
 
 // Generic headers
 #include "platform.h"
@@ -419,7 +420,7 @@ const elua_int_descriptor elua_int_table[ INT_ELUA_LAST ] =
   { int_tmr_match_set_status, int_tmr_match_get_status, int_tmr_match_get_flag }
 };
 
-#else // #if defined( BUILD_C_INT_HANDLERS ) || defined( BUILD_LUA_INT_HANDLERS )
+#else // #ifdef BUILD_INT_HANDLERS
 
 void gpioa_handler()
 {
@@ -471,5 +472,5 @@ void tmr3_handler()
 {
 }
 
-#endif // #if defined( BUILD_C_INT_HANDLERS ) || defined( BUILD_LUA_INT_HANDLERS )
+#endif // #ifdef BUILD_INT_HANDLERS
 
@@ -45,6 +45,7 @@ extern void UARTIntHandler();
 
 #include "hw_memmap.h"
 #include "platform_conf.h"
+#include "elua_int_cfg.h"
 
 #if defined( BUILD_CAN )
 extern void CANIntHandler();
@@ -109,12 +110,12 @@ void (* const g_pfnVectors[])(void) =
     gpioc_handler,                          // GPIO Port C
     gpiod_handler,                          // GPIO Port D
     gpioe_handler,                          // GPIO Port E
-#if defined( BUILD_C_INT_HANDLERS ) || defined( BUILD_LUA_INT_HANDLERS )
+#ifdef BUILD_INT_HANDLERS
     uart0_handler,                          // UART0 Rx and Tx
 #else
     IntDefaultHandler,
 #endif
-#if defined( BUILD_C_INT_HANDLERS ) || defined( BUILD_LUA_INT_HANDLERS )
+#ifdef BUILD_INT_HANDLERS
     uart1_handler,                          // UART1 Rx and Tx
 #else
     IntDefaultHandler,                      // UART1 Rx and Tx
@@ -152,7 +153,7 @@ void (* const g_pfnVectors[])(void) =
     gpiof_handler,                          // GPIO Port F
     gpiog_handler,                          // GPIO Port G
     gpioh_handler,                          // GPIO Port H
-#if defined( BUILD_C_INT_HANDLERS ) || defined( BUILD_LUA_INT_HANDLERS )
+#ifdef BUILD_INT_HANDLERS
     uart2_handler,                          // UART2 Rx and Tx
 #else    
     IntDefaultHandler,                      // UART2 Rx and Tx
@@ -27,21 +27,25 @@ static u8 *rfsc_buffer;
 static p_rfsc_send rfsc_send;
 static p_rfsc_recv rfsc_recv;
 static timer_data_type rfsc_timeout;
+static unsigned rfsc_max_window = 1;
+static unsigned rfsc_window;  // negotiated window, 0 if not known yet
+static u32 rfsc_seq;
 
 // ****************************************************************************
 // Client helpers
 
-static int rfsch_send_request_read_response()
+static void rfsch_flush()
 {
-  u16 temp16;
-  u32 readbytes;
-
 #ifndef ELUA_CPU_LINUX
   // Empty receive buffer
   while( rfsc_recv( rfsc_buffer, 1, 0 ) == 1 );
 #endif
+}
+
+static int rfsch_send_request()
+{
+  u16 temp16;
 
-  // Send request
   if( eluarpc_get_packet_size( rfsc_buffer, &temp16 ) == ELUARPC_ERR )
   {
     RFSDEBUG( "[RFS] get packet size error\n" );
@@ -52,12 +56,18 @@ static int rfsch_send_request_read_response()
     RFSDEBUG( "[RFS] rfsc_send error\n" );
     return CLIENT_ERR;
   }
-  
-  // Get response
+  return CLIENT_OK;
+}
+
+static int rfsch_read_response()
+{
+  u16 temp16;
+  u32 readbytes;
+
   // First the length, then the rest of the data
   if( ( readbytes = rfsc_recv( rfsc_buffer, ELUARPC_START_OFFSET, rfsc_timeout ) ) != ELUARPC_START_OFFSET )
   {
-    RFSDEBUG( "[RFS] rfsc_recv (1) error: expected %u, got %u\n", ( unsigned )( temp16 - ELUARPC_START_OFFSET ), ( unsigned )readbytes );
+    RFSDEBUG( "[RFS] rfsc_recv (1) error: expected %u, got %u\n", ( unsigned )ELUARPC_START_OFFSET, ( unsigned )readbytes );
     return CLIENT_ERR;
   }
   if( eluarpc_get_packet_size( rfsc_buffer, &temp16 ) == ELUARPC_ERR )
@@ -73,6 +83,52 @@ static int rfsch_send_request_read_response()
   return CLIENT_OK;
 }
 
+static int rfsch_send_request_read_response()
+{
+  rfsch_flush();
+  if( rfsch_send_request() == CLIENT_ERR )
+    return CLIENT_ERR;
+  return rfsch_read_response();
+}
+
+// A pipelined transfer stopped with requests still in flight: read their
+// responses, up to the one for the last request ('last'), so that the next
+// request doesn't take one of them for its own response. 'resseq' is the
+// sequence number of the response that was just read. Stops if no response
+// comes in time.
+static void rfsch_drain( u32 last, u32 resseq, int isread )
+{
+  const u8 *resbuf;
+  u32 res;
+  int err;
+
+  while( resseq != last && rfsch_read_response() == CLIENT_OK )
+  {
+    if( isread )
+      err = remotefs_readseq_read_response( rfsc_buffer, &resseq, &resbuf, &res );
+    else
+      err = remotefs_writeseq_read_response( rfsc_buffer, &resseq, &res );
+    if( err == ELUARPC_ERR )
+      resseq = last - 1;
+  }
+}
+
+// Ask the server how many READSEQ/WRITESEQ requests can be in flight.
+// Servers that don't know about the WINDOW operation send back the request
+// unchanged, which doesn't parse as a response, so they get a window of 1.
+static void rfsch_negotiate_window()
+{
+  u32 window;
+
+  remotefs_window_write_request( rfsc_buffer, rfsc_max_window );
+  if( rfsch_send_request_read_response() == CLIENT_ERR )
+    return;
+  if( remotefs_window_read_response( rfsc_buffer, &window ) == ELUARPC_ERR || window == 0 )
+    window = 1;
+  rfsc_window = window > rfsc_max_window ? rfsc_max_window : ( unsigned )window;
+  RFSDEBUG( "[RFS] window is %u\n", rfsc_window );
+}
+
 // ****************************************************************************
 // Client public interface
 
@@ -89,10 +145,20 @@ void rfsc_set_timeout( timer_data_type timeout )
   rfsc_timeout = timeout;
 }
 
+void rfsc_set_window( unsigned window )
+{
+  rfsc_max_window = window == 0 ? 1 : window;
+  rfsc_window = 0;
+}
+
 int rfsc_open( const char* pathname, int flags, int mode )
 {
   int fd;
 
+  // Negotiate the pipeline window with the first request that reaches a server
+  if( rfsc_window == 0 && rfsc_max_window > 1 )
+    rfsch_negotiate_window();
+
   // Make the request
   remotefs_open_write_request( rfsc_buffer, pathname, os_open_sys_flags_to_rfs_flags( flags ), mode );
 
@@ -139,6 +205,136 @@ s32 rfsc_read( int fd, void *buf, u32 count )
   return ( s32 )count;
 }
 
+// Read 'count' bytes in 'chunk' sized requests, keeping up to the negotiated
+// window of requests in flight. The server executes them in order, so the
+// responses come back in order too; the sequence number only catches lost or
+// stale responses.
+s32 rfsc_read_pipelined( int fd, void *buf, u32 count, u32 chunk )
+{
+  u8 *p = ( u8* )buf;
+  u32 sent = 0, recvd = 0, total = 0, seq, resseq, res;
+  u32 nreq = ( count + chunk - 1 ) / chunk;
+  const u8 *resbuf;
+  s32 r;
+  int done = 0;
+
+  if( rfsc_window <= 1 || nreq <= 1 )
+  {
+    while( count )
+    {
+      res = count > chunk ? chunk : count;
+      if( ( r = rfsc_read( fd, p, res ) ) == -1 )
+        return total ? ( s32 )total : -1;
+      total += ( u32 )r;
+      if( ( u32 )r < res )
+        break;
+      count -= res;
+      p += res;
+    }
+    return ( s32 )total;
+  }
+  rfsch_flush();
+  seq = rfsc_seq;
+  while( recvd < sent || ( sent < nreq && !done ) )
+  {
+    // Keep the pipe full
+    while( !done && sent < nreq && sent - recvd < rfsc_window )
+    {
+      res = sent == nreq - 1 ? count - sent * chunk : chunk;
+      remotefs_readseq_write_request( rfsc_buffer, fd, res, rfsc_seq ++ );
+      if( rfsch_send_request() == CLIENT_ERR )
+      {
+        if( sent > recvd )
+          rfsch_drain( seq + sent - 1, seq + recvd - 1, 1 );
+        return total ? ( s32 )total : -1;
+      }
+      sent ++;
+    }
+    resseq = seq + recvd - 1;
+    if( rfsch_read_response() == CLIENT_ERR ||
+        remotefs_readseq_read_response( rfsc_buffer, &resseq, &resbuf, &res ) == ELUARPC_ERR ||
+        resseq != seq + recvd )
+    {
+      RFSDEBUG( "[RFS] pipelined read error at request %u\n", ( unsigned )recvd );
+      rfsch_drain( seq + sent - 1, resseq, 1 );
+      return total ? ( s32 )total : -1;
+    }
+    // Data that follows a short read is not contiguous with what we have
+    if( !done )
+    {
+      memcpy( p + recvd * chunk, resbuf, res );
+      total += res;
+      if( res < chunk )
+        done = 1;
+    }
+    recvd ++;
+  }
+  return ( s32 )total;
+}
+
+// Same as rfsc_read_pipelined, for writes. After a short write the requests
+// already in flight may still be executed by the server; the returned count
+// only covers the data that was written contiguously.
+s32 rfsc_write_pipelined( int fd, const void *buf, u32 count, u32 chunk )
+{
+  const u8 *p = ( const u8* )buf;
+  u32 sent = 0, recvd = 0, total = 0, seq, resseq, res, towrite;
+  u32 nreq = ( count + chunk - 1 ) / chunk;
+  s32 r;
+  int done = 0;
+
+  if( rfsc_window <= 1 || nreq <= 1 )
+  {
+    while( count )
+    {
+      towrite = count > chunk ? chunk : count;
+      if( ( r = rfsc_write( fd, p, towrite ) ) == -1 )
+        return total ? ( s32 )total : -1;
+      total += ( u32 )r;
+      if( ( u32 )r < towrite )
+        break;
+      count -= towrite;
+      p += towrite;
+    }
+    return ( s32 )total;
+  }
+  rfsch_flush();
+  seq = rfsc_seq;
+  while( recvd < sent || ( sent < nreq && !done ) )
+  {
+    while( !done && sent < nreq && sent - recvd < rfsc_window )
+    {
+      towrite = sent == nreq - 1 ? count - sent * chunk : chunk;
+      remotefs_writeseq_write_request( rfsc_buffer, fd, p + sent * chunk, towrite, rfsc_seq ++ );
+      if( rfsch_send_request() == CLIENT_ERR )
+      {
+        if( sent > recvd )
+          rfsch_drain( seq + sent - 1, seq + recvd - 1, 0 );
+        return total ? ( s32 )total : -1;
+      }
+      sent ++;
+    }
+    resseq = seq + recvd - 1;
+    if( rfsch_read_response() == CLIENT_ERR ||
+        remotefs_writeseq_read_response( rfsc_buffer, &resseq, &res ) == ELUARPC_ERR ||
+        resseq != seq + recvd )
+    {
+      RFSDEBUG( "[RFS] pipelined write error at request %u\n", ( unsigned )recvd );
+      rfsch_drain( seq + sent - 1, resseq, 0 );
+      return total ? ( s32 )total : -1;
+    }
+    if( !done )
+    {
+      total += res;
+      towrite = recvd == nreq - 1 ? count - recvd * chunk : chunk;
+      if( res < towrite )
+        done = 1;
+    }
+    recvd ++;
+  }
+  return ( s32 )total;
+}
+
 s32 rfsc_lseek( int fd, s32 offset, int whence )
 {
   s32 res;
@@ -14,6 +14,7 @@
 #include "hostif.h"
 #endif
 #include <stdio.h>
+#include <string.h>
 
 #ifdef BUILD_RFS
 
@@ -26,17 +27,113 @@
 #define RFS_TIMER_ID          PLATFORM_TIMER_SYS_ID
 #endif
 
+// Number of READ/WRITE requests that can be in flight at the same time. The
+// actual value is negotiated with the server (old servers only support 1).
+#ifndef RFS_WINDOW
+#define RFS_WINDOW            4
+#endif
+
 // Our RFS buffer
 // Compute the usable buffer size starting from RFS_BUFFER_SIZE (which is the
 // size of the serial buffer). A complete packet must fit in RFS_BUFFER_SIZE
-// bytes. Computed this to be large enough for a WRITE request.
-#define RFS_REAL_BUFFER_SIZE      ( ( 1 << RFS_BUFFER_SIZE ) - ELUARPC_WRITE_REQUEST_EXTRA )
+// bytes. Computed this to be large enough for a WRITESEQ request.
+#define RFS_REAL_BUFFER_SIZE      ( ( 1 << RFS_BUFFER_SIZE ) - RFS_WRITESEQ_REQUEST_EXTRA )
 static u8 rfs_buffer[ 1 << RFS_BUFFER_SIZE ];
 
+// Read cache: RFS_CACHE_BLOCKS blocks of RFS_CACHE_BLOCK_SIZE bytes, each one
+// holding data read ahead from a single file. Set RFS_CACHE_BLOCKS to 0 to
+// disable the cache.
+#ifndef RFS_CACHE_BLOCKS
+#define RFS_CACHE_BLOCKS      1
+#endif
+
+#ifndef RFS_CACHE_BLOCK_SIZE
+#define RFS_CACHE_BLOCK_SIZE  RFS_REAL_BUFFER_SIZE
+#endif
+
 #ifdef ELUA_SIMULATOR
 static int rfs_read_fd, rfs_write_fd;
 #endif
 
+// ****************************************************************************
+// Read cache
+// The server's file position is always at the end of the cached data, so
+// the bytes that weren't consumed yet must be accounted for when seeking or
+// writing.
+
+#if RFS_CACHE_BLOCKS > 0
+
+typedef struct
+{
+  int fd;                               // file descriptor, -1 if not used
+  u32 pos;                              // bytes already consumed
+  u32 len;                              // bytes in the block
+  u32 age;                              // for LRU replacement
+  u8 data[ RFS_CACHE_BLOCK_SIZE ];
+} RFS_CACHE_BLOCK;
+
+static RFS_CACHE_BLOCK rfs_cache[ RFS_CACHE_BLOCKS ];
+static u32 rfs_cache_age;
+
+static RFS_CACHE_BLOCK* rfs_cache_find( int fd )
+{
+  unsigned i;
+
+  for( i = 0; i < RFS_CACHE_BLOCKS; i ++ )
+    if( rfs_cache[ i ].fd == fd )
+      return rfs_cache + i;
+  return NULL;
+}
+
+// Drop the block of 'fd'. If 'resync' is set, move the server's file position
+// back to where the application thinks it is.
+static void rfs_cache_drop( int fd, int resync )
+{
+  RFS_CACHE_BLOCK *pblock = rfs_cache_find( fd );
+
+  if( pblock == NULL )
+    return;
+  if( resync && pblock->pos < pblock->len )
+    rfsc_lseek( fd, -( s32 )( pblock->len - pblock->pos ), SEEK_CUR );
+  pblock->fd = -1;
+}
+
+// Return a block for 'fd', evicting the least recently used one if needed
+static RFS_CACHE_BLOCK* rfs_cache_get( int fd )
+{
+  RFS_CACHE_BLOCK *pblock = rfs_cache_find( fd );
+  unsigned i;
+
+  if( pblock == NULL )
+  {
+    pblock = rfs_cache;
+    for( i = 0; i < RFS_CACHE_BLOCKS && pblock->fd != -1; i ++ )
+      if( rfs_cache[ i ].fd == -1 || rfs_cache[ i ].age < pblock->age )
+        pblock = rfs_cache + i;
+    if( pblock->fd != -1 )
+      rfs_cache_drop( pblock->fd, 1 );
+    pblock->fd = fd;
+  }
+  pblock->pos = pblock->len = 0;
+  pblock->age = ++ rfs_cache_age;
+  return pblock;
+}
+
+static void rfs_cache_init()
+{
+  unsigned i;
+
+  for( i = 0; i < RFS_CACHE_BLOCKS; i ++ )
+    rfs_cache[ i ].fd = -1;
+}
+
+#else // #if RFS_CACHE_BLOCKS > 0
+
+#define rfs_cache_drop( fd, resync )
+#define rfs_cache_init()
+
+#endif // #if RFS_CACHE_BLOCKS > 0
+
 static int rfs_open_r( struct _reent *r, const char *path, int flags, int mode, void *pdata )
 {
   return rfsc_open( path, flags, mode );
@@ -44,59 +141,96 @@ static int rfs_open_r( struct _reent *r, const char *path, int flags, int mode,
 
 static int rfs_close_r( struct _reent *r, int fd, void *pdata )
 {
+  rfs_cache_drop( fd, 0 );
   return rfsc_close( fd );
 }
 
 static _ssize_t rfs_write_r( struct _reent *r, int fd, const void* ptr, size_t len, void *pdata )
 { 
-  s32 total = 0, res;
-  u32 towrite;
-  const u8 *p = ( const u8* )ptr;
+  s32 res;
 
+  rfs_cache_drop( fd, 1 );
   // Write in RFS_REAL_BUFFER_SIZE increments
-//  printf( "Got WRITE request for %d bytes\n", len );
-  while( len )
-  {
-    towrite = len > RFS_REAL_BUFFER_SIZE ? RFS_REAL_BUFFER_SIZE : len;
-    if( ( res = rfsc_write( fd, p, towrite ) ) == -1 )
-      break;
-    total += res;
-//    printf( "Wrote %d bytes\n", res );
-    if( res < towrite )
-      break;
-    len -= towrite;
-    p += towrite; 
-  }
-  return ( _ssize_t )total;
+  if( ( res = rfsc_write_pipelined( fd, ptr, len, RFS_REAL_BUFFER_SIZE ) ) == -1 )
+    res = 0;
+  return ( _ssize_t )res;
 }
 
 static _ssize_t rfs_read_r( struct _reent *r, int fd, void* ptr, size_t len, void *pdata )
 {
-  s32 total = 0, res;
-  u32 toread;
+  s32 res;
+#if RFS_CACHE_BLOCKS > 0
+  RFS_CACHE_BLOCK *pblock = rfs_cache_find( fd );
   u8 *p = ( u8* )ptr;
+  s32 total = 0;
 
-  // Read in RFS_REAL_BUFFER_SIZE increments
-//  printf( "Got READ request for %d bytes\n", len );
-  while( len )
+  // Serve as much as possible from the cache
+  if( pblock && pblock->pos < pblock->len )
   {
-    toread = len > RFS_REAL_BUFFER_SIZE ? RFS_REAL_BUFFER_SIZE : len;
-    if( ( res = rfsc_read( fd, p, toread ) ) == -1 )
-      break;
-    total += res; 
-//    printf( "Read %d bytes\n", res );
-    if( res < toread )
-      break;
-    len -= toread;
-    p += toread;
+    total = pblock->len - pblock->pos;
+    if( ( u32 )total > len )
+      total = len;
+    memcpy( p, pblock->data + pblock->pos, total );
+    pblock->pos += total;
+    pblock->age = ++ rfs_cache_age;
+    if( ( len -= total ) == 0 )
+      return ( _ssize_t )total;
+    p += total;
+  }
+  // Small reads fill a cache block (read-ahead), large ones go directly to
+  // the application buffer
+  if( len < RFS_CACHE_BLOCK_SIZE )
+  {
+    pblock = rfs_cache_get( fd );
+    if( ( res = rfsc_read_pipelined( fd, pblock->data, RFS_CACHE_BLOCK_SIZE, RFS_REAL_BUFFER_SIZE ) ) == -1 )
+    {
+      pblock->fd = -1;
+      return ( _ssize_t )total;
+    }
+    pblock->len = ( u32 )res;
+    pblock->pos = ( u32 )res < len ? ( u32 )res : len;
+    memcpy( p, pblock->data, pblock->pos );
+    return ( _ssize_t )( total + pblock->pos );
   }
-  return ( _ssize_t )total;
+  if( ( res = rfsc_read_pipelined( fd, p, len, RFS_REAL_BUFFER_SIZE ) ) == -1 )
+    res = 0;
+  return ( _ssize_t )( total + res );
+#else // #if RFS_CACHE_BLOCKS > 0
+
+  // Read in RFS_REAL_BUFFER_SIZE increments
+  if( ( res = rfsc_read_pipelined( fd, ptr, len, RFS_REAL_BUFFER_SIZE ) ) == -1 )
+    res = 0;
+  return ( _ssize_t )res;
+#endif // #if RFS_CACHE_BLOCKS > 0
 }
 
 // lseek
 static off_t rfs_lseek_r( struct _reent *r, int fd, off_t off, int whence, void *pdata )
 {
+#if RFS_CACHE_BLOCKS > 0
+  RFS_CACHE_BLOCK *pblock = rfs_cache_find( fd );
+  s32 res;
+
+  // The server is ahead of us by the data that wasn't consumed yet
+  if( pblock && whence == SEEK_CUR )
+  {
+    // Just asking for the current position (ftell), keep the cache
+    if( off == 0 )
+    {
+      if( ( res = rfsc_lseek( fd, 0, SEEK_CUR ) ) != -1 )
+        res -= ( s32 )( pblock->len - pblock->pos );
+      return ( off_t )res;
+    }
+    off -= ( off_t )( pblock->len - pblock->pos );
+  }
+  // If the seek fails the server's position doesn't change, so it must be
+  // moved back to the application's position
+  res = rfsc_lseek( fd, ( s32 )off, whence );
+  rfs_cache_drop( fd, res == -1 );
+  return ( off_t )res;
+#else
   return ( off_t )rfsc_lseek( fd, ( s32 )off, whence );
+#endif
 }
 
 // opendir
@@ -209,6 +343,8 @@ int remotefs_init()
   } 
 #endif
   rfsc_setup( rfs_buffer, rfs_send, rfs_recv, RFS_TIMEOUT );
+  rfsc_set_window( RFS_WINDOW );
+  rfs_cache_init();
   return dm_register( "/rfs", NULL, &rfs_device );
 }
 
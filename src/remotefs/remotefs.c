@@ -200,4 +200,76 @@ int remotefs_closedir_read_request( const u8 *p, u32 *pd )
   return eluarpc_gen_read( p, "ol", RFS_OP_CLOSEDIR, pd );
 }
 
+// ****************************************************************************
+// Operation: window
+// window: u32 window( u32 window )
+// The client asks for a number of outstanding READSEQ/WRITESEQ requests, the
+// server answers with the number it accepts
+
+void remotefs_window_write_response( u8 *p, u32 window )
+{
+  eluarpc_gen_write( p, "rl", RFS_OP_WINDOW, window );
+}
+
+int remotefs_window_read_response( const u8 *p, u32 *pwindow )
+{
+  return eluarpc_gen_read( p, "rl", RFS_OP_WINDOW, pwindow );
+}
+
+void remotefs_window_write_request( u8 *p, u32 window )
+{
+  eluarpc_gen_write( p, "ol", RFS_OP_WINDOW, window );
+}
+
+int remotefs_window_read_request( const u8 *p, u32 *pwindow )
+{
+  return eluarpc_gen_read( p, "ol", RFS_OP_WINDOW, pwindow );
+}
+
+// *****************************************************************************
+// Operation: readseq
+// readseq: ssize_t readseq( int fd, void *buf, size_t count, u32 seq )
+
+void remotefs_readseq_write_response( u8 *p, u32 seq, u32 readbytes )
+{
+  eluarpc_gen_write( p, "rlp", RFS_OP_READSEQ, seq, NULL, readbytes );
+}
+
+int remotefs_readseq_read_response( const u8 *p, u32 *pseq, const u8 **ppdata, u32 *preadbytes )
+{
+  return eluarpc_gen_read( p, "rlp", RFS_OP_READSEQ, pseq, ppdata, preadbytes );
+}
+
+void remotefs_readseq_write_request( u8 *p, int fd, u32 count, u32 seq )
+{
+  eluarpc_gen_write( p, "oill", RFS_OP_READSEQ, fd, count, seq );
+}
+
+int remotefs_readseq_read_request( const u8 *p, int *pfd, u32 *pcount, u32 *pseq )
+{
+  return eluarpc_gen_read( p, "oill", RFS_OP_READSEQ, pfd, pcount, pseq );
+}
+
+// *****************************************************************************
+// Operation: writeseq
+// writeseq: ssize_t writeseq( int fd, const void *buf, size_t count, u32 seq )
+
+void remotefs_writeseq_write_response( u8 *p, u32 seq, u32 result )
+{
+  eluarpc_gen_write( p, "rll", RFS_OP_WRITESEQ, seq, result );
+}
+
+int remotefs_writeseq_read_response( const u8 *p, u32 *pseq, u32 *presult )
+{
+  return eluarpc_gen_read( p, "rll", RFS_OP_WRITESEQ, pseq, presult );
+}
 
+void remotefs_writeseq_write_request( u8 *p, int fd, const void *buf, u32 count, u32 seq )
+{
+  eluarpc_gen_write( p, "oilp", RFS_OP_WRITESEQ, fd, seq, buf, count );
+}
+
+int remotefs_writeseq_read_request( const u8 *p, int *pfd, const void **pbuf, u32 *pcount, u32 *pseq )
+{
+  return eluarpc_gen_read( p, "oilp", RFS_OP_WRITESEQ, pfd, pseq, pbuf, pcount );
+}
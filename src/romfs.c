@@ -2,6 +2,8 @@
 #include "romfs.h"
 #include "type.h"
 #include <string.h>
+#include <stddef.h>
+#include <ctype.h>
 #include <errno.h>
 #include "devman.h"
 #include "romfiles.h"
@@ -21,22 +23,48 @@
 #define ROMFS_ALIGN     4
 
 #define fsmin( x , y ) ( ( x ) < ( y ) ? ( x ) : ( y ) )
+#define fsalign( x ) ( ( ( x ) + ROMFS_ALIGN - 1 ) & ~( ROMFS_ALIGN - 1 ) )
 
 static FD fd_table[ TOTAL_MAX_FDS ];
 static int romfs_num_fd;
+#ifdef BUILD_WOFS
+static int wofs_num_fd;                 // number of files opened on WOFS
+static int wofs_tail_fd = -1;           // the file which owns the last record of WOFS (-1 if none)
+static u32 wofs_next_id;                // id of the next file created on WOFS
+static int wofs_mapped;                 // 1 if getaddr returned a WOFS address (code might run from it)
+#endif
 #ifdef ALCOR_CPU_LINUX
 static int wofs_sim_fd;
 #define WOFS_FNAME    "/tmp/wofs.dat"
+#ifndef WOFS_SIZE
 #define WOFS_SIZE     (256 * 1024)
 #endif
+#ifndef WOFS_SECTOR_SIZE
+#define WOFS_SECTOR_SIZE  (4 * 1024)      // emulated flash sector size
+#endif
+#endif
 
 #define WOFS_END_MARKER_CHAR  0xFF
 #define WOFS_DEL_FIELD_SIZE   ( ROMFS_ALIGN )
 #define WOFS_FILE_DELETED     0xAA
+// First byte of the name of a WOFS extent and of a WOFS skip record
+#define WOFS_EXTENT_CHAR      0x01
+#define WOFS_SKIP_CHAR        0x02
+// Offsets of the WOFS header fields, relative to the beginning of the file data
+#define WOFS_TOTAL_OFFSET     ( ROMFS_SIZE_LEN + 4 )
+#define WOFS_ID_OFFSET        ( WOFS_TOTAL_OFFSET + 4 )
+#define WOFS_DEL_OFFSET       ( WOFS_ID_OFFSET + WOFS_DEL_FIELD_SIZE )
+// Length of the header of a WOFS extent (name and fields)
+#define WOFS_EXTENT_HEADER_LEN ( ROMFS_ALIGN + WOFS_DEL_OFFSET )
 
 // Length of the 'file size' field for both ROMFS/WOFS
 #define ROMFS_SIZE_LEN        4
 
+// Block compressed ROMFS file flag (in the 'file size' field)
+#define ROMFS_SIZE_COMPRESSED 0x80000000UL
+// Uncompressed size and block size fields of a compressed file
+#define ROMFS_COMP_HEADER_LEN 8
+
 static int romfs_find_empty_fd()
 {
   int i;
@@ -65,73 +93,471 @@ static u8 romfsh_read8( u32 addr, const FSDATA *pfs )
   return temp;
 }
 
+// Helper function: read a little endian u32 from the FS
+static u32 romfsh_read32( u32 addr, const FSDATA *pfs )
+{
+  return romfsh_read8( addr, pfs ) + ( romfsh_read8( addr + 1, pfs ) << 8 ) +
+         ( romfsh_read8( addr + 2, pfs ) << 16 ) + ( ( u32 )romfsh_read8( addr + 3, pfs ) << 24 );
+}
+
+// Helper function: read data from the FS
+static void romfsh_read( void *to, u32 addr, u32 size, const FSDATA *pfs )
+{
+  if( pfs->flags & ROMFS_FS_FLAG_DIRECT )
+    memcpy( to, pfs->pbase + addr, size );
+  else
+    pfs->readf( to, addr, size, pfs );
+}
+
 // Helper function: return 1 if PFS reffers to a WOFS, 0 otherwise
 static int romfsh_is_wofs( const FSDATA* pfs )
 {
   return ( pfs->flags & ROMFS_FS_FLAG_WO ) != 0;
 }
 
+#ifdef BUILD_WOFS
+// Helper function: store a little endian u32 in a buffer
+static void wofsh_put32( u8 *p, u32 data )
+{
+  p[ 0 ] = data & 0xFF;
+  p[ 1 ] = ( data >> 8 ) & 0xFF;
+  p[ 2 ] = ( data >> 16 ) & 0xFF;
+  p[ 3 ] = ( data >> 24 ) & 0xFF;
+}
+
+// Helper function: write a little endian u32 to WOFS
+static void wofsh_write32( u32 addr, u32 data, const FSDATA *pfs )
+{
+  u8 temp[ 4 ];
+
+  wofsh_put32( temp, data );
+  pfs->writef( temp, addr, 4, pfs );
+}
+
+// Return the current size of the last WOFS record, which doesn't have a size
+// yet because its file is still written
+static u32 wofsh_open_size( u32 baseaddr )
+{
+  const FD *pfd = fd_table + wofs_tail_fd;
+
+  if( wofs_tail_fd != -1 && pfd->lastaddr == baseaddr )
+    return pfd->size - pfd->laststart;
+  return 0;
+}
+#endif
+
+// Read the header of the file that starts at 'addr' (name, deleted flag, data
+// address and size). Returns the address of the next file.
+static u32 romfsh_read_header( u32 addr, const FSDATA *pfs, char *fsname, int *pis_deleted, FD *pfd )
+{
+  u32 j, fsize;
+
+  pfd->offset = 0;
+  pfd->flags = 0;
+  // WOFS skip records only have their length
+  if( romfsh_is_wofs( pfs ) && romfsh_read8( addr, pfs ) == WOFS_SKIP_CHAR )
+  {
+    fsname[ 0 ] = 0;
+    *pis_deleted = 1;
+    pfd->baseaddr = addr + ROMFS_ALIGN;
+    pfd->size = 0;
+    return addr + ( romfsh_read32( addr, pfs ) >> 8 );
+  }
+  // Read file name
+  for( j = 0; j < DM_MAX_FNAME_LENGTH; j ++ )
+  {
+    fsname[ j ] = romfsh_read8( addr + j, pfs );
+    if( fsname[ j ] == 0 )
+       break;
+  }
+  fsname[ j ] = 0;
+  // ' addr + j' now points at the '0' byte
+  j = addr + j + 1;
+  // Round to a multiple of ROMFS_ALIGN
+  j = ( j + ROMFS_ALIGN - 1 ) & ~( ROMFS_ALIGN - 1 );
+  // WOFS has an additional WOFS_DEL_FIELD_SIZE bytes before the size as an indication for "file deleted"
+  // followed by the file id and total size. Extents are not files, so they are reported as deleted.
+  if( romfsh_is_wofs( pfs ) )
+  {
+    *pis_deleted = romfsh_read8( j, pfs ) == WOFS_FILE_DELETED || fsname[ 0 ] == WOFS_EXTENT_CHAR;
+    j += WOFS_DEL_OFFSET - ROMFS_SIZE_LEN;
+  }
+  else
+    *pis_deleted = 0;
+  // And read the size
+  fsize = romfsh_read32( j, pfs );
+  j += ROMFS_SIZE_LEN;
+  pfd->baseaddr = j;
+#ifdef BUILD_WOFS
+  if( romfsh_is_wofs( pfs ) && fsize == 0xFFFFFFFF )
+    fsize = wofsh_open_size( j );
+#endif
+  pfd->size = fsize;
+  if( !romfsh_is_wofs( pfs ) && ( fsize & ROMFS_SIZE_COMPRESSED ) )
+  {
+    // Compressed file: the real size is at the beginning of the data
+    fsize &= ~ROMFS_SIZE_COMPRESSED;
+    pfd->size = romfsh_read32( j, pfs );
+    pfd->flags = ROMFS_FILE_FLAG_COMPRESSED;
+  }
+  // Move to next file
+  j += fsize;
+  // On WOFS, all file names must begin at a multiple of ROMFS_ALIGN
+  if( romfsh_is_wofs( pfs ) )
+    j = ( j + ROMFS_ALIGN - 1 ) & ~( ROMFS_ALIGN - 1 );
+  return j;
+}
+
+// Look for a file in the sorted index generated by mkfs (ROMFS only)
+static u8 romfs_find_indexed( const char* fname, FD* pfd, const FSDATA *pfs, u32 *pnameaddr )
+{
+  u32 lo = 0, hi = pfs->nindex, mid;
+  char fsname[ DM_MAX_FNAME_LENGTH + 1 ];
+  int is_deleted;
+
+  // Find the first entry which is not smaller than 'fname'
+  while( lo < hi )
+  {
+    mid = ( lo + hi ) >> 1;
+    romfsh_read_header( pfs->pindex[ mid ], pfs, fsname, &is_deleted, pfd );
+    if( strncasecmp( fsname, fname, DM_MAX_FNAME_LENGTH ) < 0 )
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if( lo == pfs->nindex )
+    return FS_FILE_NOT_FOUND;
+  romfsh_read_header( pfs->pindex[ lo ], pfs, fsname, &is_deleted, pfd );
+  if( strncasecmp( fname, fsname, DM_MAX_FNAME_LENGTH ) )
+    return FS_FILE_NOT_FOUND;
+  if( pnameaddr )
+    *pnameaddr = pfs->pindex[ lo ];
+  return FS_FILE_OK;
+}
+
+#ifdef BUILD_WOFS
+// WOFS keeps an index of its (non deleted) files in RAM, sorted by the hash
+// of their names, together with the first free address. It is built by the
+// first scan of the file system and updated when files are created or
+// deleted. If there are more than WOFS_INDEX_SIZE files, WOFS falls back to
+// scanning the file system on each open.
+#ifndef WOFS_INDEX_SIZE
+#define WOFS_INDEX_SIZE       32
+#endif
+
+typedef struct
+{
+  u32 hash;
+  u32 nameaddr;
+} WOFS_INDEX_ENTRY;
+
+enum
+{
+  WOFS_INDEX_INVALID,
+  WOFS_INDEX_VALID,
+  WOFS_INDEX_OVERFLOW
+};
+
+static WOFS_INDEX_ENTRY wofs_index[ WOFS_INDEX_SIZE ];
+static unsigned wofs_index_count;
+static u32 wofs_index_last;             // first free address, 0 while a file is written
+static u8 wofs_index_state;
+
+// Case insensitive name hash (FNV-1a)
+static u32 wofs_index_hash( const char *fname )
+{
+  u32 h = 2166136261UL;
+  unsigned i;
+
+  for( i = 0; i < DM_MAX_FNAME_LENGTH && fname[ i ]; i ++ )
+    h = ( h ^ ( u8 )tolower( ( u8 )fname[ i ] ) ) * 16777619UL;
+  return h;
+}
+
+// Returns the position of the first entry with the given hash (or of the
+// place where it should be inserted)
+static unsigned wofs_index_lookup( u32 hash )
+{
+  unsigned lo = 0, hi = wofs_index_count, mid;
+
+  while( lo < hi )
+  {
+    mid = ( lo + hi ) >> 1;
+    if( wofs_index[ mid ].hash < hash )
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static void wofs_index_add( const char *fname, u32 nameaddr )
+{
+  u32 hash;
+  unsigned pos;
+
+  if( wofs_index_state != WOFS_INDEX_VALID )
+    return;
+  if( wofs_index_count == WOFS_INDEX_SIZE )
+  {
+    wofs_index_state = WOFS_INDEX_OVERFLOW;
+    return;
+  }
+  hash = wofs_index_hash( fname );
+  pos = wofs_index_lookup( hash );
+  memmove( wofs_index + pos + 1, wofs_index + pos, ( wofs_index_count - pos ) * sizeof( WOFS_INDEX_ENTRY ) );
+  wofs_index[ pos ].hash = hash;
+  wofs_index[ pos ].nameaddr = nameaddr;
+  wofs_index_count ++;
+}
+
+static void wofs_index_remove( const char *fname, u32 nameaddr )
+{
+  u32 hash;
+  unsigned pos;
+
+  if( wofs_index_state != WOFS_INDEX_VALID )
+    return;
+  hash = wofs_index_hash( fname );
+  for( pos = wofs_index_lookup( hash ); pos < wofs_index_count && wofs_index[ pos ].hash == hash; pos ++ )
+    if( wofs_index[ pos ].nameaddr == nameaddr )
+    {
+      memmove( wofs_index + pos, wofs_index + pos + 1, ( wofs_index_count - pos - 1 ) * sizeof( WOFS_INDEX_ENTRY ) );
+      wofs_index_count --;
+      break;
+    }
+}
+
+static u8 wofs_index_find( const char *fname, FD *pfd, const FSDATA *pfs, u32 *pnameaddr )
+{
+  u32 hash = wofs_index_hash( fname );
+  unsigned pos;
+  char fsname[ DM_MAX_FNAME_LENGTH + 1 ];
+  int is_deleted;
+
+  // Different names can have the same hash, so check the actual name too
+  for( pos = wofs_index_lookup( hash ); pos < wofs_index_count && wofs_index[ pos ].hash == hash; pos ++ )
+  {
+    romfsh_read_header( wofs_index[ pos ].nameaddr, pfs, fsname, &is_deleted, pfd );
+    if( !is_deleted && !strncasecmp( fname, fsname, DM_MAX_FNAME_LENGTH ) )
+    {
+      if( pnameaddr )
+        *pnameaddr = wofs_index[ pos ].nameaddr;
+      return FS_FILE_OK;
+    }
+  }
+  return FS_FILE_NOT_FOUND;
+}
+#else // #ifdef BUILD_WOFS
+#define wofs_index_add( fname, nameaddr )
+#define wofs_index_remove( fname, nameaddr )
+#endif // #ifdef BUILD_WOFS
+
 // Open the given file, returning one of FS_FILE_NOT_FOUND, FS_FILE_ALREADY_OPENED
-// or FS_FILE_OK
+// or FS_FILE_OK. '*plast' is set to the first free address of the FS if the
+// file is not found.
 static u8 romfs_open_file( const char* fname, FD* pfd, FSDATA *pfs, u32 *plast, u32 *pnameaddr )
 {
-  u32 i, j, n;
+  u32 i, next;
   char fsname[ DM_MAX_FNAME_LENGTH + 1 ];
-  u32 fsize;
-  int is_deleted;
-  
-  // Look for the file
-  i = 0;
-  while( 1 )
+  int is_deleted, build = 0;
+  FD tempfd;
+  u8 res = FS_FILE_NOT_FOUND;
+
+  if( !romfsh_is_wofs( pfs ) && pfs->pindex )
+  {
+    *plast = 0;
+    return romfs_find_indexed( fname, pfd, pfs, pnameaddr );
+  }
+#ifdef BUILD_WOFS
+  if( romfsh_is_wofs( pfs ) )
   {
-    if( romfsh_read8( i, pfs ) == WOFS_END_MARKER_CHAR )
+    if( wofs_index_state == WOFS_INDEX_VALID )
     {
-      *plast = i;
-      return FS_FILE_NOT_FOUND;
+      *plast = wofs_index_last;
+      return wofs_index_find( fname, pfd, pfs, pnameaddr );
     }
-    // Read file name
-    n = i;
-    for( j = 0; j < DM_MAX_FNAME_LENGTH; j ++ )
+    // Build the index while scanning the file system for the first time
+    if( ( build = wofs_index_state == WOFS_INDEX_INVALID ) != 0 )
     {
-      fsname[ j ] = romfsh_read8( i + j, pfs );
-      if( fsname[ j ] == 0 )
-         break;
+      wofs_index_count = 0;
+      wofs_index_state = WOFS_INDEX_VALID;
     }
-    // ' i + j' now points at the '0' byte
-    j = i + j + 1;
-    // Round to a multiple of ROMFS_ALIGN
-    j = ( j + ROMFS_ALIGN - 1 ) & ~( ROMFS_ALIGN - 1 );
-    // WOFS has an additional WOFS_DEL_FIELD_SIZE bytes before the size as an indication for "file deleted"
-    if( romfsh_is_wofs( pfs ) )
+  }
+#endif
+  // Look for the file
+  i = 0;
+  while( romfsh_read8( i, pfs ) != WOFS_END_MARKER_CHAR )
+  {
+    next = romfsh_read_header( i, pfs, fsname, &is_deleted, &tempfd );
+    if( !is_deleted )
     {
-      is_deleted = romfsh_read8( j, pfs ) == WOFS_FILE_DELETED;
-      j += WOFS_DEL_FIELD_SIZE;
+      if( res == FS_FILE_NOT_FOUND && !strncasecmp( fname, fsname, DM_MAX_FNAME_LENGTH ) )
+      {
+        // Found the file
+        memcpy( pfd, &tempfd, sizeof( FD ) );
+        if( pnameaddr )
+          *pnameaddr = i;
+        if( !build )
+          return FS_FILE_OK;
+        res = FS_FILE_OK;
+      }
+      if( build )
+        wofs_index_add( fsname, i );
     }
-    else
-      is_deleted = 0;
-    // And read the size
-    fsize = romfsh_read8( j, pfs ) + ( romfsh_read8( j + 1, pfs ) << 8 );
-    fsize += ( romfsh_read8( j + 2, pfs ) << 16 ) + ( romfsh_read8( j + 3, pfs ) << 24 );
-    j += ROMFS_SIZE_LEN;
-    if( !strncasecmp( fname, fsname, DM_MAX_FNAME_LENGTH ) && !is_deleted )
+    i = next;
+  }
+  *plast = i;
+#ifdef BUILD_WOFS
+  if( build )
+    wofs_index_last = i;
+#endif
+  return res;
+}
+
+#ifdef BUILD_WOFS
+static int wofsh_compact( FSDATA *pfs );
+
+// Delete a WOFS file by changing WOFS_DEL_FIELD_SIZE bytes of its first
+// record to WOFS_FILE_DELETED (its extents are marked later by the compaction)
+static void romfsh_delete_file( const char *path, u32 baseaddr, u32 nameaddr, const FSDATA *pfs )
+{
+  u8 tempb[] = { WOFS_FILE_DELETED, 0xFF, 0xFF, 0xFF };
+
+  pfs->writef( tempb, baseaddr - WOFS_DEL_OFFSET, WOFS_DEL_FIELD_SIZE, pfs );
+  wofs_index_remove( path, nameaddr );
+}
+
+// Return the size of the WOFS record whose data begins at 'baseaddr'
+static u32 wofsh_data_size( u32 baseaddr, const FSDATA *pfs )
+{
+  u32 size = romfsh_read32( baseaddr - ROMFS_SIZE_LEN, pfs );
+
+  return size == 0xFFFFFFFF ? wofsh_open_size( baseaddr ) : size;
+}
+
+// Look for the next extent of file 'id', starting with the record at 'addr'.
+// Returns the address of the extent (its data is described by 'pfd') or
+// 0xFFFFFFFF if the file doesn't have other extents.
+static u32 wofsh_find_extent( u32 addr, u32 id, FD *pfd, const FSDATA *pfs )
+{
+  char fsname[ DM_MAX_FNAME_LENGTH + 1 ];
+  int is_deleted;
+  u32 next;
+
+  while( romfsh_read8( addr, pfs ) != WOFS_END_MARKER_CHAR )
+  {
+    next = romfsh_read_header( addr, pfs, fsname, &is_deleted, pfd );
+    if( fsname[ 0 ] == WOFS_EXTENT_CHAR && romfsh_read32( pfd->baseaddr - WOFS_ID_OFFSET, pfs ) == id )
+      return addr;
+    addr = next;
+  }
+  return 0xFFFFFFFF;
+}
+
+// Return the size of the WOFS file whose first record has its data at 'baseaddr'
+static u32 wofsh_file_size( u32 baseaddr, const FSDATA *pfs )
+{
+  u32 size = romfsh_read32( baseaddr - WOFS_TOTAL_OFFSET, pfs ), id, addr;
+  unsigned i;
+  FD tempfd;
+
+  if( size != 0xFFFFFFFF )
+    return size;
+  // The total size is written when the file is closed, so the file might be still written
+  for( i = 0; i < TOTAL_MAX_FDS; i ++ )
+    if( fd_table[ i ].baseaddr == baseaddr && ( fd_table[ i ].flags & ( ROMFS_FILE_FLAG_WRITE | ROMFS_FILE_FLAG_APPEND ) ) )
+      return fd_table[ i ].size;
+  // Otherwise add the sizes of all its records
+  id = romfsh_read32( baseaddr - WOFS_ID_OFFSET, pfs );
+  size = wofsh_data_size( baseaddr, pfs );
+  addr = fsalign( baseaddr + size );
+  while( wofsh_find_extent( addr, id, &tempfd, pfs ) != 0xFFFFFFFF )
+  {
+    size += tempfd.size;
+    addr = fsalign( tempfd.baseaddr + tempfd.size );
+  }
+  return size;
+}
+
+// Write the size of the last WOFS record, so that another record can follow it
+static void wofsh_seal( FSDATA *pfs )
+{
+  FD *pfd = fd_table + wofs_tail_fd;
+  u32 size;
+
+  if( wofs_tail_fd == -1 )
+    return;
+  size = pfd->size - pfd->laststart;
+  wofsh_write32( pfd->lastaddr - ROMFS_SIZE_LEN, size, pfs );
+  wofs_index_last = fsalign( pfd->lastaddr + size );
+  wofs_tail_fd = -1;
+}
+
+// Continue file 'fd' in a new record (extent) at the end of WOFS, because
+// another file was written after its last record. Returns 1 if OK, 0 if
+// there's not enough space left.
+static int wofsh_new_extent( int fd, FSDATA *pfs )
+{
+  FD *pfd = fd_table + fd;
+  u8 header[ WOFS_EXTENT_HEADER_LEN ];
+  u32 addr, id = romfsh_read32( pfd->baseaddr - WOFS_ID_OFFSET, pfs );
+  FD tempfd;
+
+  wofsh_seal( pfs );
+  romfs_open_file( "\1", &tempfd, pfs, &addr, NULL );
+  if( addr + WOFS_EXTENT_HEADER_LEN + ROMFS_ALIGN >= pfs->max_size )
+    return 0;
+  memset( header, 0xFF, sizeof( header ) );
+  header[ 0 ] = WOFS_EXTENT_CHAR;
+  header[ 1 ] = 0;
+  wofsh_put32( header + WOFS_EXTENT_HEADER_LEN - WOFS_ID_OFFSET, id );
+  pfs->writef( header, addr, WOFS_EXTENT_HEADER_LEN, pfs );
+  pfd->lastaddr = addr + WOFS_EXTENT_HEADER_LEN;
+  pfd->laststart = pfd->size;
+  wofs_tail_fd = fd;
+  return 1;
+}
+
+// Read from a WOFS file, following its extents
+static _ssize_t wofsh_read( FD *pfd, u8 *ptr, u32 len, const FSDATA *pfs )
+{
+  u32 chunk, done = 0, id;
+  FD tempfd;
+
+  len = fsmin( len, pfd->size - pfd->offset );
+  while( done < len )
+  {
+    if( pfd->offset < pfd->extstart )
     {
-      // Found the file
-      pfd->baseaddr = j;
-      pfd->offset = 0;
-      pfd->size = fsize;
-      if( pnameaddr )
-        *pnameaddr = n;
-      return FS_FILE_OK;
+      // Start again from the first record
+      pfd->extaddr = pfd->baseaddr;
+      pfd->extstart = 0;
+      pfd->extsize = wofsh_data_size( pfd->baseaddr, pfs );
+    }
+    if( pfd->offset >= pfd->extstart + pfd->extsize )
+    {
+      // The last record of the file might have grown since it was read
+      pfd->extsize = wofsh_data_size( pfd->extaddr, pfs );
+      if( pfd->offset >= pfd->extstart + pfd->extsize )
+      {
+        id = romfsh_read32( pfd->baseaddr - WOFS_ID_OFFSET, pfs );
+        if( wofsh_find_extent( fsalign( pfd->extaddr + pfd->extsize ), id, &tempfd, pfs ) == 0xFFFFFFFF )
+          break;
+        pfd->extstart += pfd->extsize;
+        pfd->extaddr = tempfd.baseaddr;
+        pfd->extsize = tempfd.size;
+        continue;
+      }
     }
-    // Move to next file
-    i = j + fsize;
-    // On WOFS, all file names must begin at a multiple of ROMFS_ALIGN
-    if( romfsh_is_wofs( pfs ) )
-      i = ( i + ROMFS_ALIGN - 1 ) & ~( ROMFS_ALIGN - 1 );
+    chunk = fsmin( len - done, pfd->extstart + pfd->extsize - pfd->offset );
+    romfsh_read( ptr + done, pfd->extaddr + pfd->offset - pfd->extstart, chunk, pfs );
+    done += chunk;
+    pfd->offset += chunk;
   }
-  *plast = 0;
-  return FS_FILE_NOT_FOUND;
+  return done;
 }
+#endif // #ifdef BUILD_WOFS
 
 static int romfs_open_r( struct _reent *r, const char *path, int flags, int mode, void *pdata )
 {
@@ -188,53 +614,74 @@ static int romfs_open_r( struct _reent *r, const char *path, int flags, int mode
     r->_errno = EACCES;
     return -1;
   }
-  if( ( lflags & ( ROMFS_FILE_FLAG_WRITE | ROMFS_FILE_FLAG_APPEND ) ) && romfs_fs_is_flag_set( pfsdata, ROMFS_FS_FLAG_WRITING ) )
-  {
-    // At most one file can be opened in write mode at any given time on WOFS
-    r->_errno = EROFS;
-    return -1;
-  }
+#ifdef BUILD_WOFS
   // Do we need to create the file ?
   if( must_create )
   {
-    if( exists )
+    u8 header[ DM_MAX_FNAME_LENGTH + ROMFS_ALIGN + WOFS_DEL_OFFSET ];
+    u32 namelen = fsalign( strlen( path ) + 1 );
+
+    if( strlen( path ) > DM_MAX_FNAME_LENGTH )
     {
-      // Invalidate the file first by changing WOFS_DEL_FIELD_SIZE bytes before
-      // the file length to WOFS_FILE_DELETED
-      u8 tempb[] = { WOFS_FILE_DELETED, 0xFF, 0xFF, 0xFF };
-      pfsdata->writef( tempb, tempfs.baseaddr - ROMFS_SIZE_LEN - WOFS_DEL_FIELD_SIZE, WOFS_DEL_FIELD_SIZE, pfsdata );
+      r->_errno = ENAMETOOLONG;
+      return -1;
     }
+    if( exists )
+      romfsh_delete_file( path, tempfs.baseaddr, nameaddr, pfsdata );
+    // The last record of WOFS must have a size before a new file can follow it
+    wofsh_seal( pfsdata );
     // Find the last available position by asking romfs_open_file to look for a file
     // with an invalid name
     romfs_open_file( "\1", &tempfs, pfsdata, &firstfree, NULL );
-    // Is there enough space on the FS for another file?
+    // Is there enough space on the FS for another file? If not, try to make
+    // some room by compacting WOFS (this needs all the other WOFS files closed)
+    if( pfsdata->max_size - firstfree + 1 < strlen( path ) + 1 + WOFS_MIN_NEEDED_SIZE + WOFS_DEL_FIELD_SIZE &&
+        wofsh_compact( pfsdata ) )
+      romfs_open_file( "\1", &tempfs, pfsdata, &firstfree, NULL );
     if( pfsdata->max_size - firstfree + 1 < strlen( path ) + 1 + WOFS_MIN_NEEDED_SIZE + WOFS_DEL_FIELD_SIZE )
     {
       r->_errno = ENOSPC;
       return -1;
     }
-    // Write the name of the file
-    pfsdata->writef( path, firstfree, strlen( path ) + 1, pfsdata );
-    firstfree += strlen( path ) + 1; // skip over the name
-    // Align to a multiple of ROMFS_ALIGN
-    firstfree = ( firstfree + ROMFS_ALIGN - 1 ) & ~( ROMFS_ALIGN - 1 );
-    firstfree += ROMFS_SIZE_LEN + WOFS_DEL_FIELD_SIZE; // skip over the size and the deleted flags area
-    tempfs.baseaddr = firstfree;
+    // Write the name of the file and its id
+    memset( header, 0xFF, sizeof( header ) );
+    strcpy( ( char* )header, path );
+    wofsh_put32( header + namelen + WOFS_DEL_FIELD_SIZE, wofs_next_id ++ );
+    pfsdata->writef( header, firstfree, namelen + WOFS_DEL_OFFSET, pfsdata );
+    wofs_index_add( path, firstfree );
+    tempfs.baseaddr = firstfree + namelen + WOFS_DEL_OFFSET;
     tempfs.offset = tempfs.size = 0;
-    // Set the "writing" flag on the FS to indicate that there is a file opened in write mode
-    romfs_fs_set_flag( pfsdata, ROMFS_FS_FLAG_WRITING );
+    tempfs.lastaddr = tempfs.baseaddr;
+    tempfs.laststart = 0;
   }
-  else // File must exist (and was found in the previous 'romfs_open_file' call)
+  else
+#endif // #ifdef BUILD_WOFS
+  // File must exist (and was found in the previous 'romfs_open_file' call)
+  if( !exists )
   {
-    if( !exists )
-    {
-      r->_errno = ENOENT;
-      return -1;
-    }
+    r->_errno = ENOENT;
+    return -1;
   }
   // Find a free FD and copy the descriptor information
+  if( !must_create )
+    lflags |= tempfs.flags & ROMFS_FILE_FLAG_COMPRESSED;
   tempfs.flags = lflags;
+  // The first record of a WOFS file might not be the only one
+  tempfs.extaddr = tempfs.baseaddr;
+  tempfs.extstart = 0;
+  tempfs.extsize = tempfs.size;
   i = romfs_find_empty_fd();
+#ifdef BUILD_WOFS
+  if( romfsh_is_wofs( pfsdata ) )
+  {
+    // A new file owns the last record of WOFS until another one is added after it
+    if( must_create )
+      wofs_tail_fd = i;
+    else
+      tempfs.size = wofsh_file_size( tempfs.baseaddr, pfsdata );
+    wofs_num_fd ++;
+  }
+#endif
   memcpy( fd_table + i, &tempfs, sizeof( FD ) );
   romfs_num_fd ++;
   return i;
@@ -242,22 +689,21 @@ static int romfs_open_r( struct _reent *r, const char *path, int flags, int mode
 
 static int romfs_close_r( struct _reent *r, int fd, void *pdata )
 {
+#ifdef BUILD_WOFS
   FD* pfd = fd_table + fd;
   FSDATA *pfsdata = ( FSDATA* )pdata;
-  u8 temp[ ROMFS_SIZE_LEN ];
 
   if( pfd->flags & ( ROMFS_FILE_FLAG_WRITE | ROMFS_FILE_FLAG_APPEND ) )
   {
-    // Write back the size
-    temp[ 0 ] = pfd->size & 0xFF;
-    temp[ 1 ] = ( pfd->size >> 8 ) & 0xFF;
-    temp[ 2 ] = ( pfd->size >> 16 ) & 0xFF;
-    temp[ 3 ] = ( pfd->size >> 24 ) & 0xFF;
-    pfsdata->writef( temp, pfd->baseaddr - ROMFS_SIZE_LEN, ROMFS_SIZE_LEN, pfsdata );
-    // Clear the "writing" flag on the FS instance to allow other files to be opened
-    // in write mode
-    romfs_fs_clear_flag( pfsdata, ROMFS_FS_FLAG_WRITING );
+    // Write back the size of the last record (if it's still the last one in
+    // WOFS) and the size of the whole file
+    if( wofs_tail_fd == fd )
+      wofsh_seal( pfsdata );
+    wofsh_write32( pfd->baseaddr - WOFS_TOTAL_OFFSET, pfd->size, pfsdata );
   }
+  if( romfsh_is_wofs( pfsdata ) )
+    wofs_num_fd --;
+#endif
   romfs_close_fd( fd );
   romfs_num_fd --;
   return 0;
@@ -267,6 +713,9 @@ static _ssize_t romfs_write_r( struct _reent *r, int fd, const void* ptr, size_t
 {
   FD* pfd = fd_table + fd;
   FSDATA *pfsdata = ( FSDATA* )pdata;
+#ifdef BUILD_WOFS
+  u32 addr;
+#endif
 
   if( ( pfd->flags & ( ROMFS_FILE_FLAG_WRITE | ROMFS_FILE_FLAG_APPEND ) ) == 0 )
   {
@@ -277,19 +726,148 @@ static _ssize_t romfs_write_r( struct _reent *r, int fd, const void* ptr, size_t
   if( pfd->flags & ROMFS_FILE_FLAG_APPEND )
     pfd->offset = pfd->size;
   // Only write at the end of the file!
-  if( pfd->offset != pfd->size )
+  if( pfd->offset != pfd->size || len == 0 )
+    return 0;
+#ifdef BUILD_WOFS
+  // If another file was written after this one, continue in a new record
+  if( wofs_tail_fd != fd && !wofsh_new_extent( fd, pfsdata ) )
     return 0;
+  addr = pfd->lastaddr + pfd->size - pfd->laststart;
   // Check if we have enough space left on the device. Always keep 1 byte for the final 0xFF
   // and ROMFS_ALIGN - 1 bytes for aligning the contents of the file data in the worst case
   // scenario (so ROMFS_ALIGN bytes in total)
-  if( pfd->baseaddr + pfd->size + len > pfsdata->max_size - ROMFS_ALIGN )
-    len = pfsdata->max_size - ( pfd->baseaddr + pfd->size ) - ROMFS_ALIGN;
-  pfsdata->writef( ptr, pfd->offset + pfd->baseaddr, len, pfsdata );
+  if( addr + len > pfsdata->max_size - ROMFS_ALIGN )
+    len = pfsdata->max_size - addr - ROMFS_ALIGN;
+  pfsdata->writef( ptr, addr, len, pfsdata );
+#endif
   pfd->offset += len;
   pfd->size += len;
   return len;
 }
 
+#ifdef ROMFILES_BLOCK_SIZE
+// Decompressed data of the last block read from a compressed file
+static u8 romfs_block_buf[ ROMFILES_BLOCK_SIZE ];
+static u32 romfs_block_file = 0xFFFFFFFF;  // baseaddr of the file
+static u32 romfs_block_num;
+
+// Helper function: read an extended LZ4 length
+static const u8* romfsh_lz_length( const u8 *src, const u8 *send, u32 *plen )
+{
+  u8 b;
+
+  do
+  {
+    if( src == send )
+      return NULL;
+    b = *src ++;
+    *plen += b;
+  } while( b == 255 );
+  return src;
+}
+
+// Decompress a block in the LZ4 block format. Returns the size of the
+// decompressed data or 0xFFFFFFFF for error.
+static u32 romfs_lz_decode( const u8 *src, u32 srclen, u8 *dst, u32 dstlen )
+{
+  const u8 *send = src + srclen;
+  u8 *d = dst, *dend = dst + dstlen;
+  u32 len, off;
+  u8 token;
+
+  while( src < send )
+  {
+    token = *src ++;
+    // Literals
+    len = token >> 4;
+    if( len == 15 && ( src = romfsh_lz_length( src, send, &len ) ) == NULL )
+      return 0xFFFFFFFF;
+    if( len > ( u32 )( send - src ) || len > ( u32 )( dend - d ) )
+      return 0xFFFFFFFF;
+    memcpy( d, src, len );
+    d += len;
+    src += len;
+    // The last sequence doesn't have a match
+    if( src == send )
+      break;
+    // Match
+    if( send - src < 2 )
+      return 0xFFFFFFFF;
+    off = src[ 0 ] | ( src[ 1 ] << 8 );
+    src += 2;
+    len = token & 0x0F;
+    if( len == 15 && ( src = romfsh_lz_length( src, send, &len ) ) == NULL )
+      return 0xFFFFFFFF;
+    len += 4;
+    if( off == 0 || off > ( u32 )( d - dst ) || len > ( u32 )( dend - d ) )
+      return 0xFFFFFFFF;
+    // The match can overlap the output, so copy byte by byte
+    while( len -- )
+    {
+      *d = *( d - off );
+      d ++;
+    }
+  }
+  return d - dst;
+}
+
+// Read from a compressed file. Only the blocks that contain the requested
+// data are decompressed, so seeking is cheap. Whole blocks are decompressed
+// directly to 'ptr', the others go through romfs_block_buf.
+static _ssize_t romfs_read_compressed( struct _reent *r, FD *pfd, u8 *ptr, u32 len, const FSDATA *pfsdata )
+{
+  u32 bsize, nblocks, nblock, boff, blen, chunk, done = 0;
+  u32 table, start, end;
+  const u8 *pdata;
+  u8 *pdest;
+
+  bsize = romfsh_read32( pfd->baseaddr + 4, pfsdata );
+  if( ( pfsdata->flags & ROMFS_FS_FLAG_DIRECT ) == 0 || bsize == 0 || bsize > ROMFILES_BLOCK_SIZE )
+  {
+    r->_errno = EIO;
+    return -1;
+  }
+  nblocks = ( pfd->size + bsize - 1 ) / bsize;
+  table = pfd->baseaddr + ROMFS_COMP_HEADER_LEN;
+  pdata = pfsdata->pbase + table + ( nblocks + 1 ) * 4;
+  len = fsmin( len, pfd->size - pfd->offset );
+  while( done < len )
+  {
+    nblock = pfd->offset / bsize;
+    boff = pfd->offset % bsize;
+    blen = nblock == nblocks - 1 ? pfd->size - nblock * bsize : bsize;
+    chunk = fsmin( len - done, blen - boff );
+    if( romfs_block_file != pfd->baseaddr || romfs_block_num != nblock )
+    {
+      pdest = boff == 0 && chunk == blen ? ptr + done : romfs_block_buf;
+      start = romfsh_read32( table + nblock * 4, pfsdata );
+      end = romfsh_read32( table + nblock * 4 + 4, pfsdata );
+      if( end < start || romfs_lz_decode( pdata + start, end - start, pdest, blen ) != blen )
+      {
+        romfs_block_file = 0xFFFFFFFF;
+        r->_errno = EIO;
+        return done > 0 ? ( _ssize_t )done : -1;
+      }
+      if( pdest == romfs_block_buf )
+      {
+        romfs_block_file = pfd->baseaddr;
+        romfs_block_num = nblock;
+      }
+      else
+      {
+        done += chunk;
+        pfd->offset += chunk;
+        continue;
+      }
+    }
+    memcpy( ptr + done, romfs_block_buf + boff, chunk );
+    done += chunk;
+    pfd->offset += chunk;
+  }
+  return done;
+}
+#endif // #ifdef ROMFILES_BLOCK_SIZE
+
 static _ssize_t romfs_read_r( struct _reent *r, int fd, void* ptr, size_t len, void *pdata )
 {
   FD* pfd = fd_table + fd;
@@ -301,6 +879,14 @@ static _ssize_t romfs_read_r( struct _reent *r, int fd, void* ptr, size_t len, v
     r->_errno = EBADF;
     return -1;
   }
+#ifdef ROMFILES_BLOCK_SIZE
+  if( pfd->flags & ROMFS_FILE_FLAG_COMPRESSED )
+    return romfs_read_compressed( r, pfd, ( u8* )ptr, len, pfsdata );
+#endif
+#ifdef BUILD_WOFS
+  if( romfsh_is_wofs( pfsdata ) )
+    return wofsh_read( pfd, ( u8* )ptr, len, pfsdata );
+#endif
   if( pfsdata->flags & ROMFS_FS_FLAG_DIRECT )
     memcpy( ptr, pfsdata->pbase + pfd->offset + pfd->baseaddr, actlen );
   else
@@ -359,36 +945,26 @@ static struct dm_dirent* romfs_readdir_r( struct _reent *r, void *d, void *pdata
 {
   u32 off = *( u32* )d;
   struct dm_dirent *pent = &dm_shared_dirent;
-  unsigned j;
   FSDATA *pfsdata = ( FSDATA* )pdata;
   int is_deleted;
+  FD tempfd;
  
   while( 1 )
   {
     if( romfsh_read8( off, pfsdata ) == WOFS_END_MARKER_CHAR )
       return NULL;
-    j = 0;
-    while( ( dm_shared_fname[ j ++ ] = romfsh_read8( off ++, pfsdata ) ) != '\0' );
-    pent->fname = dm_shared_fname;
-    off = ( off + ROMFS_ALIGN - 1 ) & ~( ROMFS_ALIGN - 1 );
-    if( romfsh_is_wofs( pfsdata ) )
-    {
-      is_deleted = romfsh_read8( off, pfsdata ) == WOFS_FILE_DELETED;
-      off += WOFS_DEL_FIELD_SIZE;
-    }
-    else
-      is_deleted = 0;
-    pent->fsize = romfsh_read8( off, pfsdata ) + ( romfsh_read8( off + 1, pfsdata ) << 8 );
-    pent->fsize += ( romfsh_read8( off + 2, pfsdata ) << 16 ) + ( romfsh_read8( off + 3, pfsdata ) << 24 );
-    pent->ftime = 0;
-    pent->flags = 0;
-    off += ROMFS_SIZE_LEN;
-    off += pent->fsize;
-    if( romfsh_is_wofs( pfsdata ) )
-      off = ( off + ROMFS_ALIGN - 1 ) & ~( ROMFS_ALIGN - 1 );
+    off = romfsh_read_header( off, pfsdata, dm_shared_fname, &is_deleted, &tempfd );
     if( !is_deleted )
       break;
   }
+  pent->fname = dm_shared_fname;
+  pent->fsize = tempfd.size;
+#ifdef BUILD_WOFS
+  if( romfsh_is_wofs( pfsdata ) )
+    pent->fsize = wofsh_file_size( tempfd.baseaddr, pfsdata );
+#endif
+  pent->ftime = 0;
+  pent->flags = 0;
   *( u32* )d = off;
   return pent;
 }
@@ -406,12 +982,484 @@ static const char* romfs_getaddr_r( struct _reent *r, int fd, void *pdata )
   FD* pfd = fd_table + fd;
   FSDATA *pfsdata = ( FSDATA* )pdata;
 
-  if( pfsdata->flags & ROMFS_FS_FLAG_DIRECT )
-    return ( const char* )pfsdata->pbase + pfd->baseaddr;
-  else
+  // Compressed files can't be accessed directly
+  if( ( pfsdata->flags & ROMFS_FS_FLAG_DIRECT ) == 0 || ( pfd->flags & ROMFS_FILE_FLAG_COMPRESSED ) )
     return NULL;
+#ifdef BUILD_WOFS
+  // Neither can WOFS files with more than one record
+  if( romfsh_is_wofs( pfsdata ) )
+  {
+    if( wofsh_data_size( pfd->baseaddr, pfsdata ) < pfd->size )
+      return NULL;
+    // Bytecode loaded from this address keeps pointers to it after the file
+    // is closed, so the WOFS records can't be moved until the next reset
+    wofs_mapped = 1;
+  }
+#endif
+  return ( const char* )pfsdata->pbase + pfd->baseaddr;
+}
+
+#ifdef BUILD_WOFS
+// unlink (WOFS only)
+static int romfs_unlink_r( struct _reent *r, const char *path, void *pdata )
+{
+  FSDATA *pfsdata = ( FSDATA* )pdata;
+  FD tempfs;
+  u32 firstfree, nameaddr;
+
+  if( !romfsh_is_wofs( pfsdata ) )
+  {
+    r->_errno = EROFS;
+    return -1;
+  }
+  if( romfs_open_file( path, &tempfs, pfsdata, &firstfree, &nameaddr ) != FS_FILE_OK )
+  {
+    r->_errno = ENOENT;
+    return -1;
+  }
+  romfsh_delete_file( path, tempfs.baseaddr, nameaddr, pfsdata );
+  return 0;
+}
+#endif // #ifdef BUILD_WOFS
+
+#ifdef BUILD_WOFS
+// ****************************************************************************
+// WOFS compaction
+
+// The last two sectors of the WOFS flash area are reserved for compaction.
+// The compaction rewrites the sectors of WOFS in order, moving the records
+// that must be kept over the deleted ones. The new content of a sector is
+// built in the "spare" sector, then an entry is written in the "journal"
+// sector, then the sector is erased and the spare sector is copied over it.
+// The journal has enough information to finish a compaction which was
+// interrupted by a power failure (see wofsh_recover). When the journal is
+// full, the compaction stops at a record boundary and leaves a skip record
+// over the space that was not reclaimed yet, then continues with a new
+// journal. Records that can't be moved within the size of the journal
+// are left in place.
+
+#define WOFS_JOURNAL_MAGIC    0x574F4653UL
+#define WOFS_JOURNAL_STOP     0xFFFFFFFEUL  // 'src' of the last entry: WOFS is consistent after the sector is rewritten
+#define WOFS_JOURNAL_END      0xFFFFFFFDUL  // same, but the sectors after this one must also be erased
+#define WOFS_JOURNAL_DONE     0
+
+typedef struct
+{
+  u32 sector;                     // start of the sector which is rewritten
+  u32 src;                        // source of the data that follows the sector (or WOFS_JOURNAL_STOP/END)
+  u32 rem;                        // bytes left to copy from the record at 'src'
+  u32 check;                      // sector ^ src ^ rem ^ WOFS_JOURNAL_MAGIC
+  u32 done;                       // set to WOFS_JOURNAL_DONE after the sector was rewritten
+} WOFS_JOURNAL_ENTRY;
+
+typedef struct
+{
+  u32 out;                        // destination of the next byte
+  u32 src;                        // source of the next byte
+  u32 rem;                        // bytes left to copy from the current record (0 on a record boundary)
+  u32 entry;                      // address of the next journal entry
+} WOFS_COMPACT;
+
+enum
+{
+  WOFS_COMPACT_CONTINUE,
+  WOFS_COMPACT_STOP,
+  WOFS_COMPACT_END,
+  WOFS_COMPACT_ERROR
+};
+
+// Start of the spare and journal sectors (0 if compaction is not available)
+static u32 wofs_spare_addr, wofs_journal_addr;
+
+// Platform specific: return the start of the flash sector that contains 'addr'
+// (and its last address in '*pend'), erase the sector that starts at 'addr'
+static u32 wofsh_sector( u32 addr, u32 *pend, const FSDATA *pfs );
+static int wofsh_erase_sector( u32 addr, const FSDATA *pfs );
+
+// Copy data inside WOFS (to an area which was erased)
+static void wofsh_copy( u32 to, u32 from, u32 size, const FSDATA *pfs )
+{
+  u8 temp[ 32 ];
+  u32 chunk;
+
+  if( pfs->flags & ROMFS_FS_FLAG_DIRECT )
+  {
+    pfs->writef( pfs->pbase + from, to, size, pfs );
+    return;
+  }
+  while( size )
+  {
+    chunk = fsmin( size, sizeof( temp ) );
+    pfs->readf( temp, from, chunk, pfs );
+    pfs->writef( temp, to, chunk, pfs );
+    to += chunk;
+    from += chunk;
+    size -= chunk;
+  }
+}
+
+// Return the address after the last byte which is not 0xFF between 'addr' and 'end'
+static u32 wofsh_used_end( u32 addr, u32 end, const FSDATA *pfs )
+{
+  u8 temp[ 32 ];
+  u32 chunk;
+
+  while( end > addr )
+  {
+    chunk = fsmin( end - addr, sizeof( temp ) );
+    romfsh_read( temp, end - chunk, chunk, pfs );
+    while( chunk && temp[ chunk - 1 ] == 0xFF )
+    {
+      chunk --;
+      end --;
+    }
+    if( chunk )
+      break;
+  }
+  return end;
+}
+
+// Return the number of sectors spanned by the area at 'addr' with 'size' bytes
+static u32 wofsh_sectors( u32 addr, u32 size, const FSDATA *pfs )
+{
+  u32 n = 0, end;
+
+  while( size )
+  {
+    wofsh_sector( addr, &end, pfs );
+    end = fsmin( size, end + 1 - addr );
+    addr += end;
+    size -= end;
+    n ++;
+  }
+  return n;
+}
+
+// Return 1 if the WOFS record at 'addr' (described by 'pfd') doesn't hold useful data
+static int wofsh_is_dead( u32 addr, const FD *pfd, const FSDATA *pfs )
+{
+  return romfsh_read8( addr, pfs ) == WOFS_SKIP_CHAR || romfsh_read8( pfd->baseaddr - WOFS_DEL_OFFSET, pfs ) == WOFS_FILE_DELETED;
+}
+
+// Copy the spare sector over the sector that starts at 'sector' and mark the
+// journal entry at 'entry' as done. Returns 1 if OK, 0 for error.
+static int wofsh_commit( u32 sector, u32 entry, const FSDATA *pfs )
+{
+  u32 end;
+
+  wofsh_sector( sector, &end, pfs );
+  if( !wofsh_erase_sector( sector, pfs ) )
+    return 0;
+  wofsh_copy( sector, wofs_spare_addr, end + 1 - sector, pfs );
+  wofsh_write32( entry + offsetof( WOFS_JOURNAL_ENTRY, done ), WOFS_JOURNAL_DONE, pfs );
+  return 1;
+}
+
+// Erase the sectors after 'addr' which are not empty (after the compaction
+// reached the end of WOFS). Returns 1 if OK, 0 for error.
+static int wofsh_erase_tail( u32 addr, const FSDATA *pfs )
+{
+  u32 end;
+
+  while( addr < pfs->max_size )
+  {
+    wofsh_sector( addr, &end, pfs );
+    if( wofsh_used_end( addr, end + 1, pfs ) != addr && !wofsh_erase_sector( addr, pfs ) )
+      return 0;
+    addr = end + 1;
+  }
+  return 1;
+}
+
+// Rewrite the sector that contains pc->out with the data that must be kept
+// from pc->src on. Returns one of the WOFS_COMPACT_xxx constants.
+static int wofsh_compact_step( WOFS_COMPACT *pc, const FSDATA *pfs )
+{
+  u32 start, end, pos, next, chunk, left;
+  char fsname[ DM_MAX_FNAME_LENGTH + 1 ];
+  int is_deleted, res = WOFS_COMPACT_CONTINUE;
+  WOFS_JOURNAL_ENTRY e;
+  FD tempfd;
+
+  start = wofsh_sector( pc->out, &end, pfs );
+  end ++;
+  left = ( wofs_spare_addr - pc->entry ) / sizeof( WOFS_JOURNAL_ENTRY );
+  if( left == 0 )
+    return WOFS_COMPACT_ERROR;
+  if( !wofsh_erase_sector( wofs_spare_addr, pfs ) )
+    return WOFS_COMPACT_ERROR;
+  // Keep the data before the output position
+  if( pc->out > start )
+    wofsh_copy( wofs_spare_addr, start, pc->out - start, pfs );
+  pos = pc->out;
+  while( pos < end )
+  {
+    if( pc->rem == 0 )
+    {
+      if( romfsh_read8( pc->src, pfs ) == WOFS_END_MARKER_CHAR )
+      {
+        res = WOFS_COMPACT_END;
+        break;
+      }
+      next = romfsh_read_header( pc->src, pfs, fsname, &is_deleted, &tempfd );
+      if( wofsh_is_dead( pc->src, &tempfd, pfs ) )
+      {
+        pc->src = next;
+        continue;
+      }
+      // Stop if the journal doesn't have enough entries to copy the whole
+      // record (and to leave a skip record after it), keeping one entry
+      // spare in case an entry is only partly written (see wofsh_recover)
+      if( wofsh_sectors( pos, next - pc->src + ROMFS_ALIGN, pfs ) >= left )
+      {
+        res = WOFS_COMPACT_STOP;
+        break;
+      }
+      pc->rem = next - pc->src;
+    }
+    chunk = fsmin( pc->rem, end - pos );
+    wofsh_copy( wofs_spare_addr + pos - start, pc->src, chunk, pfs );
+    pos += chunk;
+    pc->src += chunk;
+    pc->rem -= chunk;
+  }
+  if( res == WOFS_COMPACT_STOP )
+  {
+    // Leave the rest of the records in place: keep the part of the next
+    // record which is in this sector and skip over the space before it
+    if( pc->src < end )
+      wofsh_copy( wofs_spare_addr + pc->src - start, pc->src, end - pc->src, pfs );
+    if( pos < pc->src )
+      wofsh_write32( wofs_spare_addr + pos - start, ( ( pc->src - pos ) << 8 ) | WOFS_SKIP_CHAR, pfs );
+  }
+  // Write the journal entry and rewrite the sector
+  e.sector = start;
+  e.src = res == WOFS_COMPACT_CONTINUE ? pc->src : res == WOFS_COMPACT_STOP ? WOFS_JOURNAL_STOP : WOFS_JOURNAL_END;
+  e.rem = pc->rem;
+  e.check = e.sector ^ e.src ^ e.rem ^ WOFS_JOURNAL_MAGIC;
+  pfs->writef( &e, pc->entry, offsetof( WOFS_JOURNAL_ENTRY, done ), pfs );
+  if( !wofsh_commit( start, pc->entry, pfs ) )
+    return WOFS_COMPACT_ERROR;
+  pc->entry += sizeof( WOFS_JOURNAL_ENTRY );
+  pc->out = res == WOFS_COMPACT_CONTINUE ? end : pos;
+  return res;
+}
+
+// Rewrite sectors until the compaction stops or reaches the end of WOFS, then
+// clear the journal. Returns one of the WOFS_COMPACT_xxx constants.
+static int wofsh_compact_run( WOFS_COMPACT *pc, const FSDATA *pfs )
+{
+  int res;
+  u32 end;
+
+  while( ( res = wofsh_compact_step( pc, pfs ) ) == WOFS_COMPACT_CONTINUE );
+  if( res == WOFS_COMPACT_END )
+  {
+    wofsh_sector( pc->out, &end, pfs );
+    if( !wofsh_erase_tail( end + 1, pfs ) )
+      res = WOFS_COMPACT_ERROR;
+  }
+  if( res != WOFS_COMPACT_ERROR && !wofsh_erase_sector( wofs_journal_addr, pfs ) )
+    res = WOFS_COMPACT_ERROR;
+  return res;
+}
+
+// Mark the extents of the deleted files as deleted too, so that the
+// compaction can drop them. The file of an extent is always before it in WOFS.
+#define WOFS_ID_CACHE_SIZE    TOTAL_MAX_FDS
+static void wofsh_mark_extents( const FSDATA *pfs )
+{
+  u32 addr = 0, next, id, faddr, ids[ WOFS_ID_CACHE_SIZE ];
+  u8 live[ WOFS_ID_CACHE_SIZE ];
+  char fsname[ DM_MAX_FNAME_LENGTH + 1 ];
+  int is_deleted, found;
+  unsigned i, pos = 0;
+  FD tempfd;
+
+  memset( ids, 0xFF, sizeof( ids ) );
+  while( romfsh_read8( addr, pfs ) != WOFS_END_MARKER_CHAR )
+  {
+    next = romfsh_read_header( addr, pfs, fsname, &is_deleted, &tempfd );
+    if( fsname[ 0 ] == WOFS_EXTENT_CHAR && !wofsh_is_dead( addr, &tempfd, pfs ) )
+    {
+      id = romfsh_read32( tempfd.baseaddr - WOFS_ID_OFFSET, pfs );
+      for( i = 0; i < WOFS_ID_CACHE_SIZE && ids[ i ] != id; i ++ );
+      if( i == WOFS_ID_CACHE_SIZE )
+      {
+        // Not in the cache, look for the file of the extent
+        found = 0;
+        for( faddr = 0; faddr < addr; )
+        {
+          faddr = romfsh_read_header( faddr, pfs, fsname, &is_deleted, &tempfd );
+          if( !is_deleted && romfsh_read32( tempfd.baseaddr - WOFS_ID_OFFSET, pfs ) == id )
+            found = 1;
+        }
+        i = pos;
+        ids[ i ] = id;
+        live[ i ] = found;
+        pos = ( pos + 1 ) % WOFS_ID_CACHE_SIZE;
+        romfsh_read_header( addr, pfs, fsname, &is_deleted, &tempfd );
+      }
+      if( !live[ i ] )
+        romfsh_delete_file( "", tempfd.baseaddr, 0, pfs );
+    }
+    addr = next;
+  }
+}
+
+// Compact WOFS. Returns 1 if OK, 0 if compaction is not possible (or for error).
+static int wofsh_compact( FSDATA *pfs )
+{
+  WOFS_COMPACT c;
+  u32 addr = 0, src, next = 0;
+  char fsname[ DM_MAX_FNAME_LENGTH + 1 ];
+  int is_deleted, res;
+  FD tempfd;
+
+  if( wofs_journal_addr == 0 || wofs_num_fd > 0 || wofs_mapped )
+    return 0;
+  wofsh_mark_extents( pfs );
+  wofs_index_state = WOFS_INDEX_INVALID;
+  while( 1 )
+  {
+    // Find the first record which doesn't have to be kept
+    while( romfsh_read8( addr, pfs ) != WOFS_END_MARKER_CHAR )
+    {
+      next = romfsh_read_header( addr, pfs, fsname, &is_deleted, &tempfd );
+      if( wofsh_is_dead( addr, &tempfd, pfs ) )
+        break;
+      addr = next;
+    }
+    if( romfsh_read8( addr, pfs ) == WOFS_END_MARKER_CHAR )
+      return 1;
+    // And the first record after it that must be kept
+    for( src = addr; romfsh_read8( src, pfs ) != WOFS_END_MARKER_CHAR; src = next )
+    {
+      next = romfsh_read_header( src, pfs, fsname, &is_deleted, &tempfd );
+      if( !wofsh_is_dead( src, &tempfd, pfs ) )
+        break;
+    }
+    if( romfsh_read8( src, pfs ) != WOFS_END_MARKER_CHAR &&
+        wofsh_sectors( addr, next - src + ROMFS_ALIGN, pfs ) >= ( wofs_spare_addr - wofs_journal_addr ) / sizeof( WOFS_JOURNAL_ENTRY ) )
+    {
+      // This record is too large to be moved, continue after it
+      addr = next;
+      continue;
+    }
+    c.out = c.src = addr;
+    c.rem = 0;
+    c.entry = wofs_journal_addr;
+    if( ( res = wofsh_compact_run( &c, pfs ) ) == WOFS_COMPACT_ERROR )
+      return 0;
+    if( res == WOFS_COMPACT_END )
+      return 1;
+    // Continue from the skip record left by the compaction
+    addr = c.out;
+  }
+}
+
+// Make WOFS consistent after a reset: finish an interrupted compaction, give
+// a size to the last record if its file was not closed (the size is found by
+// looking for the last byte which is not 0xFF) and compute the next file id.
+static void wofsh_recover( FSDATA *pfs )
+{
+  WOFS_JOURNAL_ENTRY e;
+  WOFS_COMPACT c;
+  u32 addr, last = 0xFFFFFFFF, next, id;
+  char fsname[ DM_MAX_FNAME_LENGTH + 1 ];
+  int is_deleted;
+  FD tempfd;
+
+  if( wofs_journal_addr )
+  {
+    for( addr = wofs_journal_addr; addr + sizeof( e ) <= wofs_spare_addr; addr += sizeof( e ) )
+    {
+      romfsh_read( &e, addr, sizeof( e ), pfs );
+      if( e.sector == 0xFFFFFFFF || e.check != ( e.sector ^ e.src ^ e.rem ^ WOFS_JOURNAL_MAGIC ) )
+        break;
+      last = addr;
+    }
+    if( last != 0xFFFFFFFF )
+    {
+      romfsh_read( &e, last, sizeof( e ), pfs );
+      if( e.done == WOFS_JOURNAL_DONE || wofsh_commit( e.sector, last, pfs ) )
+      {
+        wofsh_sector( e.sector, &c.out, pfs );
+        c.out ++;
+        if( e.src == WOFS_JOURNAL_END )
+          wofsh_erase_tail( c.out, pfs );
+        else if( e.src != WOFS_JOURNAL_STOP )
+        {
+          c.src = e.src;
+          c.rem = e.rem;
+          // The entry after the last valid one might have been partly written
+          // when the power failed, continue with the first erased entry
+          for( c.entry = last + sizeof( e ); c.entry + sizeof( e ) <= wofs_spare_addr; c.entry += sizeof( e ) )
+            if( wofsh_used_end( c.entry, c.entry + sizeof( e ), pfs ) == c.entry )
+              break;
+          wofsh_compact_run( &c, pfs );
+        }
+      }
+    }
+    if( wofsh_used_end( wofs_journal_addr, wofs_spare_addr, pfs ) != wofs_journal_addr )
+      wofsh_erase_sector( wofs_journal_addr, pfs );
+  }
+  for( addr = 0; romfsh_read8( addr, pfs ) != WOFS_END_MARKER_CHAR; addr = next )
+  {
+    next = romfsh_read_header( addr, pfs, fsname, &is_deleted, &tempfd );
+    if( romfsh_read8( addr, pfs ) == WOFS_SKIP_CHAR )
+      continue;
+    if( romfsh_read32( tempfd.baseaddr - ROMFS_SIZE_LEN, pfs ) == 0xFFFFFFFF )
+    {
+      // This must be the last record
+      tempfd.size = wofsh_used_end( tempfd.baseaddr, pfs->max_size, pfs ) - tempfd.baseaddr;
+      wofsh_write32( tempfd.baseaddr - ROMFS_SIZE_LEN, tempfd.size, pfs );
+      next = fsalign( tempfd.baseaddr + tempfd.size );
+    }
+    id = romfsh_read32( tempfd.baseaddr - WOFS_ID_OFFSET, pfs );
+    if( id != 0xFFFFFFFF && id >= wofs_next_id )
+      wofs_next_id = id + 1;
+  }
+  // Now the files that were not closed can get their total size
+  for( addr = 0; romfsh_read8( addr, pfs ) != WOFS_END_MARKER_CHAR; addr = next )
+  {
+    next = romfsh_read_header( addr, pfs, fsname, &is_deleted, &tempfd );
+    if( !is_deleted && romfsh_read32( tempfd.baseaddr - WOFS_TOTAL_OFFSET, pfs ) == 0xFFFFFFFF )
+      wofsh_write32( tempfd.baseaddr - WOFS_TOTAL_OFFSET, wofsh_file_size( tempfd.baseaddr, pfs ), pfs );
+  }
+  // Compact now if less than a sector is free: once code runs from WOFS,
+  // the compaction must wait until the next reset
+  if( wofs_journal_addr )
+  {
+    romfs_open_file( "\1", &tempfd, pfs, &addr, NULL );
+    wofsh_sector( wofs_spare_addr, &next, pfs );
+    if( pfs->max_size - addr < next + 1 - wofs_spare_addr )
+      wofsh_compact( pfs );
+  }
 }
 
+// Reserve the last two sectors of WOFS for compaction, if the last one is not
+// smaller than the others
+static void wofsh_init_compaction( FSDATA *pfs )
+{
+  u32 spare, spare_end, journal, addr, start, end;
+
+  wofs_spare_addr = wofs_journal_addr = 0;
+  spare = wofsh_sector( pfs->max_size - 1, &spare_end, pfs );
+  if( spare == 0 || ( journal = wofsh_sector( spare - 1, NULL, pfs ) ) == 0 )
+    return;
+  for( addr = 0; addr < journal; addr = end + 1 )
+  {
+    start = wofsh_sector( addr, &end, pfs );
+    if( end - start > spare_end - spare )
+      return;
+  }
+  wofs_spare_addr = spare;
+  wofs_journal_addr = journal;
+  pfs->max_size = journal;
+}
+#endif // #ifdef BUILD_WOFS
+
 // ****************************************************************************
 // Our ROMFS device descriptor structure
 // These functions apply to both ROMFS and WOFS
@@ -428,7 +1476,11 @@ static const DM_DEVICE romfs_device =
   romfs_closedir_r,     // closedir
   romfs_getaddr_r,      // getaddr
   NULL,                 // mkdir
+#ifdef BUILD_WOFS
+  romfs_unlink_r,       // unlink
+#else
   NULL,                 // unlink
+#endif
   NULL,                 // rmdir
   NULL                  // rename
 };
@@ -442,7 +1494,14 @@ static const FSDATA romfs_fsdata =
   ROMFS_FS_FLAG_DIRECT,
   NULL,
   NULL,
-  sizeof( romfiles_fs )
+  sizeof( romfiles_fs ),
+#ifdef ROMFILES_INDEX_SIZE
+  romfiles_index,
+  ROMFILES_INDEX_SIZE
+#else
+  NULL,
+  0
+#endif
 };
 
 // ****************************************************************************
@@ -468,9 +1527,32 @@ static FSDATA wofs_sim_fsdata =
   ROMFS_FS_FLAG_WO,
   sim_wofs_read,
   sim_wofs_write,
-  WOFS_SIZE
+  WOFS_SIZE,
+  NULL,
+  0
 };
 
+// The simulated flash has sectors of WOFS_SECTOR_SIZE bytes
+static u32 wofsh_sector( u32 addr, u32 *pend, const FSDATA *pfs )
+{
+  addr -= addr % WOFS_SECTOR_SIZE;
+  if( pend )
+    *pend = addr + WOFS_SECTOR_SIZE - 1;
+  return addr;
+}
+
+static int wofsh_erase_sector( u32 addr, const FSDATA *pfs )
+{
+  u8 temp[ 64 ];
+  unsigned i;
+
+  memset( temp, WOFS_END_MARKER_CHAR, sizeof( temp ) );
+  hostif_lseek( wofs_sim_fd, ( long )addr, SEEK_SET );
+  for( i = 0; i < WOFS_SECTOR_SIZE; i += sizeof( temp ) )
+    hostif_write( wofs_sim_fd, temp, sizeof( temp ) );
+  return 1;
+}
+
 // WOFS formatting function
 // Returns 1 if OK, 0 for error
 int wofs_format()
@@ -481,9 +1563,19 @@ int wofs_format()
   u8 temp = WOFS_END_MARKER_CHAR;
   for( i = 0; i < WOFS_SIZE; i ++ )
     hostif_write( wofs_sim_fd, &temp, 1 );
+  wofs_index_state = WOFS_INDEX_INVALID;
+  wofs_tail_fd = -1;
+  wofs_next_id = 0;
   return 1;
 }
 
+// WOFS compaction function
+// Returns 1 if OK, 0 for error
+int wofs_compact()
+{
+  return wofsh_compact( &wofs_sim_fsdata );
+}
+
 #endif // #ifdef ALCOR_CPU_LINUX
 
 // ****************************************************************************
@@ -505,9 +1597,27 @@ static FSDATA wofs_fsdata =
   ROMFS_FS_FLAG_WO | ROMFS_FS_FLAG_DIRECT,
   NULL,
   sim_wofs_write,
+  0,
+  NULL,
   0
 };
 
+// Return the start and end of a flash sector, relative to the start of WOFS
+static u32 wofsh_sector( u32 addr, u32 *pend, const FSDATA *pfs )
+{
+  u32 start, end;
+
+  platform_flash_get_sector_bounds( addr + ( u32 )pfs->pbase, &start, &end );
+  if( pend )
+    *pend = end - ( u32 )pfs->pbase;
+  return start - ( u32 )pfs->pbase;
+}
+
+static int wofsh_erase_sector( u32 addr, const FSDATA *pfs )
+{
+  return platform_flash_erase_sector( platform_flash_get_sector_of_address( addr + ( u32 )pfs->pbase ) ) == PLATFORM_OK;
+}
+
 // WOFS formatting function
 // Returns 1 if OK, 0 for error
 int wofs_format()
@@ -520,12 +1630,25 @@ int wofs_format()
   // erase, instead of simply erasing everything from sect_first to the last Flash page. 
   romfs_open_file( "\1", &tempfd, &wofs_fsdata, &sect_last, NULL );
   sect_last = platform_flash_get_sector_of_address( sect_last + ( u32 )wofs_fsdata.pbase );
+  wofs_index_state = WOFS_INDEX_INVALID;
+  wofs_tail_fd = -1;
+  wofs_next_id = 0;
   while( sect_first <= sect_last )
     if( platform_flash_erase_sector( sect_first ++ ) == PLATFORM_ERR )
       return 0;
+  // The compaction journal might not be empty either
+  if( wofs_journal_addr && wofsh_used_end( wofs_journal_addr, wofs_spare_addr, &wofs_fsdata ) != wofs_journal_addr )
+    return wofsh_erase_sector( wofs_journal_addr, &wofs_fsdata );
   return 1;
 }
 
+// WOFS compaction function
+// Returns 1 if OK, 0 for error
+int wofs_compact()
+{
+  return wofsh_compact( &wofs_fsdata );
+}
+
 #endif // #ifdef BUILD_WOFS
 
 // Initialize both ROMFS and WOFS as needed
@@ -538,6 +1661,14 @@ int romfs_init()
     memset( fd_table + i, 0xFF, sizeof( FD ) );
     fd_table[ i ].flags = 0;
   }
+  romfs_num_fd = 0;
+#ifdef BUILD_WOFS
+  wofs_num_fd = 0;
+  wofs_tail_fd = -1;
+  wofs_next_id = 0;
+  wofs_mapped = 0;
+  wofs_index_state = WOFS_INDEX_INVALID;
+#endif
 #if defined( ALCOR_CPU_LINUX ) && defined( BUILD_WOFS )
   // Initialize and register WOFS for the simulator
   wofs_sim_fd = hostif_open( WOFS_FNAME, 2, 0666 ); // try to open directly first
@@ -551,12 +1682,17 @@ int romfs_init()
     hostif_close( wofs_sim_fd );
     wofs_sim_fd = hostif_open( WOFS_FNAME, 2, 0666 );
   }
+  wofs_sim_fsdata.max_size = WOFS_SIZE;
+  wofsh_init_compaction( &wofs_sim_fsdata );
+  wofsh_recover( &wofs_sim_fsdata );
   dm_register( "/wo", ( void* )&wofs_sim_fsdata, &romfs_device );
 #endif // #if defined( ALCOR_CPU_LINUX ) && defined( BUILD_WOFS )
 #if defined( BUILD_WOFS ) && !defined( ALCOR_CPU_LINUX )
   // Get the start address and size of WOFS and register it
   wofs_fsdata.pbase = ( u8* )platform_flash_get_first_free_block_address( NULL );
   wofs_fsdata.max_size = INTERNAL_FLASH_SIZE - ( ( u32 )wofs_fsdata.pbase - INTERNAL_FLASH_START_ADDRESS );
+  wofsh_init_compaction( &wofs_fsdata );
+  wofsh_recover( &wofs_fsdata );
   dm_register( "/wo", &wofs_fsdata, &romfs_device );
 #endif // ifdef BUILD_WOFS
 #ifdef BUILD_ROMFS
@@ -35,36 +35,143 @@
 
 #ifdef BUILD_XMODEM
 
-const char shell_help_recv[] = "[<path>]\n"
+const char shell_help_recv[] = "[<path> | -y <dir>]\n"
   "  [<path>] - the data received via XMODEM will be saved to this file.\n"
+  "  [-y <dir>] - receive a batch of files via YMODEM and save them in <dir>.\n"
 #ifdef ALCOR_LANG_PICOC
   "Without arguments, it shows this help message.\n";
 #else
   "Without arguments it runs Lua to execute the data it receives.\n";
 #endif
 
-const char shell_help_summary_recv[] = "receive files via XMODEM";
+const char shell_help_summary_recv[] = "receive files via XMODEM/YMODEM";
 
 extern char *shell_prog;
 
+// State of the file data sinks (nothing can be printed during the
+// transfer, since the console is also the XMODEM line)
+static FILE *shellh_recv_fp;
+static const char *shellh_recv_dir;
+static char *shellh_recv_path;
+static unsigned shellh_recv_files;
+
+static int shellh_recv_write( const u8 *data, u32 size )
+{
+  return fwrite( data, 1, size, shellh_recv_fp ) == size ? 0 : -1;
+}
+
+// YMODEM: open a file in the destination directory or close the current one
+static int shellh_recv_file( const char *name, u32 size )
+{
+  const char *p;
+
+  ( void )size;
+  if( name == NULL )
+  {
+    fclose( shellh_recv_fp );
+    shellh_recv_fp = NULL;
+    shellh_recv_files ++;
+    return 0;
+  }
+  // Keep only the base name sent by the remote part
+  if( ( p = strrchr( name, '/' ) ) != NULL )
+    name = p + 1;
+  free( shellh_recv_path );
+  if( ( shellh_recv_path = cmn_fs_path_join( shellh_recv_dir, name, NULL ) ) == NULL )
+    return -1;
+  if( ( shellh_recv_fp = fopen( shellh_recv_path, "w" ) ) == NULL )
+    return -1;
+  return 0;
+}
+
+// Print the result of a failed transfer
+static void shellh_recv_error( long res )
+{
+  if( res == XMODEM_ERROR_OUTOFMEM )
+    printf( "file too big\n" );
+  else if( res == XMODEM_ERROR_LOCALCANCEL )
+  {
+    if( shellh_recv_path )
+      printf( "unable to save file %s (no space left on target?)\n", shellh_recv_path );
+    else
+      printf( "unable to write the received data\n" );
+  }
+  else
+    printf( "XMODEM error\n" );
+}
+
+// Receive directly to a file (XMODEM) or to a directory (YMODEM batch)
+static void shellh_recv_to_fs( const char *path, int batch )
+{
+  long actsize;
+
+  shellh_recv_path = NULL;
+  shellh_recv_files = 0;
+  if( batch )
+  {
+    if( !cmn_fs_check_directory( path ) )
+    {
+      printf( "unable to open directory %s\n", path );
+      return;
+    }
+    shellh_recv_dir = path;
+    shellh_recv_fp = NULL;
+  }
+  else if( ( shellh_recv_fp = fopen( path, "w" ) ) == NULL )
+  {
+    printf( "unable to open file %s\n", path );
+    return;
+  }
+  printf( "Waiting for file%s ... ", batch ? "s" : "" );
+  actsize = batch ? xmodem_receive_stream( shellh_recv_write, shellh_recv_file ) :
+                    xmodem_receive_stream( shellh_recv_write, NULL );
+  if( shellh_recv_fp )
+    fclose( shellh_recv_fp );
+  shellh_recv_fp = NULL;
+  if( actsize < 0 )
+  {
+    if( !batch )
+      shellh_recv_path = ( char* )path;
+    shellh_recv_error( actsize );
+  }
+  else if( batch )
+    printf( "done, got %u file(s), %u bytes\n", shellh_recv_files, ( unsigned )actsize );
+  else
+    printf( "done, got %u bytes\nreceived and saved as %s\n", ( unsigned )actsize, path );
+  if( batch )
+    free( shellh_recv_path );
+  shellh_recv_path = NULL;
+}
+
 void shell_recv( int argc, char **argv )
 {
-  char *p;
   long actsize;
 #ifdef ALCOR_LANG_LUA
   lua_State* L;
 #endif
 
+  if( argc == 3 && !strcmp( argv[ 1 ], "-y" ) )
+  {
+    shellh_recv_to_fs( argv[ 2 ], 1 );
+    return;
+  }
 #ifdef ALCOR_LANG_PICOC
-  if( ( argc > 2 ) || ( argc == 0 ) )
+  if( argc != 2 )
 #else
-  if( argc > 2 )
+  if( argc > 2 || ( argc == 2 && argv[ 1 ][ 0 ] == '-' ) )
 #endif
   {
     SHELL_SHOW_HELP( recv );
     return;
   }
 
+  // we've received an argument, save the data to a file as it arrives
+  if( argc == 2 )
+  {
+    shellh_recv_to_fs( argv[ 1 ], 0 );
+    return;
+  }
+
   if( ( shell_prog = malloc( XMODEM_INITIAL_BUFFER_SIZE ) ) == NULL )
   {
     printf( "Unable to allocate memory\n" );
@@ -73,51 +180,25 @@ void shell_recv( int argc, char **argv )
   printf( "Waiting for file ... " );
   if( ( actsize = xmodem_receive( &shell_prog ) ) < 0 )
   {
-    if( actsize == XMODEM_ERROR_OUTOFMEM )
-      printf( "file too big\n" );
-    else
-      printf( "XMODEM error\n" );
+    shellh_recv_error( actsize );
     goto exit;
   }
-  // Eliminate the XMODEM padding bytes
-  p = shell_prog + actsize - 1;
-  while( *p == '\x1A' )
-    p --;
-  p ++;
-  printf( "done, got %u bytes\n", ( unsigned )( p - shell_prog ) );          
+  printf( "done, got %u bytes\n", ( unsigned )actsize );          
   
-  // we've received an argument, try saving it to a file
-  if( argc == 2 )
-  {
-    FILE *foutput = fopen( argv[ 1 ], "w" );
-    size_t file_sz = p - shell_prog;
-    if( foutput == NULL )
-    {
-      printf( "unable to open file %s\n", argv[ 1 ] );
-      goto exit;
-    }
-    if( fwrite( shell_prog, sizeof( char ), file_sz, foutput ) == file_sz )
-      printf( "received and saved as %s\n", argv[ 1 ] );
-    else
-      printf( "unable to save file %s (no space left on target?)\n", argv[ 1 ] );
-    fclose( foutput );
-  }
 #ifdef ALCOR_LANG_LUA
-  else // no arg, running the file with lua.
+  // no arg, running the file with lua.
+  if( ( L = lua_open() ) == NULL )
   {
-    if( ( L = lua_open() ) == NULL )
-    {
-      printf( "Unable to create Lua state\n" );
-      goto exit;
-    }
-    luaL_openlibs( L );
-    if( luaL_loadbuffer( L, shell_prog, p - shell_prog, "xmodem" ) != 0 )
-      printf( "Error: %s\n", lua_tostring( L, -1 ) );
-    else
-      if( lua_pcall( L, 0, LUA_MULTRET, 0 ) != 0 )
-        printf( "Error: %s\n", lua_tostring( L, -1 ) );
-    lua_close( L );
+    printf( "Unable to create Lua state\n" );
+    goto exit;
   }
+  luaL_openlibs( L );
+  if( luaL_loadbuffer( L, shell_prog, actsize, "xmodem" ) != 0 )
+    printf( "Error: %s\n", lua_tostring( L, -1 ) );
+  else
+    if( lua_pcall( L, 0, LUA_MULTRET, 0 ) != 0 )
+      printf( "Error: %s\n", lua_tostring( L, -1 ) );
+  lua_close( L );
 #endif
 exit:
   free( shell_prog );
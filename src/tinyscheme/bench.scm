@@ -0,0 +1,37 @@
+; Micro-benchmark of the interpreter loop.
+;
+; Every iteration runs a handful of short builtins and special forms, so
+; the time goes to opcode dispatch and argument checking rather than to
+; the primitives themselves.  Run it with and without USE_THREADED_DISPATCH
+; (or before and after a change to Eval_Cycle) and compare the times:
+;
+;    time ./scheme bench.scm
+;
+; The checksum printed at the end must not change between builds.
+
+(define bench-iterations 200000)
+
+(define bench-pair (cons 1 2))
+(define bench-vec (make-vector 4 1))
+
+(define (bench-step i acc)
+  (let* ((a (car bench-pair))
+         (b (cdr bench-pair))
+         (c (vector-ref bench-vec (remainder i 4))))
+    (cond ((and (pair? bench-pair) (eqv? a 1) (not (null? bench-pair)))
+           (case (remainder i 3)
+             ((0) (+ acc a b c))
+             ((1) (- acc a))
+             (else (if (< acc 0) (+ acc b) acc))))
+          ((or (zero? i) (symbol? a)) acc)
+          (else 0))))
+
+(define (bench-loop n)
+  (let loop ((i 0) (acc 0))
+    (if (< i n)
+        (loop (+ i 1) (bench-step i acc))
+        acc)))
+
+(display "checksum: ")
+(display (bench-loop bench-iterations))
+(newline)
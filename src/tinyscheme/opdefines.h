@@ -192,4 +192,14 @@
     _OP_DEF(opexe_6, "get-closure-code",               1,  1,       TST_NONE,                        OP_GET_CLOSURE      )
     _OP_DEF(opexe_6, "closure?",                       1,  1,       TST_NONE,                        OP_CLOSUREP         )
     _OP_DEF(opexe_6, "macro?",                         1,  1,       TST_NONE,                        OP_MACROP           )
+#ifdef ALCOR_LANG_TINYSCHEME
+    _OP_DEF(opexe_7, "cpu-cli",                        0,  INF_ARG, TST_NATURAL,                     OP_CPU_CLI          )
+    _OP_DEF(opexe_7, "cpu-sei",                        0,  INF_ARG, TST_NATURAL,                     OP_CPU_SEI          )
+    _OP_DEF(opexe_7, "cpu-set-int-handler",            2,  2,       TST_NATURAL TST_ANY,             OP_CPU_SET_INT_HANDLER )
+    _OP_DEF(opexe_7, "cpu-get-int-handler",            1,  1,       TST_NATURAL,                     OP_CPU_GET_INT_HANDLER )
+    _OP_DEF(opexe_7, "cpu-get-int-flag",               2,  3,       TST_NATURAL TST_NATURAL TST_ANY, OP_CPU_GET_INT_FLAG )
+    _OP_DEF(opexe_7, "cpu-set-int-priority",           2,  2,       TST_NATURAL,                     OP_CPU_SET_INT_PRIO )
+    _OP_DEF(opexe_7, "cpu-get-int-priority",           1,  1,       TST_NATURAL,                     OP_CPU_GET_INT_PRIO )
+    _OP_DEF(opexe_7, "tmr-set-match-int",              3,  3,       TST_NATURAL,                     OP_TMR_SET_MATCH_INT )
+#endif
 #undef _OP_DEF
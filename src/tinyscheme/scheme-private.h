@@ -68,11 +68,16 @@ int retcode;
 int tracing;
 
 
-#define CELL_SEGSIZE    5000  /* # of cells in one segment */
-#define CELL_NSEGMENT   10    /* # of segments for cells */
+#ifndef CELL_SEGSIZE
+#define CELL_SEGSIZE    5000  /* default # of cells in one segment */
+#endif
+#define CELL_SEGSIZE_MIN 512  /* smallest segment tried when memory is short */
+#define CELL_NSEGMENT   32    /* max # of segments for cells */
 char *alloc_seg[CELL_NSEGMENT];
-pointer cell_seg[CELL_NSEGMENT];
+pointer cell_seg[CELL_NSEGMENT];  /* sorted by address */
+int     cell_seglen[CELL_NSEGMENT]; /* # of cells in each segment */
 int     last_cell_seg;
+int     cell_segsize;         /* # of cells in new segments */
 
 /* We use 4 registers. */
 pointer args;            /* register for arguments of function */
@@ -93,8 +98,10 @@ pointer F;               /* special cell representing #f */
 struct cell _EOF_OBJ;
 pointer EOF_OBJ;         /* special cell representing end-of-file object */
 pointer oblist;          /* pointer to symbol table */
+int     oblist_count;    /* # of symbols in the symbol table */
 pointer global_env;      /* pointer to global environment */
 pointer c_nest;          /* stack for nested calls from C */
+pointer int_handlers;    /* alist of interrupt handlers, (id . proc) */
 
 /* global pointers to special symbols */
 pointer LAMBDA;               /* pointer to syntax lambda */
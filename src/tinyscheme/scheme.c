@@ -31,6 +31,23 @@
 #include <limits.h>
 #include <float.h>
 #include <ctype.h>
+#include <string.h>
+
+#ifdef ALCOR_LANG_TINYSCHEME
+# include "platform.h"
+# include "platform_conf.h"
+# include "elua_int.h"
+#endif
+
+/* Interrupt handlers: elua_int_add() queues the interrupts, Eval_Cycle
+ * runs their handlers between two opcodes */
+#if defined(ALCOR_LANG_TINYSCHEME) && defined(BUILD_TINYSCHEME_INT_HANDLERS)
+# define USE_INT_HANDLERS 1
+# define int_pending() elua_int_should_dispatch()
+#else
+# define USE_INT_HANDLERS 0
+# define int_pending() 0
+#endif
 
 #undef USE_STRCASECMP
 #if USE_STRCASECMP
@@ -112,6 +129,22 @@ static const char *strlwr(char *s) {
 # define FIRST_CELLSEGS 3
 #endif
 
+/* With the RAM size known, cell segments are sized so that this many of
+   them cover all of it: the cells are then limited by the heap, not by
+   CELL_NSEGMENT. */
+#ifndef CELL_SEGS_PER_RAM
+# define CELL_SEGS_PER_RAM 16
+#endif
+#ifndef CELL_SEGSIZE_MAX
+# define CELL_SEGSIZE_MAX (4*CELL_SEGSIZE)
+#endif
+
+/* Initial size of the symbol table; it doubles when there are more
+   symbols than buckets */
+#ifndef OBLIST_INITIAL_SIZE
+# define OBLIST_INITIAL_SIZE 461
+#endif
+
 enum scheme_types {
   T_STRING=1,
   T_NUMBER=2,
@@ -134,6 +167,7 @@ enum scheme_types {
 #define ADJ 32
 #define TYPE_BITS 5
 #define T_MASKTYPE      31    /* 0000000000011111 */
+#define T_LOCALVAR    2048    /* 0000100000000000 */   /* symbol was bound in a local frame */
 #define T_SYNTAX      4096    /* 0001000000000000 */
 #define T_IMMUTABLE   8192    /* 0010000000000000 */
 #define T_ATOM       16384    /* 0100000000000000 */   /* only for gc */
@@ -221,6 +255,8 @@ INTERFACE INLINE char *symname(pointer p)   { return strvalue(car(p)); }
 SCHEME_EXPORT INLINE int hasprop(pointer p)     { return (typeflag(p)&T_SYMBOL); }
 #define symprop(p)       cdr(p)
 #endif
+#define is_localvar(p)   (typeflag(p)&T_LOCALVAR)
+#define setlocalvar(p)   typeflag(p) |= T_LOCALVAR
 
 INTERFACE INLINE int is_syntax(pointer p)   { return (typeflag(p)&T_SYNTAX); }
 INTERFACE INLINE int is_proc(pointer p)     { return (type(p)==T_PROC); }
@@ -380,6 +416,9 @@ static pointer opexe_3(scheme *sc, enum scheme_opcodes op);
 static pointer opexe_4(scheme *sc, enum scheme_opcodes op);
 static pointer opexe_5(scheme *sc, enum scheme_opcodes op);
 static pointer opexe_6(scheme *sc, enum scheme_opcodes op);
+#ifdef ALCOR_LANG_TINYSCHEME
+static pointer opexe_7(scheme *sc, enum scheme_opcodes op);
+#endif
 static void Eval_Cycle(scheme *sc, enum scheme_opcodes op);
 static void assign_syntax(scheme *sc, char *name);
 static int syntaxnum(pointer p);
@@ -558,14 +597,52 @@ static long binary_decode(const char *s) {
  return x;
 }
 
+/* size of the cell segments, from the RAM available on the target */
+static int cellseg_size(void) {
+#ifdef ALCOR_LANG_TINYSCHEME
+     unsigned long total = 0;
+     unsigned id;
+     char *pstart;
+     long n;
+
+     for (id = 0; (pstart = platform_get_first_free_ram(id)) != NULL; id++) {
+          total += (char*)platform_get_last_free_ram(id) - pstart;
+     }
+     n = total / CELL_SEGS_PER_RAM / sizeof(struct cell);
+     if (n < CELL_SEGSIZE_MIN) {
+          return CELL_SEGSIZE_MIN;
+     }
+     return n > CELL_SEGSIZE_MAX ? CELL_SEGSIZE_MAX : n;
+#else
+     return CELL_SEGSIZE;
+#endif
+}
+
+/* insert the linked cells from 'first' to 'last' in address order on the
+   free list, so that vectors can still find consecutive cells */
+static void free_cells_insert(scheme *sc, pointer first, pointer last) {
+     pointer p;
+
+     if (sc->free_cell == sc->NIL || last < sc->free_cell) {
+          cdr(last) = sc->free_cell;
+          sc->free_cell = first;
+     } else {
+          p = sc->free_cell;
+          while (cdr(p) != sc->NIL && first > cdr(p))
+               p = cdr(p);
+          cdr(last) = cdr(p);
+          cdr(p) = first;
+     }
+}
+
 /* allocate new cell segment */
 static int alloc_cellseg(scheme *sc, int n) {
      pointer newp;
      pointer last;
      pointer p;
      char *cp;
-     long i;
-     int k;
+     int i, lo, hi;
+     int k, len;
      int adj=ADJ;
 
      if(adj<sizeof(struct cell)) {
@@ -575,45 +652,83 @@ static int alloc_cellseg(scheme *sc, int n) {
      for (k = 0; k < n; k++) {
          if (sc->last_cell_seg >= CELL_NSEGMENT - 1)
               return k;
-         cp = (char*) sc->malloc(CELL_SEGSIZE * sizeof(struct cell)+adj);
+         /* if the heap is short or fragmented, settle for smaller segments */
+         for (len = sc->cell_segsize; ; len /= 2) {
+              cp = (char*) sc->malloc(len * sizeof(struct cell)+adj);
+              if (cp != 0 || len / 2 < CELL_SEGSIZE_MIN)
+                   break;
+         }
          if (cp == 0)
               return k;
-         i = ++sc->last_cell_seg ;
-         sc->alloc_seg[i] = cp;
+         sc->cell_segsize = len;
          /* adjust in TYPE_BITS-bit boundary */
+         newp=(pointer)cp;
          if(((unsigned long)cp)%adj!=0) {
-           cp=(char*)(adj*((unsigned long)cp/adj+1));
+           newp=(pointer)(adj*((unsigned long)cp/adj+1));
          }
          /* insert new segment in address order */
-         newp=(pointer)cp;
-         sc->cell_seg[i] = newp;
-         while (i > 0 && sc->cell_seg[i - 1] > sc->cell_seg[i]) {
-             p = sc->cell_seg[i];
-             sc->cell_seg[i] = sc->cell_seg[i - 1];
-             sc->cell_seg[--i] = p;
+         for (lo = 0, hi = sc->last_cell_seg + 1; lo < hi; ) {
+              i = (lo + hi) / 2;
+              if (sc->cell_seg[i] < newp)
+                   lo = i + 1;
+              else
+                   hi = i;
          }
-         sc->fcells += CELL_SEGSIZE;
-         last = newp + CELL_SEGSIZE - 1;
+         i = ++sc->last_cell_seg - lo;
+         memmove(sc->alloc_seg + lo + 1, sc->alloc_seg + lo, i * sizeof(char*));
+         memmove(sc->cell_seg + lo + 1, sc->cell_seg + lo, i * sizeof(pointer));
+         memmove(sc->cell_seglen + lo + 1, sc->cell_seglen + lo, i * sizeof(int));
+         sc->alloc_seg[lo] = cp;
+         sc->cell_seg[lo] = newp;
+         sc->cell_seglen[lo] = len;
+         sc->fcells += len;
+         last = newp + len - 1;
          for (p = newp; p <= last; p++) {
               typeflag(p) = 0;
               cdr(p) = p + 1;
               car(p) = sc->NIL;
          }
-         /* insert new cells in address order on free list */
-         if (sc->free_cell == sc->NIL || p < sc->free_cell) {
-              cdr(last) = sc->free_cell;
-              sc->free_cell = newp;
-         } else {
-               p = sc->free_cell;
-               while (cdr(p) != sc->NIL && newp > cdr(p))
-                    p = cdr(p);
-               cdr(last) = cdr(p);
-               cdr(p) = newp;
-         }
+         free_cells_insert(sc, newp, last);
      }
      return n;
 }
 
+#if USE_CELLSEG_RELEASE
+/* Give back to malloc the segments that gc found empty (flagged in 'empty',
+   their cells are not on the free list), as long as at least FIRST_CELLSEGS
+   segments remain and half of the remaining cells are free. The others
+   go back on the free list, in address order. */
+static void release_cellsegs(scheme *sc, unsigned long empty) {
+     long total = 0;
+     int i, n;
+     pointer p;
+
+     for (i = 0; i <= sc->last_cell_seg; i++) {
+          total += sc->cell_seglen[i];
+     }
+     for (i = sc->last_cell_seg; i >= 0; i--) {
+          if ((empty & (1UL << i)) == 0) {
+               continue;
+          }
+          n = sc->cell_seglen[i];
+          if (sc->last_cell_seg >= FIRST_CELLSEGS && 2 * sc->fcells >= total - n) {
+               sc->free(sc->alloc_seg[i]);
+               total -= n;
+               n = sc->last_cell_seg-- - i;
+               memmove(sc->alloc_seg + i, sc->alloc_seg + i + 1, n * sizeof(char*));
+               memmove(sc->cell_seg + i, sc->cell_seg + i + 1, n * sizeof(pointer));
+               memmove(sc->cell_seglen + i, sc->cell_seglen + i + 1, n * sizeof(int));
+          } else {
+               for (p = sc->cell_seg[i]; p < sc->cell_seg[i] + n - 1; p++) {
+                    cdr(p) = p + 1;
+               }
+               free_cells_insert(sc, sc->cell_seg[i], p);
+               sc->fcells += n;
+          }
+     }
+}
+#endif
+
 static INLINE pointer get_cell_x(scheme *sc, pointer a, pointer b) {
   if (sc->free_cell != sc->NIL) {
     pointer x = sc->free_cell;
@@ -826,7 +941,41 @@ static int hash_fn(const char *key, int table_size);
 
 static pointer oblist_initial_value(scheme *sc)
 {
-  return mk_vector(sc, 461); /* probably should be bigger */
+  sc->oblist_count = 0;
+  return mk_vector(sc, OBLIST_INITIAL_SIZE);
+}
+
+/*
+ * Double the symbol table and rehash it. The bucket cells are moved to
+ * the new vector, so nothing but the vector itself is allocated. If there
+ * are no free consecutive cells for it (not even after getting a new
+ * segment), the table simply keeps its size for now.
+ */
+static void oblist_grow(scheme *sc)
+{
+  int i, location, size = ivalue_unchecked(sc->oblist);
+  int len = 2 * size + 1;
+  pointer v, x, next;
+
+  if ((v = find_consecutive_cells(sc, len/2+len%2+1)) == sc->NIL) {
+    if (!alloc_cellseg(sc, 1) ||
+        (v = find_consecutive_cells(sc, len/2+len%2+1)) == sc->NIL) {
+      return;
+    }
+  }
+  typeflag(v) = (T_VECTOR | T_ATOM);
+  ivalue_unchecked(v) = len;
+  set_num_integer(v);
+  fill_vector(v, sc->NIL);
+  for (i = 0; i < size; i++) {
+    for (x = vector_elem(sc->oblist, i); x != sc->NIL; x = next) {
+      next = cdr(x);
+      location = hash_fn(symname(car(x)), len);
+      cdr(x) = vector_elem(v, location);
+      set_vector_elem(v, location, x);
+    }
+  }
+  sc->oblist = v;
 }
 
 /* returns the new symbol */
@@ -842,6 +991,9 @@ static pointer oblist_add_by_name(scheme *sc, const char *name)
   location = hash_fn(name, ivalue_unchecked(sc->oblist));
   set_vector_elem(sc->oblist, location,
                   immutable_cons(sc, x, vector_elem(sc->oblist, location)));
+  if (++sc->oblist_count > ivalue_unchecked(sc->oblist)) {
+    oblist_grow(sc);
+  }
   return x;
 }
 
@@ -1255,6 +1407,9 @@ E6:   /* up.  Undo the link switching from steps E4 and E5. */
 static void gc(scheme *sc, pointer a, pointer b) {
   pointer p;
   int i;
+#if USE_CELLSEG_RELEASE
+  unsigned long empty = 0;
+#endif
 
   if(sc->gc_verbose) {
     putstr(sc, "gc...");
@@ -1279,6 +1434,7 @@ static void gc(scheme *sc, pointer a, pointer b) {
   mark(car(sc->sink));
   /* Mark any older stuff above nested C calls */
   mark(sc->c_nest);
+  mark(sc->int_handlers);
 
   /* mark variables a, b */
   mark(a);
@@ -1294,7 +1450,11 @@ static void gc(scheme *sc, pointer a, pointer b) {
      free-list in sorted order.
   */
   for (i = sc->last_cell_seg; i >= 0; i--) {
-    p = sc->cell_seg[i] + CELL_SEGSIZE;
+#if USE_CELLSEG_RELEASE
+    pointer seg_free_cell = sc->free_cell;
+    long seg_fcells = sc->fcells;
+#endif
+    p = sc->cell_seg[i] + sc->cell_seglen[i];
     while (--p >= sc->cell_seg[i]) {
       if (is_mark(p)) {
     clrmark(p);
@@ -1310,7 +1470,21 @@ static void gc(scheme *sc, pointer a, pointer b) {
         sc->free_cell = p;
       }
     }
+#if USE_CELLSEG_RELEASE
+    /* a segment with no live cells is taken off the free list (its cells
+       are the ones just added in front) and maybe released below */
+    if (sc->fcells - seg_fcells == sc->cell_seglen[i]) {
+      sc->free_cell = seg_free_cell;
+      sc->fcells = seg_fcells;
+      empty |= 1UL << i;
+    }
+#endif
+  }
+#if USE_CELLSEG_RELEASE
+  if (empty) {
+    release_cellsegs(sc, empty);
   }
+#endif
 
   if (sc->gc_verbose) {
     char msg[80];
@@ -2166,6 +2340,44 @@ static int hash_fn(const char *key, int table_size)
 }
 #endif
 
+/*
+ * Global bindings are cached on their symbol: the cdr of a symbol (unless
+ * it holds a property list) points to its slot in the global environment.
+ * Symbols also remember whether they were ever bound in a local frame; the
+ * ones that weren't (most procedure names) skip the frame walk altogether,
+ * so a reference to a global costs the same at any nesting depth.
+ * Frames only grow, and every environment ends in the global one, so both
+ * shortcuts stay valid for eval and define at runtime.
+ */
+#if !USE_PLIST
+#define symglobal(p)     cdr(p)
+#endif
+
+static INLINE void note_slot_in_env(scheme *sc, pointer env, pointer slot)
+{
+  if (env == sc->global_env) {
+#if !USE_PLIST
+    symglobal(car(slot)) = slot;
+#endif
+  } else {
+    setlocalvar(car(slot));
+  }
+}
+
+#if !USE_PLIST
+#define find_global_slot(sc, env, hdl, all)                     \
+  if (!is_localvar(hdl)) {                                      \
+    return (all) || (env) == sc->global_env ? symglobal(hdl) : sc->NIL; \
+  }
+#define find_cached_slot(sc, x, hdl)                            \
+  if ((x) == sc->global_env) {                                  \
+    return symglobal(hdl);                                      \
+  }
+#else
+#define find_global_slot(sc, env, hdl, all)
+#define find_cached_slot(sc, x, hdl)
+#endif
+
 #ifndef USE_ALIST_ENV
 
 /*
@@ -2196,6 +2408,7 @@ static INLINE void new_slot_spec_in_env(scheme *sc, pointer env,
 {
   pointer slot = immutable_cons(sc, variable, value);
 
+  note_slot_in_env(sc, env, slot);
   if (is_vector(car(env))) {
     int location = hash_fn(symname(variable), ivalue_unchecked(car(env)));
 
@@ -2211,7 +2424,9 @@ static pointer find_slot_in_env(scheme *sc, pointer env, pointer hdl, int all)
   pointer x,y;
   int location;
 
+  find_global_slot(sc, env, hdl, all);
   for (x = env; x != sc->NIL; x = cdr(x)) {
+    find_cached_slot(sc, x, hdl);
     if (is_vector(car(x))) {
       location = hash_fn(symname(hdl), ivalue_unchecked(car(x)));
       y = vector_elem(car(x), location);
@@ -2247,13 +2462,18 @@ static INLINE void new_frame_in_env(scheme *sc, pointer old_env)
 static INLINE void new_slot_spec_in_env(scheme *sc, pointer env,
                                         pointer variable, pointer value)
 {
-  car(env) = immutable_cons(sc, immutable_cons(sc, variable, value), car(env));
+  pointer slot = immutable_cons(sc, variable, value);
+
+  note_slot_in_env(sc, env, slot);
+  car(env) = immutable_cons(sc, slot, car(env));
 }
 
 static pointer find_slot_in_env(scheme *sc, pointer env, pointer hdl, int all)
 {
     pointer x,y;
+    find_global_slot(sc, env, hdl, all);
     for (x = env; x != sc->NIL; x = cdr(x)) {
+         find_cached_slot(sc, x, hdl);
          for (y = car(x); y != sc->NIL; y = cdr(y)) {
               if (caar(y) == hdl) {
                    break;
@@ -2351,11 +2571,42 @@ static pointer _Error_1(scheme *sc, const char *s, pointer a) {
 /* Too small to turn into function */
 # define  BEGIN     do {
 # define  END  } while (0)
+#if USE_THREADED_DISPATCH
+/* An opexe_N that declares its own op_labels table continues directly
+ * with the internal opcodes listed there; builtins and the opcodes of the
+ * other groups still go back to Eval_Cycle, which checks their arguments.
+ * This file scope table hides nothing, so the other groups always return. */
+static void *const *const op_labels = 0;
+
+# define OP_CASE(op) case op: op##_L
+
+# define s_dispatch(sc) BEGIN                               \
+    void *next_;                                            \
+    if(op_labels == 0 || sc->no_memory || int_pending()    \
+       || (next_ = op_labels[sc->op]) == 0) {               \
+      return sc->T;                                         \
+    }                                                       \
+    ok_to_freely_gc(sc);                                    \
+    goto *next_; END
+
+#define s_goto(sc,a) BEGIN                                  \
+    sc->op = (int)(a);                                      \
+    s_dispatch(sc); END
+
+#define s_return(sc,a) BEGIN                                \
+    if(_s_return(sc,a) == sc->NIL) {                        \
+      return sc->NIL;                                       \
+    }                                                       \
+    s_dispatch(sc); END
+#else
+# define OP_CASE(op) case op
+
 #define s_goto(sc,a) BEGIN                                  \
     sc->op = (int)(a);                                      \
     return sc->T; END
 
 #define s_return(sc,a) return _s_return(sc,a)
+#endif
 
 #ifndef USE_SCHEME_STACK
 
@@ -2486,6 +2737,41 @@ static INLINE void dump_stack_mark(scheme *sc)
 
 static pointer opexe_0(scheme *sc, enum scheme_opcodes op) {
      pointer x, y;
+#if USE_THREADED_DISPATCH
+     static void *const op_labels[OP_MAXDEFINED] = {
+          [OP_T0LVL] = &&OP_T0LVL_L,
+          [OP_T1LVL] = &&OP_T1LVL_L,
+          [OP_READ_INTERNAL] = &&OP_READ_INTERNAL_L,
+          [OP_VALUEPRINT] = &&OP_VALUEPRINT_L,
+          [OP_EVAL] = &&OP_EVAL_L,
+#if USE_TRACING
+          [OP_REAL_EVAL] = &&OP_REAL_EVAL_L,
+#endif
+          [OP_E0ARGS] = &&OP_E0ARGS_L,
+          [OP_E1ARGS] = &&OP_E1ARGS_L,
+          [OP_APPLY] = &&OP_APPLY_L,
+#if USE_TRACING
+          [OP_REAL_APPLY] = &&OP_REAL_APPLY_L,
+#endif
+          [OP_DOMACRO] = &&OP_DOMACRO_L,
+          [OP_LAMBDA] = &&OP_LAMBDA_L,
+          [OP_LAMBDA1] = &&OP_LAMBDA1_L,
+          [OP_QUOTE] = &&OP_QUOTE_L,
+          [OP_DEF0] = &&OP_DEF0_L,
+          [OP_DEF1] = &&OP_DEF1_L,
+          [OP_BEGIN] = &&OP_BEGIN_L,
+          [OP_IF0] = &&OP_IF0_L,
+          [OP_IF1] = &&OP_IF1_L,
+          [OP_SET0] = &&OP_SET0_L,
+          [OP_SET1] = &&OP_SET1_L,
+          [OP_LET0] = &&OP_LET0_L,
+          [OP_LET1] = &&OP_LET1_L,
+          [OP_LET2] = &&OP_LET2_L,
+          [OP_LET0AST] = &&OP_LET0AST_L,
+          [OP_LET1AST] = &&OP_LET1AST_L,
+          [OP_LET2AST] = &&OP_LET2AST_L,
+     };
+#endif
 
      switch (op) {
      case OP_LOAD:       /* load */
@@ -2502,7 +2788,7 @@ static pointer opexe_0(scheme *sc, enum scheme_opcodes op) {
           s_goto(sc,OP_T0LVL);
         }
 
-     case OP_T0LVL: /* top level */
+     OP_CASE(OP_T0LVL): /* top level */
        /* If we reached the end of file, this loop is done. */
        if(sc->loadport->_object._port->kind & port_saw_EOF)
      {
@@ -2537,12 +2823,12 @@ static pointer opexe_0(scheme *sc, enum scheme_opcodes op) {
        s_save(sc,OP_T1LVL, sc->NIL, sc->NIL);
        s_goto(sc,OP_READ_INTERNAL);
 
-     case OP_T1LVL: /* top level */
+     OP_CASE(OP_T1LVL): /* top level */
           sc->code = sc->value;
           sc->inport=sc->save_inport;
           s_goto(sc,OP_EVAL);
 
-     case OP_READ_INTERNAL:       /* internal read */
+     OP_CASE(OP_READ_INTERNAL):       /* internal read */
           sc->tok = token(sc);
           if(sc->tok==TOK_EOF)
         { s_return(sc,sc->EOF_OBJ); }
@@ -2551,7 +2837,7 @@ static pointer opexe_0(scheme *sc, enum scheme_opcodes op) {
      case OP_GENSYM:
           s_return(sc, gensym(sc));
 
-     case OP_VALUEPRINT: /* print evaluation result */
+     OP_CASE(OP_VALUEPRINT): /* print evaluation result */
           /* OP_VALUEPRINT is always pushed, because when changing from
              non-interactive to interactive mode, it needs to be
              already on the stack */
@@ -2566,7 +2852,7 @@ static pointer opexe_0(scheme *sc, enum scheme_opcodes op) {
          s_return(sc,sc->value);
        }
 
-     case OP_EVAL:       /* main part of evaluation */
+     OP_CASE(OP_EVAL):       /* main part of evaluation */
 #if USE_TRACING
        if(sc->tracing) {
          /*s_save(sc,OP_VALUEPRINT,sc->NIL,sc->NIL);*/
@@ -2576,7 +2862,7 @@ static pointer opexe_0(scheme *sc, enum scheme_opcodes op) {
          s_goto(sc,OP_P0LIST);
        }
        /* fall through */
-     case OP_REAL_EVAL:
+     OP_CASE(OP_REAL_EVAL):
 #endif
           if (is_symbol(sc->code)) {    /* symbol */
                x=find_slot_in_env(sc,sc->envir,sc->code,1);
@@ -2599,7 +2885,7 @@ static pointer opexe_0(scheme *sc, enum scheme_opcodes op) {
                s_return(sc,sc->code);
           }
 
-     case OP_E0ARGS:     /* eval arguments */
+     OP_CASE(OP_E0ARGS):     /* eval arguments */
           if (is_macro(sc->value)) {    /* macro expansion */
                s_save(sc,OP_DOMACRO, sc->NIL, sc->NIL);
                sc->args = cons(sc,sc->code, sc->NIL);
@@ -2610,7 +2896,7 @@ static pointer opexe_0(scheme *sc, enum scheme_opcodes op) {
                s_goto(sc,OP_E1ARGS);
           }
 
-     case OP_E1ARGS:     /* eval arguments */
+     OP_CASE(OP_E1ARGS):     /* eval arguments */
           sc->args = cons(sc, sc->value, sc->args);
           if (is_pair(sc->code)) { /* continue */
                s_save(sc,OP_E1ARGS, sc->args, cdr(sc->code));
@@ -2632,7 +2918,7 @@ static pointer opexe_0(scheme *sc, enum scheme_opcodes op) {
      }
 #endif
 
-     case OP_APPLY:      /* apply 'code' to 'args' */
+     OP_CASE(OP_APPLY):      /* apply 'code' to 'args' */
 #if USE_TRACING
        if(sc->tracing) {
          s_save(sc,OP_REAL_APPLY,sc->args,sc->code);
@@ -2642,7 +2928,7 @@ static pointer opexe_0(scheme *sc, enum scheme_opcodes op) {
          s_goto(sc,OP_P0LIST);
        }
        /* fall through */
-     case OP_REAL_APPLY:
+     OP_CASE(OP_REAL_APPLY):
 #endif
           if (is_proc(sc->code)) {
                s_goto(sc,procnum(sc->code));   /* PROCEDURE */
@@ -2686,12 +2972,12 @@ static pointer opexe_0(scheme *sc, enum scheme_opcodes op) {
                Error_0(sc,"illegal function");
           }
 
-     case OP_DOMACRO:    /* do macro */
+     OP_CASE(OP_DOMACRO):    /* do macro */
           sc->code = sc->value;
           s_goto(sc,OP_EVAL);
 
 #if 1
-     case OP_LAMBDA:     /* lambda */
+     OP_CASE(OP_LAMBDA):     /* lambda */
           /* If the hook is defined, apply it to sc->code, otherwise
              set sc->value fall thru */
           {
@@ -2707,7 +2993,7 @@ static pointer opexe_0(scheme *sc, enum scheme_opcodes op) {
                }
           }
 
-     case OP_LAMBDA1:
+     OP_CASE(OP_LAMBDA1):
           s_return(sc,mk_closure(sc, sc->value, sc->envir));
 
 #else
@@ -2728,10 +3014,10 @@ static pointer opexe_0(scheme *sc, enum scheme_opcodes op) {
        }
        s_return(sc,mk_closure(sc, x, y));
 
-     case OP_QUOTE:      /* quote */
+     OP_CASE(OP_QUOTE):      /* quote */
           s_return(sc,car(sc->code));
 
-     case OP_DEF0:  /* define */
+     OP_CASE(OP_DEF0):  /* define */
           if(is_immutable(car(sc->code)))
             Error_1(sc,"define: unable to alter immutable", car(sc->code));
 
@@ -2748,7 +3034,7 @@ static pointer opexe_0(scheme *sc, enum scheme_opcodes op) {
           s_save(sc,OP_DEF1, sc->NIL, x);
           s_goto(sc,OP_EVAL);
 
-     case OP_DEF1:  /* define */
+     OP_CASE(OP_DEF1):  /* define */
           x=find_slot_in_env(sc,sc->envir,sc->code,0);
           if (x != sc->NIL) {
                set_slot_in_env(sc, x, sc->value);
@@ -2765,14 +3051,14 @@ static pointer opexe_0(scheme *sc, enum scheme_opcodes op) {
           }
           s_retbool(find_slot_in_env(sc,x,car(sc->args),1)!=sc->NIL);
 
-     case OP_SET0:       /* set! */
+     OP_CASE(OP_SET0):       /* set! */
           if(is_immutable(car(sc->code)))
                 Error_1(sc,"set!: unable to alter immutable variable",car(sc->code));
           s_save(sc,OP_SET1, sc->NIL, car(sc->code));
           sc->code = cadr(sc->code);
           s_goto(sc,OP_EVAL);
 
-     case OP_SET1:       /* set! */
+     OP_CASE(OP_SET1):       /* set! */
           y=find_slot_in_env(sc,sc->envir,sc->code,1);
           if (y != sc->NIL) {
                set_slot_in_env(sc, y, sc->value);
@@ -2782,7 +3068,7 @@ static pointer opexe_0(scheme *sc, enum scheme_opcodes op) {
           }
 
 
-     case OP_BEGIN:      /* begin */
+     OP_CASE(OP_BEGIN):      /* begin */
           if (!is_pair(sc->code)) {
                s_return(sc,sc->code);
           }
@@ -2792,12 +3078,12 @@ static pointer opexe_0(scheme *sc, enum scheme_opcodes op) {
           sc->code = car(sc->code);
           s_goto(sc,OP_EVAL);
 
-     case OP_IF0:        /* if */
+     OP_CASE(OP_IF0):        /* if */
           s_save(sc,OP_IF1, sc->NIL, cdr(sc->code));
           sc->code = car(sc->code);
           s_goto(sc,OP_EVAL);
 
-     case OP_IF1:        /* if */
+     OP_CASE(OP_IF1):        /* if */
           if (is_true(sc->value))
                sc->code = car(sc->code);
           else
@@ -2805,13 +3091,13 @@ static pointer opexe_0(scheme *sc, enum scheme_opcodes op) {
                                             * car(sc->NIL) = sc->NIL */
           s_goto(sc,OP_EVAL);
 
-     case OP_LET0:       /* let */
+     OP_CASE(OP_LET0):       /* let */
           sc->args = sc->NIL;
           sc->value = sc->code;
           sc->code = is_symbol(car(sc->code)) ? cadr(sc->code) : car(sc->code);
           s_goto(sc,OP_LET1);
 
-     case OP_LET1:       /* let (calculate parameters) */
+     OP_CASE(OP_LET1):       /* let (calculate parameters) */
           sc->args = cons(sc, sc->value, sc->args);
           if (is_pair(sc->code)) { /* continue */
                if (!is_pair(car(sc->code)) || !is_pair(cdar(sc->code))) {
@@ -2829,7 +3115,7 @@ static pointer opexe_0(scheme *sc, enum scheme_opcodes op) {
                s_goto(sc,OP_LET2);
           }
 
-     case OP_LET2:       /* let */
+     OP_CASE(OP_LET2):       /* let */
           new_frame_in_env(sc, sc->envir);
           for (x = is_symbol(car(sc->code)) ? cadr(sc->code) : car(sc->code), y = sc->args;
                y != sc->NIL; x = cdr(x), y = cdr(y)) {
@@ -2853,7 +3139,7 @@ static pointer opexe_0(scheme *sc, enum scheme_opcodes op) {
           }
           s_goto(sc,OP_BEGIN);
 
-     case OP_LET0AST:    /* let* */
+     OP_CASE(OP_LET0AST):    /* let* */
           if (car(sc->code) == sc->NIL) {
                new_frame_in_env(sc, sc->envir);
                sc->code = cdr(sc->code);
@@ -2866,11 +3152,11 @@ static pointer opexe_0(scheme *sc, enum scheme_opcodes op) {
           sc->code = cadaar(sc->code);
           s_goto(sc,OP_EVAL);
 
-     case OP_LET1AST:    /* let* (make new frame) */
+     OP_CASE(OP_LET1AST):    /* let* (make new frame) */
           new_frame_in_env(sc, sc->envir);
           s_goto(sc,OP_LET2AST);
 
-     case OP_LET2AST:    /* let* (calculate parameters) */
+     OP_CASE(OP_LET2AST):    /* let* (calculate parameters) */
           new_slot_in_env(sc, caar(sc->code), sc->value);
           sc->code = cdr(sc->code);
           if (is_pair(sc->code)) { /* continue */
@@ -2892,16 +3178,37 @@ static pointer opexe_0(scheme *sc, enum scheme_opcodes op) {
 
 static pointer opexe_1(scheme *sc, enum scheme_opcodes op) {
      pointer x, y;
+#if USE_THREADED_DISPATCH
+     static void *const op_labels[OP_MAXDEFINED] = {
+          [OP_LET0REC] = &&OP_LET0REC_L,
+          [OP_LET1REC] = &&OP_LET1REC_L,
+          [OP_LET2REC] = &&OP_LET2REC_L,
+          [OP_COND0] = &&OP_COND0_L,
+          [OP_COND1] = &&OP_COND1_L,
+          [OP_DELAY] = &&OP_DELAY_L,
+          [OP_AND0] = &&OP_AND0_L,
+          [OP_AND1] = &&OP_AND1_L,
+          [OP_OR0] = &&OP_OR0_L,
+          [OP_OR1] = &&OP_OR1_L,
+          [OP_C0STREAM] = &&OP_C0STREAM_L,
+          [OP_C1STREAM] = &&OP_C1STREAM_L,
+          [OP_MACRO0] = &&OP_MACRO0_L,
+          [OP_MACRO1] = &&OP_MACRO1_L,
+          [OP_CASE0] = &&OP_CASE0_L,
+          [OP_CASE1] = &&OP_CASE1_L,
+          [OP_CASE2] = &&OP_CASE2_L,
+     };
+#endif
 
      switch (op) {
-     case OP_LET0REC:    /* letrec */
+     OP_CASE(OP_LET0REC):    /* letrec */
           new_frame_in_env(sc, sc->envir);
           sc->args = sc->NIL;
           sc->value = sc->code;
           sc->code = car(sc->code);
           s_goto(sc,OP_LET1REC);
 
-     case OP_LET1REC:    /* letrec (calculate parameters) */
+     OP_CASE(OP_LET1REC):    /* letrec (calculate parameters) */
           sc->args = cons(sc, sc->value, sc->args);
           if (is_pair(sc->code)) { /* continue */
                if (!is_pair(car(sc->code)) || !is_pair(cdar(sc->code))) {
@@ -2919,7 +3226,7 @@ static pointer opexe_1(scheme *sc, enum scheme_opcodes op) {
                s_goto(sc,OP_LET2REC);
           }
 
-     case OP_LET2REC:    /* letrec */
+     OP_CASE(OP_LET2REC):    /* letrec */
           for (x = car(sc->code), y = sc->args; y != sc->NIL; x = cdr(x), y = cdr(y)) {
                new_slot_in_env(sc, caar(x), car(y));
           }
@@ -2927,7 +3234,7 @@ static pointer opexe_1(scheme *sc, enum scheme_opcodes op) {
           sc->args = sc->NIL;
           s_goto(sc,OP_BEGIN);
 
-     case OP_COND0:      /* cond */
+     OP_CASE(OP_COND0):      /* cond */
           if (!is_pair(sc->code)) {
                Error_0(sc,"syntax error in cond");
           }
@@ -2935,7 +3242,7 @@ static pointer opexe_1(scheme *sc, enum scheme_opcodes op) {
           sc->code = caar(sc->code);
           s_goto(sc,OP_EVAL);
 
-     case OP_COND1:      /* cond */
+     OP_CASE(OP_COND1):      /* cond */
           if (is_true(sc->value)) {
                if ((sc->code = cdar(sc->code)) == sc->NIL) {
                     s_return(sc,sc->value);
@@ -2959,12 +3266,12 @@ static pointer opexe_1(scheme *sc, enum scheme_opcodes op) {
                }
           }
 
-     case OP_DELAY:      /* delay */
+     OP_CASE(OP_DELAY):      /* delay */
           x = mk_closure(sc, cons(sc, sc->NIL, sc->code), sc->envir);
           typeflag(x)=T_PROMISE;
           s_return(sc,x);
 
-     case OP_AND0:       /* and */
+     OP_CASE(OP_AND0):       /* and */
           if (sc->code == sc->NIL) {
                s_return(sc,sc->T);
           }
@@ -2972,7 +3279,7 @@ static pointer opexe_1(scheme *sc, enum scheme_opcodes op) {
           sc->code = car(sc->code);
           s_goto(sc,OP_EVAL);
 
-     case OP_AND1:       /* and */
+     OP_CASE(OP_AND1):       /* and */
           if (is_false(sc->value)) {
                s_return(sc,sc->value);
           } else if (sc->code == sc->NIL) {
@@ -2983,7 +3290,7 @@ static pointer opexe_1(scheme *sc, enum scheme_opcodes op) {
                s_goto(sc,OP_EVAL);
           }
 
-     case OP_OR0:        /* or */
+     OP_CASE(OP_OR0):        /* or */
           if (sc->code == sc->NIL) {
                s_return(sc,sc->F);
           }
@@ -2991,7 +3298,7 @@ static pointer opexe_1(scheme *sc, enum scheme_opcodes op) {
           sc->code = car(sc->code);
           s_goto(sc,OP_EVAL);
 
-     case OP_OR1:        /* or */
+     OP_CASE(OP_OR1):        /* or */
           if (is_true(sc->value)) {
                s_return(sc,sc->value);
           } else if (sc->code == sc->NIL) {
@@ -3002,18 +3309,18 @@ static pointer opexe_1(scheme *sc, enum scheme_opcodes op) {
                s_goto(sc,OP_EVAL);
           }
 
-     case OP_C0STREAM:   /* cons-stream */
+     OP_CASE(OP_C0STREAM):   /* cons-stream */
           s_save(sc,OP_C1STREAM, sc->NIL, cdr(sc->code));
           sc->code = car(sc->code);
           s_goto(sc,OP_EVAL);
 
-     case OP_C1STREAM:   /* cons-stream */
+     OP_CASE(OP_C1STREAM):   /* cons-stream */
           sc->args = sc->value;  /* save sc->value to register sc->args for gc */
           x = mk_closure(sc, cons(sc, sc->NIL, sc->code), sc->envir);
           typeflag(x)=T_PROMISE;
           s_return(sc,cons(sc, sc->args, x));
 
-     case OP_MACRO0:     /* macro */
+     OP_CASE(OP_MACRO0):     /* macro */
           if (is_pair(car(sc->code))) {
                x = caar(sc->code);
                sc->code = cons(sc, sc->LAMBDA, cons(sc, cdar(sc->code), cdr(sc->code)));
@@ -3027,7 +3334,7 @@ static pointer opexe_1(scheme *sc, enum scheme_opcodes op) {
           s_save(sc,OP_MACRO1, sc->NIL, x);
           s_goto(sc,OP_EVAL);
 
-     case OP_MACRO1:     /* macro */
+     OP_CASE(OP_MACRO1):     /* macro */
           typeflag(sc->value) = T_MACRO;
           x = find_slot_in_env(sc, sc->envir, sc->code, 0);
           if (x != sc->NIL) {
@@ -3037,12 +3344,12 @@ static pointer opexe_1(scheme *sc, enum scheme_opcodes op) {
           }
           s_return(sc,sc->code);
 
-     case OP_CASE0:      /* case */
+     OP_CASE(OP_CASE0):      /* case */
           s_save(sc,OP_CASE1, sc->NIL, cdr(sc->code));
           sc->code = car(sc->code);
           s_goto(sc,OP_EVAL);
 
-     case OP_CASE1:      /* case */
+     OP_CASE(OP_CASE1):      /* case */
           for (x = sc->code; x != sc->NIL; x = cdr(x)) {
                if (!is_pair(y = caar(x))) {
                     break;
@@ -3069,7 +3376,7 @@ static pointer opexe_1(scheme *sc, enum scheme_opcodes op) {
                s_return(sc,sc->NIL);
           }
 
-     case OP_CASE2:      /* case */
+     OP_CASE(OP_CASE2):      /* case */
           if (is_true(sc->value)) {
                s_goto(sc,OP_BEGIN);
           } else {
@@ -4339,6 +4646,143 @@ static pointer opexe_6(scheme *sc, enum scheme_opcodes op) {
      return sc->T; /* NOTREACHED */
 }
 
+#ifdef ALCOR_LANG_TINYSCHEME
+
+#if USE_INT_HANDLERS
+/* Returns the (id . proc) pair of an interrupt or '() */
+static pointer int_handler_pair(scheme *sc, long id) {
+     pointer x;
+
+     for (x = sc->int_handlers; x != sc->NIL; x = cdr(x)) {
+          if (ivalue(caar(x)) == id) {
+               return car(x);
+          }
+     }
+     return sc->NIL;
+}
+#endif
+
+/* Alcor6L platform: interrupt handlers and timer match interrupts */
+static pointer opexe_7(scheme *sc, enum scheme_opcodes op) {
+#if USE_INT_HANDLERS
+     pointer x, y;
+     long id = 0;
+     int res;
+#endif
+
+     if ((op == OP_CPU_CLI || op == OP_CPU_SEI) && sc->args == sc->NIL) {
+          platform_cpu_set_global_interrupts(op == OP_CPU_SEI ?
+               PLATFORM_CPU_ENABLE : PLATFORM_CPU_DISABLE);
+          s_return(sc,sc->T);
+     }
+#if USE_INT_HANDLERS
+     if (op != OP_TMR_SET_MATCH_INT) {
+          id = ivalue(car(sc->args));
+          if (id < ELUA_INT_FIRST_ID || id > INT_ELUA_LAST) {
+               Error_1(sc,"invalid interrupt ID:",car(sc->args));
+          }
+     }
+
+     switch (op) {
+     case OP_CPU_CLI:    /* cpu-cli */
+     case OP_CPU_SEI:    /* cpu-sei */
+          for (x = cdr(sc->args); x != sc->NIL; x = cdr(x)) {
+               res = platform_cpu_set_interrupt(id, ivalue(car(x)),
+                    op == OP_CPU_SEI ? PLATFORM_CPU_ENABLE : PLATFORM_CPU_DISABLE);
+               if (res == PLATFORM_INT_INVALID) {
+                    Error_1(sc,"not a valid interrupt ID:",car(sc->args));
+               } else if (res == PLATFORM_INT_NOT_HANDLED) {
+                    Error_1(sc,"not implemented for this interrupt with resource:",car(x));
+               } else if (res == PLATFORM_INT_BAD_RESNUM) {
+                    Error_1(sc,"resource not valid for this interrupt:",car(x));
+               }
+          }
+          s_return(sc,sc->T);
+
+     case OP_CPU_SET_INT_HANDLER: /* cpu-set-int-handler */
+          y = cadr(sc->args);
+          if (y == sc->NIL) {
+               y = sc->F;
+          }
+          if (y != sc->F && !is_proc(y) && !is_closure(y)
+              && !is_continuation(y) && !is_foreign(y)) {
+               Error_1(sc,"cpu-set-int-handler: not a procedure:",y);
+          }
+          x = int_handler_pair(sc, id);
+          if (x == sc->NIL) {
+               sc->int_handlers = cons(sc, cons(sc, car(sc->args), y), sc->int_handlers);
+               x = sc->F;
+          } else {
+               sc->value = cdr(x);
+               cdr(x) = y;
+               x = sc->value;
+          }
+          if (y == sc->F) {
+               elua_int_disable(id);
+          } else {
+               elua_int_enable(id);
+          }
+          s_return(sc,x);
+
+     case OP_CPU_GET_INT_HANDLER: /* cpu-get-int-handler */
+          x = int_handler_pair(sc, id);
+          s_return(sc,x == sc->NIL ? sc->F : cdr(x));
+
+     case OP_CPU_GET_INT_FLAG: /* cpu-get-int-flag */
+          x = cddr(sc->args);
+          res = platform_cpu_get_interrupt_flag(id, ivalue(cadr(sc->args)),
+                                                x == sc->NIL || car(x) != sc->F);
+          if (res == PLATFORM_INT_INVALID) {
+               Error_1(sc,"not a valid interrupt ID:",car(sc->args));
+          } else if (res == PLATFORM_INT_NOT_HANDLED) {
+               Error_1(sc,"get flag not implemented for this interrupt with resource:",cadr(sc->args));
+          } else if (res == PLATFORM_INT_BAD_RESNUM) {
+               Error_1(sc,"resource not valid for this interrupt:",cadr(sc->args));
+          }
+          s_return(sc,mk_integer(sc,res));
+
+     case OP_CPU_SET_INT_PRIO: /* cpu-set-int-priority */
+          if (elua_int_set_priority(id, ivalue(cadr(sc->args))) != PLATFORM_OK) {
+               Error_1(sc,"cpu-set-int-priority: invalid priority:",cadr(sc->args));
+          }
+          s_return(sc,sc->T);
+
+     case OP_CPU_GET_INT_PRIO: /* cpu-get-int-priority */
+          s_return(sc,mk_integer(sc,elua_int_get_priority(id)));
+
+     case OP_TMR_SET_MATCH_INT: /* tmr-set-match-int */
+#ifdef INT_TMR_MATCH
+          id = ivalue(car(sc->args));
+          if ((id == PLATFORM_TIMER_SYS_ID && !platform_timer_sys_available())
+              || !platform_timer_exists(id)) {
+               Error_1(sc,"tmr-set-match-int: timer does not exist:",car(sc->args));
+          }
+          res = platform_timer_set_match_int(id, ivalue(cadr(sc->args)),
+                                             ivalue(caddr(sc->args)));
+          if (res == PLATFORM_TIMER_INT_TOO_SHORT) {
+               Error_0(sc,"tmr-set-match-int: timer interval too small");
+          } else if (res == PLATFORM_TIMER_INT_TOO_LONG) {
+               Error_0(sc,"tmr-set-match-int: timer interval too long");
+          } else if (res == PLATFORM_TIMER_INT_INVALID_ID) {
+               Error_0(sc,"tmr-set-match-int: match interrupt cannot be set on this timer");
+          }
+          s_return(sc,sc->T);
+#else
+          Error_0(sc,"tmr-set-match-int: timer match interrupts not available");
+#endif
+
+     default:
+          snprintf(sc->strbuff,STRBUFFSIZE,"%d: illegal operator", sc->op);
+          Error_0(sc,sc->strbuff);
+     }
+#else
+     Error_0(sc,"interrupt support not available");
+#endif
+     return sc->T; /* NOTREACHED */
+}
+
+#endif /* ALCOR_LANG_TINYSCHEME */
+
 typedef pointer (*dispatch_func)(scheme *, enum scheme_opcodes);
 
 typedef int (*test_predicate)(pointer);
@@ -4411,11 +4855,46 @@ static const char *procname(pointer x) {
  return name;
 }
 
+#if USE_INT_HANDLERS
+/* Called by elua_int_dispatch: run the handler of one interrupt */
+static void int_call(elua_int_id id, elua_int_resnum resnum, void *arg) {
+  scheme *sc = (scheme *)arg;
+  pointer x = int_handler_pair(sc, id);
+
+  if (x != sc->NIL && cdr(x) != sc->F) {
+    scheme_call(sc, cdr(x), cons(sc, mk_integer(sc, resnum), sc->NIL));
+  }
+}
+
+/* Run queued interrupt handlers in between two opcodes. The registers of
+ * the interrupted computation wait in a frame on the dump. */
+static void int_dispatch(scheme *sc) {
+  int retcode = sc->retcode;
+  pointer x = cons(sc, sc->value, sc->args);
+
+  if (sc->no_memory) {
+    return;
+  }
+  s_save(sc, (enum scheme_opcodes)sc->op, x, sc->code);
+  elua_int_dispatch(int_call, sc);
+  _s_return(sc, sc->NIL);
+  sc->value = car(sc->args);
+  sc->args = cdr(sc->args);
+  sc->retcode = retcode;
+}
+#endif
+
 /* kernel of this interpreter */
 static void Eval_Cycle(scheme *sc, enum scheme_opcodes op) {
   sc->op = op;
   for (;;) {
-    op_code_info *pcd=dispatch_table+sc->op;
+    op_code_info *pcd;
+#if USE_INT_HANDLERS
+    if (elua_int_should_dispatch()) {
+      int_dispatch(sc);
+    }
+#endif
+    pcd=dispatch_table+sc->op;
     if (pcd->name!=0) { /* if built-in function, check arguments */
       char msg[STRBUFFSIZE];
       int ok=1;
@@ -4445,7 +4924,14 @@ static void Eval_Cycle(scheme *sc, enum scheme_opcodes op) {
           do {
             pointer arg=car(arglist);
             j=(int)t[0];
-            if(j==TST_LIST[0]) {
+            if(j==TST_ANY[0] && t[1]==0) {
+              /* whatever is left is replicated TST_ANY: nothing to test */
+              i=n;
+              break;
+            }
+            if(j==TST_NUMBER[0]) { /* arithmetic, spare it the indirect call */
+                  if(!is_number(arg)) break;
+            } else if(j==TST_LIST[0]) {
                   if(arg!=sc->NIL && !is_pair(arg)) break;
             } else {
               if(!tests[j].fct(arg)) break;
@@ -4660,6 +5146,7 @@ int scheme_init_custom_alloc(scheme *sc, func_alloc malloc, func_dealloc free) {
   sc->malloc=malloc;
   sc->free=free;
   sc->last_cell_seg = -1;
+  sc->cell_segsize = cellseg_size();
   sc->sink = &sc->_sink;
   sc->NIL = &sc->_NIL;
   sc->T = &sc->_HASHT;
@@ -4682,6 +5169,8 @@ int scheme_init_custom_alloc(scheme *sc, func_alloc malloc, func_dealloc free) {
   sc->gc_verbose = 0;
   dump_stack_initialize(sc);
   sc->code = sc->NIL;
+  sc->args = sc->NIL;
+  sc->value = sc->NIL;
   sc->tracing=0;
 
   /* init sc->NIL */
@@ -4698,6 +5187,7 @@ int scheme_init_custom_alloc(scheme *sc, func_alloc malloc, func_dealloc free) {
   car(sc->sink) = sc->NIL;
   /* init c_nest */
   sc->c_nest = sc->NIL;
+  sc->int_handlers = sc->NIL;
 
   sc->oblist = oblist_initial_value(sc);
   /* init global_env */
@@ -4772,8 +5262,12 @@ void scheme_deinit(scheme *sc) {
   char *fname;
 #endif
 
+#ifdef ALCOR_LANG_TINYSCHEME
+  elua_int_cleanup();
+#endif
   sc->oblist=sc->NIL;
   sc->global_env=sc->NIL;
+  sc->int_handlers=sc->NIL;
   dump_stack_free(sc);
   sc->envir=sc->NIL;
   sc->code=sc->NIL;
@@ -4893,7 +5387,9 @@ void scheme_register_foreign_func_list(scheme * sc,
 
 pointer scheme_apply0(scheme *sc, const char *procname)
 { return scheme_eval(sc, cons(sc,mk_symbol(sc,procname),sc->NIL)); }
+#endif
 
+#if !STANDALONE || USE_INT_HANDLERS
 void save_from_C_call(scheme *sc)
 {
   pointer saved_data =
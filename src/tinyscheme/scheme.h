@@ -79,6 +79,18 @@ extern "C" {
 # define USE_PLIST 0
 #endif
 
+#ifndef USE_CELLSEG_RELEASE /* Give empty cell segments back to malloc after gc */
+# define USE_CELLSEG_RELEASE 0
+#endif
+
+#ifndef USE_THREADED_DISPATCH /* Chain internal opcodes with GCC computed goto */
+# ifdef __GNUC__
+#  define USE_THREADED_DISPATCH 1
+# else
+#  define USE_THREADED_DISPATCH 0
+# endif
+#endif
+
 /* To force system errors through user-defined error handling (see *error-hook*) */
 #ifndef USE_ERROR_HOOK
 # define USE_ERROR_HOOK 1
@@ -39,15 +39,18 @@
 #ifdef BUILD_XMODEM
 
 #define PXM_ACKET_SIZE    128
+#define PXM_1K_SIZE       1024
 static p_xm_send_func xmodem_out_func;
 static p_xm_recv_func xmodem_in_func;
 
 // Line control codes
 #define XM_SOH  0x01
+#define XM_STX  0x02
 #define XM_ACK  0x06
 #define XM_NAK  0x15
 #define XM_CAN  0x18
 #define XM_EOT  0x04
+#define XM_SUB  0x1A
 
 // Arguments to xmodem_flush
 #define XMODEM_FLUSH_ONLY       0
@@ -56,6 +59,25 @@ static p_xm_recv_func xmodem_in_func;
 // Delay in "flush packet" mode
 #define XMODEM_PXM_ACKET_DELAY     10000UL
 
+// Return values of xmodem_get_record
+#define XM_RECORD_OK            0
+#define XM_RECORD_DUP           1
+#define XM_RECORD_ERR           2
+
+// Receiver buffers: the packet being received (block number, its complement,
+// data and CRC) and the data of the previous block. The latter is held back
+// until the next packet (or EOT) arrives, so that the padding of the last block
+// can be removed before it reaches the data sink.
+typedef struct
+{
+  u8 pkt[ PXM_1K_SIZE + 4 ];
+  u8 held[ PXM_1K_SIZE ];
+} XM_RECV_STATE;
+
+// State of the RAM data sink used by xmodem_receive
+static char **xm_dest;
+static u32 xm_limit, xm_size;
+
 void xmodem_init( p_xm_send_func send_func, p_xm_recv_func recv_func )
 {
   xmodem_out_func = send_func;
@@ -74,30 +96,14 @@ static void xmodem_flush( int how )
   }
 }
 
-// This private function receives a x-modem record to the pointer and
-// returns 1 on success and 0 on error
-static int xmodem_get_record( unsigned char blocknum, unsigned char *pbuf )
+// CRC16 (XMODEM/CCITT) of a data block
+static unsigned xmodem_crc( const u8 *p, unsigned size )
 {
-  unsigned chk, j, size;
-  int ch;
-  
-  // Read packet
-  for( j = 0; j < PXM_ACKET_SIZE + 4; j ++ )
-  {
-    if( ( ch = xmodem_in_func( XMODEM_TIMEOUT ) ) == -1 )
-      goto err;
-    pbuf[ j ] = ( unsigned char )ch;
-  }
+  unsigned chk = 0, j;
 
-  // Check block number
-  if( *pbuf ++ != blocknum )
-    goto err;
-  if( *pbuf ++ != ( unsigned char )~blocknum )
-    goto err;
-  // Check CRC
-  for( size = chk = 0; size < PXM_ACKET_SIZE; size++, pbuf ++ ) 
+  while( size -- )
   {
-    chk = chk ^ *pbuf << 8;
+    chk = chk ^ *p ++ << 8;
     for( j = 0; j < 8; j ++ ) 
     {
       if( chk & 0x8000 )
@@ -106,79 +112,218 @@ static int xmodem_get_record( unsigned char blocknum, unsigned char *pbuf )
         chk = chk << 1;
     }
   }
-  chk &= 0xFFFF;
-  if( *pbuf ++ != ( ( chk >> 8 ) & 0xFF ) )
+  return chk & 0xFFFF;
+}
+
+// This private function receives a x-modem record of 'size' data bytes to
+// the pointer. It returns XM_RECORD_OK if the record is the expected one,
+// XM_RECORD_DUP if it is a retransmission of the previous record (which
+// happens when our ACK was lost) or XM_RECORD_ERR (after sending a NAK) on error.
+static int xmodem_get_record( u8 blocknum, u8 *pbuf, unsigned size )
+{
+  unsigned chk, j;
+  int ch;
+  
+  // Read packet
+  for( j = 0; j < size + 4; j ++ )
+  {
+    if( ( ch = xmodem_in_func( XMODEM_TIMEOUT ) ) == -1 )
+      goto err;
+    pbuf[ j ] = ( u8 )ch;
+  }
+
+  // Check CRC and block number
+  chk = xmodem_crc( pbuf + 2, size );
+  if( pbuf[ size + 2 ] != ( ( chk >> 8 ) & 0xFF ) || pbuf[ size + 3 ] != ( chk & 0xFF ) )
     goto err;
-  if( *pbuf ++ != ( chk & 0xFF ) )
+  if( pbuf[ 0 ] != ( u8 )~pbuf[ 1 ] )
     goto err;
-  return 1;
+  if( pbuf[ 0 ] == blocknum )
+    return XM_RECORD_OK;
+  if( pbuf[ 0 ] == ( u8 )( blocknum - 1 ) )
+    return XM_RECORD_DUP;
   
 err:
+  xmodem_flush( XMODEM_FLUSH_ONLY );
   xmodem_out_func( XM_NAK );
-  return 0;
+  return XM_RECORD_ERR;
+}
+
+// Parse the size field of a YMODEM header block (decimal, after the name)
+static u32 xmodem_header_size( const u8 *p, unsigned size )
+{
+  const u8 *pend = p + size;
+  u32 res = 0;
+
+  p += strlen( ( const char* )p ) + 1;
+  if( p >= pend || *p < '0' || *p > '9' )
+    return XMODEM_SIZE_UNKNOWN;
+  while( p < pend && *p >= '0' && *p <= '9' )
+    res = res * 10 + *p ++ - '0';
+  return res;
 }
 
 // This global function receives a x-modem transmission consisting of
-// (potentially) several blocks.  Returns the number of bytes received or
-// an error code an error
-long xmodem_receive( char **dest )
+// (potentially) several 128 or 1024 bytes blocks and passes the data
+// to 'data_func' as it arrives, so the size of the transfer is not limited
+// by the available RAM. If 'file_func' is not NULL, the transfer is a YMODEM
+// batch: every file starts with a header block (block 0) and the batch ends
+// with an empty header. Returns the number of bytes received or an error code.
+long xmodem_receive_stream( p_xm_data_func data_func, p_xm_file_func file_func )
 {
-  int starting = 1, ch;
-  unsigned char packnum = 1, buf[ PXM_ACKET_SIZE + 4 ];
-  unsigned retries = XMODEM_RETRY_LIMIT;
-  u32 limit = XMODEM_INITIAL_BUFFER_SIZE, size = 0;
-  void *p;
+  XM_RECV_STATE *ps;
+  int starting = 1, header = file_func != NULL, ch;
+  u8 packnum = header ? 0 : 1;
+  unsigned retries = XMODEM_RETRY_LIMIT, psize;
+  u32 held = 0, remaining = XMODEM_SIZE_UNKNOWN;
+  long total = 0, res = XMODEM_ERROR_RETRYEXCEED;
   
+  if( ( ps = malloc( sizeof( XM_RECV_STATE ) ) ) == NULL )
+  {
+    xmodem_flush( XMODEM_FLUSH_AND_XM_CAN );
+    return XMODEM_ERROR_OUTOFMEM;
+  }
   while( retries-- ) 
   {
     if( starting )
       xmodem_out_func( 'C' );
-    if( ( ( ch = xmodem_in_func( XMODEM_TIMEOUT ) ) == -1 ) || ( ch != XM_SOH && ch != XM_EOT && ch != XM_CAN ) )
+    if( ( ch = xmodem_in_func( XMODEM_TIMEOUT ) ) == -1 )
       continue;
-    if( ch == XM_EOT ) 
+    if( ch == XM_EOT && !header ) 
     {
-      // End of transmission
+      // End of file, the held block is the last one. Without a size from
+      // a YMODEM header, strip the padding
+      if( remaining == XMODEM_SIZE_UNKNOWN )
+        while( held > 0 && ps->held[ held - 1 ] == XM_SUB )
+          held --;
+      if( held > 0 && data_func( ps->held, held ) < 0 )
+        goto cancel;
+      total += held;
+      held = 0;
+      if( file_func && file_func( NULL, 0 ) < 0 )
+        goto cancel;
       xmodem_out_func( XM_ACK );
-      xmodem_flush( XMODEM_FLUSH_ONLY );
-      return size;
+      if( !file_func )
+      {
+        xmodem_flush( XMODEM_FLUSH_ONLY );
+        res = total;
+        goto done;
+      }
+      // Wait for the header of the next file in the batch
+      starting = header = 1;
+      packnum = 0;
+      remaining = XMODEM_SIZE_UNKNOWN;
+      retries = XMODEM_RETRY_LIMIT;
+      continue;
     }
     else if( ch == XM_CAN )
     {
       // The remote part ended the transmission
       xmodem_out_func( XM_ACK );
       xmodem_flush( XMODEM_FLUSH_ONLY );
-      return XMODEM_ERROR_REMOTECANCEL;      
+      res = XMODEM_ERROR_REMOTECANCEL;
+      goto done;
     }
-    starting = 0;
+    else if( ch == XM_SOH )
+      psize = PXM_ACKET_SIZE;
+    else if( ch == XM_STX )
+      psize = PXM_1K_SIZE;
+    else
+      continue;
     
     // Get XMODEM packet
-    if( !xmodem_get_record( packnum, buf ) )
+    if( ( ch = xmodem_get_record( packnum, ps->pkt, psize ) ) == XM_RECORD_ERR )
       continue; // allow for retransmission
-    xmodem_flush( XMODEM_FLUSH_ONLY );      
     retries = XMODEM_RETRY_LIMIT;
-    packnum ++;
-      
-    // Got a valid packet
-    if( size + PXM_ACKET_SIZE > limit )
+    if( ch == XM_RECORD_DUP )
     {
-      limit += XMODEM_INCREMENT_AMMOUNT;
-      if( ( p = realloc( *dest, limit ) ) == NULL )
+      xmodem_out_func( XM_ACK );
+      continue;
+    }
+    if( header )
+    {
+      // YMODEM header: file name, then optional size. An empty name ends the batch
+      ps->pkt[ psize + 1 ] = '\0';
+      if( ps->pkt[ 2 ] == '\0' )
       {
-        // Not enough memory, force cancel and return
-        xmodem_flush( XMODEM_FLUSH_AND_XM_CAN );
-        return XMODEM_ERROR_OUTOFMEM;
+        xmodem_out_func( XM_ACK );
+        xmodem_flush( XMODEM_FLUSH_ONLY );
+        res = total;
+        goto done;
       }
-      *dest = ( char* )p;
-    }    
-    // Acknowledge and consume packet
+      remaining = xmodem_header_size( ps->pkt + 2, psize );
+      if( file_func( ( const char* )ps->pkt + 2, remaining ) < 0 )
+        goto cancel;
+      xmodem_out_func( XM_ACK );
+      header = 0;
+      packnum = 1;
+      continue; // 'starting' is still set, so 'C' requests the file data
+    }
+    starting = 0;
+      
+    // Got a valid packet, so the held one is not the last: pass it on
+    // before acknowledging, as the sink might be slow (flash writes)
+    if( held > 0 && data_func( ps->held, held ) < 0 )
+      goto cancel;
+    total += held;
+    held = psize;
+    if( remaining != XMODEM_SIZE_UNKNOWN )
+    {
+      if( held > remaining )
+        held = remaining;
+      remaining -= held;
+    }
+    memcpy( ps->held, ps->pkt + 2, held );
+    packnum ++;
     xmodem_out_func( XM_ACK );
-    memcpy( *dest + size, buf + 2, PXM_ACKET_SIZE );
-    size += PXM_ACKET_SIZE;
   }
   
   // Exceeded retry count
   xmodem_flush( XMODEM_FLUSH_AND_XM_CAN );
-  return XMODEM_ERROR_RETRYEXCEED;
+  goto done;
+
+cancel:
+  xmodem_flush( XMODEM_FLUSH_AND_XM_CAN );
+  res = XMODEM_ERROR_LOCALCANCEL;
+done:
+  free( ps );
+  return res;
+}
+
+// RAM data sink: grows the buffer as needed
+static int xmodem_ram_write( const u8 *data, u32 size )
+{
+  u32 limit = xm_limit;
+  void *p;
+
+  if( xm_size + size > limit )
+  {
+    while( xm_size + size > limit )
+      limit += XMODEM_INCREMENT_AMMOUNT;
+    if( ( p = realloc( *xm_dest, limit ) ) == NULL )
+      return -1;
+    *xm_dest = ( char* )p;
+    xm_limit = limit;
+  }
+  memcpy( *xm_dest + xm_size, data, size );
+  xm_size += size;
+  return 0;
+}
+
+// Receive a x-modem transmission in RAM. '*dest' must point to a buffer of
+// XMODEM_INITIAL_BUFFER_SIZE bytes allocated with malloc, which will be enlarged
+// as needed. Returns the number of bytes received (padding excluded) or an
+// error code
+long xmodem_receive( char **dest )
+{
+  long res;
+
+  xm_dest = dest;
+  xm_limit = XMODEM_INITIAL_BUFFER_SIZE;
+  xm_size = 0;
+  res = xmodem_receive_stream( xmodem_ram_write, NULL );
+  // The RAM sink can only fail because of memory
+  return res == XMODEM_ERROR_LOCALCANCEL ? XMODEM_ERROR_OUTOFMEM : res;
 }
 
 #else // #ifdef BUILD_XMODEM
@@ -32,6 +32,76 @@ local function _add_data( data, outfile, moredata )
   end
 end
 
+-- Write an extended LZ4 length
+local function _lz_length( out, n )
+  while n >= 255 do
+    table.insert( out, string.char( 255 ) )
+    n = n - 255
+  end
+  table.insert( out, string.char( n ) )
+end
+
+-- Write a LZ4 sequence (literals followed by a match, mlen is 0 for the last sequence)
+local function _lz_sequence( out, lits, offset, mlen )
+  local token = math.min( #lits, 15 ) * 16
+  if mlen > 0 then
+    token = token + math.min( mlen - 4, 15 )
+  end
+  table.insert( out, string.char( token ) )
+  if #lits >= 15 then
+    _lz_length( out, #lits - 15 )
+  end
+  table.insert( out, lits )
+  if mlen > 0 then
+    table.insert( out, string.char( offset % 256, math.floor( offset / 256 ) ) )
+    if mlen - 4 >= 15 then
+      _lz_length( out, mlen - 4 - 15 )
+    end
+  end
+end
+
+-- Compress a block in the LZ4 block format (greedy matching)
+local function _lz_compress( data )
+  local out, tab = {}, {}
+  local anchor, i = 1, 1
+  while i + 3 <= #data do
+    local key = data:sub( i, i + 3 )
+    local cand = tab[ key ]
+    tab[ key ] = i
+    if not cand then
+      i = i + 1
+    else
+      local mlen = 4
+      while i + mlen <= #data and data:byte( cand + mlen ) == data:byte( i + mlen ) do
+        mlen = mlen + 1
+      end
+      _lz_sequence( out, data:sub( anchor, i - 1 ), i - cand, mlen )
+      for j = i + 1, math.min( i + mlen, #data - 2 ) - 1 do
+        tab[ data:sub( j, j + 3 ) ] = j
+      end
+      i = i + mlen
+      anchor = i
+    end
+  end
+  _lz_sequence( out, data:sub( anchor ), 0, 0 )
+  return table.concat( out )
+end
+
+-- Block compress a file (see inc/romfs.h for the format)
+local function _block_compress( data, blocksize )
+  local blocks, offsets = {}, { 0 }
+  for i = 1, #data, blocksize do
+    local b = _lz_compress( data:sub( i, i + blocksize - 1 ) )
+    table.insert( blocks, b )
+    table.insert( offsets, offsets[ #offsets ] + #b )
+  end
+  local header = { string.pack( "<i", #data ), string.pack( "<i", blocksize ) }
+  for _, o in ipairs( offsets ) do
+    table.insert( header, string.pack( "<i", o ) )
+  end
+  return table.concat( header ) .. table.concat( blocks )
+end
+
 -- dirname - the directory where the files are located.
 -- outname - the name of the C output
 -- flist - list of files
@@ -40,8 +110,10 @@ end
 --   "compile" - precompile all files to Lua bytecode and then copy them
 --   "compress" - keep the source code, but compress it with LuaSrcDiet
 -- compcmd - the command to use for compiling if "mode" is "compile"
+-- blocksize - if not 0 or nil, compress the files in blocks of this size. Lua
+--   bytecode files are never compressed, so they can still be executed from ROM.
 -- Returns true for OK, false for error
-function mkfs( dirname, outname, flist, mode, compcmd )
+function mkfs( dirname, outname, flist, mode, compcmd, blocksize )
   -- Try to create the output files
   local outfname = outname .. ".h"
   outfile = io.open( outfname, "wb" )
@@ -53,6 +125,8 @@ function mkfs( dirname, outname, flist, mode, compcmd )
   _crtline = '  '
   _numdata = 0
   _bytecnt = 0
+  local findex = {}
+  local compressed = false
 
   -- Generate headers
   outfile:write( "// Generated by mkfs.lua\n// DO NOT MODIFY\n\n" )
@@ -116,7 +190,18 @@ function mkfs( dirname, outname, flist, mode, compcmd )
         if fextpart == ".lua" and mode ~= "verbatim" then
           os.remove( newname )
         end
+        -- Block compress the file if requested and if it makes it smaller
+        local realsize, sizeflag = #filedata, 0
+        if blocksize and blocksize > 0 and filedata:sub( 1, 4 ) ~= "\027Lua" then
+          local compdata = _block_compress( filedata, blocksize )
+          if #compdata < #filedata then
+            filedata = compdata
+            sizeflag = 0x80
+            compressed = true
+          end
+        end
         -- Write name, size, id, numpars
+        table.insert( findex, { name = fname:lower(), offset = _bytecnt } )
         _fcnt = 0
         for i = 1, #fname do
           _add_data( fname:byte( i ), outfile )
@@ -131,20 +216,38 @@ function mkfs( dirname, outname, flist, mode, compcmd )
         _add_data( plen:byte( 1 ), outfile )
         _add_data( plen:byte( 2 ), outfile )
         _add_data( plen:byte( 3 ), outfile )
-        _add_data( plen:byte( 4 ), outfile )
+        _add_data( plen:byte( 4 ) + sizeflag, outfile )
        -- Then write the rest of the file
         for i = 1, #filedata do
           _add_data( filedata:byte( i ), outfile )
         end
         -- Report
-        print( sf( "Encoded file %s (%d bytes real size, %d bytes encoded size)", fname, #filedata, _fcnt ) )
+        print( sf( "Encoded file %s (%d bytes real size, %d bytes encoded size%s)", fname, realsize, _fcnt, sizeflag > 0 and ", compressed" or "" ) )
       end
     end
   end
     
   -- All done, write the final "0xFF" (terminator)
   _add_data( 0xFF, outfile, false )
-  outfile:write( "};\n\n#endif\n" );
+  outfile:write( "};\n\n" )
+
+  -- Size of the buffer needed to decompress a block
+  if compressed then
+    outfile:write( sf( "#define %s_BLOCK_SIZE %d\n\n", outname:upper(), blocksize ) )
+  end
+
+  -- Write the index (offsets of the file names sorted by name, case insensitive)
+  table.sort( findex, function( a, b ) return a.name < b.name or ( a.name == b.name and a.offset < b.offset ) end )
+  outfile:write( sf( "#define %s_INDEX_SIZE %d\n\n", outname:upper(), #findex ) )
+  outfile:write( sf( "const unsigned long %s_index[] = \n{\n", outname:lower() ) )
+  for i = 1, #findex, 8 do
+    local line = '  '
+    for j = i, math.min( i + 7, #findex ) do
+      line = line .. sf( "0x%08X, ", findex[ j ].offset )
+    end
+    outfile:write( line .. '\n' )
+  end
+  outfile:write( "  0xFFFFFFFF\n};\n\n#endif\n" )
   outfile:close()
   print( sf( "Done, total size is %d bytes", _bytecnt ) )
   return true